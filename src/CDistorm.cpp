@@ -2,14 +2,38 @@
 #include "CDistorm.h"
 #include <sstream>
 #include <iomanip>
+#include <algorithm>	// min
 #include "Util.h"
+#include "MSPE.h"
 
 extern "C" {
 #include "distorm/include/mnemonics.h"
 #include "distorm/src/prefix.h"			// prefixes_decode
 }
 
-CDistorm::CDistorm() : codeOffset(0), prefixSize(0), opcodeSize(0), valueSize(0), disasm()
+// オペランドの即値・ディスプレースメントのバイト数を返す
+static int GetValueSize(const _DInst& di, const _Operand& op)
+{
+	switch (op.type) {
+	case O_NONE: //operand is to be ignored.
+	case O_REG: //index holds global register index.
+		break;
+	case O_IMM: //instruction.imm.
+	case O_IMM1: //instruction.imm.ex.i1.
+	case O_IMM2: //instruction.imm.ex.i2.
+	case O_PC: //the relative address of a branch instruction(instruction.imm.addr).
+	case O_PTR: //the absolute target address of a far branch instruction(instruction.imm.ptr.seg / off).
+		return (op.size >> 3);
+	case O_DISP: //memory dereference with displacement only, instruction.disp.
+	case O_SMEM: //simple memory dereference with optional displacement(a single register memory dereference).
+	case O_MEM: //complex memory dereference(optional fields : s / i / b / disp).
+		return (di.dispSize >> 3);
+	}
+	return 0;
+}
+
+
+CDistorm::CDistorm() : codeOffset(0), prefixSize(0), opcodeSize(0), valueSize(0), volatileMask(0), disasm()
 {
 	memset(&di, 0, sizeof(di));
 	memset(code, 0, sizeof(code));
@@ -17,7 +41,7 @@ CDistorm::CDistorm() : codeOffset(0), prefixSize(0), opcodeSize(0), valueSize(0)
 }
 
 
-CDistorm::CDistorm(uintptr_t codeOffset) : codeOffset(0), prefixSize(0), opcodeSize(0), valueSize(0), disasm()
+CDistorm::CDistorm(uintptr_t codeOffset) : codeOffset(0), prefixSize(0), opcodeSize(0), valueSize(0), volatileMask(0), disasm()
 {
 	memset(&di, 0, sizeof(di));
 	memset(code, 0, sizeof(code));
@@ -39,6 +63,44 @@ bool CDistorm::Decode(uintptr_t codeOffset)
 	}
 	disasm = basicinfo.instruction;
 
+	if (!DecodeCode(codeOffset, codeLen, false)) {
+		return false;
+	}
+
+	auto& image = MSPE::Image::Get();
+	if (image.contains_addr(codeOffset)) {
+		auto& relocations = MSPE::RelocationTable::Get();
+		std::uint32_t rva = image.rva(codeOffset);
+		for (unsigned int i = 0; i < di.size; ++i) {
+			if (relocations.contains(rva + i)) {
+				volatileMask |= 1u << i;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+bool CDistorm::Decode(uintptr_t codeOffset, const std::uint8_t* data, size_t size)
+{
+	disasm.clear();
+
+	// 命令の最大長 (15バイト) まで渡して、先頭の1命令だけ逆アセンブルする
+	int codeLen = static_cast<int>(std::min<size_t>(size, 15));
+	if (codeLen == 0) {
+		di.size = 0;
+		di.flags = FLAG_NOT_DECODABLE;
+		return false;
+	}
+	memcpy(code, data, codeLen);
+
+	return DecodeCode(codeOffset, codeLen, true);
+}
+
+
+bool CDistorm::DecodeCode(uintptr_t codeOffset, int codeLen, bool firstOnly)
+{
 #ifdef _WIN64
 	_CodeInfo ci = { codeOffset, 0, code, codeLen, Decode64Bits, DF_NONE };
 #else
@@ -46,17 +108,21 @@ bool CDistorm::Decode(uintptr_t codeOffset)
 #endif
 
 	unsigned int instructionCount = 0;
-	_DecodeResult decodeResult = distorm_decompose(&ci, &di, codeLen, &instructionCount);
-	if (decodeResult != DECRES_SUCCESS) {
+	_DecodeResult decodeResult = distorm_decompose(&ci, &di, firstOnly ? 1 : codeLen, &instructionCount);
+	// firstOnlyなら後続の命令が入りきらずにDECRES_MEMORYERRが返る
+	if (decodeResult != DECRES_SUCCESS && !(firstOnly && decodeResult == DECRES_MEMORYERR)) {
 		di.size = 0;
 		di.flags = FLAG_NOT_DECODABLE;
 		return false;
 	}
-	if (instructionCount != 1) {
+	if (instructionCount != 1 || (firstOnly && di.flags == FLAG_NOT_DECODABLE)) {
 		di.size = 0;
 		di.flags = FLAG_NOT_DECODABLE;
 		return false;
 	}
+	if (firstOnly) {
+		codeLen = di.size;
+	}
 	if (codeLen != di.size) {
 		di.size = 0;
 		di.flags = FLAG_NOT_DECODABLE;
@@ -115,57 +181,78 @@ bool CDistorm::Decode(uintptr_t codeOffset)
 	//
 	opcodeSize = di.size - prefixSize - valueSize;
 
+	//
+	// calc volatile bytes
+	//
+	volatileMask = 0;
+	int pos = prefixSize + opcodeSize;
+	for (unsigned int i = 0; i < OPERANDS_NO; ++i) {
+		const _Operand& op = di.ops[i];
+		int size = GetValueSize(di, op);
+
+		bool relative = false;
+		switch (op.type) {
+		case O_PC:
+			relative = true;
+			break;
+		case O_SMEM:
+			relative = (op.index == R_RIP);
+			break;
+		case O_MEM:
+			relative = (di.base == R_RIP);
+			break;
+		}
+		if (relative) {
+			for (int j = pos; j < pos + size && j < 32; ++j) {
+				volatileMask |= 1u << j;
+			}
+		}
+		pos += size;
+	}
+
 	return true;
 }
 
-bool CDistorm::GetDump(std::string& dump, bool wildcard) const
+bool CDistorm::GetDump(std::string& dump, Wildcard wildcard) const
 {
 	std::ostringstream hexDump;
 
-	const uint8_t* p = code;
+	auto put = [this, &hexDump, wildcard](int i, bool value) {
+		bool mask = false;
+		switch (wildcard) {
+		case Wildcard::kAll:
+			mask = value;
+			break;
+		case Wildcard::kVolatile:
+			mask = (volatileMask >> i) & 1;
+			break;
+		}
+		if (mask) {
+			hexDump << "??";
+		}
+		else {
+			hexDump << std::hex << std::uppercase << std::setfill('0') << std::setw(2) << (int)code[i];
+		}
+	};
+
+	int i = 0;
 	if (prefixSize > 0) {
-		for (const uint8_t* end = p + prefixSize; p < end; ++p) {
-			hexDump << std::hex << std::uppercase << std::setfill('0') << std::setw(2) << (int)*p;
+		for (; i < prefixSize; ++i) {
+			put(i, false);
 		}
 		hexDump << ':';
 	}
 
-	for (const uint8_t* end = p + opcodeSize; p < end; ++p) {
-		hexDump << std::hex << std::uppercase << std::setfill('0') << std::setw(2) << (int)*p;
+	for (int end = i + opcodeSize; i < end; ++i) {
+		put(i, false);
 	}
 
-	for (unsigned int i = 0; i < OPERANDS_NO; ++i) {
-		const _Operand& op = di.ops[i];
-		int size = 0;
-
-		switch (op.type) {
-		case O_NONE: //operand is to be ignored.
-		case O_REG: //index holds global register index.
-			break;
-		case O_IMM: //instruction.imm.
-		case O_IMM1: //instruction.imm.ex.i1.
-		case O_IMM2: //instruction.imm.ex.i2.
-		case O_PC: //the relative address of a branch instruction(instruction.imm.addr).
-		case O_PTR: //the absolute target address of a far branch instruction(instruction.imm.ptr.seg / off).
-			size = (op.size >> 3);
-			break;
-		case O_DISP: //memory dereference with displacement only, instruction.disp.
-		case O_SMEM: //simple memory dereference with optional displacement(a single register memory dereference).
-		case O_MEM: //complex memory dereference(optional fields : s / i / b / disp).
-			size = (di.dispSize >> 3);
-			break;
-		}
+	for (unsigned int n = 0; n < OPERANDS_NO; ++n) {
+		int size = GetValueSize(di, di.ops[n]);
 		if (size > 0) {
 			hexDump << " ";
-			if (wildcard) {
-				for (const uint8_t* end = p + size; p < end; ++p) {
-					hexDump << "??";
-				}
-			}
-			else {
-				for (const uint8_t* end = p + size; p < end; ++p) {
-					hexDump << std::hex << std::uppercase << std::setfill('0') << std::setw(2) << (int)*p;
-				}
+			for (int end = i + size; i < end; ++i) {
+				put(i, true);
 			}
 		}
 	}
@@ -240,8 +327,7 @@ bool CDistorm::ContainsLabel(std::string& outLabel) const
 {
 	uintptr_t addr;
 	if (ContainsAddress(addr)) {
-		if (addr && Util::HasLabel(addr)) {
-			Util::GetLabel(addr, outLabel);
+		if (addr && Util::GetLabel(addr, outLabel)) {
 			return true;
 		}
 	}
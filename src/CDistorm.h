@@ -10,11 +10,23 @@ extern "C" {
 class CDistorm
 {
 public:
+	// 16進ダンプでワイルドカード(??)にするバイト
+	enum class Wildcard
+	{
+		kNone,			// なし
+		kVolatile,		// 再配置されるバイトとRIP相対のオフセット (VolatileMask)
+		kAll			// 即値・ディスプレースメントすべて
+	};
+
 	CDistorm();
 	explicit CDistorm::CDistorm(uintptr_t codeOffset);
 
 	bool Decode(uintptr_t codeOffset);
 
+	// ローカルのバッファdata (sizeバイト) の先頭の1命令を、codeOffsetにあるものとして逆アセンブルする
+	// x64dbgを呼ばないのでワーカースレッドからも使える。ニーモニック (str()) と再配置されるバイトは求めない
+	bool Decode(uintptr_t codeOffset, const std::uint8_t* data, size_t size);
+
 	inline size_t Size() const {
 		return di.size;
 	}
@@ -30,6 +42,11 @@ public:
 	inline int ValueSize() const {
 		return valueSize;
 	}
+	// バージョンによって変わるバイトのビットマスク (bit i = i バイト目)
+	// ローダーが再配置するアドレスと、RIP相対のディスプレースメント・分岐先
+	inline std::uint32_t VolatileMask() const {
+		return volatileMask;
+	}
 	inline uintptr_t addr() const {
 		return Script::Module::GetMainModuleBase() + di.addr;
 	}
@@ -40,7 +57,10 @@ public:
 	}
 
 	// 16進ダンプを文字列で返す
-	bool GetDump(std::string& dump, bool wildcard) const;
+	bool GetDump(std::string& dump, Wildcard wildcard) const;
+	inline bool GetDump(std::string& dump, bool wildcard) const {
+		return GetDump(dump, wildcard ? Wildcard::kAll : Wildcard::kNone);
+	}
 
 	// オペコードにアドレスを含んでいればtrueを返し、outAddrにアドレスを代入する
 	bool ContainsAddress(uintptr_t& outAddr) const;
@@ -52,11 +72,16 @@ public:
 	bool ContainsLabel(std::string& outLabel) const;
 
 private:
+	// codeのcodeLenバイトを逆アセンブルして、各部のサイズを求める
+	// firstOnlyなら先頭の1命令だけを逆アセンブルする (codeLenは命令長の上限)
+	bool DecodeCode(uintptr_t codeOffset, int codeLen, bool firstOnly);
+
 	uintptr_t codeOffset;
 	_DInst di;
 	int prefixSize;
 	int opcodeSize;
 	int valueSize;
+	std::uint32_t volatileMask;
 	uint8_t code[24];
 	std::string disasm;
 };
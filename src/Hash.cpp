@@ -0,0 +1,217 @@
+﻿#include "pch.h"
+#include "Hash.h"
+#include "Util.h"
+#include <cstring>
+#include <vector>
+#include <algorithm>	// min
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define HASH_USE_SSE2
+#endif
+
+
+namespace
+{
+	constexpr size_t kStripeSize = 64;					// 8 lanes x 64bit
+	constexpr size_t kStripesPerBlock = 8;
+	constexpr size_t kBlockSize = kStripeSize * kStripesPerBlock;
+	constexpr size_t kChunkSize = 1024 * 1024;			// ComputeParallel
+
+	constexpr std::uint64_t kPrime32 = 0x9E3779B1;
+	constexpr std::uint64_t kPrime64_1 = 0x9E3779B185EBCA87;
+	constexpr std::uint64_t kPrime64_2 = 0xC2B2AE3D27D4EB4F;
+
+	// 8 lanes (stripe) + 7 lanes (offset per stripe) + 8 lanes (scramble)
+	alignas(16) constexpr std::uint64_t kKey[23] = {
+		0xBE4BA423396CFEB8, 0x1CAD21F72C81017C, 0xDB979083E96DD4DE, 0x1F67B3B7A4A44072,
+		0x78E5C0CC4EE679CB, 0x2172FFCC7DD05A82, 0x8E2443F7744608B8, 0x4C263A81E69035E0,
+		0xCB00C391BB52283C, 0xA32E531B8B65D088, 0x4EF90DA297486471, 0xD8ACDEA946EF1938,
+		0x3F349CE33F76FAA8, 0x1D4F0BC7C7BBDCF9, 0x3159B4CD4BE0518A, 0x647378D9C97E9FC8,
+		0xC3EBD33483ACC5EA, 0xEB6313FAFFA081C5, 0x49DAF0B751DD0D17, 0x9E68D429265516D3,
+		0xFCA1477D58BE162B, 0xCE31D07AD1B8F88F, 0x280416958F3ACB45
+	};
+
+	constexpr std::uint64_t kInit[8] = {
+		kPrime32, kPrime64_1, kPrime64_2, 0x165667B19E3779F9,
+		0x85EBCA77C2B2AE63, 0x27D4EB2F165667C5, kPrime64_1 ^ kPrime64_2, 0x61C8864E7A143579
+	};
+
+
+	inline std::uint64_t Read64(const std::uint8_t* p)
+	{
+		std::uint64_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+
+	inline std::uint64_t Rotl(std::uint64_t x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+
+	inline std::uint64_t Avalanche(std::uint64_t h)
+	{
+		h ^= h >> 33;
+		h *= kPrime64_2;
+		h ^= h >> 29;
+		h *= kPrime64_1;
+		h ^= h >> 32;
+		return h;
+	}
+
+
+#ifdef HASH_USE_SSE2
+	struct Accumulator
+	{
+		__m128i acc[4];
+
+		explicit Accumulator(std::uint64_t seed)
+		{
+			__m128i s = _mm_set1_epi64x(static_cast<long long>(seed));
+			for (int j = 0; j < 4; ++j) {
+				acc[j] = _mm_add_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&kInit[j * 2])), s);
+			}
+		}
+
+		inline void Stripe(const std::uint8_t* p, const std::uint64_t* key)
+		{
+			for (int j = 0; j < 4; ++j) {
+				__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + j * 16));
+				__m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + j * 2));
+				__m128i dk = _mm_xor_si128(d, k);
+				__m128i product = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+				__m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+				acc[j] = _mm_add_epi64(acc[j], _mm_add_epi64(swapped, product));
+			}
+		}
+
+		inline void Scramble(const std::uint64_t* key)
+		{
+			__m128i prime = _mm_set1_epi32(static_cast<int>(kPrime32));
+			for (int j = 0; j < 4; ++j) {
+				__m128i a = acc[j];
+				a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+				a = _mm_xor_si128(a, _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + j * 2)));
+				__m128i lo = _mm_mul_epu32(a, prime);
+				__m128i hi = _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), prime), 32);
+				acc[j] = _mm_add_epi64(lo, hi);
+			}
+		}
+
+		inline void Store(std::uint64_t* out) const
+		{
+			for (int j = 0; j < 4; ++j) {
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + j * 2), acc[j]);
+			}
+		}
+	};
+#else
+	struct Accumulator
+	{
+		std::uint64_t acc[8];
+
+		explicit Accumulator(std::uint64_t seed)
+		{
+			for (int i = 0; i < 8; ++i) {
+				acc[i] = kInit[i] + seed;
+			}
+		}
+
+		inline void Stripe(const std::uint8_t* p, const std::uint64_t* key)
+		{
+			for (int i = 0; i < 8; ++i) {
+				std::uint64_t d = Read64(p + i * 8);
+				std::uint64_t dk = d ^ key[i];
+				acc[i ^ 1] += d;
+				acc[i] += (dk & 0xFFFFFFFF) * (dk >> 32);
+			}
+		}
+
+		inline void Scramble(const std::uint64_t* key)
+		{
+			for (int i = 0; i < 8; ++i) {
+				std::uint64_t a = acc[i];
+				a ^= a >> 47;
+				a ^= key[i];
+				acc[i] = a * kPrime32;
+			}
+		}
+
+		inline void Store(std::uint64_t* out) const
+		{
+			std::memcpy(out, acc, sizeof(acc));
+		}
+	};
+#endif
+}
+
+
+namespace Hash
+{
+	std::uint64_t Compute(const void* data, size_t size, std::uint64_t seed)
+	{
+		auto* p = static_cast<const std::uint8_t*>(data);
+		Accumulator acc(seed);
+
+		size_t rest = size;
+		while (rest >= kBlockSize) {
+			for (size_t s = 0; s < kStripesPerBlock; ++s) {
+				acc.Stripe(p + s * kStripeSize, kKey + (s & 7));
+			}
+			acc.Scramble(kKey + 15);
+			p += kBlockSize;
+			rest -= kBlockSize;
+		}
+
+		size_t s = 0;
+		while (rest >= kStripeSize) {
+			acc.Stripe(p, kKey + s++);
+			p += kStripeSize;
+			rest -= kStripeSize;
+		}
+
+		if (rest > 0) {
+			alignas(16) std::uint8_t last[kStripeSize];
+			std::memset(last, 0, sizeof(last));
+			std::memcpy(last, p, rest);
+			acc.Stripe(last, kKey + 7);
+		}
+
+		std::uint64_t lanes[8];
+		acc.Store(lanes);
+
+		std::uint64_t h = static_cast<std::uint64_t>(size) * kPrime64_1;
+		for (int i = 0; i < 8; ++i) {
+			h += Avalanche(lanes[i] ^ kKey[15 + i]);
+			h = Rotl(h, 27) * kPrime64_2;
+		}
+		return Avalanche(h);
+	}
+
+
+	std::uint64_t ComputeParallel(const void* data, size_t size)
+	{
+		auto* p = static_cast<const std::uint8_t*>(data);
+		size_t numChunks = (size + kChunkSize - 1) / kChunkSize;
+		if (numChunks <= 1) {
+			return Compute(data, size, 0);
+		}
+
+		std::vector<std::uint64_t> chunks(numChunks);
+		Util::ParallelFor(numChunks, [&](size_t i) {
+			size_t offset = i * kChunkSize;
+			chunks[i] = Compute(p + offset, std::min<size_t>(kChunkSize, size - offset), i);
+		});
+
+		return Compute(chunks.data(), chunks.size() * sizeof(std::uint64_t), size);
+	}
+
+
+	std::uint64_t Combine(std::uint64_t lhs, std::uint64_t rhs)
+	{
+		return Avalanche(Rotl(lhs, 31) * kPrime64_1 ^ rhs);
+	}
+}
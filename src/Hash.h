@@ -0,0 +1,19 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+
+// 非暗号学的ハッシュ (SSE2でベクトル化、大きなデータはチャンクごとに並列計算)
+// 結果はCPUやスレッド数によらず同じになる
+namespace Hash
+{
+	// dataのハッシュ値を返す
+	std::uint64_t Compute(const void* data, size_t size, std::uint64_t seed = 0);
+
+	// dataをチャンクに分け、ワーカースレッドで並列にハッシュ値を計算する
+	std::uint64_t ComputeParallel(const void* data, size_t size);
+
+	// ハッシュ値を連結する (順序に依存する)
+	std::uint64_t Combine(std::uint64_t lhs, std::uint64_t rhs);
+}
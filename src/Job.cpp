@@ -0,0 +1,227 @@
+﻿#include "pch.h"
+#include "Job.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <vector>
+
+
+namespace Job
+{
+	namespace
+	{
+		struct Task
+		{
+			std::shared_ptr<Context>	context;
+			Work						work;
+			Finished					finished;
+		};
+
+		std::mutex							s_mutex;
+		std::condition_variable				s_wakeup;
+		std::condition_variable				s_idle;			// workが戻ったとき
+		std::shared_ptr<Context>			s_current;		// finishedを呼び終わるまで残す
+		std::unique_ptr<Task>				s_task;			// ワーカースレッドがまだ取り出していないジョブ
+		std::thread							s_worker;		// 最初のStartで作り、Shutdownまで使い回す
+		bool								s_working = false;	// ワーカースレッドがworkを実行している
+		std::vector<std::function<void()>>	s_completions;	// GUIスレッドで呼ぶもの
+		std::vector<std::function<void()>>	s_whenIdle;		// ジョブが終わったらGUIスレッドで呼ぶもの
+		bool								s_shutdown = false;
+
+
+		// GuiExecuteOnGuiThreadから呼ばれる (引数を渡せないので、キューから取り出す)
+		void RunCompletions()
+		{
+			std::vector<std::function<void()>> completions;
+			{
+				std::lock_guard<std::mutex> lock(s_mutex);
+				completions.swap(s_completions);
+			}
+			for (auto& completion : completions) {
+				completion();
+			}
+		}
+
+
+		void PostToGuiThread(std::function<void()> completion)
+		{
+			{
+				std::lock_guard<std::mutex> lock(s_mutex);
+				if (s_shutdown) {
+					return;
+				}
+				s_completions.push_back(std::move(completion));
+			}
+			GuiExecuteOnGuiThread(RunCompletions);
+		}
+
+
+		void WorkerThread()
+		{
+			for (;;) {
+				std::unique_ptr<Task> task;
+				{
+					std::unique_lock<std::mutex> lock(s_mutex);
+					s_wakeup.wait(lock, []() { return s_shutdown || s_task; });
+					if (s_shutdown) {
+						return;
+					}
+					task = std::move(s_task);
+					s_working = true;
+				}
+
+				auto context = task->context;
+				task->work(*context);
+				{
+					std::lock_guard<std::mutex> lock(s_mutex);
+					s_working = false;
+				}
+				s_idle.notify_all();
+
+				PostToGuiThread([context, finished = std::move(task->finished)]() {
+					// workが戻ってからここまでの間に中止されることもあるので (デバッグの終了など)、ここで確かめる
+					bool cancelled = context->cancelled();
+					GuiReferenceSetCurrentTaskProgress(100, context->name().c_str());
+					GuiAddStatusBarMessage(("[ SECUNDA MOON ] " + context->name() + (cancelled ? ": cancelled\n" : ": done\n")).c_str());
+
+					// finishedの中から次のジョブを始められるように、先に外しておく
+					{
+						std::lock_guard<std::mutex> lock(s_mutex);
+						s_current.reset();
+					}
+					finished(cancelled);
+
+					// finishedが次のジョブを始めていなければ、待たせていたものを呼ぶ
+					std::vector<std::function<void()>> waiting;
+					{
+						std::lock_guard<std::mutex> lock(s_mutex);
+						if (!s_current) {
+							waiting.swap(s_whenIdle);
+						}
+					}
+					for (auto& fn : waiting) {
+						fn();
+					}
+				});
+			}
+		}
+	}
+
+
+	void Context::Progress(size_t done, size_t total)
+	{
+		DWORD now = GetTickCount();
+		DWORD last = _lastProgress.load(std::memory_order_relaxed);
+		if (done < total && now - last < kProgressInterval) {
+			return;
+		}
+		// ほかのスレッドが先に出したら、こちらは出さない
+		if (!_lastProgress.compare_exchange_strong(last, now, std::memory_order_relaxed) && done < total) {
+			return;
+		}
+
+		int percent = total ? static_cast<int>(done * 100 / total) : 100;
+		GuiReferenceSetCurrentTaskProgress(percent, _name.c_str());
+
+		char message[256];
+		sprintf_s(message, "[ SECUNDA MOON ] %s: %d%% (%zu / %zu)\n", _name.c_str(), percent, done, total);
+		GuiAddStatusBarMessage(message);
+	}
+
+
+	bool Start(const char* name, Work work, Finished finished)
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+
+		if (s_current) {
+			_plugin_logprintf("[ SECUNDA MOON ] %s is still running (Cancel to stop it)\n", s_current->name().c_str());
+			return false;
+		}
+
+		s_shutdown = false;
+		if (!s_worker.joinable()) {
+			s_worker = std::thread(WorkerThread);
+		}
+
+		s_current = std::make_shared<Context>(name);
+		s_task.reset(new Task{ s_current, std::move(work), std::move(finished) });
+		s_wakeup.notify_one();
+		return true;
+	}
+
+
+	bool Cancel()
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+
+		if (!s_current) {
+			return false;
+		}
+		s_current->Cancel();
+		_plugin_logprintf("[ SECUNDA MOON ] cancelling %s...\n", s_current->name().c_str());
+		return true;
+	}
+
+
+	bool IsRunning()
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+		return s_current != nullptr;
+	}
+
+
+	void Post(std::function<void()> fn)
+	{
+		PostToGuiThread(std::move(fn));
+	}
+
+
+	void PostWhenIdle(std::function<void()> fn)
+	{
+		{
+			std::lock_guard<std::mutex> lock(s_mutex);
+			if (s_current) {
+				s_whenIdle.push_back(std::move(fn));
+				return;
+			}
+		}
+		PostToGuiThread(std::move(fn));
+	}
+
+
+	void Wait()
+	{
+		// Shutdownのあとは、取り出されていないジョブはもう動かない
+		std::unique_lock<std::mutex> lock(s_mutex);
+		s_idle.wait(lock, []() { return !s_working && (!s_task || s_shutdown); });
+	}
+
+
+	void Shutdown()
+	{
+		std::thread worker;
+		{
+			std::lock_guard<std::mutex> lock(s_mutex);
+
+			s_shutdown = true;
+			if (s_current) {
+				s_current->Cancel();
+			}
+			worker = std::move(s_worker);
+		}
+		s_wakeup.notify_one();
+		s_idle.notify_all();
+
+		// プラグインを外すときは、ワーカースレッドを残さない
+		if (worker.joinable()) {
+			worker.join();
+		}
+
+		std::lock_guard<std::mutex> lock(s_mutex);
+		s_task.reset();
+		s_completions.clear();
+		s_whenIdle.clear();
+		s_current.reset();
+	}
+}
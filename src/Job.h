@@ -0,0 +1,74 @@
+﻿#pragma once
+
+#include <string>
+#include <atomic>
+#include <functional>
+
+
+// バックグラウンドジョブ
+//
+// 重い処理 (シグネチャファイルの解決、RTTIの解析、スキャン) をワーカースレッドで動かし、
+// 結果はGUIスレッドに戻してから適用する。同時に動くジョブは1つだけで、ワーカースレッドは使い回す。
+// ジョブの中の並列化はUtil::ParallelForで行う。
+namespace Job
+{
+	// 動いているジョブの中止要求と進み具合
+	class Context
+	{
+	public:
+		static constexpr DWORD kProgressInterval = 250;		// ms
+
+		explicit Context(const char* name) : _name(name) {}
+
+		// 中止を求められたらtrue。ジョブは区切りのよいところで確かめて、早めに戻ること
+		inline bool cancelled() const {
+			return _cancelled.load(std::memory_order_relaxed);
+		}
+
+		inline void Cancel() {
+			_cancelled = true;
+		}
+
+		// 進み具合 (done / total) をリファレンスビューとステータスバーに出す
+		// kProgressIntervalより頻繁な分は間引く。どのスレッドから呼んでもよい
+		void Progress(size_t done, size_t total);
+
+		inline const std::string& name() const {
+			return _name;
+		}
+
+	private:
+		std::string			_name;
+		std::atomic<bool>	_cancelled = false;
+		std::atomic<DWORD>	_lastProgress = 0;
+	};
+
+	// workはワーカースレッドで、finishedは終わったあとにGUIスレッドで呼ぶ
+	// (中止されたときもfinishedは呼ばれ、cancelledがtrueになる。workが戻ったあとでも、finishedを呼ぶ前に中止されればtrue)
+	// デバッグが終わったあとに呼ばれることもあるので、デバッグ中の状態を使うfinishedはDbgIsDebuggingも確かめること
+	using Work = std::function<void(Context& context)>;
+	using Finished = std::function<void(bool cancelled)>;
+
+	// ジョブnameを始める。ほかのジョブがfinishedまで終わっていなければ、始めずにfalseを返す
+	bool Start(const char* name, Work work, Finished finished);
+
+	// 動いているジョブに中止を求める。ジョブがなければfalseを返す
+	bool Cancel();
+
+	// ジョブが始まってから、finishedを呼び終わるまでtrue
+	bool IsRunning();
+
+	// ジョブがあれば、workが戻るまで待つ (finishedは待たない。中止していれば、あとでcancelledがtrueで呼ばれる)
+	// workが使っているもの (MSPE::Imageや索引) を解放する前に呼ぶ。ワーカースレッドからは呼ばないこと
+	void Wait();
+
+	// ジョブがあれば中止して、ワーカースレッドが終わるまで待つ (finishedは呼ばない)
+	void Shutdown();
+
+	// fnをGUIスレッドで呼ぶ (デバッグイベントのコールバックなど、どのスレッドから呼んでもよい)
+	void Post(std::function<void()> fn);
+
+	// ジョブがなければPostと同じ。あれば、そのfinishedを呼び終えてからGUIスレッドでfnを呼ぶ
+	// (finishedが次のジョブを始めたら、それも終わるまで待つ)
+	void PostWhenIdle(std::function<void()> fn);
+}
@@ -0,0 +1,131 @@
+﻿#include "pch.h"
+#include "LabelIndex.h"
+#include <algorithm>	// sort, upper_bound
+
+
+namespace Util
+{
+	LabelIndex& LabelIndex::Get()
+	{
+		static LabelIndex s_index;
+		return s_index;
+	}
+
+
+	void LabelIndex::Set(const std::string& label, duint addr)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		// x64dbgと同じく、1つのラベルは1か所、1か所に1つのラベル
+		auto oldAddr = _addresses.find(label);
+		if (oldAddr != _addresses.end()) {
+			if (oldAddr->second == addr) {
+				return;
+			}
+			_labels.erase(oldAddr->second);
+		}
+		auto oldLabel = _labels.find(addr);
+		if (oldLabel != _labels.end()) {
+			_addresses.erase(oldLabel->second);
+		}
+
+		_labels.insert_or_assign(addr, label);
+		_addresses.insert_or_assign(label, addr);
+		_dirty = true;
+	}
+
+
+	void LabelIndex::Remove(duint addr)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		auto it = _labels.find(addr);
+		if (it == _labels.end()) {
+			return;
+		}
+		_addresses.erase(it->second);
+		_labels.erase(it);
+		_dirty = true;
+	}
+
+
+	void LabelIndex::Clear()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_labels.clear();
+		_addresses.clear();
+		_sorted.clear();
+		_dirty = false;
+	}
+
+
+	bool LabelIndex::Find(duint addr, std::string& label) const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		auto it = _labels.find(addr);
+		if (it == _labels.end()) {
+			return false;
+		}
+		label = it->second;
+		return true;
+	}
+
+
+	bool LabelIndex::FindAddress(const std::string& label, duint& addr) const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		auto it = _addresses.find(label);
+		if (it == _addresses.end()) {
+			return false;
+		}
+		addr = it->second;
+		return true;
+	}
+
+
+	bool LabelIndex::FindPreceding(duint addr, duint& labelAddr, std::string& label) const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		Sort();
+		auto it = std::upper_bound(_sorted.begin(), _sorted.end(), addr);
+		if (it == _sorted.begin()) {
+			return false;
+		}
+		labelAddr = *(it - 1);
+		label = _labels.at(labelAddr);
+		return true;
+	}
+
+
+	size_t LabelIndex::size() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _labels.size();
+	}
+
+
+	std::unordered_map<std::string, duint> LabelIndex::addresses() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _addresses;
+	}
+
+
+	void LabelIndex::Sort() const
+	{
+		if (!_dirty) {
+			return;
+		}
+		_sorted.clear();
+		_sorted.reserve(_labels.size());
+		for (auto& kv : _labels) {
+			_sorted.push_back(kv.first);
+		}
+		std::sort(_sorted.begin(), _sorted.end());
+		_dirty = false;
+	}
+}
@@ -0,0 +1,54 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+
+namespace Util
+{
+	// Secundaが張ったラベルの索引 (アドレス -> ラベル、ラベル -> アドレス、アドレス順の配列)
+	//
+	// Util::SetLabel / Util::DeleteLabel と、シグネチャの登録で更新する。x64dbgを呼ばずに引けるが、
+	// x64dbg上で直接張ったり消したりしたラベルは知らないので、見つからなければx64dbgに問い合わせること。
+	// (Util::GetLabelは見つかったラベルを加え、Util::RefreshLabelは付け替えや削除を反映する)
+	// アドレス順の配列は、変更があれば次に前後を引くときに作り直す。
+	class LabelIndex
+	{
+	public:
+		static LabelIndex& Get();
+
+		// labelをaddrに張る (labelの前のアドレスと、addrの前のラベルは外れる)
+		void Set(const std::string& label, duint addr);
+
+		// addrのラベルを外す
+		void Remove(duint addr);
+
+		void Clear();
+
+		// addrのラベル
+		bool Find(duint addr, std::string& label) const;
+
+		// labelのアドレス
+		bool FindAddress(const std::string& label, duint& addr) const;
+
+		// addr以前で最も近いラベル (addrを含む関数などの先頭のラベル)
+		bool FindPreceding(duint addr, duint& labelAddr, std::string& label) const;
+
+		size_t size() const;
+
+		// ラベル -> アドレスの写し (ジョブのスレッドで、GUIスレッドの変更に左右されずに引くとき)
+		std::unordered_map<std::string, duint> addresses() const;
+
+	private:
+		void Sort() const;
+
+		// members
+		mutable std::mutex							_mutex;
+		std::unordered_map<duint, std::string>		_labels;		// アドレス -> ラベル
+		std::unordered_map<std::string, duint>		_addresses;		// ラベル -> アドレス
+		mutable std::vector<duint>					_sorted;		// _labelsのアドレスを昇順に
+		mutable bool								_dirty = false;
+	};
+}
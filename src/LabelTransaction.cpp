@@ -0,0 +1,139 @@
+﻿#include "pch.h"
+#include "LabelTransaction.h"
+#include "LabelIndex.h"
+#include "Util.h"
+#include <unordered_map>
+
+
+namespace Util
+{
+	void LabelTransaction::Set(const std::string& name, duint addr)
+	{
+		_ops.push_back({ name, addr });
+	}
+
+
+	void LabelTransaction::Delete(const std::string& name)
+	{
+		_ops.push_back({ name, 0 });
+	}
+
+
+	size_t LabelTransaction::Commit()
+	{
+		if (_ops.empty()) {
+			return 0;
+		}
+
+		GuiUpdateDisable();
+		size_t applied = _ops.size() < kSnapshotThreshold ? CommitEach() : CommitSnapshot();
+		_ops.clear();
+
+		// 何も変わらなければ、画面も更新しない
+		if (applied) {
+			GuiUpdateEnable(true);
+		}
+		else {
+			GuiUpdateEnable(false);
+		}
+		return applied;
+	}
+
+
+	size_t LabelTransaction::CommitEach()
+	{
+		size_t applied = 0;
+		for (auto& op : _ops) {
+			if (op.addr == 0) {
+				applied += DeleteLabel(op.name) ? 1 : 0;
+				continue;
+			}
+
+			// 索引ではなくx64dbgに問い合わせる (x64dbg上で消されているかもしれない)
+			char current[MAX_LABEL_SIZE] = "";
+			if (Script::Label::Get(op.addr, current) && op.name == current) {
+				LabelIndex::Get().Set(op.name, op.addr);
+				continue;
+			}
+			applied += SetLabel(op.name, op.addr) ? 1 : 0;
+		}
+		return applied;
+	}
+
+
+	size_t LabelTransaction::CommitSnapshot()
+	{
+		//
+		// x64dbgのラベルを取得する
+		//
+		std::unordered_map<duint, std::string> labels;		// アドレス -> ラベル
+		std::unordered_map<std::string, duint> addresses;	// ラベル -> アドレス
+
+		ListInfo list;
+		if (Script::Label::GetList(&list)) {
+			auto* info = static_cast<Script::Label::LabelInfo*>(list.data);
+			std::unordered_map<std::string, duint> bases;
+			labels.reserve(list.count + _ops.size());
+			addresses.reserve(list.count + _ops.size());
+			for (int i = 0; i < list.count; ++i) {
+				auto base = bases.try_emplace(info[i].mod, 0);
+				if (base.second) {
+					base.first->second = Script::Module::BaseFromName(info[i].mod);
+				}
+				duint addr = base.first->second + info[i].rva;
+				labels.insert_or_assign(addr, info[i].text);
+				addresses.insert_or_assign(info[i].text, addr);
+			}
+			BridgeFree(list.data);
+		}
+
+		//
+		// 変更を順に当てはめ、変わるものだけx64dbgに渡す
+		//
+		auto& index = LabelIndex::Get();
+		size_t applied = 0;
+		for (auto& op : _ops) {
+			auto oldAddr = addresses.find(op.name);
+
+			if (op.addr == 0) {
+				if (oldAddr != addresses.end()) {
+					index.Remove(oldAddr->second);
+					applied += Script::Label::Delete(oldAddr->second) ? 1 : 0;
+					labels.erase(oldAddr->second);
+					addresses.erase(oldAddr);
+				}
+				continue;
+			}
+
+			if (oldAddr != addresses.end()) {
+				if (oldAddr->second == op.addr) {
+					// すでに張ってある
+					index.Set(op.name, op.addr);
+					continue;
+				}
+				index.Remove(oldAddr->second);
+				Script::Label::Delete(oldAddr->second);
+				labels.erase(oldAddr->second);
+				addresses.erase(oldAddr);
+			}
+
+			if (!Script::Label::Set(op.addr, op.name.c_str())) {
+				continue;
+			}
+			applied++;
+			index.Set(op.name, op.addr);
+
+			// そのアドレスにあったラベルは置き換わる
+			auto oldLabel = labels.find(op.addr);
+			if (oldLabel != labels.end()) {
+				addresses.erase(oldLabel->second);
+				oldLabel->second = op.name;
+			}
+			else {
+				labels.emplace(op.addr, op.name);
+			}
+			addresses.emplace(op.name, op.addr);
+		}
+		return applied;
+	}
+}
@@ -0,0 +1,45 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+
+
+namespace Util
+{
+	// ラベルの変更をためておき、Commitでまとめて適用する
+	//
+	// Commitでは、x64dbgのラベルを一度だけ取得 (Script::Label::GetList) して、変更を順に当てはめ、
+	// 実際に変わるものだけx64dbgに渡す。画面の更新は最後に1回だけ行う。
+	// 変更が少なければ一覧は取得せず、Util::SetLabelと同じように1件ずつ適用する。
+	class LabelTransaction
+	{
+	public:
+		// 変更がkSnapshotThreshold以上なら、x64dbgのラベルの一覧と比べる
+		static constexpr size_t kSnapshotThreshold = 32;
+
+		// nameをaddrに張る (nameが別のアドレスにあれば外す)
+		void Set(const std::string& name, duint addr);
+
+		// nameを外す
+		void Delete(const std::string& name);
+
+		inline size_t size() const {
+			return _ops.size();
+		}
+
+		// ためた変更を適用して、x64dbgに渡した変更の数を返す
+		size_t Commit();
+
+	private:
+		struct Op
+		{
+			std::string		name;
+			duint			addr;		// Deleteなら0
+		};
+
+		size_t CommitEach();
+		size_t CommitSnapshot();
+
+		std::vector<Op>		_ops;
+	};
+}
@@ -1,6 +1,10 @@
 ﻿#pragma once
 
 #include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <string>
+#include <memory>
 #include <cassert>
 
 // microsoft portable executable
@@ -8,6 +12,52 @@ namespace MSPE
 {
 	class Module;
 	class Session;
+	class Image;
+	class FunctionTable;
+	class FingerprintTable;
+	class CodeHashTable;
+	class RelocationTable;
+	class ImportTable;
+	class XrefTable;
+	class StringTable;
+	class ConstantTable;
+	class Identity;
+
+	// the tables (Image, FunctionTable, XrefTable, ...) are built on first use by their Get(), which is called from
+	// the GUI thread and from jobs. Get() holds a lock of its own table while it builds it, so concurrent callers get
+	// the same table. a table is only replaced when the image serial changes, never while a job runs (see Job::Wait)
+
+
+	// ArrayView
+	// read-only view of a contiguous array
+	template <class T>
+	class ArrayView
+	{
+	public:
+		constexpr ArrayView() : _first(nullptr), _last(nullptr) {}
+		constexpr ArrayView(const T* a_first, const T* a_last) : _first(a_first), _last(a_last) {}
+		constexpr ArrayView(const T* a_first, size_t a_size) : _first(a_first), _last(a_first + a_size) {}
+
+		inline const T* begin() const {
+			return _first;
+		}
+		inline const T* end() const {
+			return _last;
+		}
+		inline size_t size() const {
+			return _last - _first;
+		}
+		inline bool empty() const {
+			return _first == _last;
+		}
+		inline const T& operator[](size_t a_idx) const {
+			return _first[a_idx];
+		}
+
+	private:
+		const T*	_first;
+		const T*	_last;
+	};
 
 
 	// Module
@@ -136,4 +186,558 @@ namespace MSPE
 		size_t			_size;
 		std::uint32_t	_rva;
 	};
-}
\ No newline at end of file
+
+	// Image
+	// local copy of the main module (headers and sections), read through the bridge once
+	class Image
+	{
+	public:
+		Image(const Image&) = delete;
+		Image& operator=(const Image&) = delete;
+
+		static const Image& Get();
+		static void Release();
+
+		// true if Get() would return the current copy without reading the module through the bridge
+		static bool IsLoaded();
+
+		// local copy of any loaded module (a DLL), not cached. the image is empty if it cannot be read
+		static std::unique_ptr<const Image> Snapshot(uintptr_t a_base);
+
+		// incremented every time an image is (re)loaded
+		inline std::uint32_t serial() const {
+			return _serial;
+		}
+
+		inline uintptr_t base() const {
+			return _base;
+		}
+		inline size_t size() const {
+			return _data.size();
+		}
+		inline const std::uint8_t* data() const {
+			return _data.data();
+		}
+
+		inline bool contains(std::uint32_t a_rva, size_t a_size = 1) const {
+			return a_rva < size() && a_size <= size() - a_rva;
+		}
+		inline bool contains_addr(uintptr_t a_addr) const {
+			return (base() <= a_addr) && (a_addr < base() + size());
+		}
+		inline std::uint32_t rva(uintptr_t a_addr) const {
+			assert(contains_addr(a_addr));
+			return static_cast<std::uint32_t>(a_addr - base());
+		}
+
+		// returns nullptr when [a_rva, a_rva + a_size) is out of the image
+		template <class T = std::uint8_t>
+		inline const T* ptr(std::uint32_t a_rva, size_t a_size = sizeof(T)) const {
+			return contains(a_rva, a_size) ? reinterpret_cast<const T*>(data() + a_rva) : nullptr;
+		}
+
+		const IMAGE_NT_HEADERS* nt_headers() const;
+		IMAGE_DATA_DIRECTORY directory(int a_index) const;
+		ArrayView<IMAGE_SECTION_HEADER> sections() const;
+
+		// first section whose name matches a_name (".text", ".rdata", ...)
+		const IMAGE_SECTION_HEADER* section(const char* a_name) const;
+
+		// sections holding code (IMAGE_SCN_MEM_EXECUTE), in the order of the section table
+		std::vector<const IMAGE_SECTION_HEADER*> code_sections() const;
+
+		// NUL terminated string at a_rva, empty if it runs out of the image
+		std::string_view string(std::uint32_t a_rva) const;
+
+	private:
+		Image() = default;
+
+		bool Load(uintptr_t a_base);
+
+		// members
+		uintptr_t					_base = 0;
+		std::uint32_t				_serial = 0;
+		std::vector<std::uint8_t>	_data;
+	};
+
+
+	// UNWIND_INFO (x64)
+	struct UnwindInfo
+	{
+		enum Flag : std::uint8_t
+		{
+			kNone				= 0,
+			kExceptionHandler	= 1 << 0,
+			kTerminationHandler	= 1 << 1,
+			kChainInfo			= 1 << 2
+		};
+
+		inline std::uint8_t version() const {
+			return versionAndFlags & 0x07;
+		}
+		inline std::uint8_t flags() const {
+			return versionAndFlags >> 3;
+		}
+		inline std::uint8_t frame_register() const {
+			return frameRegisterAndOffset & 0x0F;
+		}
+		inline std::uint8_t frame_offset() const {
+			return frameRegisterAndOffset >> 4;
+		}
+		// size of the header and unwind codes, without handler data / chained entry
+		inline size_t size() const {
+			return offsetof(UnwindInfo, unwindCode) + ((countOfCodes + 1) & ~1) * sizeof(std::uint16_t);
+		}
+
+		// members
+		std::uint8_t	versionAndFlags;			// 00 - version:3, flags:5
+		std::uint8_t	sizeOfProlog;				// 01
+		std::uint8_t	countOfCodes;				// 02
+		std::uint8_t	frameRegisterAndOffset;		// 03 - register:4, offset:4
+		std::uint16_t	unwindCode[1];				// 04 - followed by a RUNTIME_FUNCTION if kChainInfo is set
+	};
+	static_assert(sizeof(IMAGE_RUNTIME_FUNCTION_ENTRY) == 0xC);
+
+
+	// FunctionTable
+	// function boundaries from the exception directory (.pdata)
+	class FunctionTable
+	{
+	public:
+		static constexpr size_t npos = static_cast<size_t>(-1);
+
+		struct Function
+		{
+			std::uint32_t	begin;		// 00 - rva
+			std::uint32_t	end;		// 04 - rva (exclusive)
+			std::uint32_t	unwind;		// 08 - rva of UNWIND_INFO
+			std::uint32_t	owner;		// 0C - index of the primary entry (itself unless chained)
+		};
+		static_assert(sizeof(Function) == 0x10);
+
+		FunctionTable(const FunctionTable&) = delete;
+		FunctionTable& operator=(const FunctionTable&) = delete;
+
+		static const FunctionTable& Get();
+
+		inline size_t size() const {
+			return _functions.size();
+		}
+		inline const Function& operator[](size_t a_idx) const {
+			return _functions[a_idx];
+		}
+		inline auto begin() const {
+			return _functions.begin();
+		}
+		inline auto end() const {
+			return _functions.end();
+		}
+
+		// index of the entry containing a_rva, or npos
+		size_t Find(std::uint32_t a_rva) const;
+
+		// index of the function containing a_rva, chained fragments are folded into their primary entry
+		inline size_t FindOwner(std::uint32_t a_rva) const {
+			size_t idx = Find(a_rva);
+			return idx != npos ? _functions[idx].owner : npos;
+		}
+
+		// same as DbgFunctionGet(): a_end is the last byte of the function
+		bool Lookup(duint a_addr, duint* a_start, duint* a_end) const;
+
+	private:
+		FunctionTable() = default;
+
+		void Build(const Image& a_image);
+
+		// members
+		std::uint32_t				_serial = 0;
+		std::vector<std::uint32_t>	_begin;			// search keys
+		std::vector<Function>		_functions;
+	};
+
+
+	// FingerprintTable
+	// hash of the unwind codes (prolog size, frame register, push/alloc sequence) and the length bucket of each function.
+	// it rarely changes between builds unless the stack frame of the function does.
+	class FingerprintTable
+	{
+	public:
+		FingerprintTable(const FingerprintTable&) = delete;
+		FingerprintTable& operator=(const FingerprintTable&) = delete;
+
+		static const FingerprintTable& Get();
+
+		static std::uint64_t Compute(const Image& a_image, const FunctionTable::Function& a_func);
+
+		// fingerprint of the function table entry, 0 for chained fragments
+		inline std::uint64_t operator[](size_t a_idx) const {
+			return _fingerprints[a_idx];
+		}
+
+		// index of the function carrying a_fingerprint, npos unless exactly one function does
+		size_t FindUnique(std::uint64_t a_fingerprint) const;
+
+		// fingerprint of the function starting at a_rva, 0 unless it is unique in this build
+		std::uint64_t GetUnique(std::uint32_t a_rva) const;
+
+	private:
+		static constexpr std::uint32_t kAmbiguous = static_cast<std::uint32_t>(-1);
+
+		FingerprintTable() = default;
+
+		void Build(const Image& a_image, const FunctionTable& a_functions);
+
+		// members
+		std::uint32_t									_serial = 0;
+		std::vector<std::uint64_t>						_fingerprints;
+		std::unordered_map<std::uint64_t, std::uint32_t>	_index;		// fingerprint -> function index or kAmbiguous
+	};
+
+
+	// CodeHashTable
+	// hash of the instruction bytes of each function, with the operand values that move between builds
+	// (branch targets, rip-relative displacements and relocated bytes) masked to zero.
+	// a function whose code did not change keeps its hash even if everything around it moved.
+	class CodeHashTable
+	{
+	public:
+		CodeHashTable(const CodeHashTable&) = delete;
+		CodeHashTable& operator=(const CodeHashTable&) = delete;
+
+		static const CodeHashTable& Get();
+
+		static std::uint64_t Compute(const Image& a_image, const RelocationTable& a_relocations, const FunctionTable::Function& a_func);
+
+		// hash of the function table entry, 0 for chained fragments
+		inline std::uint64_t operator[](size_t a_idx) const {
+			return _hashes[a_idx];
+		}
+
+		// index of the function carrying a_hash, npos unless exactly one function does
+		size_t FindUnique(std::uint64_t a_hash) const;
+
+		// hash of the function starting at a_rva, 0 unless it is unique in this build
+		std::uint64_t GetUnique(std::uint32_t a_rva) const;
+
+	private:
+		static constexpr std::uint32_t kAmbiguous = static_cast<std::uint32_t>(-1);
+
+		CodeHashTable() = default;
+
+		void Build(const Image& a_image, const FunctionTable& a_functions);
+
+		// members
+		std::uint32_t									_serial = 0;
+		std::vector<std::uint64_t>						_hashes;
+		std::unordered_map<std::uint64_t, std::uint32_t>	_index;		// hash -> function index or kAmbiguous
+	};
+
+
+	// RelocationTable
+	// bitmap of the bytes patched by the loader (.reloc), one bit per byte of the image
+	class RelocationTable
+	{
+	public:
+		RelocationTable(const RelocationTable&) = delete;
+		RelocationTable& operator=(const RelocationTable&) = delete;
+
+		static const RelocationTable& Get();
+
+		inline size_t count() const {
+			return _count;
+		}
+
+		inline bool contains(std::uint32_t a_rva) const {
+			size_t word = a_rva >> 6;
+			return word < _bits.size() && (_bits[word] >> (a_rva & 63)) & 1;
+		}
+
+		// true if any byte of [a_rva, a_rva + a_size) is relocated
+		bool contains(std::uint32_t a_rva, size_t a_size) const;
+
+	private:
+		RelocationTable() = default;
+
+		void Build(const Image& a_image);
+		void Set(std::uint32_t a_rva, size_t a_size);
+
+		// members
+		std::uint32_t				_serial = 0;
+		size_t						_count = 0;		// number of relocation entries
+		std::vector<std::uint64_t>	_bits;
+	};
+
+
+	// ImportTable
+	// IAT slots of the import directory and the call sites that go through them
+	class ImportTable
+	{
+	public:
+		static constexpr size_t npos = static_cast<size_t>(-1);
+
+		struct Import
+		{
+			std::uint32_t	slot;		// rva of the IAT slot
+			std::string		name;		// "kernel32.dll!Sleep" or "kernel32.dll!#12" (module name in lowercase)
+		};
+
+		ImportTable(const ImportTable&) = delete;
+		ImportTable& operator=(const ImportTable&) = delete;
+
+		static const ImportTable& Get();
+
+		inline size_t size() const {
+			return _imports.size();
+		}
+		inline const Import& operator[](size_t a_idx) const {
+			return _imports[a_idx];
+		}
+
+		// index of the import named "dll!function" (the module name is case-insensitive), or npos
+		size_t Find(const std::string& a_name) const;
+
+		// index of the import using the IAT slot at a_slot, or npos
+		size_t FindSlot(std::uint32_t a_slot) const;
+
+		// rva of every call/jmp through the IAT slot of the import, sorted.
+		// only the functions of the exception directory are decoded, so byte pairs inside other instructions never count
+		inline ArrayView<std::uint32_t> CallSites(size_t a_idx) const {
+			return ArrayView<std::uint32_t>(_sites.data() + _siteOffsets[a_idx], _sites.data() + _siteOffsets[a_idx + 1]);
+		}
+
+		// normalizes "DLL!function" to the key used by Find()
+		static std::string Normalize(const std::string& a_name);
+
+	private:
+		ImportTable() = default;
+
+		void Build(const Image& a_image);
+		void BuildCallSites(const Image& a_image, const FunctionTable& a_functions);
+
+		// members
+		std::uint32_t									_serial = 0;
+		std::vector<Import>								_imports;
+		std::unordered_map<std::uint32_t, std::uint32_t>	_slotIndex;		// slot -> import index
+		std::unordered_map<std::string, std::uint32_t>	_nameIndex;		// name -> import index
+		std::vector<std::uint32_t>						_siteOffsets;	// import index -> first call site (CSR)
+		std::vector<std::uint32_t>						_sites;
+	};
+
+
+	// XrefTable
+	// cross references of the main module: direct calls and jumps, and rip-relative memory operands (loads, stores, lea).
+	// every function of the exception directory is decoded once, in parallel, and the table is cached per module hash.
+	// queries are binary searches in either direction
+	class XrefTable
+	{
+	public:
+		enum class Kind : std::uint8_t
+		{
+			kCall,		// call rel32
+			kJump,		// jmp / jcc
+			kData		// [rip+disp32]
+		};
+
+		struct Xref
+		{
+			std::uint32_t	from;		// 00 - rva of the instruction
+			std::uint32_t	to;			// 04 - rva of the target
+			Kind			kind;		// 08
+		};
+		static_assert(sizeof(Xref) == 0xC);
+
+		XrefTable(const XrefTable&) = delete;
+		XrefTable& operator=(const XrefTable&) = delete;
+
+		static const XrefTable& Get();
+
+		inline size_t size() const {
+			return _xrefs.size();
+		}
+		// sorted by source, then by target
+		inline const Xref& operator[](size_t a_idx) const {
+			return _xrefs[a_idx];
+		}
+		inline auto begin() const {
+			return _xrefs.begin();
+		}
+		inline auto end() const {
+			return _xrefs.end();
+		}
+
+		// references made by the instructions in [a_first, a_last), sorted by source
+		ArrayView<Xref> From(std::uint32_t a_first, std::uint32_t a_last) const;
+		inline ArrayView<Xref> From(std::uint32_t a_rva) const {
+			return From(a_rva, a_rva + 1);
+		}
+
+		// indices (for operator[]) of the references to a_rva, sorted by source
+		ArrayView<std::uint32_t> To(std::uint32_t a_rva) const;
+
+	private:
+		XrefTable() = default;
+
+		void Build(const Image& a_image, const FunctionTable& a_functions);
+		void BuildTargetIndex();
+
+		bool Load(const std::string& a_path);
+		bool Save(const std::string& a_path) const;
+
+		// members
+		std::uint32_t				_serial = 0;
+		std::vector<Xref>			_xrefs;
+		std::vector<std::uint32_t>	_byTarget;		// indices of _xrefs sorted by target, then by source
+	};
+
+
+	// StringTable
+	// NUL-terminated string literals of .rdata: runs of printable ASCII, and UTF-16LE runs of the same characters.
+	// the section is classified 16 bytes at a time with SSE2 and the literals are indexed by the hash of their text.
+	class StringTable
+	{
+	public:
+		static constexpr size_t npos = static_cast<size_t>(-1);
+
+		// shorter runs are too common to tell apart and are not indexed
+		static constexpr size_t kMinLength = 4;
+
+		struct Literal
+		{
+			std::uint32_t	rva;		// 00
+			std::uint32_t	length;		// 04 - characters, without the terminator
+			bool			wide;		// 08 - UTF-16LE
+		};
+		static_assert(sizeof(Literal) == 0xC);
+
+		StringTable(const StringTable&) = delete;
+		StringTable& operator=(const StringTable&) = delete;
+
+		static const StringTable& Get();
+
+		inline size_t size() const {
+			return _literals.size();
+		}
+		// sorted by rva
+		inline const Literal& operator[](size_t a_idx) const {
+			return _literals[a_idx];
+		}
+		inline auto begin() const {
+			return _literals.begin();
+		}
+		inline auto end() const {
+			return _literals.end();
+		}
+
+		// index of the literal starting at a_rva, or npos
+		size_t Find(std::uint32_t a_rva) const;
+
+		// rvas of the literals whose text is a_text (UTF-16 ones compared character by character), sorted
+		std::vector<std::uint32_t> Find(const Image& a_image, const std::string& a_text) const;
+
+		// text of the literal, UTF-16 ones narrowed to ASCII
+		std::string Text(const Image& a_image, size_t a_idx) const;
+
+		// hash of the index, the same for an ASCII literal and a UTF-16 one of the same text
+		static std::uint64_t HashText(const std::string& a_text);
+
+	private:
+		StringTable() = default;
+
+		void Build(const Image& a_image);
+
+		// members
+		std::uint32_t										_serial = 0;
+		std::vector<Literal>								_literals;
+		std::unordered_multimap<std::uint64_t, std::uint32_t>	_index;		// hash of the text -> literal index
+	};
+
+
+	// ConstantTable
+	// immediates and displacements (other than rip-relative ones) of the main module, decoded function by function.
+	// the values are sorted and each has a posting list of the instructions using it, stored as LEB128 deltas.
+	// like XrefTable, the table is cached per module hash.
+	class ConstantTable
+	{
+	public:
+		// values in (-kMinMagnitude, kMinMagnitude) are in nearly every function and are not indexed
+		static constexpr std::int64_t kMinMagnitude = 0x100;
+
+		struct Use
+		{
+			std::uint64_t	value;		// 00 - sign-extended to 64 bits, as the decoder does
+			std::uint32_t	rva;		// 08 - rva of the instruction
+		};
+
+		ConstantTable(const ConstantTable&) = delete;
+		ConstantTable& operator=(const ConstantTable&) = delete;
+
+		static const ConstantTable& Get();
+
+		// number of distinct values
+		inline size_t size() const {
+			return _values.size();
+		}
+
+		// rvas of the instructions using a_value, sorted
+		std::vector<std::uint32_t> Find(std::uint64_t a_value) const;
+
+		// appends the values indexed for the instructions in [a_begin, a_end) to a_out
+		static void Collect(const Image& a_image, std::uint32_t a_begin, std::uint32_t a_end, std::vector<Use>& a_out);
+
+	private:
+		ConstantTable() = default;
+
+		void Build(const Image& a_image, const FunctionTable& a_functions);
+		bool Load(const std::string& a_path);
+		bool Save(const std::string& a_path) const;
+
+		// members
+		std::uint32_t				_serial = 0;
+		std::vector<std::uint64_t>	_values;		// sorted
+		std::vector<std::uint32_t>	_offsets;		// value index -> first byte of its postings, size() + 1 entries
+		std::vector<std::uint8_t>	_postings;
+	};
+
+
+	// Identity
+	// content hash of the main module file (headers, .text, .rdata and .data).
+	// the file is hashed rather than the loaded image, which is relocated and written to at runtime.
+	class Identity
+	{
+	public:
+		Identity(const Identity&) = delete;
+		Identity& operator=(const Identity&) = delete;
+
+		static const Identity& Get();
+
+		// 0 if the module file could not be read
+		inline std::uint64_t hash() const {
+			return _hash;
+		}
+		// file name of the module, only used as a display alias
+		inline const std::string& name() const {
+			return _name;
+		}
+
+		// "SkyrimSE.exe@0123456789ABCDEF", or the bare file name when the hash is unknown
+		std::string key() const;
+
+		// file next to the plugin for data derived from this build ("<plugin dir>\Secunda\<key><a_extension>"),
+		// empty if the hash is unknown
+		std::string cache_path(const char* a_extension) const;
+
+		// splits a key written by key(). a_hash is 0 for a legacy key (file name only)
+		static void ParseKey(const std::string& a_key, std::string& a_name, std::uint64_t& a_hash);
+
+	private:
+		Identity() = default;
+
+		bool Compute(const char* a_path);
+
+		// members
+		std::uint32_t	_serial = 0;
+		std::uint64_t	_hash = 0;
+		std::string		_name;
+	};
+}
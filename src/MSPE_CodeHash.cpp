@@ -0,0 +1,115 @@
+﻿#include "pch.h"
+#include "MSPE.h"
+#include "CDistorm.h"
+#include "Hash.h"
+#include "Util.h"
+#include <memory>
+#include <mutex>
+#include <algorithm>	// min
+
+
+namespace MSPE
+{
+	static std::unique_ptr<CodeHashTable> s_codeHashTable;
+	static std::mutex s_codeHashTableMutex;
+
+	// functions hashed by one task of the parallel build
+	static constexpr size_t kFunctionsPerTask = 256;
+
+
+	std::uint64_t CodeHashTable::Compute(const Image& a_image, const RelocationTable& a_relocations, const FunctionTable::Function& a_func)
+	{
+		size_t size = a_func.end - a_func.begin;
+		const std::uint8_t* code = a_image.ptr(a_func.begin, size);
+		if (!code || size == 0) {
+			return 0;
+		}
+
+		// prefixes, opcodes and stable operand values are kept as they are; the volatile value fields become zero
+		std::vector<std::uint8_t> normalized(code, code + size);
+		CDistorm distorm;
+		for (size_t pos = 0; pos < size;) {
+			if (!distorm.Decode(a_func.begin + pos, code + pos, size - pos)) {
+				++pos;		// not decodable: keep the byte and resynchronize on the next one
+				continue;
+			}
+			std::uint32_t mask = distorm.VolatileMask();
+			for (size_t i = 0; i < distorm.Size(); ++i) {
+				if ((mask >> i) & 1 || a_relocations.contains(static_cast<std::uint32_t>(a_func.begin + pos + i))) {
+					normalized[pos + i] = 0;
+				}
+			}
+			pos += distorm.Size();
+		}
+
+		std::uint64_t hash = Hash::Compute(normalized.data(), normalized.size());
+		return hash ? hash : 1;
+	}
+
+
+	const CodeHashTable& CodeHashTable::Get()
+	{
+		std::lock_guard<std::mutex> lock(s_codeHashTableMutex);
+		auto& functions = FunctionTable::Get();
+		auto& image = Image::Get();
+		if (!s_codeHashTable || s_codeHashTable->_serial != image.serial()) {
+			s_codeHashTable.reset(new CodeHashTable());
+			s_codeHashTable->Build(image, functions);
+		}
+		return *s_codeHashTable;
+	}
+
+
+	size_t CodeHashTable::FindUnique(std::uint64_t a_hash) const
+	{
+		auto it = _index.find(a_hash);
+		if (it == _index.end() || it->second == kAmbiguous) {
+			return FunctionTable::npos;
+		}
+		return it->second;
+	}
+
+
+	std::uint64_t CodeHashTable::GetUnique(std::uint32_t a_rva) const
+	{
+		auto& functions = FunctionTable::Get();
+		size_t idx = functions.Find(a_rva);
+		if (idx == FunctionTable::npos || functions[idx].begin != a_rva || functions[idx].owner != idx) {
+			return 0;
+		}
+		std::uint64_t hash = _hashes[idx];
+		return FindUnique(hash) == idx ? hash : 0;
+	}
+
+
+	void CodeHashTable::Build(const Image& a_image, const FunctionTable& a_functions)
+	{
+		_serial = a_image.serial();
+		_hashes.assign(a_functions.size(), 0);
+
+		// every task writes its own slots, so no lock is needed
+		auto& relocations = RelocationTable::Get();
+		size_t taskCount = (a_functions.size() + kFunctionsPerTask - 1) / kFunctionsPerTask;
+		Util::ParallelFor(taskCount, [&](size_t a_task) {
+			size_t first = a_task * kFunctionsPerTask;
+			size_t last = std::min<size_t>(first + kFunctionsPerTask, a_functions.size());
+			for (size_t i = first; i < last; ++i) {
+				if (a_functions[i].owner != i) {
+					continue;	// chained fragment
+				}
+				_hashes[i] = Compute(a_image, relocations, a_functions[i]);
+			}
+		});
+
+		_index.reserve(a_functions.size());
+		for (size_t i = 0; i < _hashes.size(); ++i) {
+			if (_hashes[i] == 0) {
+				continue;
+			}
+			auto result = _index.emplace(_hashes[i], static_cast<std::uint32_t>(i));
+			if (!result.second) {
+				result.first->second = kAmbiguous;
+			}
+		}
+	}
+}
@@ -0,0 +1,282 @@
+﻿#include "pch.h"
+#include "MSPE.h"
+#include "MSPE_Decode.h"
+#include "Util.h"
+#include "pluginsdk/lz4/lz4.h"
+#include <memory>
+#include <mutex>
+#include <algorithm>	// sort, unique, lower_bound
+#include <cstring>		// memcpy
+
+
+namespace MSPE
+{
+	static std::unique_ptr<ConstantTable> s_constantTable;
+	static std::mutex s_constantTableMutex;
+
+	// functions decoded by one task of the parallel build
+	static constexpr size_t kFunctionsPerTask = 256;
+
+
+	struct ConstantFileHeader
+	{
+		static constexpr std::uint32_t kMagic = 0x54534353;		// "SCST"
+		static constexpr std::uint32_t kVersion = 1;
+
+		std::uint32_t	magic;
+		std::uint32_t	version;
+		std::uint32_t	count;				// number of distinct values
+		std::uint32_t	postingsSize;		// bytes of the posting lists
+		std::uint32_t	compressedSize;		// lz4 block that follows
+	};
+	// the block holds count value deltas, count + 1 offsets and the posting lists, in this order
+
+
+	const ConstantTable& ConstantTable::Get()
+	{
+		std::lock_guard<std::mutex> lock(s_constantTableMutex);
+		auto& image = Image::Get();
+		if (!s_constantTable || s_constantTable->_serial != image.serial()) {
+			s_constantTable.reset(new ConstantTable());
+			s_constantTable->_serial = image.serial();
+
+			std::string path = Identity::Get().cache_path(".const");
+			if (path.empty() || !s_constantTable->Load(path)) {
+				s_constantTable->Build(image, FunctionTable::Get());
+				if (!path.empty() && !s_constantTable->Save(path)) {
+					_plugin_logprintf("cannot write the constant cache: \"%s\"\n", path.c_str());
+				}
+			}
+		}
+		return *s_constantTable;
+	}
+
+
+	std::vector<std::uint32_t> ConstantTable::Find(std::uint64_t a_value) const
+	{
+		std::vector<std::uint32_t> result;
+		auto it = std::lower_bound(_values.begin(), _values.end(), a_value);
+		if (it == _values.end() || *it != a_value) {
+			return result;
+		}
+
+		size_t idx = it - _values.begin();
+		const std::uint8_t* p = _postings.data() + _offsets[idx];
+		const std::uint8_t* last = _postings.data() + _offsets[idx + 1];
+		std::uint32_t rva = 0;
+		while (p < last) {
+			std::uint32_t delta = 0;
+			for (int shift = 0; p < last; shift += 7) {
+				std::uint8_t byte = *p++;
+				delta |= static_cast<std::uint32_t>(byte & 0x7F) << shift;
+				if (!(byte & 0x80)) {
+					break;
+				}
+			}
+			rva += delta;
+			result.push_back(rva);
+		}
+		return result;
+	}
+
+
+	static inline bool IsIndexed(std::uint64_t a_value)
+	{
+		auto value = static_cast<std::int64_t>(a_value);
+		return value <= -ConstantTable::kMinMagnitude || value >= ConstantTable::kMinMagnitude;
+	}
+
+
+	void ConstantTable::Collect(const Image& a_image, std::uint32_t a_begin, std::uint32_t a_end, std::vector<Use>& a_out)
+	{
+		Decode(a_image, a_begin, a_end, [&](const _DInst& di) {
+			// the decoder has already sign-extended both fields to 64 bits
+			bool hasImm = false;
+			bool hasDisp = false;
+			for (unsigned int n = 0; n < OPERANDS_NO; ++n) {
+				const _Operand& op = di.ops[n];
+				if (op.type == O_IMM) {
+					hasImm = true;
+				}
+				else if ((op.type == O_SMEM || op.type == O_MEM || op.type == O_DISP) && di.dispSize && op.index != R_RIP) {
+					hasDisp = true;
+				}
+			}
+			auto rva = static_cast<std::uint32_t>(di.addr);
+			if (hasImm && IsIndexed(di.imm.qword)) {
+				a_out.push_back({ di.imm.qword, rva });
+			}
+			if (hasDisp && IsIndexed(di.disp) && !(hasImm && di.disp == di.imm.qword)) {
+				a_out.push_back({ di.disp, rva });
+			}
+		});
+	}
+
+
+	void ConstantTable::Build(const Image& a_image, const FunctionTable& a_functions)
+	{
+		_values.clear();
+		_offsets.clear();
+		_postings.clear();
+
+		// decode function by function, so that data and padding between functions are not mistaken for code
+		size_t taskCount = (a_functions.size() + kFunctionsPerTask - 1) / kFunctionsPerTask;
+		std::vector<std::vector<Use>> partial(taskCount);
+		Util::ParallelFor(taskCount, [&](size_t a_task) {
+			size_t first = a_task * kFunctionsPerTask;
+			size_t last = std::min<size_t>(first + kFunctionsPerTask, a_functions.size());
+			for (size_t i = first; i < last; ++i) {
+				Collect(a_image, a_functions[i].begin, a_functions[i].end, partial[a_task]);
+			}
+		});
+
+		size_t total = 0;
+		for (auto& elem : partial) {
+			total += elem.size();
+		}
+		std::vector<Use> uses;
+		uses.reserve(total);
+		for (auto& elem : partial) {
+			uses.insert(uses.end(), elem.begin(), elem.end());
+		}
+		partial.clear();
+
+		std::sort(uses.begin(), uses.end(), [](const Use& a, const Use& b) -> bool {
+			return a.value != b.value ? a.value < b.value : a.rva < b.rva;
+		});
+		uses.erase(std::unique(uses.begin(), uses.end(), [](const Use& a, const Use& b) -> bool {
+			return a.value == b.value && a.rva == b.rva;
+		}), uses.end());
+
+		// one posting list per value: the rvas are sorted, so the deltas are small and mostly fit in one or two bytes
+		std::uint32_t prev = 0;
+		for (size_t i = 0; i < uses.size(); ++i) {
+			if (i == 0 || uses[i].value != uses[i - 1].value) {
+				_values.push_back(uses[i].value);
+				_offsets.push_back(static_cast<std::uint32_t>(_postings.size()));
+				prev = 0;
+			}
+			std::uint32_t delta = uses[i].rva - prev;
+			prev = uses[i].rva;
+			while (delta >= 0x80) {
+				_postings.push_back(static_cast<std::uint8_t>(delta | 0x80));
+				delta >>= 7;
+			}
+			_postings.push_back(static_cast<std::uint8_t>(delta));
+		}
+		_offsets.push_back(static_cast<std::uint32_t>(_postings.size()));
+	}
+
+
+	bool ConstantTable::Load(const std::string& a_path)
+	{
+		FILE* fp = nullptr;
+		if (fopen_s(&fp, a_path.c_str(), "rb") != 0 || !fp) {
+			return false;
+		}
+
+		ConstantFileHeader header = {};
+		std::vector<char> compressed;
+		bool succeeded = fread(&header, sizeof(header), 1, fp) == 1
+			&& header.magic == ConstantFileHeader::kMagic
+			&& header.version == ConstantFileHeader::kVersion
+			&& header.count < 0x10000000
+			&& header.postingsSize < 0x40000000
+			&& header.compressedSize < 0x7FFFFFFF;
+		if (succeeded) {
+			compressed.resize(header.compressedSize);
+			succeeded = fread(compressed.data(), 1, compressed.size(), fp) == compressed.size();
+		}
+		fclose(fp);
+		if (!succeeded) {
+			return false;
+		}
+
+		size_t count = header.count;
+		size_t rawSize = count * sizeof(std::uint64_t) + (count + 1) * sizeof(std::uint32_t) + header.postingsSize;
+		if (rawSize > 0x7FFFFFFF) {
+			return false;
+		}
+		std::vector<char> raw(rawSize);
+		if (LZ4_decompress_safe(compressed.data(), raw.data(), static_cast<int>(compressed.size()), static_cast<int>(rawSize)) != static_cast<int>(rawSize)) {
+			return false;
+		}
+
+		const char* deltas = raw.data();
+		const char* offsets = deltas + count * sizeof(std::uint64_t);
+		const char* postings = offsets + (count + 1) * sizeof(std::uint32_t);
+		_values.resize(count);
+		_offsets.resize(count + 1);
+		std::uint64_t value = 0;
+		for (size_t i = 0; i < count; ++i) {
+			std::uint64_t delta;
+			std::memcpy(&delta, deltas + i * sizeof(delta), sizeof(delta));
+			value += delta;
+			_values[i] = value;
+		}
+		std::memcpy(_offsets.data(), offsets, _offsets.size() * sizeof(std::uint32_t));
+		_postings.assign(postings, postings + header.postingsSize);
+
+		// the offsets must stay inside the posting lists
+		for (size_t i = 0; i < count; ++i) {
+			if (_offsets[i] > _offsets[i + 1]) {
+				_offsets.clear();
+				break;
+			}
+		}
+		if (_offsets.empty() || _offsets.front() != 0 || _offsets.back() != header.postingsSize) {
+			_values.clear();
+			_offsets.clear();
+			_postings.clear();
+			return false;
+		}
+		return true;
+	}
+
+
+	bool ConstantTable::Save(const std::string& a_path) const
+	{
+		// the values are sorted, so they are stored as deltas which compress well
+		size_t count = _values.size();
+		std::vector<char> raw(count * sizeof(std::uint64_t) + _offsets.size() * sizeof(std::uint32_t) + _postings.size());
+		char* deltas = raw.data();
+		char* offsets = deltas + count * sizeof(std::uint64_t);
+		char* postings = offsets + _offsets.size() * sizeof(std::uint32_t);
+		std::uint64_t prev = 0;
+		for (size_t i = 0; i < count; ++i) {
+			std::uint64_t delta = _values[i] - prev;
+			prev = _values[i];
+			std::memcpy(deltas + i * sizeof(delta), &delta, sizeof(delta));
+		}
+		std::memcpy(offsets, _offsets.data(), _offsets.size() * sizeof(std::uint32_t));
+		std::memcpy(postings, _postings.data(), _postings.size());
+
+		std::vector<char> compressed(LZ4_compressBound(static_cast<int>(raw.size())));
+		int size = LZ4_compress(raw.data(), compressed.data(), static_cast<int>(raw.size()));
+		if (size <= 0 && raw.size() != 0) {
+			return false;
+		}
+
+		ConstantFileHeader header = {};
+		header.magic = ConstantFileHeader::kMagic;
+		header.version = ConstantFileHeader::kVersion;
+		header.count = static_cast<std::uint32_t>(count);
+		header.postingsSize = static_cast<std::uint32_t>(_postings.size());
+		header.compressedSize = static_cast<std::uint32_t>(std::max<int>(size, 0));
+
+		// write to a temporary file and replace, so that a crash never leaves a truncated cache
+		std::string temp = a_path + ".tmp";
+		FILE* fp = nullptr;
+		if (fopen_s(&fp, temp.c_str(), "wb") != 0 || !fp) {
+			return false;
+		}
+		bool succeeded = fwrite(&header, sizeof(header), 1, fp) == 1
+			&& fwrite(compressed.data(), 1, header.compressedSize, fp) == header.compressedSize;
+		succeeded = fclose(fp) == 0 && succeeded;
+		if (!succeeded) {
+			DeleteFileA(temp.c_str());
+			return false;
+		}
+		return Util::CommitFile(temp, a_path.c_str());
+	}
+}
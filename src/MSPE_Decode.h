@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include "MSPE.h"
+
+extern "C" {
+#include "distorm/include/distorm.h"
+#include "distorm/include/mnemonics.h"	// R_RIP
+}
+
+// batch decoder shared by the tables that are built by decoding every function
+namespace MSPE
+{
+	// instructions decoded by one call of distorm_decompose
+	static constexpr unsigned int kDecodeBatch = 256;
+
+	// decodes [a_begin, a_end) of a_image and calls a_fn(const _DInst&) for every decodable instruction
+	// code offsets are rvas, so the addresses and targets come out as rvas too
+	template <class Fn>
+	void Decode(const Image& a_image, std::uint32_t a_begin, std::uint32_t a_end, Fn&& a_fn)
+	{
+		const std::uint8_t* code = a_image.ptr(a_begin, a_end - a_begin);
+		if (!code) {
+			return;
+		}
+
+		_CodeInfo ci = {};
+		ci.codeOffset = a_begin;
+		ci.code = code;
+		ci.codeLen = static_cast<int>(a_end - a_begin);
+#ifdef _WIN64
+		ci.dt = Decode64Bits;
+#else
+		ci.dt = Decode32Bits;
+#endif
+		ci.features = DF_NONE;
+
+		_DInst insts[kDecodeBatch];
+		while (ci.codeLen > 0) {
+			unsigned int count = 0;
+			_DecodeResult result = distorm_decompose(&ci, insts, kDecodeBatch, &count);
+			if (result == DECRES_INPUTERR || count == 0) {
+				return;
+			}
+
+			for (unsigned int i = 0; i < count; ++i) {
+				if (insts[i].flags != FLAG_NOT_DECODABLE) {
+					a_fn(insts[i]);
+				}
+			}
+
+			if (result == DECRES_SUCCESS) {
+				return;
+			}
+			// DECRES_MEMORYERR: the batch is full, continue after the last instruction
+			const _DInst& last = insts[count - 1];
+			auto next = static_cast<int>(last.addr + last.size - ci.codeOffset);
+			ci.code += next;
+			ci.codeLen -= next;
+			ci.codeOffset += next;
+		}
+	}
+}
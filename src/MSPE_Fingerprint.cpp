@@ -0,0 +1,118 @@
+﻿#include "pch.h"
+#include "MSPE.h"
+#include <memory>
+#include <mutex>
+
+
+namespace MSPE
+{
+	static std::unique_ptr<FingerprintTable> s_fingerprintTable;
+	static std::mutex s_fingerprintTableMutex;
+
+
+	// functions of similar length share a bucket: two buckets per power of two
+	static std::uint32_t GetLengthBucket(std::uint32_t a_length)
+	{
+		std::uint32_t msb = 0;
+		while ((a_length >> msb) > 1) {
+			++msb;
+		}
+		std::uint32_t half = msb > 0 ? (a_length >> (msb - 1)) & 1 : 0;
+		return (msb << 1) | half;
+	}
+
+
+	std::uint64_t FingerprintTable::Compute(const Image& a_image, const FunctionTable::Function& a_func)
+	{
+		auto* unwind = a_image.ptr<UnwindInfo>(a_func.unwind, offsetof(UnwindInfo, unwindCode));
+		if (!unwind || !a_image.contains(a_func.unwind, unwind->size())) {
+			return 0;
+		}
+
+		// FNV-1a
+		std::uint64_t hash = 0xCBF29CE484222325;
+		auto feed = [&hash](std::uint8_t a_byte) {
+			hash ^= a_byte;
+			hash *= 0x00000100000001B3;
+		};
+
+		feed(unwind->version());
+		feed(unwind->flags() & (UnwindInfo::kExceptionHandler | UnwindInfo::kTerminationHandler));
+		feed(unwind->sizeOfProlog);
+		feed(unwind->frameRegisterAndOffset);
+		feed(unwind->countOfCodes);
+
+		// unwind codes: prolog offset, operation and operand of every push/alloc/save
+		auto* codes = reinterpret_cast<const std::uint8_t*>(unwind->unwindCode);
+		for (size_t i = 0; i < unwind->countOfCodes * sizeof(std::uint16_t); ++i) {
+			feed(codes[i]);
+		}
+
+		std::uint32_t bucket = GetLengthBucket(a_func.end - a_func.begin);
+		feed(static_cast<std::uint8_t>(bucket));
+
+		return hash ? hash : 1;
+	}
+
+
+	const FingerprintTable& FingerprintTable::Get()
+	{
+		std::lock_guard<std::mutex> lock(s_fingerprintTableMutex);
+		auto& functions = FunctionTable::Get();
+		auto& image = Image::Get();
+		if (!s_fingerprintTable || s_fingerprintTable->_serial != image.serial()) {
+			s_fingerprintTable.reset(new FingerprintTable());
+			s_fingerprintTable->Build(image, functions);
+		}
+		return *s_fingerprintTable;
+	}
+
+
+	size_t FingerprintTable::FindUnique(std::uint64_t a_fingerprint) const
+	{
+		auto it = _index.find(a_fingerprint);
+		if (it == _index.end() || it->second == kAmbiguous) {
+			return FunctionTable::npos;
+		}
+		return it->second;
+	}
+
+
+	std::uint64_t FingerprintTable::GetUnique(std::uint32_t a_rva) const
+	{
+		auto& functions = FunctionTable::Get();
+		size_t idx = functions.Find(a_rva);
+		if (idx == FunctionTable::npos || functions[idx].begin != a_rva || functions[idx].owner != idx) {
+			return 0;
+		}
+
+		std::uint64_t fingerprint = _fingerprints[idx];
+		return FindUnique(fingerprint) == idx ? fingerprint : 0;
+	}
+
+
+	void FingerprintTable::Build(const Image& a_image, const FunctionTable& a_functions)
+	{
+		_serial = a_image.serial();
+		_fingerprints.assign(a_functions.size(), 0);
+		_index.reserve(a_functions.size());
+
+		for (size_t i = 0; i < a_functions.size(); ++i) {
+			auto& func = a_functions[i];
+			if (func.owner != i) {
+				continue;	// chained fragment
+			}
+
+			std::uint64_t fingerprint = Compute(a_image, func);
+			_fingerprints[i] = fingerprint;
+			if (fingerprint == 0) {
+				continue;
+			}
+
+			auto result = _index.emplace(fingerprint, static_cast<std::uint32_t>(i));
+			if (!result.second) {
+				result.first->second = kAmbiguous;
+			}
+		}
+	}
+}
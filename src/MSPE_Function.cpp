@@ -0,0 +1,149 @@
+﻿#include "pch.h"
+#include "MSPE.h"
+#include <memory>
+#include <mutex>
+#include <algorithm>	// sort
+
+
+namespace MSPE
+{
+	static std::unique_ptr<FunctionTable> s_functionTable;
+	static std::mutex s_functionTableMutex;
+
+
+	const FunctionTable& FunctionTable::Get()
+	{
+		std::lock_guard<std::mutex> lock(s_functionTableMutex);
+		auto& image = Image::Get();
+		if (!s_functionTable || s_functionTable->_serial != image.serial()) {
+			s_functionTable.reset(new FunctionTable());
+			s_functionTable->Build(image);
+		}
+		return *s_functionTable;
+	}
+
+
+	size_t FunctionTable::Find(std::uint32_t a_rva) const
+	{
+		size_t n = _begin.size();
+		if (n == 0 || a_rva < _begin[0]) {
+			return npos;
+		}
+
+		// branch-free lower bound: the loop count depends only on n
+		const std::uint32_t* base = _begin.data();
+		while (n > 1) {
+			size_t half = n >> 1;
+			base = (base[half] <= a_rva) ? base + half : base;
+			n -= half;
+		}
+
+		size_t idx = base - _begin.data();
+		return a_rva < _functions[idx].end ? idx : npos;
+	}
+
+
+	bool FunctionTable::Lookup(duint a_addr, duint* a_start, duint* a_end) const
+	{
+		auto& image = Image::Get();
+		if (!image.contains_addr(a_addr)) {
+			return false;
+		}
+
+		size_t idx = FindOwner(image.rva(a_addr));
+		if (idx == npos) {
+			return false;
+		}
+
+		auto& func = _functions[idx];
+		if (a_start) {
+			*a_start = image.base() + func.begin;
+		}
+		if (a_end) {
+			*a_end = image.base() + func.end - 1;
+		}
+		return true;
+	}
+
+
+	void FunctionTable::Build(const Image& a_image)
+	{
+		_serial = a_image.serial();
+
+		auto dir = a_image.directory(IMAGE_DIRECTORY_ENTRY_EXCEPTION);
+		size_t count = dir.Size / sizeof(IMAGE_RUNTIME_FUNCTION_ENTRY);
+		auto* entries = a_image.ptr<IMAGE_RUNTIME_FUNCTION_ENTRY>(dir.VirtualAddress, count * sizeof(IMAGE_RUNTIME_FUNCTION_ENTRY));
+		if (!entries || count == 0) {
+			return;
+		}
+
+		_functions.reserve(count);
+		for (size_t i = 0; i < count; ++i) {
+			auto& entry = entries[i];
+			if (entry.BeginAddress >= entry.EndAddress || !a_image.contains(entry.BeginAddress, entry.EndAddress - entry.BeginAddress)) {
+				continue;
+			}
+			_functions.push_back({ entry.BeginAddress, entry.EndAddress, entry.UnwindData, 0 });
+		}
+
+		// the linker emits .pdata sorted, but do not rely on it
+		auto less = [](const Function& a, const Function& b) -> bool {
+			return a.begin < b.begin;
+		};
+		if (!std::is_sorted(_functions.begin(), _functions.end(), less)) {
+			std::sort(_functions.begin(), _functions.end(), less);
+		}
+
+		_begin.resize(_functions.size());
+		for (size_t i = 0; i < _functions.size(); ++i) {
+			_begin[i] = _functions[i].begin;
+			_functions[i].owner = static_cast<std::uint32_t>(i);
+		}
+
+		//
+		// chained unwind info: fold fragments into the function owning the primary entry
+		//
+		auto parentOf = [this, &a_image](const Function& func) -> size_t {
+			std::uint32_t parent = 0;
+			if (func.unwind & 1) {
+				// RUNTIME_FUNCTION_INDIRECT
+				auto* entry = a_image.ptr<IMAGE_RUNTIME_FUNCTION_ENTRY>(func.unwind & ~1u);
+				if (!entry) {
+					return npos;
+				}
+				parent = entry->BeginAddress;
+			}
+			else {
+				auto* unwind = a_image.ptr<UnwindInfo>(func.unwind, offsetof(UnwindInfo, unwindCode));
+				if (!unwind || !(unwind->flags() & UnwindInfo::kChainInfo)) {
+					return npos;
+				}
+				auto* chained = a_image.ptr<IMAGE_RUNTIME_FUNCTION_ENTRY>(func.unwind + static_cast<std::uint32_t>(unwind->size()));
+				if (!chained) {
+					return npos;
+				}
+				parent = chained->BeginAddress;
+			}
+
+			size_t idx = Find(parent);
+			return (idx != npos && _functions[idx].begin == parent) ? idx : npos;
+		};
+
+		for (size_t i = 0; i < _functions.size(); ++i) {
+			size_t owner = i;
+			for (int depth = 0; depth < 32; ++depth) {
+				size_t parent = parentOf(_functions[owner]);
+				if (parent == npos || parent == owner) {
+					break;
+				}
+				owner = parent;
+				if (owner < i) {
+					// already resolved
+					owner = _functions[owner].owner;
+					break;
+				}
+			}
+			_functions[i].owner = static_cast<std::uint32_t>(owner);
+		}
+	}
+}
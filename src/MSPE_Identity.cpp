@@ -0,0 +1,150 @@
+﻿#include "pch.h"
+#include "MSPE.h"
+#include "Hash.h"
+#include "Util.h"
+#include <memory>
+#include <mutex>
+#include <algorithm>	// min
+#include <cctype>		// isxdigit
+
+
+namespace MSPE
+{
+	static std::unique_ptr<Identity> s_identity;
+	static std::mutex s_identityMutex;
+
+	// sections covered by the hash. the others (.pdata, .reloc, resources, ...) follow from these or do not affect addresses
+	static const char* const kHashedSections[] = { ".text", ".rdata", ".data" };
+
+
+	const Identity& Identity::Get()
+	{
+		std::lock_guard<std::mutex> lock(s_identityMutex);
+		auto& image = Image::Get();
+		if (!s_identity || s_identity->_serial != image.serial()) {
+			s_identity.reset(new Identity());
+			s_identity->_serial = image.serial();
+			if (image.base()) {
+				s_identity->_name = Util::GetModName(image.base());
+
+				char path[MAX_PATH] = { 0 };
+				if (!Script::Module::GetMainModulePath(path) || !s_identity->Compute(path)) {
+					_plugin_logprintf("cannot hash the module file: \"%s\"\n", path);
+					s_identity->_hash = 0;
+				}
+			}
+		}
+		return *s_identity;
+	}
+
+
+	std::string Identity::key() const
+	{
+		if (_hash == 0) {
+			return _name;
+		}
+		char buffer[20];
+		sprintf_s(buffer, "@%016llX", static_cast<unsigned long long>(_hash));
+		return _name + buffer;
+	}
+
+
+	std::string Identity::cache_path(const char* a_extension) const
+	{
+		if (_hash == 0) {
+			return std::string();
+		}
+
+		char path[MAX_PATH] = { 0 };
+		if (!GetModuleFileNameA(g_dllHandle, path, MAX_PATH)) {
+			return std::string();
+		}
+		std::string dir(path);
+		auto pos = dir.find_last_of("\\/");
+		dir = (pos != std::string::npos ? dir.substr(0, pos + 1) : std::string()) + "Secunda";
+		CreateDirectoryA(dir.c_str(), nullptr);
+
+		return dir + "\\" + key() + a_extension;
+	}
+
+
+	void Identity::ParseKey(const std::string& a_key, std::string& a_name, std::uint64_t& a_hash)
+	{
+		a_name = a_key;
+		a_hash = 0;
+
+		auto pos = a_key.rfind('@');
+		if (pos == std::string::npos || a_key.size() - pos != 17) {
+			return;
+		}
+		for (size_t i = pos + 1; i < a_key.size(); ++i) {
+			if (!std::isxdigit(static_cast<unsigned char>(a_key[i]))) {
+				return;
+			}
+		}
+
+		a_name = a_key.substr(0, pos);
+		a_hash = std::strtoull(a_key.c_str() + pos + 1, nullptr, 16);
+	}
+
+
+	bool Identity::Compute(const char* a_path)
+	{
+		HANDLE file = CreateFileA(a_path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		LARGE_INTEGER fileSize;
+		HANDLE mapping = nullptr;
+		if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		}
+		CloseHandle(file);
+		if (!mapping) {
+			return false;
+		}
+
+		auto* view = static_cast<const std::uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		CloseHandle(mapping);
+		if (!view) {
+			return false;
+		}
+
+		size_t size = static_cast<size_t>(fileSize.QuadPart);
+		auto contains = [size](size_t offset, size_t length) -> bool {
+			return offset < size && length <= size - offset;
+		};
+
+		bool result = false;
+		auto* dos = reinterpret_cast<const IMAGE_DOS_HEADER*>(view);
+		if (contains(0, sizeof(IMAGE_DOS_HEADER)) && dos->e_magic == IMAGE_DOS_SIGNATURE && contains(dos->e_lfanew, sizeof(IMAGE_NT_HEADERS))) {
+			auto* nt = reinterpret_cast<const IMAGE_NT_HEADERS*>(view + dos->e_lfanew);
+			auto* first = IMAGE_FIRST_SECTION(nt);
+			size_t count = nt->FileHeader.NumberOfSections;
+
+			if (nt->Signature == IMAGE_NT_SIGNATURE && contains(reinterpret_cast<const std::uint8_t*>(first) - view, count * sizeof(IMAGE_SECTION_HEADER))) {
+				size_t headerSize = std::min<size_t>(nt->OptionalHeader.SizeOfHeaders, size);
+				std::uint64_t hash = Hash::ComputeParallel(view, headerSize);
+
+				for (auto* name : kHashedSections) {
+					auto length = std::min<size_t>(std::strlen(name) + 1, IMAGE_SIZEOF_SHORT_NAME);
+					for (size_t i = 0; i < count; ++i) {
+						auto& section = first[i];
+						if (std::memcmp(section.Name, name, length) == 0 && contains(section.PointerToRawData, section.SizeOfRawData)) {
+							hash = Hash::Combine(hash, Hash::ComputeParallel(view + section.PointerToRawData, section.SizeOfRawData));
+							break;
+						}
+					}
+				}
+
+				// 0 is reserved for "unknown"
+				_hash = hash ? hash : 1;
+				result = true;
+			}
+		}
+
+		UnmapViewOfFile(view);
+		return result;
+	}
+}
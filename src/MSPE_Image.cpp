@@ -0,0 +1,190 @@
+﻿#include "pch.h"
+#include "MSPE.h"
+#include <memory>
+#include <mutex>
+#include <algorithm>	// min
+
+
+namespace MSPE
+{
+	static std::unique_ptr<Image> s_image;
+	static std::mutex s_imageMutex;
+	static std::uint32_t s_serial = 0;
+
+
+	const Image& Image::Get()
+	{
+		std::lock_guard<std::mutex> lock(s_imageMutex);
+		uintptr_t base = Module::base();
+		if (!s_image || s_image->_base != base) {
+			s_image.reset(new Image());
+			s_image->_serial = ++s_serial;
+			if (base && !s_image->Load(base)) {
+				_plugin_logprintf("cannot read the module image: %p\n", (PVOID)base);
+				s_image->_data.clear();
+			}
+		}
+		return *s_image;
+	}
+
+
+	void Image::Release()
+	{
+		std::lock_guard<std::mutex> lock(s_imageMutex);
+		s_image.reset();
+	}
+
+
+	bool Image::IsLoaded()
+	{
+		std::lock_guard<std::mutex> lock(s_imageMutex);
+		return s_image && s_image->_base == Module::base();
+	}
+
+
+	std::unique_ptr<const Image> Image::Snapshot(uintptr_t a_base)
+	{
+		// the serial is left at 0, tables are only built for the main module
+		std::unique_ptr<Image> image(new Image());
+		if (!image->Load(a_base)) {
+			_plugin_logprintf("cannot read the module image: %p\n", (PVOID)a_base);
+			image->_data.clear();
+		}
+		return image;
+	}
+
+
+	const IMAGE_NT_HEADERS* Image::nt_headers() const
+	{
+		auto dos = ptr<IMAGE_DOS_HEADER>(0);
+		if (!dos || dos->e_magic != IMAGE_DOS_SIGNATURE) {
+			return nullptr;
+		}
+		auto nt = ptr<IMAGE_NT_HEADERS>(dos->e_lfanew);
+		if (!nt || nt->Signature != IMAGE_NT_SIGNATURE || nt->OptionalHeader.Magic != IMAGE_NT_OPTIONAL_HDR_MAGIC) {
+			return nullptr;
+		}
+		return nt;
+	}
+
+
+	IMAGE_DATA_DIRECTORY Image::directory(int a_index) const
+	{
+		IMAGE_DATA_DIRECTORY dir = { 0, 0 };
+		auto nt = nt_headers();
+		if (nt && a_index < nt->OptionalHeader.NumberOfRvaAndSizes) {
+			dir = nt->OptionalHeader.DataDirectory[a_index];
+			if (!contains(dir.VirtualAddress, dir.Size)) {
+				dir.VirtualAddress = 0;
+				dir.Size = 0;
+			}
+		}
+		return dir;
+	}
+
+
+	ArrayView<IMAGE_SECTION_HEADER> Image::sections() const
+	{
+		auto nt = nt_headers();
+		if (!nt) {
+			return ArrayView<IMAGE_SECTION_HEADER>();
+		}
+
+		auto* first = IMAGE_FIRST_SECTION(nt);
+		size_t count = nt->FileHeader.NumberOfSections;
+		std::uint32_t rva = static_cast<std::uint32_t>(reinterpret_cast<const std::uint8_t*>(first) - data());
+		if (!contains(rva, count * sizeof(IMAGE_SECTION_HEADER))) {
+			return ArrayView<IMAGE_SECTION_HEADER>();
+		}
+		return ArrayView<IMAGE_SECTION_HEADER>(first, count);
+	}
+
+
+	const IMAGE_SECTION_HEADER* Image::section(const char* a_name) const
+	{
+		auto length = std::min<size_t>(std::strlen(a_name) + 1, IMAGE_SIZEOF_SHORT_NAME);
+		for (auto& elem : sections()) {
+			if (std::memcmp(elem.Name, a_name, length) == 0) {
+				return &elem;
+			}
+		}
+		return nullptr;
+	}
+
+
+	std::vector<const IMAGE_SECTION_HEADER*> Image::code_sections() const
+	{
+		std::vector<const IMAGE_SECTION_HEADER*> result;
+		for (auto& elem : sections()) {
+			if ((elem.Characteristics & IMAGE_SCN_MEM_EXECUTE) && elem.VirtualAddress < size()) {
+				result.push_back(&elem);
+			}
+		}
+		return result;
+	}
+
+
+	std::string_view Image::string(std::uint32_t a_rva) const
+	{
+		if (!contains(a_rva)) {
+			return std::string_view();
+		}
+		auto* first = reinterpret_cast<const char*>(data() + a_rva);
+		auto* last = static_cast<const char*>(std::memchr(first, '\0', size() - a_rva));
+		return last ? std::string_view(first, last - first) : std::string_view();
+	}
+
+
+	bool Image::Load(uintptr_t a_base)
+	{
+		_base = a_base;
+
+		//
+		// headers
+		//
+		IMAGE_DOS_HEADER dos;
+		duint sizeRead = 0;
+		if (!Script::Memory::Read(a_base, &dos, sizeof(dos), &sizeRead) || dos.e_magic != IMAGE_DOS_SIGNATURE) {
+			return false;
+		}
+		IMAGE_NT_HEADERS nt;
+		if (!Script::Memory::Read(a_base + dos.e_lfanew, &nt, sizeof(nt), &sizeRead) || nt.Signature != IMAGE_NT_SIGNATURE) {
+			return false;
+		}
+
+		size_t imageSize = nt.OptionalHeader.SizeOfImage;
+		size_t headerSize = std::min<size_t>(nt.OptionalHeader.SizeOfHeaders, imageSize);
+		_data.assign(imageSize, 0);
+		if (!Script::Memory::Read(a_base, _data.data(), headerSize, &sizeRead)) {
+			return false;
+		}
+
+		auto* headers = nt_headers();
+		if (!headers) {
+			return false;
+		}
+
+		//
+		// sections
+		//
+		auto headerView = sections();
+		if (headerView.empty()) {
+			return false;
+		}
+		std::vector<IMAGE_SECTION_HEADER> sectionHeaders(headerView.begin(), headerView.end());
+
+		for (auto& elem : sectionHeaders) {
+			size_t rva = elem.VirtualAddress;
+			size_t size = elem.Misc.VirtualSize ? elem.Misc.VirtualSize : elem.SizeOfRawData;
+			if (rva >= imageSize) {
+				continue;
+			}
+			size = std::min<size_t>(size, imageSize - rva);
+			if (!Script::Memory::Read(a_base + rva, _data.data() + rva, size, &sizeRead)) {
+				_plugin_logprintf("section read error: %.8s\n", elem.Name);
+			}
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,161 @@
+﻿#include "pch.h"
+#include "MSPE.h"
+#include "MSPE_Decode.h"
+#include "Util.h"
+#include <memory>
+#include <mutex>
+#include <algorithm>	// sort, min
+#include <cctype>		// tolower
+
+
+namespace MSPE
+{
+	static std::unique_ptr<ImportTable> s_importTable;
+	static std::mutex s_importTableMutex;
+
+	// functions decoded by one task of the parallel build
+	static constexpr size_t kFunctionsPerTask = 256;
+
+
+	const ImportTable& ImportTable::Get()
+	{
+		std::lock_guard<std::mutex> lock(s_importTableMutex);
+		auto& functions = FunctionTable::Get();
+		auto& image = Image::Get();
+		if (!s_importTable || s_importTable->_serial != image.serial()) {
+			s_importTable.reset(new ImportTable());
+			s_importTable->Build(image);
+			s_importTable->BuildCallSites(image, functions);
+		}
+		return *s_importTable;
+	}
+
+
+	std::string ImportTable::Normalize(const std::string& a_name)
+	{
+		std::string result = a_name;
+		auto pos = result.find('!');
+		if (pos == std::string::npos) {
+			pos = result.size();
+		}
+		std::transform(result.begin(), result.begin() + pos, result.begin(), [](char c) -> char {
+			return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+		});
+		return result;
+	}
+
+
+	size_t ImportTable::Find(const std::string& a_name) const
+	{
+		auto it = _nameIndex.find(Normalize(a_name));
+		return it != _nameIndex.end() ? it->second : npos;
+	}
+
+
+	size_t ImportTable::FindSlot(std::uint32_t a_slot) const
+	{
+		auto it = _slotIndex.find(a_slot);
+		return it != _slotIndex.end() ? it->second : npos;
+	}
+
+
+	void ImportTable::Build(const Image& a_image)
+	{
+		_serial = a_image.serial();
+
+		auto dir = a_image.directory(IMAGE_DIRECTORY_ENTRY_IMPORT);
+		std::uint32_t end = dir.VirtualAddress + dir.Size;
+		for (std::uint32_t rva = dir.VirtualAddress; rva + sizeof(IMAGE_IMPORT_DESCRIPTOR) <= end; rva += sizeof(IMAGE_IMPORT_DESCRIPTOR)) {
+			auto* desc = a_image.ptr<IMAGE_IMPORT_DESCRIPTOR>(rva);
+			if (!desc || desc->Name == 0 || desc->FirstThunk == 0) {
+				break;
+			}
+
+			std::string dllName(a_image.string(desc->Name));
+			std::transform(dllName.begin(), dllName.end(), dllName.begin(), [](char c) -> char {
+				return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+			});
+
+			// the loader overwrites the IAT with addresses, so names come from the INT
+			std::uint32_t lookup = desc->OriginalFirstThunk ? desc->OriginalFirstThunk : desc->FirstThunk;
+			for (std::uint32_t i = 0;; ++i) {
+				auto* thunk = a_image.ptr<ULONG_PTR>(lookup + i * sizeof(ULONG_PTR));
+				if (!thunk || *thunk == 0) {
+					break;
+				}
+
+				std::string name = dllName + "!";
+				if (*thunk & IMAGE_ORDINAL_FLAG) {
+					name += "#" + std::to_string(IMAGE_ORDINAL(*thunk));
+				}
+				else {
+					std::string_view funcName;
+					if (desc->OriginalFirstThunk && *thunk < a_image.size()) {
+						funcName = a_image.string(static_cast<std::uint32_t>(*thunk + offsetof(IMAGE_IMPORT_BY_NAME, Name)));
+					}
+					if (funcName.empty()) {
+						name += "#" + std::to_string(i);
+					}
+					else {
+						name += funcName;
+					}
+				}
+
+				std::uint32_t slot = desc->FirstThunk + i * sizeof(ULONG_PTR);
+				auto idx = static_cast<std::uint32_t>(_imports.size());
+				_imports.push_back({ slot, name });
+				_slotIndex.emplace(slot, idx);
+				_nameIndex.emplace(name, idx);
+			}
+		}
+	}
+
+
+	// decodes [a_begin, a_end) and appends every call/jmp qword ptr [rip+disp32] through an IAT slot as (import index, rva)
+	static void CollectCallSites(const Image& a_image, const std::unordered_map<std::uint32_t, std::uint32_t>& a_slotIndex,
+		std::uint32_t a_begin, std::uint32_t a_end, std::vector<std::pair<std::uint32_t, std::uint32_t>>& a_out)
+	{
+		Decode(a_image, a_begin, a_end, [&](const _DInst& di) {
+			int flow = META_GET_FC(di.meta);
+			const _Operand& op = di.ops[0];
+			if ((flow != FC_CALL && flow != FC_UNC_BRANCH) || op.type != O_SMEM || op.index != R_RIP) {
+				return;
+			}
+			auto it = a_slotIndex.find(static_cast<std::uint32_t>(INSTRUCTION_GET_RIP_TARGET(&di)));
+			if (it != a_slotIndex.end()) {
+				a_out.emplace_back(it->second, static_cast<std::uint32_t>(di.addr));
+			}
+		});
+	}
+
+
+	void ImportTable::BuildCallSites(const Image& a_image, const FunctionTable& a_functions)
+	{
+		// decode function by function, so that data, padding and the operands of other instructions are not mistaken for calls
+		size_t taskCount = (a_functions.size() + kFunctionsPerTask - 1) / kFunctionsPerTask;
+		std::vector<std::vector<std::pair<std::uint32_t, std::uint32_t>>> partial(taskCount);
+		Util::ParallelFor(taskCount, [&](size_t a_task) {
+			size_t first = a_task * kFunctionsPerTask;
+			size_t last = std::min<size_t>(first + kFunctionsPerTask, a_functions.size());
+			for (size_t i = first; i < last; ++i) {
+				CollectCallSites(a_image, _slotIndex, a_functions[i].begin, a_functions[i].end, partial[a_task]);
+			}
+		});
+
+		std::vector<std::pair<std::uint32_t, std::uint32_t>> sites;		// (import index, rva)
+		for (auto& elem : partial) {
+			sites.insert(sites.end(), elem.begin(), elem.end());
+		}
+		std::sort(sites.begin(), sites.end());
+
+		_siteOffsets.assign(_imports.size() + 1, 0);
+		_sites.resize(sites.size());
+		for (size_t i = 0; i < sites.size(); ++i) {
+			_siteOffsets[sites[i].first + 1]++;
+			_sites[i] = sites[i].second;
+		}
+		for (size_t i = 0; i < _imports.size(); ++i) {
+			_siteOffsets[i + 1] += _siteOffsets[i];
+		}
+	}
+}
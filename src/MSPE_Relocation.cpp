@@ -0,0 +1,88 @@
+﻿#include "pch.h"
+#include "MSPE.h"
+#include <memory>
+#include <mutex>
+
+
+namespace MSPE
+{
+	static std::unique_ptr<RelocationTable> s_relocationTable;
+	static std::mutex s_relocationTableMutex;
+
+
+	const RelocationTable& RelocationTable::Get()
+	{
+		std::lock_guard<std::mutex> lock(s_relocationTableMutex);
+		auto& image = Image::Get();
+		if (!s_relocationTable || s_relocationTable->_serial != image.serial()) {
+			s_relocationTable.reset(new RelocationTable());
+			s_relocationTable->Build(image);
+		}
+		return *s_relocationTable;
+	}
+
+
+	bool RelocationTable::contains(std::uint32_t a_rva, size_t a_size) const
+	{
+		for (size_t i = 0; i < a_size; ++i) {
+			if (contains(static_cast<std::uint32_t>(a_rva + i))) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+
+	void RelocationTable::Set(std::uint32_t a_rva, size_t a_size)
+	{
+		for (size_t i = 0; i < a_size; ++i) {
+			size_t rva = a_rva + i;
+			size_t word = rva >> 6;
+			if (word >= _bits.size()) {
+				break;
+			}
+			_bits[word] |= std::uint64_t(1) << (rva & 63);
+		}
+	}
+
+
+	void RelocationTable::Build(const Image& a_image)
+	{
+		_serial = a_image.serial();
+		_bits.assign((a_image.size() + 63) >> 6, 0);
+
+		auto dir = a_image.directory(IMAGE_DIRECTORY_ENTRY_BASERELOC);
+		std::uint32_t rva = dir.VirtualAddress;
+		std::uint32_t end = dir.VirtualAddress + dir.Size;
+
+		while (rva + sizeof(IMAGE_BASE_RELOCATION) <= end) {
+			auto* block = a_image.ptr<IMAGE_BASE_RELOCATION>(rva);
+			if (!block || block->SizeOfBlock < sizeof(IMAGE_BASE_RELOCATION) || rva + block->SizeOfBlock > end) {
+				break;
+			}
+
+			size_t count = (block->SizeOfBlock - sizeof(IMAGE_BASE_RELOCATION)) / sizeof(std::uint16_t);
+			auto* entries = a_image.ptr<std::uint16_t>(rva + sizeof(IMAGE_BASE_RELOCATION), count * sizeof(std::uint16_t));
+			for (size_t i = 0; entries && i < count; ++i) {
+				std::uint16_t type = entries[i] >> 12;
+				std::uint32_t target = block->VirtualAddress + (entries[i] & 0x0FFF);
+				switch (type) {
+				case IMAGE_REL_BASED_ABSOLUTE:		// padding
+					break;
+				case IMAGE_REL_BASED_HIGHLOW:
+					Set(target, 4);
+					_count++;
+					break;
+				case IMAGE_REL_BASED_DIR64:
+					Set(target, 8);
+					_count++;
+					break;
+				default:
+					break;
+				}
+			}
+
+			rva += block->SizeOfBlock;
+		}
+	}
+}
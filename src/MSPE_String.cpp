@@ -0,0 +1,271 @@
+﻿#include "pch.h"
+#include "MSPE.h"
+#include "Util.h"
+#include <memory>
+#include <mutex>
+#include <algorithm>	// merge, lower_bound, sort, min
+#include <cstring>		// memcmp
+#include <emmintrin.h>
+
+
+namespace MSPE
+{
+	static std::unique_ptr<StringTable> s_stringTable;
+	static std::mutex s_stringTableMutex;
+
+
+	const StringTable& StringTable::Get()
+	{
+		std::lock_guard<std::mutex> lock(s_stringTableMutex);
+		auto& image = Image::Get();
+		if (!s_stringTable || s_stringTable->_serial != image.serial()) {
+			s_stringTable.reset(new StringTable());
+			s_stringTable->Build(image);
+		}
+		return *s_stringTable;
+	}
+
+
+	// FNV-1a over the characters, so that ASCII and UTF-16 literals of the same text hash alike
+	template <class Char>
+	static std::uint64_t HashChars(const Char* a_text, size_t a_length)
+	{
+		std::uint64_t hash = 0xCBF29CE484222325ull;
+		for (size_t i = 0; i < a_length; ++i) {
+			hash ^= static_cast<std::uint8_t>(a_text[i]);
+			hash *= 0x100000001B3ull;
+		}
+		return hash;
+	}
+
+
+	std::uint64_t StringTable::HashText(const std::string& a_text)
+	{
+		return HashChars(a_text.data(), a_text.size());
+	}
+
+
+	size_t StringTable::Find(std::uint32_t a_rva) const
+	{
+		auto it = std::lower_bound(_literals.begin(), _literals.end(), a_rva, [](const Literal& a_literal, std::uint32_t a_rva) -> bool {
+			return a_literal.rva < a_rva;
+		});
+		return it != _literals.end() && it->rva == a_rva ? it - _literals.begin() : npos;
+	}
+
+
+	std::vector<std::uint32_t> StringTable::Find(const Image& a_image, const std::string& a_text) const
+	{
+		std::vector<std::uint32_t> result;
+		if (a_text.size() < kMinLength) {
+			return result;
+		}
+
+		auto range = _index.equal_range(HashText(a_text));
+		for (auto it = range.first; it != range.second; ++it) {
+			const Literal& literal = _literals[it->second];
+			if (literal.length != a_text.size()) {
+				continue;
+			}
+			const std::uint8_t* data = a_image.data() + literal.rva;
+			if (!literal.wide) {
+				if (std::memcmp(data, a_text.data(), a_text.size()) == 0) {
+					result.push_back(literal.rva);
+				}
+				continue;
+			}
+			auto* chars = reinterpret_cast<const std::uint16_t*>(data);
+			size_t i = 0;
+			while (i < a_text.size() && chars[i] == static_cast<std::uint8_t>(a_text[i])) {
+				++i;
+			}
+			if (i == a_text.size()) {
+				result.push_back(literal.rva);
+			}
+		}
+		std::sort(result.begin(), result.end());
+		return result;
+	}
+
+
+	std::string StringTable::Text(const Image& a_image, size_t a_idx) const
+	{
+		const Literal& literal = _literals[a_idx];
+		const std::uint8_t* data = a_image.data() + literal.rva;
+		if (!literal.wide) {
+			return std::string(reinterpret_cast<const char*>(data), literal.length);
+		}
+		auto* chars = reinterpret_cast<const std::uint16_t*>(data);
+		std::string text(literal.length, '\0');
+		for (size_t i = 0; i < literal.length; ++i) {
+			text[i] = static_cast<char>(chars[i]);
+		}
+		return text;
+	}
+
+
+	// tab, line feeds and 0x20-0x7E
+	static inline bool IsPrintable(std::uint32_t a_char)
+	{
+		return (a_char >= 0x20 && a_char < 0x7F) || a_char == '\t' || a_char == '\n' || a_char == '\r';
+	}
+
+
+	// turns blocks of classified characters into literals: a run of printable characters closed by a terminator
+	class RunCollector
+	{
+	public:
+		RunCollector(std::uint32_t a_rva, bool a_wide, std::vector<StringTable::Literal>& a_out) :
+			_rva(a_rva), _wide(a_wide), _out(a_out)
+		{}
+
+		// a_printable and a_terminator have one bit per character of the block starting at character a_pos
+		void Block(size_t a_pos, std::uint32_t a_printable, std::uint32_t a_terminator, size_t a_count)
+		{
+			const std::uint32_t full = (1u << a_count) - 1;
+			if (a_printable == full) {
+				if (_start == kNone) {
+					_start = a_pos;
+				}
+				return;
+			}
+
+			for (size_t i = 0; i < a_count; ++i) {
+				if ((a_printable >> i) & 1) {
+					if (_start == kNone) {
+						_start = a_pos + i;
+					}
+					continue;
+				}
+				if (((a_terminator >> i) & 1) && _start != kNone && a_pos + i - _start >= StringTable::kMinLength) {
+					size_t scale = _wide ? 2 : 1;
+					_out.push_back({ static_cast<std::uint32_t>(_rva + _start * scale), static_cast<std::uint32_t>(a_pos + i - _start), _wide });
+				}
+				_start = kNone;
+
+				// nothing printable is left in this block
+				if (i + 1 >= a_count || (a_printable >> (i + 1)) == 0) {
+					return;
+				}
+			}
+		}
+
+	private:
+		static constexpr size_t kNone = static_cast<size_t>(-1);
+
+		std::uint32_t						_rva;
+		bool								_wide;
+		std::vector<StringTable::Literal>&	_out;
+		size_t								_start = kNone;		// first character of the current run
+	};
+
+
+	// byte strings
+	static void ScanNarrow(const std::uint8_t* a_data, size_t a_size, std::uint32_t a_rva, std::vector<StringTable::Literal>& a_out)
+	{
+		RunCollector runs(a_rva, false, a_out);
+
+		// bytes 0x80-0xFF are negative, so the signed compares drop them along with the control characters
+		const __m128i low = _mm_set1_epi8(0x1F);
+		const __m128i high = _mm_set1_epi8(0x7F);
+		const __m128i tab = _mm_set1_epi8('\t');
+		const __m128i lf = _mm_set1_epi8('\n');
+		const __m128i cr = _mm_set1_epi8('\r');
+		const __m128i zero = _mm_setzero_si128();
+
+		size_t pos = 0;
+		for (; pos + 16 <= a_size; pos += 16) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a_data + pos));
+			__m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, low), _mm_cmplt_epi8(v, high));
+			printable = _mm_or_si128(printable, _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr))));
+			runs.Block(pos, _mm_movemask_epi8(printable), _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)), 16);
+		}
+
+		std::uint32_t printable = 0;
+		std::uint32_t terminator = 0;
+		for (size_t i = 0; pos + i < a_size; ++i) {
+			printable |= IsPrintable(a_data[pos + i]) << i;
+			terminator |= (a_data[pos + i] == 0) << i;
+		}
+		if (pos < a_size) {
+			runs.Block(pos, printable, terminator, a_size - pos);
+		}
+	}
+
+
+	// UTF-16LE strings of ASCII characters at 2-byte boundaries (a_size is in characters)
+	static void ScanWide(const std::uint16_t* a_data, size_t a_size, std::uint32_t a_rva, std::vector<StringTable::Literal>& a_out)
+	{
+		RunCollector runs(a_rva, true, a_out);
+
+		// characters 0x8000-0xFFFF are negative as well
+		const __m128i low = _mm_set1_epi16(0x1F);
+		const __m128i high = _mm_set1_epi16(0x7F);
+		const __m128i tab = _mm_set1_epi16('\t');
+		const __m128i lf = _mm_set1_epi16('\n');
+		const __m128i cr = _mm_set1_epi16('\r');
+		const __m128i zero = _mm_setzero_si128();
+
+		size_t pos = 0;
+		for (; pos + 8 <= a_size; pos += 8) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a_data + pos));
+			__m128i printable = _mm_and_si128(_mm_cmpgt_epi16(v, low), _mm_cmplt_epi16(v, high));
+			printable = _mm_or_si128(printable, _mm_or_si128(_mm_cmpeq_epi16(v, tab), _mm_or_si128(_mm_cmpeq_epi16(v, lf), _mm_cmpeq_epi16(v, cr))));
+			// packing the 16-bit masks to bytes leaves one bit per character
+			__m128i masks = _mm_packs_epi16(printable, _mm_cmpeq_epi16(v, zero));
+			std::uint32_t bits = _mm_movemask_epi8(masks);
+			runs.Block(pos, bits & 0xFF, bits >> 8, 8);
+		}
+
+		std::uint32_t printable = 0;
+		std::uint32_t terminator = 0;
+		for (size_t i = 0; pos + i < a_size; ++i) {
+			printable |= IsPrintable(a_data[pos + i]) << i;
+			terminator |= (a_data[pos + i] == 0) << i;
+		}
+		if (pos < a_size) {
+			runs.Block(pos, printable, terminator, a_size - pos);
+		}
+	}
+
+
+	void StringTable::Build(const Image& a_image)
+	{
+		_serial = a_image.serial();
+
+		auto* section = a_image.section(".rdata");
+		if (!section || section->VirtualAddress >= a_image.size()) {
+			return;
+		}
+		std::uint32_t rva = section->VirtualAddress;
+		size_t size = std::min<size_t>(section->Misc.VirtualSize ? section->Misc.VirtualSize : section->SizeOfRawData, a_image.size() - rva);
+		const std::uint8_t* data = a_image.data() + rva;
+
+		// the two passes are independent, and the section starts at a page boundary so UTF-16 is aligned
+		std::vector<Literal> narrow;
+		std::vector<Literal> wide;
+		Util::ParallelFor(2, [&](size_t a_pass) {
+			if (a_pass == 0) {
+				ScanNarrow(data, size, rva, narrow);
+			}
+			else {
+				ScanWide(reinterpret_cast<const std::uint16_t*>(data), size / 2, rva, wide);
+			}
+		});
+
+		_literals.resize(narrow.size() + wide.size());
+		std::merge(narrow.begin(), narrow.end(), wide.begin(), wide.end(), _literals.begin(), [](const Literal& a_lhs, const Literal& a_rhs) -> bool {
+			return a_lhs.rva < a_rhs.rva;
+		});
+
+		_index.reserve(_literals.size());
+		for (size_t i = 0; i < _literals.size(); ++i) {
+			const Literal& literal = _literals[i];
+			const std::uint8_t* text = a_image.data() + literal.rva;
+			std::uint64_t hash = literal.wide
+				? HashChars(reinterpret_cast<const std::uint16_t*>(text), literal.length)
+				: HashChars(reinterpret_cast<const char*>(text), literal.length);
+			_index.emplace(hash, static_cast<std::uint32_t>(i));
+		}
+	}
+}
@@ -0,0 +1,247 @@
+﻿#include "pch.h"
+#include "MSPE.h"
+#include "MSPE_Decode.h"
+#include "Util.h"
+#include "pluginsdk/lz4/lz4.h"
+#include <memory>
+#include <mutex>
+#include <algorithm>	// sort, lower_bound
+#include <cstring>		// memcpy
+
+
+namespace MSPE
+{
+	static std::unique_ptr<XrefTable> s_xrefTable;
+	static std::mutex s_xrefTableMutex;
+
+	// functions decoded by one task of the parallel build
+	static constexpr size_t kFunctionsPerTask = 256;
+
+
+	struct XrefFileHeader
+	{
+		static constexpr std::uint32_t kMagic = 0x46525853;		// "SXRF"
+		static constexpr std::uint32_t kVersion = 1;
+
+		std::uint32_t	magic;
+		std::uint32_t	version;
+		std::uint32_t	count;				// number of xrefs
+		std::uint32_t	compressedSize;		// lz4 block that follows
+	};
+	// the block holds count source deltas, count targets and count kinds, in this order
+
+
+	const XrefTable& XrefTable::Get()
+	{
+		std::lock_guard<std::mutex> lock(s_xrefTableMutex);
+		auto& image = Image::Get();
+		if (!s_xrefTable || s_xrefTable->_serial != image.serial()) {
+			s_xrefTable.reset(new XrefTable());
+			s_xrefTable->_serial = image.serial();
+
+			std::string path = Identity::Get().cache_path(".xref");
+			if (path.empty() || !s_xrefTable->Load(path)) {
+				s_xrefTable->Build(image, FunctionTable::Get());
+				if (!path.empty() && !s_xrefTable->Save(path)) {
+					_plugin_logprintf("cannot write the xref cache: \"%s\"\n", path.c_str());
+				}
+			}
+			s_xrefTable->BuildTargetIndex();
+		}
+		return *s_xrefTable;
+	}
+
+
+	ArrayView<XrefTable::Xref> XrefTable::From(std::uint32_t a_first, std::uint32_t a_last) const
+	{
+		auto less = [](const Xref& a_xref, std::uint32_t a_rva) -> bool {
+			return a_xref.from < a_rva;
+		};
+		auto first = std::lower_bound(_xrefs.begin(), _xrefs.end(), a_first, less);
+		auto last = std::lower_bound(first, _xrefs.end(), a_last, less);
+		return ArrayView<Xref>(_xrefs.data() + (first - _xrefs.begin()), _xrefs.data() + (last - _xrefs.begin()));
+	}
+
+
+	ArrayView<std::uint32_t> XrefTable::To(std::uint32_t a_rva) const
+	{
+		auto first = std::lower_bound(_byTarget.begin(), _byTarget.end(), a_rva, [this](std::uint32_t a_idx, std::uint32_t a_rva) -> bool {
+			return _xrefs[a_idx].to < a_rva;
+		});
+		auto last = std::upper_bound(first, _byTarget.end(), a_rva, [this](std::uint32_t a_rva, std::uint32_t a_idx) -> bool {
+			return a_rva < _xrefs[a_idx].to;
+		});
+		return ArrayView<std::uint32_t>(_byTarget.data() + (first - _byTarget.begin()), _byTarget.data() + (last - _byTarget.begin()));
+	}
+
+
+	// decodes [a_begin, a_end) and appends the references to a_out
+	static void DecodeRange(const Image& a_image, std::uint32_t a_begin, std::uint32_t a_end, std::vector<XrefTable::Xref>& a_out)
+	{
+		Decode(a_image, a_begin, a_end, [&](const _DInst& di) {
+			for (unsigned int n = 0; n < OPERANDS_NO; ++n) {
+				const _Operand& op = di.ops[n];
+				std::uint64_t target;
+				XrefTable::Kind kind;
+				if (op.type == O_PC) {
+					target = INSTRUCTION_GET_TARGET(&di);
+					kind = META_GET_FC(di.meta) == FC_CALL ? XrefTable::Kind::kCall : XrefTable::Kind::kJump;
+				}
+				else if (op.type == O_SMEM && op.index == R_RIP) {
+					target = INSTRUCTION_GET_RIP_TARGET(&di);
+					kind = XrefTable::Kind::kData;
+				}
+				else {
+					continue;
+				}
+				if (target < a_image.size()) {
+					a_out.push_back({ static_cast<std::uint32_t>(di.addr), static_cast<std::uint32_t>(target), kind });
+				}
+			}
+		});
+	}
+
+
+	void XrefTable::Build(const Image& a_image, const FunctionTable& a_functions)
+	{
+		_xrefs.clear();
+
+		// decode function by function, so that data and padding between functions are not mistaken for code
+		size_t taskCount = (a_functions.size() + kFunctionsPerTask - 1) / kFunctionsPerTask;
+		std::vector<std::vector<Xref>> partial(taskCount);
+		Util::ParallelFor(taskCount, [&](size_t a_task) {
+			size_t first = a_task * kFunctionsPerTask;
+			size_t last = std::min<size_t>(first + kFunctionsPerTask, a_functions.size());
+			for (size_t i = first; i < last; ++i) {
+				DecodeRange(a_image, a_functions[i].begin, a_functions[i].end, partial[a_task]);
+			}
+		});
+
+		size_t total = 0;
+		for (auto& elem : partial) {
+			total += elem.size();
+		}
+		_xrefs.reserve(total);
+		for (auto& elem : partial) {
+			_xrefs.insert(_xrefs.end(), elem.begin(), elem.end());
+		}
+
+		// the function table is sorted and the entries do not overlap, but sort anyway
+		std::sort(_xrefs.begin(), _xrefs.end(), [](const Xref& a, const Xref& b) -> bool {
+			return a.from != b.from ? a.from < b.from : a.to < b.to;
+		});
+	}
+
+
+	void XrefTable::BuildTargetIndex()
+	{
+		_byTarget.resize(_xrefs.size());
+		for (size_t i = 0; i < _xrefs.size(); ++i) {
+			_byTarget[i] = static_cast<std::uint32_t>(i);
+		}
+		// _xrefs is sorted by source, so a stable sort keeps the sources in order for each target
+		std::stable_sort(_byTarget.begin(), _byTarget.end(), [this](std::uint32_t a, std::uint32_t b) -> bool {
+			return _xrefs[a].to < _xrefs[b].to;
+		});
+	}
+
+
+	bool XrefTable::Load(const std::string& a_path)
+	{
+		FILE* fp = nullptr;
+		if (fopen_s(&fp, a_path.c_str(), "rb") != 0 || !fp) {
+			return false;
+		}
+
+		XrefFileHeader header = {};
+		std::vector<char> compressed;
+		bool succeeded = fread(&header, sizeof(header), 1, fp) == 1
+			&& header.magic == XrefFileHeader::kMagic
+			&& header.version == XrefFileHeader::kVersion
+			&& header.count < 0x10000000
+			&& header.compressedSize < 0x7FFFFFFF;
+		if (succeeded) {
+			compressed.resize(header.compressedSize);
+			succeeded = fread(compressed.data(), 1, compressed.size(), fp) == compressed.size();
+		}
+		fclose(fp);
+		if (!succeeded) {
+			return false;
+		}
+
+		size_t count = header.count;
+		size_t rawSize = count * (sizeof(std::uint32_t) * 2 + sizeof(Kind));
+		if (rawSize > 0x7FFFFFFF) {
+			return false;
+		}
+		std::vector<char> raw(rawSize);
+		if (LZ4_decompress_safe(compressed.data(), raw.data(), static_cast<int>(compressed.size()), static_cast<int>(rawSize)) != static_cast<int>(rawSize)) {
+			return false;
+		}
+
+		const char* deltas = raw.data();
+		const char* targets = deltas + count * sizeof(std::uint32_t);
+		const char* kinds = targets + count * sizeof(std::uint32_t);
+		_xrefs.resize(count);
+		std::uint32_t from = 0;
+		for (size_t i = 0; i < count; ++i) {
+			std::uint32_t delta;
+			std::memcpy(&delta, deltas + i * sizeof(delta), sizeof(delta));
+			from += delta;
+			_xrefs[i].from = from;
+			std::memcpy(&_xrefs[i].to, targets + i * sizeof(std::uint32_t), sizeof(std::uint32_t));
+			_xrefs[i].kind = static_cast<Kind>(kinds[i]);
+			if (_xrefs[i].kind > Kind::kData) {
+				_xrefs.clear();
+				return false;
+			}
+		}
+		return true;
+	}
+
+
+	bool XrefTable::Save(const std::string& a_path) const
+	{
+		// the sources are sorted, so they are stored as deltas which compress well
+		size_t count = _xrefs.size();
+		std::vector<char> raw(count * (sizeof(std::uint32_t) * 2 + sizeof(Kind)));
+		char* deltas = raw.data();
+		char* targets = deltas + count * sizeof(std::uint32_t);
+		char* kinds = targets + count * sizeof(std::uint32_t);
+		std::uint32_t prev = 0;
+		for (size_t i = 0; i < count; ++i) {
+			std::uint32_t delta = _xrefs[i].from - prev;
+			prev = _xrefs[i].from;
+			std::memcpy(deltas + i * sizeof(delta), &delta, sizeof(delta));
+			std::memcpy(targets + i * sizeof(std::uint32_t), &_xrefs[i].to, sizeof(std::uint32_t));
+			kinds[i] = static_cast<char>(_xrefs[i].kind);
+		}
+
+		std::vector<char> compressed(LZ4_compressBound(static_cast<int>(raw.size())));
+		int size = LZ4_compress(raw.data(), compressed.data(), static_cast<int>(raw.size()));
+		if (size <= 0 && raw.size() != 0) {
+			return false;
+		}
+
+		XrefFileHeader header = {};
+		header.magic = XrefFileHeader::kMagic;
+		header.version = XrefFileHeader::kVersion;
+		header.count = static_cast<std::uint32_t>(count);
+		header.compressedSize = static_cast<std::uint32_t>(std::max<int>(size, 0));
+
+		// write to a temporary file and replace, so that a crash never leaves a truncated cache
+		std::string temp = a_path + ".tmp";
+		FILE* fp = nullptr;
+		if (fopen_s(&fp, temp.c_str(), "wb") != 0 || !fp) {
+			return false;
+		}
+		bool succeeded = fwrite(&header, sizeof(header), 1, fp) == 1
+			&& fwrite(compressed.data(), 1, header.compressedSize, fp) == header.compressedSize;
+		succeeded = fclose(fp) == 0 && succeeded;
+		if (!succeeded) {
+			DeleteFileA(temp.c_str());
+			return false;
+		}
+		return Util::CommitFile(temp, a_path.c_str());
+	}
+}
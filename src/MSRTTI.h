@@ -5,9 +5,17 @@
 #include <string_view>
 #include <deque>
 
+namespace Job
+{
+	class Context;
+}
+
 namespace MSRTTI
 {
-	bool Find(std::deque<std::tuple<std::string, duint, duint>>& result);
+	// contextがあれば進み具合を知らせ、中止を求められたら途中でfalseを返す
+	bool Find(std::deque<std::tuple<std::string, duint, duint>>& result, Job::Context* context = nullptr);
+
+	// バックグラウンドのジョブでFindし、終わったらリファレンスビューに表示する
 	void Analyse();
 
 	class RVABase;
@@ -1,6 +1,7 @@
 ﻿#include "pch.h"
 #include "MSRTTI.h"
 #include "Util.h"
+#include "Job.h"
 #include <functional>	// boyer_moore_searcher
 #include <sstream>
 #include <memory>
@@ -147,7 +148,7 @@ namespace MSRTTI
 	}
 
 
-	bool Find(std::deque<std::tuple<std::string, duint, duint>>& result)
+	bool Find(std::deque<std::tuple<std::string, duint, duint>>& result, Job::Context* context)
 	{
 		duint sizeRead;
 
@@ -186,7 +187,15 @@ namespace MSRTTI
 		//
 		// RTTI検索
 		//
+		size_t done = 0;
 		for (TypeDescriptor* typeDesc : typeDescroptors) {
+			if (context) {
+				if (context->cancelled()) {
+					return false;
+				}
+				context->Progress(++done, typeDescroptors.size());
+			}
+
 			duint typeDescOffset = (duint)typeDesc - (duint)data.get();
 			duint typeDescAddr = dataSection.base() + typeDescOffset;
 
@@ -235,8 +244,18 @@ namespace MSRTTI
 
 	void Analyse()
 	{
-		std::deque<std::tuple<std::string, duint, duint>> rttis;
-		if (MSRTTI::Find(rttis)) {
+		auto result = std::make_shared<std::deque<std::tuple<std::string, duint, duint>>>();
+		auto found = std::make_shared<bool>(false);
+
+		auto work = [result, found](Job::Context& context) -> void {
+			*found = MSRTTI::Find(*result, &context);
+		};
+
+		auto finished = [result, found](bool cancelled) -> void {
+			if (cancelled || !*found || !DbgIsDebugging()) {
+				return;
+			}
+			auto& rttis = *result;
 
 			GuiReferenceInitialize("RTTI");
 			GuiReferenceAddColumn(16, GuiTranslateText("Address"));
@@ -269,6 +288,8 @@ namespace MSRTTI
 
 			GuiReferenceSetProgress(100);
 			GuiUpdateAllViews();
-		}
+		};
+
+		Job::Start("Analyse RTTI", work, finished);
 	}
 }
\ No newline at end of file
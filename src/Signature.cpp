@@ -1,103 +1,67 @@
 ﻿#include "pch.h"
 #include "Signature.h"
+#include "SignatureStore.h"
+#include "SignatureAnchor.h"
+#include "SignatureData.h"
+#include "SignatureRelation.h"
+#include "SignatureString.h"
+#include "SignatureConstant.h"
 #include "Util.h"
 #include "CDistorm.h"
+#include "MSPE.h"
 #include <sstream>
-#include <unordered_map>
-
-static std::unordered_map<std::string, std::string> s_signatureMap;
+#include <algorithm>	// min, find
+#include <cstring>		// memchr
 
 
 namespace Signature
 {
 	bool Get(const std::string& label)
 	{
-		auto it = s_signatureMap.find(label);
-		return (it != s_signatureMap.end());
+		return Store::Get().Find(label) != Store::npos;
 	}
 
 
 	bool Get(const std::string& label, std::string& signature)
 	{
-		auto it = s_signatureMap.find(label);
-		if (it == s_signatureMap.end()) {
+		auto& store = Store::Get();
+		std::uint32_t id = store.Find(label);
+		if (id == Store::npos) {
 			return false;
 		}
 
-		signature = it->second;
+		std::string buffer;
+		signature = store.signature(id, buffer);
 		return true;
 	}
 
 
 	void Set(const std::string& label, const std::string& signature)
 	{
-		s_signatureMap.insert_or_assign(label, signature);
+		Store::Get().Set(label, signature);
 	}
 
 
 	void Remove(const std::string& label)
 	{
-		s_signatureMap.erase(label);
+		Store::Get().Remove(label);
 	}
 
 	size_t Size() {
-		return s_signatureMap.size();
+		return Store::Get().size();
 	}
 
 	void Clear()
 	{
-		s_signatureMap.clear();
+		Store::Get().Clear();
 	}
 
-
-	void ForEach(std::function<void(const std::string & label, const std::string & signature)> callback)
+	void Reserve(size_t count)
 	{
-		for (auto& kv : s_signatureMap) {
-			callback(kv.first, kv.second);
-		}
+		Store::Get().Reserve(count);
 	}
 
 
-	void Show()
-	{
-		GuiReferenceInitialize("Signatures");
-		GuiReferenceAddColumn(16, GuiTranslateText("Address"));
-		GuiReferenceAddColumn(40, GuiTranslateText("Disassembly"));
-		GuiReferenceAddColumn(50, GuiTranslateText("Label"));
-		GuiReferenceAddColumn(50, "Signature");
-		GuiReferenceSetRowCount(s_signatureMap.size());
-		GuiReferenceSetProgress(0);
-
-		int idx = 0;
-		for (auto& kv : s_signatureMap) {
-			const std::string& label = kv.first;
-			const std::string& signature = kv.second;
-			duint addr = 0;
-			if (Script::Label::FromString(label.c_str(), &addr)) {
-				char temp[32];
-				sprintf_s(temp, "%p", (PVOID)addr);
-				GuiReferenceSetCellContent(idx, 0, temp);
-
-				DISASM_INSTR inst;
-				DbgDisasmAt(addr, &inst);
-				GuiReferenceSetCellContent(idx, 1, inst.instruction);
-			}
-			else {
-				GuiReferenceSetCellContent(idx, 0, "<missing>");
-				GuiReferenceSetCellContent(idx, 1, "");
-			}
-
-			GuiReferenceSetCellContent(idx, 2, label.c_str());
-			GuiReferenceSetCellContent(idx, 3, signature.c_str());
-
-			++idx;
-		}
-
-		_plugin_logprintf("%d signature(s) listed in Reference View\n", idx);
-		GuiReferenceSetProgress(100);
-		GuiUpdateAllViews();
-	}
-
 	bool MakePatternFromSignature(const std::string& signature, std::string& pattern, size_t& index)
 	{
 		std::ostringstream oss;
@@ -122,8 +86,99 @@ namespace Signature
 		return true;
 	}
 
+	bool PatternView::Match(const std::uint8_t* data) const
+	{
+		for (size_t i = 0; i < size; ++i) {
+			if ((data[i] & mask[i]) != bytes[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool Compile(const std::string& signature, Pattern& pattern)
+	{
+		if (Anchor::IsAnchor(signature) || Data::IsData(signature) || Relation::IsRelation(signature) || String::IsString(signature)
+			|| Constant::IsConstant(signature)) {
+			return false;
+		}
+
+		std::string hex;
+		if (!MakePatternFromSignature(signature, hex, pattern.index)) {
+			return false;
+		}
+		if (hex.size() == 0 || (hex.size() & 1)) {
+			return false;
+		}
+
+		pattern.bytes.resize(hex.size() / 2);
+		pattern.mask.resize(hex.size() / 2);
+		for (size_t i = 0; i < hex.size(); ++i) {
+			char c = hex[i];
+			std::uint8_t value = 0;
+			std::uint8_t mask = 0;
+			if (c != '?') {
+				value = std::isdigit(c) ? c - '0' : (std::toupper(c) - 'A' + 10);
+				mask = 0x0F;
+			}
+			if (i & 1) {
+				pattern.bytes[i / 2] |= value;
+				pattern.mask[i / 2] |= mask;
+			}
+			else {
+				pattern.bytes[i / 2] = value << 4;
+				pattern.mask[i / 2] = mask << 4;
+			}
+		}
+
+		return pattern.index <= pattern.size();
+	}
+
+	bool Verify(const std::string& signature, duint labelAddr)
+	{
+		if (Data::IsData(signature)) {
+			return Data::Verify(signature, labelAddr);
+		}
+		if (Relation::IsRelation(signature)) {
+			return Relation::Verify(signature, labelAddr);
+		}
+		if (String::IsString(signature)) {
+			return String::Verify(signature, labelAddr);
+		}
+		if (Constant::IsConstant(signature)) {
+			return Constant::Verify(signature, labelAddr);
+		}
+
+		Pattern pattern;
+		if (!Compile(signature, pattern)) {
+			return false;
+		}
+		return Verify(pattern.view(), labelAddr);
+	}
+
+	bool Verify(const PatternView& pattern, duint labelAddr)
+	{
+		return Verify(MSPE::Image::Get(), pattern, labelAddr);
+	}
+
 	bool Find(const std::string& signature, std::vector<duint>& result, size_t max)
 	{
+		if (Anchor::IsAnchor(signature)) {
+			return Anchor::Find(signature, result, max);
+		}
+		if (Data::IsData(signature)) {
+			return Data::Find(signature, result, max);
+		}
+		if (Relation::IsRelation(signature)) {
+			return Relation::Find(signature, result, max);
+		}
+		if (String::IsString(signature)) {
+			return String::Find(signature, result, max);
+		}
+		if (Constant::IsConstant(signature)) {
+			return Constant::Find(signature, result, max);
+		}
+
 		std::string pattern;
 		size_t idx;
 
@@ -180,4 +235,172 @@ namespace Signature
 		return true;
 	}
 
+	// パターンがstartに一致したとき、Find() と同じ規則でラベルのアドレスを求める
+	// ラベルの位置が命令の途中なら、その命令のオペランドが指すアドレスをラベルとする
+	static bool LocateLabel(const MSPE::Image& image, duint start, size_t index, duint& labelAddr, size_t& errors)
+	{
+		size_t pos = index;
+		duint ptr = start;
+		for (;;) {
+			CDistorm distorm;
+			if (!image.contains_addr(ptr)) {
+				errors++;
+				return false;
+			}
+			std::uint32_t rva = image.rva(ptr);
+			if (!distorm.Decode(ptr, image.data() + rva, image.size() - rva)) {
+				// 逆アセンブル失敗
+				errors++;
+				return false;
+			}
+			size_t size = distorm.Size();
+			if (pos == 0) {
+				labelAddr = ptr;
+				return true;
+			}
+			if (pos < size) {
+				uintptr_t addr = 0;
+				if (size - distorm.ValueSize() != pos || !distorm.ContainsAddress(addr)) {
+					errors++;
+					return false;
+				}
+				labelAddr = addr;
+				return addr != 0;
+			}
+			pos -= size;
+			ptr += size;
+		}
+	}
+
+	// パターンがstartに一致し、そこからFind() と同じ規則で求めたラベルがlabelAddrならtrueを返す
+	static bool MatchAt(const MSPE::Image& image, const PatternView& pattern, duint start, duint labelAddr)
+	{
+		if (!image.contains_addr(start)) {
+			return false;
+		}
+		const std::uint8_t* data = image.ptr(image.rva(start), pattern.size);
+		if (!data || !pattern.Match(data)) {
+			return false;
+		}
+
+		duint found;
+		size_t errors = 0;
+		return LocateLabel(image, start, pattern.index, found, errors) && found == labelAddr;
+	}
+
+	bool Verify(const MSPE::Image& image, const PatternView& pattern, duint labelAddr)
+	{
+		if (pattern.size == 0) {
+			return false;
+		}
+
+		// ラベルが命令の先頭にあるシグネチャ
+		if (labelAddr >= pattern.index && MatchAt(image, pattern, labelAddr - pattern.index, labelAddr)) {
+			return true;
+		}
+
+		// ラベルが命令の途中 (オペランドの指す先) にあるシグネチャは、labelAddrを指す命令からパターンの先頭を求める
+		// メインモジュールは参照の索引から引き、ほかのモジュールのスナップショットは検索する
+		if (!image.contains_addr(labelAddr)) {
+			return false;
+		}
+		if (image.serial() == 0) {
+			std::vector<duint> result;
+			size_t errors;
+			Find(image, pattern, result, 0, errors);
+			return std::find(result.begin(), result.end(), labelAddr) != result.end();
+		}
+
+		auto& xrefs = MSPE::XrefTable::Get();
+		for (std::uint32_t idx : xrefs.To(image.rva(labelAddr))) {
+			duint from = image.base() + xrefs[idx].from;
+			std::uint32_t rva = xrefs[idx].from;
+			CDistorm distorm;
+			if (!distorm.Decode(from, image.data() + rva, image.size() - rva)) {
+				continue;
+			}
+			// Find() はオペランドの値の先頭をラベルの位置とする
+			duint value = from + distorm.Size() - distorm.ValueSize();
+			if (value >= pattern.index && MatchAt(image, pattern, value - pattern.index, labelAddr)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// imageの[rva, rva + size)からパターンを検索する。hitは見つかった数 (セクションをまたいで数える)
+	static void FindInRange(const MSPE::Image& image, std::uint32_t rva, size_t size, const PatternView& pattern,
+		std::vector<duint>& result, size_t maxResult, size_t& hit, size_t& errors)
+	{
+		const std::uint8_t* data = image.data() + rva;
+		if (pattern.size == 0 || pattern.size > size) {
+			return;
+		}
+
+		// マスクのないバイトがあれば、memchrでそのバイトを探してから比較する
+		size_t key = pattern.size;
+		for (size_t i = 0; i < pattern.size; ++i) {
+			if (pattern.mask[i] == 0xFF) {
+				key = i;
+				break;
+			}
+		}
+
+		const size_t last = size - pattern.size;
+		for (size_t pos = 0; pos <= last; ++pos) {
+			if (key != pattern.size) {
+				auto* p = static_cast<const std::uint8_t*>(std::memchr(data + pos + key, pattern.bytes[key], last - pos + 1));
+				if (!p) {
+					break;
+				}
+				pos = (p - data) - key;
+			}
+			if (!pattern.Match(data + pos)) {
+				continue;
+			}
+
+			duint labelAddr;
+			if (LocateLabel(image, image.base() + rva + pos, pattern.index, labelAddr, errors)) {
+				result.push_back(labelAddr);
+			}
+			hit++;
+			if (maxResult != 0 && hit >= maxResult) {
+				break;
+			}
+		}
+	}
+
+	bool Find(const MSPE::Image& image, const PatternView& pattern, std::vector<duint>& result, size_t maxResult, size_t& errors)
+	{
+		errors = 0;
+
+		// メインモジュールはFind(signature) と同じく.textだけを検索する (結果が検索の経路で変わらないように)
+		// ほかのモジュールのスナップショット (serialが0) は、実行できるセクションをすべて検索する
+		// (DLLにはコードを別のセクションに置くものがある)
+		std::vector<const IMAGE_SECTION_HEADER*> sections;
+		if (image.serial() != 0) {
+			if (auto* text = image.section(".text")) {
+				sections.push_back(text);
+			}
+		}
+		else {
+			sections = image.code_sections();
+		}
+		if (sections.empty()) {
+			return false;
+		}
+
+		size_t hit = 0;
+		for (auto* section : sections) {
+			std::uint32_t rva = section->VirtualAddress;
+			size_t size = std::min<size_t>(section->Misc.VirtualSize ? section->Misc.VirtualSize : section->SizeOfRawData, image.size() - rva);
+			FindInRange(image, rva, size, pattern, result, maxResult, hit, errors);
+			if (maxResult != 0 && hit >= maxResult) {
+				break;
+			}
+		}
+
+		return true;
+	}
+
 }
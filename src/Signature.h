@@ -1,9 +1,14 @@
 ﻿#pragma once
 
-#include <functional>
 #include <vector>
 
 
+namespace MSPE
+{
+	class Image;
+}
+
+
 namespace Signature
 {
 	// ラベルlabelに対応するシグネチャが見つかればtrueを返す
@@ -24,15 +29,72 @@ namespace Signature
 	// 登録されたシグネチャをすべて削除する
 	void Clear();
 
-	// 登録されたシグネチャを走査する
-	void ForEach(std::function<void(const std::string& label, const std::string& signature)> callback);
+	// シグネチャcount個分の領域を確保しておく
+	void Reserve(size_t count);
+
+	// 登録されたシグネチャの走査は SignatureStore.h の ForEach()
 
 	// シグネチャ文字列を、検索用のパターン文字列とインデックスに分解して返す
 	bool MakePatternFromSignature(const std::string& signature, std::string& pattern, size_t& index);
 
+	// コンパイル済みのシグネチャへの参照 (シグネチャデータベースのパターンを直接指す)
+	struct PatternView
+	{
+		const std::uint8_t*	bytes = nullptr;
+		const std::uint8_t*	mask = nullptr;
+		size_t				size = 0;
+		size_t				index = 0;		// ラベルの位置 (バイト単位)
+
+		// dataから始まるsizeバイトがパターンに一致すればtrueを返す
+		bool Match(const std::uint8_t* data) const;
+	};
+
+	// コンパイル済みのシグネチャ (ニブル単位のマスク付きバイト列)
+	struct Pattern
+	{
+		std::vector<std::uint8_t>	bytes;
+		std::vector<std::uint8_t>	mask;
+		size_t						index = 0;		// ラベルの位置 (バイト単位)
+
+		inline size_t size() const {
+			return bytes.size();
+		}
+
+		// dataから始まるsize()バイトがパターンに一致すればtrueを返す
+		inline bool Match(const std::uint8_t* data) const {
+			return view().Match(data);
+		}
+
+		inline PatternView view() const {
+			return PatternView{ bytes.data(), mask.data(), bytes.size(), index };
+		}
+	};
+
+	// シグネチャ文字列をパターンにコンパイルする
+	bool Compile(const std::string& signature, Pattern& pattern);
+
+	// labelAddrにラベルがあるとして、シグネチャがその位置のコードに一致すればtrueを返す
+	// ラベルがオペランドの指す先にあるシグネチャは、labelAddrを参照する命令からパターンの位置を求め、
+	// Find() と同じ規則で求めたラベルがlabelAddrになるかで確かめる
+	bool Verify(const std::string& signature, duint labelAddr);
+	bool Verify(const PatternView& pattern, duint labelAddr);
+
+	// MSPE::Image (メインモジュールのスナップショット) を直接読む版。x64dbgを呼ばないので、ワーカースレッドから呼べる
+	bool Verify(const MSPE::Image& image, const PatternView& pattern, duint labelAddr);
+
 	// シグネチャを検索し、見つかったアドレスを全て返す
 	bool Find(const std::string& signature, std::vector<duint>& result, size_t maxResult = 0);
 
-	// x64dbgのリファレンスビューにシグネチャ一覧を表示
+	// imageからコンパイル済みのパターンを検索する。x64dbgを呼ばないので、ワーカースレッドから呼べる
+	// メインモジュールは.textだけ (Find(signature) と同じ範囲)、ほかのモジュールのスナップショットは実行できるセクションをすべて検索する
+	// Find(signature) がログに"disasemble error"を出す箇所は、ログに出さずに数をerrorsに返す
+	// 検索するセクションがなければfalseを返す
+	bool Find(const MSPE::Image& image, const PatternView& pattern, std::vector<duint>& result, size_t maxResult, size_t& errors);
+
+	// x64dbgのリファレンスビューにシグネチャ一覧をアドレス順に表示
+	// 最初に見える行だけすぐに埋め、残りはバックグラウンドで埋める (逆アセンブルは一度引いたものを覚えておく)
 	void Show();
+
+	// Showで覚えた逆アセンブルを捨てる (デバッグを終えたとき)
+	void ReleaseView();
 }
@@ -0,0 +1,211 @@
+﻿#include "pch.h"
+#include "SignatureAnchor.h"
+#include "MSPE.h"
+#include <algorithm>	// sort
+#include <cctype>		// isdigit, isxdigit
+
+
+namespace
+{
+	constexpr char kImportPrefix[] = "import:";
+	constexpr size_t kImportPrefixLength = sizeof(kImportPrefix) - 1;
+
+
+	bool StartsWith(const std::string& str, const char* prefix, size_t length)
+	{
+		return str.size() >= length && str.compare(0, length, prefix) == 0;
+	}
+
+
+	// import:<dll>!<function>#<n>[@<fingerprint>]
+	struct ImportAnchor
+	{
+		std::string		name;					// "dll!function"
+		size_t			ordinal = 0;			// 関数の中で n 番目 (0から) の呼び出し
+		std::uint64_t	fingerprint = 0;		// 関数のunwind情報の指紋 (MSPE::FingerprintTable)、0なら問わない
+	};
+
+
+	// "<name>#<n>[@<fingerprint>]" を分解する
+	// 装飾名には'@'が入るので、'@'は最後の'#'よりあとにあるものだけを見る
+	bool ParseImport(const std::string& str, ImportAnchor& anchor)
+	{
+		auto pos = str.rfind('#');
+		if (pos == std::string::npos || pos == 0 || pos + 1 >= str.size() || !std::isdigit(static_cast<unsigned char>(str[pos + 1]))) {
+			return false;
+		}
+		char* end = nullptr;
+		anchor.ordinal = std::strtoul(str.c_str() + pos + 1, &end, 10);
+		anchor.fingerprint = 0;
+		if (*end == '@') {
+			const char* hex = end + 1;
+			if (!std::isxdigit(static_cast<unsigned char>(*hex))) {
+				return false;
+			}
+			anchor.fingerprint = std::strtoull(hex, &end, 16);
+		}
+		if (*end != '\0') {
+			return false;
+		}
+		anchor.name = str.substr(0, pos);
+		return true;
+	}
+
+
+	std::string FormatImport(const ImportAnchor& anchor)
+	{
+		std::string signature = kImportPrefix + anchor.name + "#" + std::to_string(anchor.ordinal);
+		if (anchor.fingerprint) {
+			char buffer[32];
+			sprintf_s(buffer, "@%016llX", static_cast<unsigned long long>(anchor.fingerprint));
+			signature += buffer;
+		}
+		return signature;
+	}
+
+
+	// インポート関数の呼び出し元を関数ごとにまとめる。関数テーブルのインデックスと、関数の中での呼び出しの数 (インデックス順)
+	std::vector<std::pair<size_t, size_t>> CountCallsPerFunction(const MSPE::FunctionTable& functions, MSPE::ArrayView<std::uint32_t> sites)
+	{
+		// 連鎖したフラグメントは離れた場所にあるので、呼び出し元の順には並ばない
+		std::vector<size_t> owners;
+		owners.reserve(sites.size());
+		for (std::uint32_t rva : sites) {
+			size_t idx = functions.FindOwner(rva);
+			if (idx != MSPE::FunctionTable::npos) {
+				owners.push_back(idx);
+			}
+		}
+		std::sort(owners.begin(), owners.end());
+
+		std::vector<std::pair<size_t, size_t>> result;
+		for (size_t i = 0; i < owners.size();) {
+			size_t j = i + 1;
+			while (j < owners.size() && owners[j] == owners[i]) {
+				++j;
+			}
+			result.emplace_back(owners[i], j - i);
+			i = j;
+		}
+		return result;
+	}
+
+
+	// 関数の中で ordinal 番目のインポート関数の呼び出しがあり、指紋が一致する関数の先頭 (rva、昇順)
+	std::vector<std::uint32_t> FindImportFunctions(const ImportAnchor& anchor)
+	{
+		std::vector<std::uint32_t> result;
+		auto& imports = MSPE::ImportTable::Get();
+		size_t idx = imports.Find(anchor.name);
+		if (idx == MSPE::ImportTable::npos) {
+			return result;
+		}
+
+		auto& functions = MSPE::FunctionTable::Get();
+		auto* fingerprints = anchor.fingerprint ? &MSPE::FingerprintTable::Get() : nullptr;
+		for (auto& elem : CountCallsPerFunction(functions, imports.CallSites(idx))) {
+			if (elem.second <= anchor.ordinal || (fingerprints && (*fingerprints)[elem.first] != anchor.fingerprint)) {
+				continue;
+			}
+			result.push_back(functions[elem.first].begin);
+		}
+		return result;
+	}
+
+
+	bool FindImport(const std::string& signature, std::vector<duint>& result, size_t maxResult)
+	{
+		ImportAnchor anchor;
+		if (!ParseImport(signature.substr(kImportPrefixLength), anchor)) {
+			_plugin_logprintf("invalid import signature: \"%s\"\n", signature.c_str());
+			return false;
+		}
+
+		auto& image = MSPE::Image::Get();
+		for (std::uint32_t rva : FindImportFunctions(anchor)) {
+			if (maxResult != 0 && result.size() >= maxResult) {
+				break;
+			}
+			result.push_back(image.base() + rva);
+		}
+		return true;
+	}
+}
+
+
+namespace Signature::Anchor
+{
+	bool IsAnchor(const std::string& signature)
+	{
+		return StartsWith(signature, kImportPrefix, kImportPrefixLength);
+	}
+
+
+	bool Find(const std::string& signature, std::vector<duint>& result, size_t maxResult)
+	{
+		if (StartsWith(signature, kImportPrefix, kImportPrefixLength)) {
+			return FindImport(signature, result, maxResult);
+		}
+		return false;
+	}
+
+
+	bool MakeImportSignature(duint addr, std::string& signature)
+	{
+		auto& image = MSPE::Image::Get();
+		if (!image.contains_addr(addr)) {
+			return false;
+		}
+		auto& functions = MSPE::FunctionTable::Get();
+		std::uint32_t rva = image.rva(addr);
+		size_t funcIdx = functions.FindOwner(rva);
+		if (funcIdx == MSPE::FunctionTable::npos || functions[funcIdx].begin != rva) {
+			return false;
+		}
+
+		//
+		// 関数の中で呼び出しているインポート関数を、呼び出し元の少ないものから試す
+		// 関数の中の最後の呼び出しを指すと、呼び出しの少ない関数が候補から外れる
+		//
+		struct Candidate
+		{
+			size_t	import;
+			size_t	calls;		// 関数の中での呼び出しの数
+			size_t	sites;		// モジュール全体での呼び出しの数
+		};
+		std::vector<Candidate> candidates;
+		auto& imports = MSPE::ImportTable::Get();
+		for (size_t i = 0; i < imports.size(); ++i) {
+			auto sites = imports.CallSites(i);
+			for (auto& elem : CountCallsPerFunction(functions, sites)) {
+				if (elem.first == funcIdx) {
+					candidates.push_back({ i, elem.second, sites.size() });
+					break;
+				}
+			}
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const Candidate& lhs, const Candidate& rhs) -> bool {
+			return lhs.sites < rhs.sites;
+		});
+
+		// 指紋はスタックフレームが変わると変わるので、なくても一意になるものを先に選ぶ
+		std::uint64_t fingerprint = MSPE::FingerprintTable::Get()[funcIdx];
+		for (int pass = 0; pass < 2; ++pass) {
+			if (pass == 1 && fingerprint == 0) {
+				break;
+			}
+			for (auto& candidate : candidates) {
+				ImportAnchor anchor;
+				anchor.name = imports[candidate.import].name;
+				anchor.ordinal = candidate.calls - 1;
+				anchor.fingerprint = pass == 1 ? fingerprint : 0;
+				auto found = FindImportFunctions(anchor);
+				if (found.size() == 1 && found.front() == rva) {
+					signature = FormatImport(anchor);
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+}
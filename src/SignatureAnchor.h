@@ -0,0 +1,21 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+
+
+// アンカー形式のシグネチャ
+//   import:<dll>!<function>#<n>[@<fingerprint>]
+//		関数の中で、インポート関数を呼び出す n 番目 (0から、アドレス順) の call/jmp がある関数
+//		@<fingerprint> (16進数) があれば、unwind情報の指紋 (MSPE::FingerprintTable) が一致する関数に限る
+namespace Signature::Anchor
+{
+	// シグネチャがアンカー形式ならtrueを返す
+	bool IsAnchor(const std::string& signature);
+
+	// アンカー形式のシグネチャを解決し、見つかったアドレスを全て返す
+	bool Find(const std::string& signature, std::vector<duint>& result, size_t maxResult = 0);
+
+	// addrから始まる関数について、インポート関数の呼び出しをアンカーにしたシグネチャを作る
+	bool MakeImportSignature(duint addr, std::string& signature);
+}
@@ -0,0 +1,271 @@
+﻿#include "pch.h"
+#include "SignatureConstant.h"
+#include "MSPE.h"
+#include <algorithm>	// sort, unique, set_intersection, find
+#include <cstdlib>		// strtoull
+#include <iterator>		// back_inserter
+
+
+namespace
+{
+	constexpr char kConstantPrefix[] = "const:";
+	constexpr size_t kConstantPrefixLength = sizeof(kConstantPrefix) - 1;
+
+	// Describeで組み合わせを試す定数の数 (使っている関数が少ないものから)
+	constexpr size_t kDescribeCandidates = 8;
+
+
+	bool IsIndexed(std::uint64_t value)
+	{
+		auto signedValue = static_cast<std::int64_t>(value);
+		return signedValue <= -MSPE::ConstantTable::kMinMagnitude || signedValue >= MSPE::ConstantTable::kMinMagnitude;
+	}
+
+
+	// valueを使っている関数の先頭 (重複なし、昇順)
+	// 32ビットの即値は符号拡張して索引にあるので、0x80000000～0xFFFFFFFFは符号拡張した値も引く
+	std::vector<std::uint32_t> FunctionsUsing(const MSPE::FunctionTable& functions, const MSPE::ConstantTable& constants, std::uint64_t value)
+	{
+		std::vector<std::uint32_t> sites = constants.Find(value);
+		if (value >= 0x80000000 && value <= 0xFFFFFFFF) {
+			auto extended = constants.Find(static_cast<std::uint64_t>(static_cast<std::int64_t>(static_cast<std::int32_t>(value))));
+			sites.insert(sites.end(), extended.begin(), extended.end());
+		}
+
+		std::vector<std::uint32_t> result;
+		result.reserve(sites.size());
+		for (std::uint32_t rva : sites) {
+			size_t idx = functions.FindOwner(rva);
+			if (idx != MSPE::FunctionTable::npos) {
+				result.push_back(functions[idx].begin);
+			}
+		}
+		std::sort(result.begin(), result.end());
+		result.erase(std::unique(result.begin(), result.end()), result.end());
+		return result;
+	}
+
+
+	std::vector<std::uint32_t> Intersect(const std::vector<std::uint32_t>& lhs, const std::vector<std::uint32_t>& rhs)
+	{
+		std::vector<std::uint32_t> result;
+		std::set_intersection(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), std::back_inserter(result));
+		return result;
+	}
+
+
+	// 索引の値を、シグネチャに書く値にする
+	// スタックや構造体のオフセットは負の数のまま、それ以外の32ビットの負の数は符号拡張する前の値にする
+	std::uint64_t Normalize(std::uint64_t value)
+	{
+		auto signedValue = static_cast<std::int64_t>(value);
+		if (signedValue <= -0x10000 && signedValue >= INT32_MIN) {
+			return value & 0xFFFFFFFF;
+		}
+		return value;
+	}
+
+
+	std::string FormatValue(std::uint64_t value)
+	{
+		char buffer[32];
+		auto signedValue = static_cast<std::int64_t>(value);
+		if (signedValue < 0) {
+			sprintf_s(buffer, "-0x%llX", static_cast<unsigned long long>(0 - value));
+		}
+		else {
+			sprintf_s(buffer, "0x%llX", static_cast<unsigned long long>(value));
+		}
+		return buffer;
+	}
+
+
+	bool ParseValue(std::string token, std::uint64_t& value)
+	{
+		// 前後の空白を除く
+		auto first = token.find_first_not_of(" \t");
+		auto last = token.find_last_not_of(" \t");
+		if (first == std::string::npos) {
+			return false;
+		}
+		token = token.substr(first, last - first + 1);
+
+		bool negative = token[0] == '-';
+		size_t pos = negative ? 1 : 0;
+		int base = 10;
+		if (token.compare(pos, 2, "0x") == 0 || token.compare(pos, 2, "0X") == 0) {
+			pos += 2;
+			base = 16;
+		}
+		if (pos >= token.size() || !std::isxdigit(static_cast<unsigned char>(token[pos]))) {
+			return false;
+		}
+		char* end = nullptr;
+		value = std::strtoull(token.c_str() + pos, &end, base);
+		if (*end != '\0') {
+			return false;
+		}
+		if (negative) {
+			value = 0 - value;
+		}
+		return IsIndexed(value);
+	}
+}
+
+
+namespace Signature::Constant
+{
+	bool IsConstant(const std::string& signature)
+	{
+		return signature.size() >= kConstantPrefixLength && signature.compare(0, kConstantPrefixLength, kConstantPrefix) == 0;
+	}
+
+
+	bool Parse(const std::string& signature, std::vector<std::uint64_t>& values)
+	{
+		if (!IsConstant(signature)) {
+			return false;
+		}
+
+		values.clear();
+		size_t pos = kConstantPrefixLength;
+		for (;;) {
+			auto comma = signature.find(',', pos);
+			std::uint64_t value;
+			if (!ParseValue(signature.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos), value)) {
+				return false;
+			}
+			values.push_back(value);
+			if (comma == std::string::npos) {
+				return true;
+			}
+			pos = comma + 1;
+		}
+	}
+
+
+	std::string Format(const std::vector<std::uint64_t>& values)
+	{
+		std::string signature = kConstantPrefix;
+		for (size_t i = 0; i < values.size(); ++i) {
+			if (i) {
+				signature += ',';
+			}
+			signature += FormatValue(values[i]);
+		}
+		return signature;
+	}
+
+
+	void Find(const MSPE::Image& image, const MSPE::FunctionTable& functions, const MSPE::ConstantTable& constants,
+		const std::vector<std::uint64_t>& values, std::vector<duint>& result, size_t maxResult)
+	{
+		if (values.empty()) {
+			return;
+		}
+
+		// 使っている関数の少ない定数から突き合わせ、候補がなくなったらやめる
+		std::vector<std::vector<std::uint32_t>> lists;
+		lists.reserve(values.size());
+		for (std::uint64_t value : values) {
+			lists.push_back(FunctionsUsing(functions, constants, value));
+		}
+		std::sort(lists.begin(), lists.end(), [](const std::vector<std::uint32_t>& lhs, const std::vector<std::uint32_t>& rhs) -> bool {
+			return lhs.size() < rhs.size();
+		});
+
+		std::vector<std::uint32_t> found = std::move(lists.front());
+		for (size_t i = 1; i < lists.size() && found.size(); ++i) {
+			found = Intersect(found, lists[i]);
+		}
+
+		for (std::uint32_t rva : found) {
+			if (maxResult != 0 && result.size() >= maxResult) {
+				break;
+			}
+			result.push_back(image.base() + rva);
+		}
+	}
+
+
+	bool Describe(duint addr, std::string& signature)
+	{
+		auto& image = MSPE::Image::Get();
+		if (!image.contains_addr(addr)) {
+			return false;
+		}
+		auto& functions = MSPE::FunctionTable::Get();
+		std::uint32_t rva = image.rva(addr);
+		size_t idx = functions.FindOwner(rva);
+		if (idx == MSPE::FunctionTable::npos || functions[idx].begin != rva) {
+			return false;
+		}
+
+		std::vector<MSPE::ConstantTable::Use> uses;
+		MSPE::ConstantTable::Collect(image, functions[idx].begin, functions[idx].end, uses);
+		std::vector<std::uint64_t> values;
+		for (auto& use : uses) {
+			values.push_back(Normalize(use.value));
+		}
+		std::sort(values.begin(), values.end());
+		values.erase(std::unique(values.begin(), values.end()), values.end());
+		if (values.empty()) {
+			return false;
+		}
+
+		// 使っている関数の少ないものから
+		auto& constants = MSPE::ConstantTable::Get();
+		struct Candidate
+		{
+			std::uint64_t				value;
+			std::vector<std::uint32_t>	functions;
+		};
+		std::vector<Candidate> candidates;
+		for (std::uint64_t value : values) {
+			candidates.push_back({ value, FunctionsUsing(functions, constants, value) });
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const Candidate& lhs, const Candidate& rhs) -> bool {
+			return lhs.functions.size() < rhs.functions.size();
+		});
+
+		if (candidates.front().functions.size() == 1) {
+			signature = Format({ candidates.front().value });
+			return true;
+		}
+
+		size_t count = std::min<size_t>(candidates.size(), kDescribeCandidates);
+		for (size_t i = 0; i < count; ++i) {
+			for (size_t j = i + 1; j < count; ++j) {
+				if (Intersect(candidates[i].functions, candidates[j].functions).size() == 1) {
+					signature = Format({ candidates[i].value, candidates[j].value });
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+
+	bool Find(const std::string& signature, std::vector<duint>& result, size_t maxResult)
+	{
+		std::vector<std::uint64_t> values;
+		if (!Parse(signature, values)) {
+			_plugin_logprintf("invalid constant signature: \"%s\"\n", signature.c_str());
+			return false;
+		}
+		Find(MSPE::Image::Get(), MSPE::FunctionTable::Get(), MSPE::ConstantTable::Get(), values, result, maxResult);
+		return true;
+	}
+
+
+	bool Verify(const std::string& signature, duint labelAddr)
+	{
+		std::vector<std::uint64_t> values;
+		if (!Parse(signature, values)) {
+			return false;
+		}
+		std::vector<duint> result;
+		Find(MSPE::Image::Get(), MSPE::FunctionTable::Get(), MSPE::ConstantTable::Get(), values, result);
+		return std::find(result.begin(), result.end(), labelAddr) != result.end();
+	}
+}
@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+
+
+namespace MSPE
+{
+	class Image;
+	class FunctionTable;
+	class ConstantTable;
+}
+
+
+// 定数の形式のシグネチャ
+//   const:<value>,<value>,...	即値かディスプレースメントとして、列挙した定数をすべて使っている関数
+// 値は16進数 (0x...) か10進数で、'-'を付ければ負の数も書ける。-0x100より大きく0x100より小さい値は
+// ほとんどの関数にあるので索引になく、使えない。定数の索引 (MSPE::ConstantTable) の転置リストを
+// 関数の単位で突き合わせるだけなので、セクションは検索しない
+namespace Signature::Constant
+{
+	// シグネチャが定数の形式ならtrueを返す
+	bool IsConstant(const std::string& signature);
+
+	bool Parse(const std::string& signature, std::vector<std::uint64_t>& values);
+	std::string Format(const std::vector<std::uint64_t>& values);
+
+	// 定数をすべて使っている関数を全て返す (アドレス順)。x64dbgを呼ばないので、ワーカースレッドから呼べる
+	void Find(const MSPE::Image& image, const MSPE::FunctionTable& functions, const MSPE::ConstantTable& constants,
+		const std::vector<std::uint64_t>& values, std::vector<duint>& result, size_t maxResult = 0);
+
+	// addrの関数を、ほかの関数ではあまり使われない1つか2つの定数で表す
+	bool Describe(duint addr, std::string& signature);
+
+	// メインモジュールの索引を使う版
+	bool Find(const std::string& signature, std::vector<duint>& result, size_t maxResult = 0);
+	bool Verify(const std::string& signature, duint labelAddr);
+}
@@ -0,0 +1,202 @@
+﻿#include "pch.h"
+#include "SignatureData.h"
+#include "MSPE.h"
+#include <algorithm>	// min
+#include <cstring>		// memcpy, memchr
+
+
+namespace
+{
+	constexpr char kDataPrefix[] = "data:";
+	constexpr size_t kDataPrefixLength = sizeof(kDataPrefix) - 1;
+
+
+	// 先頭8バイトをまとめて比べるためのマスクと値 (パターンが8バイトより短ければ使わない)
+	struct Prefix
+	{
+		std::uint64_t	mask = 0;
+		std::uint64_t	bytes = 0;
+		bool			enabled = false;
+
+		explicit Prefix(const Signature::Pattern& pattern)
+		{
+			if (pattern.size() < sizeof(std::uint64_t)) {
+				return;
+			}
+			std::memcpy(&mask, pattern.mask.data(), sizeof(mask));
+			std::memcpy(&bytes, pattern.bytes.data(), sizeof(bytes));
+			enabled = true;
+		}
+
+		inline bool Match(const std::uint8_t* data) const
+		{
+			std::uint64_t value;
+			std::memcpy(&value, data, sizeof(value));
+			return (value & mask) == bytes;
+		}
+	};
+
+
+	// セクションのうちイメージに収まる範囲
+	bool GetSectionRange(const MSPE::Image& image, const std::string& name, std::uint32_t& rva, size_t& size)
+	{
+		auto* section = image.section(name.c_str());
+		if (!section || section->VirtualAddress >= image.size()) {
+			return false;
+		}
+		rva = section->VirtualAddress;
+		size = std::min<size_t>(section->Misc.VirtualSize ? section->Misc.VirtualSize : section->SizeOfRawData, image.size() - rva);
+		return true;
+	}
+}
+
+
+namespace Signature::Data
+{
+	bool IsData(const std::string& signature)
+	{
+		return signature.size() >= kDataPrefixLength && signature.compare(0, kDataPrefixLength, kDataPrefix) == 0;
+	}
+
+
+	bool Parse(const std::string& signature, Pattern& pattern)
+	{
+		if (!IsData(signature)) {
+			return false;
+		}
+
+		// data:<section>[:<align>]:<pattern>
+		auto sectionEnd = signature.find(':', kDataPrefixLength);
+		if (sectionEnd == std::string::npos || sectionEnd == kDataPrefixLength) {
+			return false;
+		}
+		pattern.section = signature.substr(kDataPrefixLength, sectionEnd - kDataPrefixLength);
+		pattern.align = 1;
+
+		auto patternBegin = sectionEnd + 1;
+		auto alignEnd = signature.find(':', patternBegin);
+		if (alignEnd != std::string::npos) {
+			char* end = nullptr;
+			pattern.align = std::strtoul(signature.c_str() + patternBegin, &end, 10);
+			if (end != signature.c_str() + alignEnd) {
+				return false;
+			}
+			patternBegin = alignEnd + 1;
+		}
+		// 2のべき乗だけ (セクションの先頭はページ境界なので、rvaで割り切れるかを見ればよい)
+		if (pattern.align == 0 || (pattern.align & (pattern.align - 1)) != 0) {
+			return false;
+		}
+
+		return Signature::Compile(signature.substr(patternBegin), pattern.pattern);
+	}
+
+
+	bool Find(const MSPE::Image& image, const Pattern& pattern, std::vector<duint>& result, size_t maxResult)
+	{
+		std::uint32_t rva;
+		size_t size;
+		if (!GetSectionRange(image, pattern.section, rva, size)) {
+			return false;
+		}
+
+		const auto& compiled = pattern.pattern;
+		if (compiled.size() == 0 || compiled.size() > size) {
+			return true;
+		}
+
+		const std::uint8_t* data = image.data() + rva;
+		const size_t last = size - compiled.size();
+		const size_t stride = pattern.align;
+		const Prefix prefix(compiled);
+		size_t hit = 0;
+
+		if (stride == 1) {
+			// 境界がなければ、バイト列のシグネチャと同じくmemchrでマスクのないバイトを探す
+			size_t key = compiled.size();
+			for (size_t i = 0; i < compiled.size(); ++i) {
+				if (compiled.mask[i] == 0xFF) {
+					key = i;
+					break;
+				}
+			}
+			for (size_t pos = 0; pos <= last; ++pos) {
+				if (key != compiled.size()) {
+					auto* p = static_cast<const std::uint8_t*>(std::memchr(data + pos + key, compiled.bytes[key], last - pos + 1));
+					if (!p) {
+						break;
+					}
+					pos = (p - data) - key;
+				}
+				if (!compiled.Match(data + pos)) {
+					continue;
+				}
+				result.push_back(image.base() + rva + pos + compiled.index);
+				if (maxResult != 0 && ++hit >= maxResult) {
+					break;
+				}
+			}
+			return true;
+		}
+
+		// 境界の位置だけを見る (8バイト境界なら1/8)。先頭8バイトはまとめて比べて、ほとんどの位置をそこで落とす
+		for (size_t pos = 0; pos <= last; pos += stride) {
+			if (prefix.enabled && !prefix.Match(data + pos)) {
+				continue;
+			}
+			if (!compiled.Match(data + pos)) {
+				continue;
+			}
+			result.push_back(image.base() + rva + pos + compiled.index);
+			if (maxResult != 0 && ++hit >= maxResult) {
+				break;
+			}
+		}
+		return true;
+	}
+
+
+	bool Verify(const MSPE::Image& image, const Pattern& pattern, duint labelAddr)
+	{
+		const auto& compiled = pattern.pattern;
+		if (compiled.size() == 0 || labelAddr < compiled.index || !image.contains_addr(labelAddr - compiled.index)) {
+			return false;
+		}
+
+		std::uint32_t rva;
+		size_t size;
+		if (!GetSectionRange(image, pattern.section, rva, size)) {
+			return false;
+		}
+		std::uint32_t start = image.rva(labelAddr - compiled.index);
+		if (compiled.size() > size || start < rva || start - rva > size - compiled.size()) {
+			return false;
+		}
+		if ((start - rva) % pattern.align != 0) {
+			return false;
+		}
+		return compiled.Match(image.data() + start);
+	}
+
+
+	bool Find(const std::string& signature, std::vector<duint>& result, size_t maxResult)
+	{
+		Pattern pattern;
+		if (!Parse(signature, pattern)) {
+			_plugin_logprintf("invalid data signature: \"%s\"\n", signature.c_str());
+			return false;
+		}
+		if (!Find(MSPE::Image::Get(), pattern, result, maxResult)) {
+			_plugin_logprintf("section not found: \"%s\"\n", pattern.section.c_str());
+			return false;
+		}
+		return true;
+	}
+
+
+	bool Verify(const std::string& signature, duint labelAddr)
+	{
+		Pattern pattern;
+		return Parse(signature, pattern) && Verify(MSPE::Image::Get(), pattern, labelAddr);
+	}
+}
@@ -0,0 +1,44 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+#include "Signature.h"
+
+
+namespace MSPE
+{
+	class Image;
+}
+
+
+// データ形式のシグネチャ
+//   data:<section>:<pattern>			セクション (.rdata、.dataなど) のバイト列
+//   data:<section>:<align>:<pattern>	alignバイト境界から始まるものだけ (ポインタの表なら8)
+// パターンはバイト列のシグネチャと同じ書き方で、'*'の位置がラベルになる (なければ先頭)。
+// 逆アセンブルはせず、ラベルの位置のオペランドもたどらない
+namespace Signature::Data
+{
+	struct Pattern
+	{
+		std::string			section;		// ".rdata"
+		size_t				align = 1;
+		Signature::Pattern	pattern;
+	};
+
+	// シグネチャがデータ形式ならtrueを返す
+	bool IsData(const std::string& signature);
+
+	// データ形式のシグネチャを分解してコンパイルする
+	bool Parse(const std::string& signature, Pattern& pattern);
+
+	// imageのセクションからパターンを検索し、見つかったラベルのアドレスを全て返す。x64dbgを呼ばないので、ワーカースレッドから呼べる
+	// セクションがなければfalseを返す
+	bool Find(const MSPE::Image& image, const Pattern& pattern, std::vector<duint>& result, size_t maxResult = 0);
+
+	// labelAddrにラベルがあるとして、セクションとアラインメントも含めてパターンに一致すればtrueを返す
+	bool Verify(const MSPE::Image& image, const Pattern& pattern, duint labelAddr);
+
+	// メインモジュールのスナップショットを使う版
+	bool Find(const std::string& signature, std::vector<duint>& result, size_t maxResult = 0);
+	bool Verify(const std::string& signature, duint labelAddr);
+}
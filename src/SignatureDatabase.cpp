@@ -0,0 +1,444 @@
+﻿#include "pch.h"
+#include "SignatureDatabase.h"
+#include "SignatureRecord.h"
+#include "Util.h"
+#include "pluginsdk/lz4/lz4.h"
+#include <algorithm>	// sort, min
+#include <cstring>		// memcpy
+#include <unordered_map>
+
+
+namespace Signature
+{
+	Database::~Database()
+	{
+		if (_view) {
+			UnmapViewOfFile(_view);
+		}
+	}
+
+
+	bool Database::Open(const char* path, std::string& err)
+	{
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			err = "cannot open the file";
+			return false;
+		}
+
+		LARGE_INTEGER fileSize;
+		HANDLE mapping = nullptr;
+		if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= sizeof(Header) && fileSize.QuadPart < 0x80000000) {
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		}
+		CloseHandle(file);
+		if (!mapping) {
+			err = "not a signature database";
+			return false;
+		}
+
+		_view = static_cast<const std::uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		CloseHandle(mapping);
+		if (!_view) {
+			err = "cannot map the file";
+			return false;
+		}
+		_viewSize = static_cast<size_t>(fileSize.QuadPart);
+
+		//
+		// テーブルの位置を求める
+		//
+		_header = reinterpret_cast<const Header*>(_view);
+		if (_header->magic != kMagic) {
+			err = "not a signature database";
+			return false;
+		}
+		if (_header->version != kVersion) {
+			err = "unsupported signature database version";
+			return false;
+		}
+
+		std::uint64_t offset = sizeof(Header);
+		auto table = [this, &offset](std::uint64_t count, size_t elementSize) -> const std::uint8_t* {
+			const std::uint8_t* result = _view + std::min<std::uint64_t>(offset, _viewSize);
+			offset += count * elementSize;
+			return result;
+		};
+		_records = reinterpret_cast<const RecordEntry*>(table(_header->recordCount, sizeof(RecordEntry)));
+		_modules = reinterpret_cast<const ModuleEntry*>(table(_header->moduleCount, sizeof(ModuleEntry)));
+		_addresses = reinterpret_cast<const AddressEntry*>(table(_header->addressCount, sizeof(AddressEntry)));
+		_patterns = reinterpret_cast<const PatternEntry*>(table(_header->patternCount, sizeof(PatternEntry)));
+		_labelIndex = reinterpret_cast<const std::uint32_t*>(table(_header->recordCount, sizeof(std::uint32_t)));
+		_blocks = reinterpret_cast<const BlockEntry*>(table(_header->blockCount, sizeof(BlockEntry)));
+		if (offset > _viewSize) {
+			err = "the signature database is truncated";
+			return false;
+		}
+
+		if (!Validate(err)) {
+			return false;
+		}
+
+		_blob.reset(new std::uint8_t[_header->blobSize]);
+		_loaded.assign(_header->blockCount, false);
+		return true;
+	}
+
+
+	// インデックスやオフセットが範囲内にあるか、最初にまとめて調べておく
+	bool Database::Validate(std::string& err) const
+	{
+		const std::uint64_t blobSize = _header->blobSize;
+		auto validString = [blobSize](const StringRef& ref) -> bool {
+			return static_cast<std::uint64_t>(ref.offset) + ref.length <= blobSize;
+		};
+
+		if (_header->blockCount != (blobSize + kBlockSize - 1) / kBlockSize) {
+			err = "invalid block table";
+			return false;
+		}
+		for (std::uint32_t i = 0; i < _header->blockCount; ++i) {
+			auto& block = _blocks[i];
+			if (block.size > kBlockSize || static_cast<std::uint64_t>(block.offset) + block.size > _viewSize) {
+				err = "invalid block table";
+				return false;
+			}
+		}
+
+		for (std::uint32_t i = 0; i < _header->moduleCount; ++i) {
+			if (!validString(_modules[i].name)) {
+				err = "invalid module table";
+				return false;
+			}
+		}
+
+		for (std::uint32_t i = 0; i < _header->addressCount; ++i) {
+			if (_addresses[i].module >= _header->moduleCount) {
+				err = "invalid address table";
+				return false;
+			}
+		}
+
+		for (std::uint32_t i = 0; i < _header->patternCount; ++i) {
+			auto& pattern = _patterns[i];
+			if (static_cast<std::uint64_t>(pattern.offset) + pattern.size * 2ull > blobSize || pattern.index > pattern.size) {
+				err = "invalid pattern table";
+				return false;
+			}
+		}
+
+		for (std::uint32_t i = 0; i < _header->recordCount; ++i) {
+			auto& record = _records[i];
+			if (!validString(record.label) || !validString(record.signature) || !validString(record.extra)
+				|| static_cast<std::uint64_t>(record.firstAddress) + record.addressCount > _header->addressCount
+				|| (record.pattern != npos && record.pattern >= _header->patternCount)
+				|| record.module > _header->moduleCount
+				|| _labelIndex[i] >= _header->recordCount) {
+				err = "invalid record table";
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+
+	// blobの[offset, offset + length)を含むブロックを展開して、その先頭を返す
+	const std::uint8_t* Database::blob(std::uint32_t offset, std::uint32_t length) const
+	{
+		if (length == 0) {
+			return _blob.get() + offset;
+		}
+
+		std::lock_guard<std::mutex> lock(_blobMutex);
+		std::uint32_t last = (offset + length - 1) / kBlockSize;
+		for (std::uint32_t i = offset / kBlockSize; i <= last; ++i) {
+			if (_loaded[i]) {
+				continue;
+			}
+			_loaded[i] = true;
+
+			auto& block = _blocks[i];
+			auto* src = reinterpret_cast<const char*>(_view + block.offset);
+			auto* dst = reinterpret_cast<char*>(_blob.get()) + static_cast<size_t>(i) * kBlockSize;
+			int rawSize = static_cast<int>(std::min<std::uint32_t>(kBlockSize, _header->blobSize - i * kBlockSize));
+			if (block.size == rawSize) {
+				std::memcpy(dst, src, rawSize);
+			}
+			else if (LZ4_decompress_safe(src, dst, block.size, rawSize) != rawSize) {
+				_plugin_logprintf("corrupted block in the signature database: %u\n", i);
+				std::memset(dst, 0, rawSize);
+			}
+		}
+		return _blob.get() + offset;
+	}
+
+
+	std::string_view Database::string(const StringRef& ref) const
+	{
+		return std::string_view(reinterpret_cast<const char*>(blob(ref.offset, ref.length)), ref.length);
+	}
+
+
+	std::string_view Database::label(size_t idx) const
+	{
+		return string(_records[idx].label);
+	}
+
+
+	std::string_view Database::signature(size_t idx) const
+	{
+		return string(_records[idx].signature);
+	}
+
+
+	std::string_view Database::extra(size_t idx) const
+	{
+		return string(_records[idx].extra);
+	}
+
+
+	std::string_view Database::module(size_t idx) const
+	{
+		return string(_modules[idx].name);
+	}
+
+
+	PatternView Database::pattern(size_t idx) const
+	{
+		std::uint32_t patternIdx = _records[idx].pattern;
+		if (patternIdx == npos) {
+			return PatternView();
+		}
+
+		auto& entry = _patterns[patternIdx];
+		const std::uint8_t* data = blob(entry.offset, entry.size * 2);
+		return PatternView{ data, data + entry.size, entry.size, entry.index };
+	}
+
+
+	std::uint32_t Database::Find(std::string_view label) const
+	{
+		auto first = _labelIndex;
+		auto last = _labelIndex + _header->recordCount;
+		auto it = std::lower_bound(first, last, label, [this](std::uint32_t idx, std::string_view key) -> bool {
+			return this->label(idx) < key;
+		});
+		return it != last && this->label(*it) == label ? *it : npos;
+	}
+
+
+	bool Database::Write(const Document& document, const char* path, std::string& err)
+	{
+		std::vector<std::uint8_t> blob;
+		auto addString = [&blob](std::string_view str) -> StringRef {
+			StringRef ref = { static_cast<std::uint32_t>(blob.size()), static_cast<std::uint32_t>(str.size()) };
+			blob.insert(blob.end(), str.begin(), str.end());
+			return ref;
+		};
+
+		//
+		// テーブル
+		//
+		std::vector<ModuleEntry> modules(document.module_count());
+		std::unordered_map<std::string_view, std::uint32_t> moduleIndex;
+		for (std::uint32_t i = 0; i < modules.size(); ++i) {
+			modules[i].name = addString(document.module(i));
+			moduleIndex.emplace(document.module(i), i);
+		}
+		// 対象モジュールの名前もモジュール表に入れる (アドレス欄のキーになければ追加する)
+		auto internModule = [&](const std::string& name) -> std::uint32_t {
+			auto result = moduleIndex.emplace(name, static_cast<std::uint32_t>(modules.size()));
+			if (result.second) {
+				modules.push_back({ addString(name) });
+			}
+			return result.first->second;
+		};
+
+		std::vector<RecordEntry> records(document.size());
+		std::vector<AddressEntry> addresses;
+		std::vector<PatternEntry> patterns;
+		Pattern pattern;
+
+		for (size_t i = 0; i < document.size(); ++i) {
+			auto& src = document[i];
+			auto& dst = records[i];
+			dst.label = addString(src.label);
+			dst.signature = addString(src.signature);
+			dst.extra = { 0, 0 };
+			if (src.extra.size() || src.relation.size() || src.codeHash) {
+				// "relation"と"code"は知らないフィールドと一緒に持つ (RecordEntryの形は変えない)
+				json11::Json::object extra(src.extra.begin(), src.extra.end());
+				if (src.relation.size()) {
+					extra.emplace("relation", src.relation);
+				}
+				if (src.codeHash) {
+					char buffer[32];
+					sprintf_s(buffer, "%016llX", static_cast<unsigned long long>(src.codeHash));
+					extra.emplace("code", buffer);
+				}
+				dst.extra = addString(json11::Json(extra).dump());
+			}
+			dst.fingerprint = src.fingerprint;
+
+			dst.firstAddress = static_cast<std::uint32_t>(addresses.size());
+			dst.addressCount = static_cast<std::uint32_t>(src.addresses.size());
+			for (auto& address : src.addresses) {
+				addresses.push_back({ address.module, static_cast<std::uint32_t>(address.rva) });
+			}
+
+			dst.pattern = npos;
+			dst.module = src.module.size() ? internModule(src.module) + 1 : 0;
+			if (Compile(src.signature, pattern)) {
+				dst.pattern = static_cast<std::uint32_t>(patterns.size());
+				patterns.push_back({ static_cast<std::uint32_t>(blob.size()), static_cast<std::uint32_t>(pattern.size()), static_cast<std::uint32_t>(pattern.index) });
+				blob.insert(blob.end(), pattern.bytes.begin(), pattern.bytes.end());
+				blob.insert(blob.end(), pattern.mask.begin(), pattern.mask.end());
+			}
+		}
+
+		std::vector<std::uint32_t> labelIndex(records.size());
+		for (std::uint32_t i = 0; i < labelIndex.size(); ++i) {
+			labelIndex[i] = i;
+		}
+		std::stable_sort(labelIndex.begin(), labelIndex.end(), [&document](std::uint32_t lhs, std::uint32_t rhs) -> bool {
+			return document[lhs].label < document[rhs].label;
+		});
+
+		//
+		// blobをブロックごとに圧縮する
+		//
+		Header header = {};
+		header.magic = kMagic;
+		header.version = kVersion;
+		header.recordCount = static_cast<std::uint32_t>(records.size());
+		header.moduleCount = static_cast<std::uint32_t>(modules.size());
+		header.addressCount = static_cast<std::uint32_t>(addresses.size());
+		header.patternCount = static_cast<std::uint32_t>(patterns.size());
+		header.blockCount = static_cast<std::uint32_t>((blob.size() + kBlockSize - 1) / kBlockSize);
+		header.blobSize = static_cast<std::uint32_t>(blob.size());
+
+		size_t offset = sizeof(Header)
+			+ records.size() * sizeof(RecordEntry)
+			+ modules.size() * sizeof(ModuleEntry)
+			+ addresses.size() * sizeof(AddressEntry)
+			+ patterns.size() * sizeof(PatternEntry)
+			+ labelIndex.size() * sizeof(std::uint32_t)
+			+ header.blockCount * sizeof(BlockEntry);
+
+		std::vector<BlockEntry> blocks(header.blockCount);
+		std::vector<char> compressed;
+		std::vector<char> buffer(LZ4_compressBound(kBlockSize));
+
+		for (std::uint32_t i = 0; i < header.blockCount; ++i) {
+			auto* src = reinterpret_cast<const char*>(blob.data()) + static_cast<size_t>(i) * kBlockSize;
+			int rawSize = static_cast<int>(std::min<size_t>(kBlockSize, blob.size() - static_cast<size_t>(i) * kBlockSize));
+			int size = LZ4_compress(src, buffer.data(), rawSize);
+			if (size <= 0 || size >= rawSize) {
+				// 縮まなければそのまま
+				compressed.insert(compressed.end(), src, src + rawSize);
+				size = rawSize;
+			}
+			else {
+				compressed.insert(compressed.end(), buffer.data(), buffer.data() + size);
+			}
+			blocks[i] = { static_cast<std::uint32_t>(offset), static_cast<std::uint32_t>(size) };
+			offset += size;
+		}
+
+		//
+		// 一時ファイルに書き出してから置き換える
+		//
+		std::string temp = std::string(path) + ".tmp";
+		FILE* fp = nullptr;
+		if (fopen_s(&fp, temp.c_str(), "wb") != 0 || !fp) {
+			err = "cannot create the file: " + temp;
+			return false;
+		}
+
+		auto write = [fp](const void* data, size_t size) -> bool {
+			return size == 0 || std::fwrite(data, 1, size, fp) == size;
+		};
+		bool succeeded = write(&header, sizeof(header))
+			&& write(records.data(), records.size() * sizeof(RecordEntry))
+			&& write(modules.data(), modules.size() * sizeof(ModuleEntry))
+			&& write(addresses.data(), addresses.size() * sizeof(AddressEntry))
+			&& write(patterns.data(), patterns.size() * sizeof(PatternEntry))
+			&& write(labelIndex.data(), labelIndex.size() * sizeof(std::uint32_t))
+			&& write(blocks.data(), blocks.size() * sizeof(BlockEntry))
+			&& write(compressed.data(), compressed.size());
+		succeeded = std::fclose(fp) == 0 && succeeded;
+
+		if (!succeeded) {
+			DeleteFileA(temp.c_str());
+			err = "cannot write the file: " + temp;
+			return false;
+		}
+		if (!Util::CommitFile(temp, path)) {
+			err = "cannot replace the file: " + std::string(path);
+			return false;
+		}
+		return true;
+	}
+
+
+
+	bool Document::LoadDatabase(const char* path, std::string& err)
+	{
+		Clear();
+
+		auto database = std::make_shared<Database>();
+		if (!database->Open(path, err)) {
+			return false;
+		}
+
+		std::vector<std::uint32_t> modules(database->module_count());
+		for (size_t i = 0; i < modules.size(); ++i) {
+			modules[i] = Intern(std::string(database->module(i)));
+		}
+
+		_records.resize(database->size());
+		for (size_t i = 0; i < _records.size(); ++i) {
+			auto& src = database->record(i);
+			auto& dst = _records[i];
+			dst.label = database->label(i);
+			dst.signature = database->signature(i);
+			dst.module = src.module ? database->module(src.module - 1) : std::string_view();
+			dst.fingerprint = src.fingerprint;
+			dst.compiled = src.pattern != Database::npos ? static_cast<std::uint32_t>(i) : Database::npos;
+
+			auto* addresses = database->addresses(i);
+			dst.addresses.resize(src.addressCount);
+			for (std::uint32_t j = 0; j < src.addressCount; ++j) {
+				dst.addresses[j] = { modules[addresses[j].module], addresses[j].rva };
+			}
+
+			if (src.extra.length) {
+				std::string extraErr;
+				auto extra = json11::Json::parse(std::string(database->extra(i)), extraErr);
+				for (auto& member : extra.object_items()) {
+					if (member.first == "relation") {
+						dst.relation = member.second.string_value();
+					}
+					else if (member.first == "code") {
+						dst.codeHash = std::strtoull(member.second.string_value().c_str(), nullptr, 16);
+					}
+					else {
+						dst.extra.push_back(member);
+					}
+				}
+			}
+
+			_labelIndex.emplace(dst.label, static_cast<std::uint32_t>(i));
+		}
+
+		_database = std::move(database);
+		return true;
+	}
+
+
+	bool Document::SaveDatabase(const char* path, std::string& err) const
+	{
+		return Database::Write(*this, path, err);
+	}
+}
@@ -0,0 +1,151 @@
+﻿#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "Signature.h"
+
+
+namespace Signature
+{
+	class Document;
+
+
+	// シグネチャデータベース (.sigdb)
+	//
+	// ファイルをマップして、テーブルはそのまま (コピーせずに) 読む。
+	// 文字列とパターンのバイト列はまとめてlz4でブロックごとに圧縮してあり、最初に触ったときにブロック単位で展開する。
+	// ただしDocument::LoadDatabaseはラベルやシグネチャをコピーするので、文字列のブロックは開いたときに全て展開される
+	// (あとから展開されるのは、Verify/Compileで引くパターンのブロックだけ)
+	//
+	//   Header
+	//   RecordEntry[recordCount]
+	//   ModuleEntry[moduleCount]
+	//   AddressEntry[addressCount]
+	//   PatternEntry[patternCount]
+	//   std::uint32_t[recordCount]		ラベル順に並べたレコードのインデックス
+	//   BlockEntry[blockCount]
+	//   圧縮したブロック
+	class Database
+	{
+	public:
+		static constexpr std::uint32_t kMagic = 0x42444753;		// "SGDB"
+		static constexpr std::uint32_t kVersion = 1;
+		static constexpr std::uint32_t kBlockSize = 64 * 1024;
+		static constexpr std::uint32_t npos = static_cast<std::uint32_t>(-1);
+
+		// 展開後のデータ (blob) 内の文字列
+		struct StringRef
+		{
+			std::uint32_t	offset;
+			std::uint32_t	length;
+		};
+
+		struct Header
+		{
+			std::uint32_t	magic;
+			std::uint32_t	version;
+			std::uint32_t	recordCount;
+			std::uint32_t	moduleCount;
+			std::uint32_t	addressCount;
+			std::uint32_t	patternCount;
+			std::uint32_t	blockCount;
+			std::uint32_t	blobSize;
+		};
+
+		struct RecordEntry
+		{
+			StringRef		label;
+			StringRef		signature;
+			StringRef		extra;				// 知らないフィールドと"relation"、"code" (JSONのオブジェクト)、なければ長さ0
+			std::uint64_t	fingerprint;
+			std::uint32_t	firstAddress;
+			std::uint32_t	addressCount;
+			std::uint32_t	pattern;			// PatternEntryのインデックス、アンカー形式などはnpos
+			std::uint32_t	module;				// 対象モジュール (ModuleEntryのインデックス + 1)、メインモジュールなら0
+		};
+
+		struct ModuleEntry
+		{
+			StringRef		name;				// アドレス欄のキー ("SkyrimSE.exe@0123456789ABCDEF")
+		};
+
+		struct AddressEntry
+		{
+			std::uint32_t	module;
+			std::uint32_t	rva;				// 0なら"deleted"
+		};
+
+		struct PatternEntry
+		{
+			std::uint32_t	offset;				// blob内のバイト列 (size) とマスク (size)
+			std::uint32_t	size;
+			std::uint32_t	index;
+		};
+
+		struct BlockEntry
+		{
+			std::uint32_t	offset;				// ファイル先頭から
+			std::uint32_t	size;				// 圧縮後のサイズ (展開後と同じなら無圧縮)
+		};
+
+		Database() = default;
+		~Database();
+		Database(const Database&) = delete;
+		Database& operator=(const Database&) = delete;
+
+		// ファイルをマップしてヘッダとテーブルを検証する
+		bool Open(const char* path, std::string& err);
+
+		// documentを書き出す
+		static bool Write(const Document& document, const char* path, std::string& err);
+
+		inline size_t size() const {
+			return _header->recordCount;
+		}
+		inline size_t module_count() const {
+			return _header->moduleCount;
+		}
+
+		inline const RecordEntry& record(size_t idx) const {
+			return _records[idx];
+		}
+		inline const AddressEntry* addresses(size_t idx) const {
+			return _addresses + _records[idx].firstAddress;
+		}
+
+		std::string_view label(size_t idx) const;
+		std::string_view signature(size_t idx) const;
+		std::string_view extra(size_t idx) const;
+		std::string_view module(size_t idx) const;
+
+		// レコードidxのコンパイル済みのパターン、なければsize 0
+		PatternView pattern(size_t idx) const;
+
+		// labelを持つレコードのインデックス、なければnpos
+		std::uint32_t Find(std::string_view label) const;
+
+	private:
+		std::string_view string(const StringRef& ref) const;
+		const std::uint8_t* blob(std::uint32_t offset, std::uint32_t length) const;
+		bool Validate(std::string& err) const;
+
+		// members
+		const std::uint8_t*		_view = nullptr;
+		size_t					_viewSize = 0;
+		const Header*			_header = nullptr;
+		const RecordEntry*		_records = nullptr;
+		const ModuleEntry*		_modules = nullptr;
+		const AddressEntry*		_addresses = nullptr;
+		const PatternEntry*		_patterns = nullptr;
+		const std::uint32_t*	_labelIndex = nullptr;
+		const BlockEntry*		_blocks = nullptr;
+
+		// 展開済みのブロック (Verify/Compileは並列に呼ばれるので、_blobMutexをロックして展開する)
+		mutable std::mutex						_blobMutex;
+		mutable std::unique_ptr<std::uint8_t[]>	_blob;
+		mutable std::vector<bool>				_loaded;
+	};
+}
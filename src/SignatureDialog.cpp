@@ -2,11 +2,20 @@
 #include "pluginmain.h"
 #include "Signature.h"
 #include "SignatureDialog.h"
+#include "SignatureFile.h"
+#include "SignatureAnchor.h"
+#include "SignatureData.h"
+#include "SignatureRelation.h"
+#include "SignatureString.h"
+#include "SignatureConstant.h"
 #include "Util.h"
+#include "Job.h"
 #include <CommCtrl.h>
+#include <memory>
 #include <sstream>
 #include <iomanip>
 #include <deque>
+#include <algorithm>
 #include "CDistorm.h"
 #include "resource.h"
 
@@ -38,8 +47,32 @@ namespace
 
 namespace Signature::Dialog
 {
+	// 命令ごとのラベル (ダイアログを開くときに一度だけ引いておく)
+	struct ItemLabel
+	{
+		std::string		own;			// 命令のアドレスのラベル
+		std::string		contained;		// オペランドが指すアドレスのラベル
+
+		// プルダウンとリストに出すラベル
+		inline const std::string& display() const {
+			return own.size() ? own : contained;
+		}
+	};
+
 	static HWND s_hDialog = nullptr;
 	static std::deque<CDistorm> s_dItems;
+	static std::vector<ItemLabel> s_labels;		// s_dItemsと同じ順
+
+
+	// チェックボックスの状態から、ワイルドカードにする範囲を決める
+	// 再配置されるバイトやRIP相対のオフセットがあればそこだけ、なければ即値すべて
+	static CDistorm::Wildcard GetWildcard(const CDistorm& distorm, bool checked)
+	{
+		if (!checked) {
+			return CDistorm::Wildcard::kNone;
+		}
+		return distorm.VolatileMask() ? CDistorm::Wildcard::kVolatile : CDistorm::Wildcard::kAll;
+	}
 
 	bool GetTargetLabel(std::string& label)
 	{
@@ -79,18 +112,17 @@ namespace Signature::Dialog
 			const CDistorm& elem = s_dItems[i];
 
 			bool wildcard = ListView_GetCheckState(hList, i);
-			if (!elem.GetDump(dump, wildcard)) {
+			if (!elem.GetDump(dump, GetWildcard(elem, wildcard))) {
 				continue;
 			}
 			if (label.size() > 0) {
-				std::string str;
-				if (Util::GetLabel(elem.CodeOffset(), str) && str == label) {
+				if (s_labels[i].own == label) {
 					label.clear();
 					oss << "*";
 					oss << dump;
 					continue;
 				}
-				else if (elem.ContainsLabel(str) && str == label) {
+				else if (s_labels[i].contained == label) {
 					auto space_pos = dump.find_first_of(' ');
 					if (space_pos != std::string::npos) {
 						label.clear();
@@ -159,7 +191,7 @@ namespace Signature::Dialog
 		item.iItem = idx;
 
 		std::string dump;
-		if (distorm.GetDump(dump, wildcard)) {
+		if (distorm.GetDump(dump, GetWildcard(distorm, wildcard))) {
 			item.pszText = const_cast<LPSTR>(dump.c_str());
 			item.iSubItem = 1;
 			ListView_SetItem(hList, &item);
@@ -173,10 +205,10 @@ namespace Signature::Dialog
 	{
 		HWND hCombo = GetDlgItem(s_hDialog, IDC_COMBO);
 
-		for (auto& elem : s_dItems) {
+		for (auto& elem : s_labels) {
 			// プルダウンリストにラベルを追加
-			std::string label;
-			if (Util::GetLabel(elem.CodeOffset(), label) || elem.ContainsLabel(label)) {
+			const std::string& label = elem.display();
+			if (label.size() > 0) {
 				if (CB_ERR == SendMessage(hCombo, CB_FINDSTRINGEXACT, -1, (LPARAM)label.c_str())) {
 					SendMessage(hCombo, CB_ADDSTRING, 0, (LPARAM)label.c_str());
 				}
@@ -249,9 +281,9 @@ namespace Signature::Dialog
 		for (auto& elem : s_dItems) {
 			item.iItem = idx;
 
-			bool wildcard = elem.ContainsAddress();
+			bool wildcard = elem.VolatileMask() != 0;
 			std::string dump;
-			if (elem.GetDump(dump, wildcard)) {
+			if (elem.GetDump(dump, GetWildcard(elem, wildcard))) {
 				item.pszText = const_cast<LPSTR>(dump.c_str());
 				item.iSubItem = 1;
 				ListView_SetItem(hList, &item);
@@ -262,8 +294,8 @@ namespace Signature::Dialog
 			item.iSubItem = 2;
 			ListView_SetItem(hList, &item);
 
-			std::string label;
-			if (Util::GetLabel(elem.CodeOffset(), label) || elem.ContainsLabel(label)) {
+			const std::string& label = s_labels[idx].display();
+			if (label.size() > 0) {
 				item.pszText = const_cast<LPSTR>(label.c_str());
 				item.iSubItem = 3;
 				ListView_SetItem(hList, &item);
@@ -295,8 +327,23 @@ namespace Signature::Dialog
 	}
 
 
-	static bool Find(const std::string& signature, std::vector<duint>& result, size_t max = 0)
+	// 一度にスキャンする大きさ (この間隔で中止を確かめ、進み具合を知らせる)
+	static constexpr duint kScanChunkSize = 1024 * 1024;
+
+	static bool Find(const std::string& signature, std::vector<duint>& result, size_t max, Job::Context& context)
 	{
+		if (Signature::Anchor::IsAnchor(signature)) {
+			return Signature::Anchor::Find(signature, result, max);
+		}
+		if (Signature::Data::IsData(signature)) {
+			// セクションのスナップショットを読むだけなので、区切らずに検索する
+			return Signature::Data::Find(signature, result, max);
+		}
+		if (Signature::Relation::IsRelation(signature) || Signature::String::IsString(signature) || Signature::Constant::IsConstant(signature)) {
+			// 索引を引くだけなので、区切らずに解決する
+			return Signature::Find(signature, result, max);
+		}
+
 		size_t idx = 0;
 		std::string pattern;
 		if (!Signature::MakePatternFromSignature(signature, pattern, idx)) {
@@ -315,67 +362,141 @@ namespace Signature::Dialog
 			return false;
 		}
 
-		result = Util::FindMemAll(addr, size, pattern.c_str(), max);
+		// パターンの文字数だけ次の区切りに重ねて、区切りをまたぐ一致も見つける
+		// (重なった部分の一致は次の区切りで数える)
+		duint overlap = pattern.size();
+		for (duint offset = 0; offset < size; offset += kScanChunkSize) {
+			if (context.cancelled()) {
+				return false;
+			}
+			context.Progress(offset, size);
+
+			// 残りの数は、この区切りで数えた一致だけから求める
+			duint chunk = std::min<duint>(kScanChunkSize + overlap, size - offset);
+			for (duint p : Util::FindMemAll(addr + offset, chunk, pattern.c_str(), max ? max - result.size() : 0)) {
+				// 一致はアドレス順に返るので、重なった部分に入ったら残りもすべて次の区切りの分
+				if (p >= addr + offset + kScanChunkSize) {
+					break;
+				}
+				result.push_back(p);
+			}
+			if (max != 0 && result.size() >= max) {
+				break;
+			}
+		}
 		return true;
 	}
 
 	static void OnScanButton()
 	{
-		size_t max = 10;
-		std::vector<duint> result;
+		static constexpr size_t max = 10;
 
 		std::string pattern;
 		if (!GetSignature(pattern)) {
 			return;
 		}
-		if (!Find(pattern, result, max)) {
-			return;
-		}
+		std::string label;
+		bool hasLabel = GetTargetLabel(label);
+		bool output = BST_CHECKED == SendMessage(GetDlgItem(s_hDialog, IDC_CHECK), BM_GETCHECK, 0, 0);
 
-		if (result.size() == 0) {
-			_plugin_logprint("not found\n");
-		}
-		if (result.size() == 1) {
-			_plugin_logprint("1 occurrence found\n");
-			EnableWindow(GetDlgItem(s_hDialog, IDC_OK), true);
-		}
-		else if (result.size() >= max) {
-			_plugin_logprint("10+ occurrence found\n");
-		}
-		else {
-			_plugin_logprintf("%d occurrences found\n", result.size());
-		}
+		// スキャンはジョブのスレッドで行い、結果はGUIスレッドで表示する
+		auto result = std::make_shared<std::vector<duint>>();
+		auto found = std::make_shared<bool>(false);
 
-		//
-		// Output a result to Reference View にチェックが入っていれば、結果を出力する
-		//
-		if (BST_CHECKED == SendMessage(GetDlgItem(s_hDialog, IDC_CHECK), BM_GETCHECK, 0, 0)) {
-			GuiReferenceInitialize("Scan result");
-			GuiReferenceAddColumn(16, GuiTranslateText("Address"));
-			GuiReferenceAddColumn(60, GuiTranslateText("Disassembly"));
-			GuiReferenceSetRowCount(result.size());
-			GuiReferenceSetProgress(0);
-
-			char temp[32];
-			DISASM_INSTR inst;
-			duint idx = 0;
-			for (duint p : result) {
-				sprintf_s(temp, "%p", (PVOID)p);
-				GuiReferenceSetCellContent(idx, 0, temp);
-
-				DbgDisasmAt(p, &inst);
-				GuiReferenceSetCellContent(idx, 1, inst.instruction);
-				++idx;
+		auto stringAnchor = std::make_shared<std::string>();
+		auto constantAnchor = std::make_shared<std::string>();
+
+		auto work = [pattern, label, hasLabel, result, found, stringAnchor, constantAnchor](Job::Context& context) -> void {
+			*found = Find(pattern, *result, max, context);
+
+			// 一意に絞れない場合に提案する文字列参照と定数のシグネチャ (索引を作るので、ここで求めておく)
+			duint addr = 0;
+			if (*found && result->size() != 1 && hasLabel && !context.cancelled() && Script::Label::FromString(label.c_str(), &addr)) {
+				Signature::String::Describe(addr, *stringAnchor);
+				Signature::Constant::Describe(addr, *constantAnchor);
 			}
+		};
 
-			GuiReferenceSetProgress(100);
-			GuiUpdateAllViews();
-		}
+		auto finished = [pattern, label, hasLabel, output, result, found, stringAnchor, constantAnchor](bool cancelled) -> void {
+			if (cancelled || !*found || !DbgIsDebugging()) {
+				return;
+			}
+
+			if (result->size() == 0) {
+				_plugin_logprint("not found\n");
+			}
+			if (result->size() == 1) {
+				_plugin_logprint("1 occurrence found\n");
+
+				// スキャン中にシグネチャが書き換えられていなければ、作成できる
+				std::string current;
+				if (IsOpen() && GetSignature(current) && current == pattern) {
+					EnableWindow(GetDlgItem(s_hDialog, IDC_OK), true);
+				}
+			}
+			else if (result->size() >= max) {
+				_plugin_logprint("10+ occurrence found\n");
+			}
+			else {
+				_plugin_logprintf("%zu occurrences found\n", result->size());
+			}
+
+			//
+			// 一意に絞れない場合は、インポート関数の呼び出しや文字列の参照、定数をアンカーにしたシグネチャを提案する
+			//
+			if (result->size() != 1) {
+				duint addr = 0;
+				std::string anchor;
+				if (hasLabel && Script::Label::FromString(label.c_str(), &addr) && Signature::Anchor::MakeImportSignature(addr, anchor)) {
+					_plugin_logprintf("import anchor: %s\n", anchor.c_str());
+				}
+				if (stringAnchor->size()) {
+					_plugin_logprintf("string anchor: %s\n", stringAnchor->c_str());
+				}
+				if (constantAnchor->size()) {
+					_plugin_logprintf("constant anchor: %s\n", constantAnchor->c_str());
+				}
+			}
+
+			//
+			// Output a result to Reference View にチェックが入っていれば、結果を出力する
+			//
+			if (output) {
+				GuiReferenceInitialize("Scan result");
+				GuiReferenceAddColumn(16, GuiTranslateText("Address"));
+				GuiReferenceAddColumn(60, GuiTranslateText("Disassembly"));
+				GuiReferenceSetRowCount(result->size());
+				GuiReferenceSetProgress(0);
+
+				char temp[32];
+				DISASM_INSTR inst;
+				duint idx = 0;
+				for (duint p : *result) {
+					sprintf_s(temp, "%p", (PVOID)p);
+					GuiReferenceSetCellContent(idx, 0, temp);
+
+					DbgDisasmAt(p, &inst);
+					GuiReferenceSetCellContent(idx, 1, inst.instruction);
+					++idx;
+				}
+
+				GuiReferenceSetProgress(100);
+				GuiUpdateAllViews();
+			}
+		};
+
+		Job::Start("Scan", work, finished);
 	}
 
 
 	static void OnOKButton()
 	{
+		// Openなどのジョブが終わるまでは、シグネチャを変えない
+		if (Job::IsRunning()) {
+			_plugin_logprint("wait for the background job to finish\n");
+			return;
+		}
+
 		std::vector<duint> result;
 
 		std::string label;
@@ -403,7 +524,7 @@ namespace Signature::Dialog
 			return;
 		}
 
-		Signature::Set(label, pattern);
+		Signature::File::Set(label, pattern);
 
 		Destroy();
 
@@ -505,6 +626,7 @@ namespace Signature::Dialog
 			HWND hwnd = s_hDialog;
 			s_hDialog = nullptr;
 			s_dItems.clear();
+			s_labels.clear();
 			DestroyWindow(hwnd);
 		}
 	}
@@ -526,6 +648,7 @@ namespace Signature::Dialog
 		if (!GuiSelectionGet(GUI_DISASSEMBLY, &sel)) {
 			return;
 		}
+
 		if (sel.end - sel.start > 4096) {
 			return;
 		}
@@ -537,9 +660,14 @@ namespace Signature::Dialog
 		}
 
 		int numLabels = 0;
-		for (auto& elem : s_dItems) {
-			std::string label;
-			if (Util::GetLabel(elem.CodeOffset(), label) || elem.ContainsLabel(label)) {
+		s_labels.assign(s_dItems.size(), ItemLabel());
+		for (size_t i = 0; i < s_dItems.size(); ++i) {
+			auto& elem = s_dItems[i];
+			auto& labels = s_labels[i];
+			// 選んだ範囲のラベルはx64dbgに問い合わせて、索引を合わせておく
+			Util::RefreshLabel(elem.CodeOffset(), labels.own);
+			elem.ContainsLabel(labels.contained);
+			if (labels.display().size() > 0) {
 				numLabels++;
 			}
 		}
@@ -1,297 +1,1845 @@
 ﻿#include "pch.h"
 #include "SignatureFile.h"
+#include "SignatureRecord.h"
+#include "SignatureData.h"
+#include "SignatureDatabase.h"
+#include "SignatureJournal.h"
+#include "SignatureMerge.h"
+#include "SignatureRelation.h"
+#include "SignatureConstant.h"
+#include "SignatureStore.h"
+#include "SignatureString.h"
 #include "Util.h"
-#include "json11/json11.hpp"
-#include <sstream>
-#include <fstream>
-#include <iomanip>
+#include "LabelIndex.h"
+#include "LabelTransaction.h"
+#include "Job.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include "Signature.h"
+#include "MSPE.h"
 
 
-static json11::Json s_json;
+static Signature::Document s_document;
+// s_documentを変えるのはGUIスレッドだけだが、遅延モードの解決 (Resolve、ResolveAll) はほかのスレッドからも
+// s_documentのレコードを読むので、変えるときはs_lazyMutexをロックする
+static std::mutex s_lazyMutex;
+static Signature::Journal s_journal;		// s_documentを開いた (保存した) シグネチャファイルのジャーナル
+static std::string s_path;					// s_documentを開いた (保存した) シグネチャファイル
+static bool s_syncPosted = false;			// ジャーナルを書き出すfnをGUIスレッドに積んでいればtrue
 
 
-static bool GetJsonAddress(std::map<std::string, json11::Json>& addressMap, const std::string& moduleName, duint& address)
+// アドレス欄のどのキーから取得したか
+enum class AddressKey
 {
-	for (auto& kv : addressMap) {
-		auto& name = kv.first;
-		if (_stricmp(name.c_str(), moduleName.c_str()) == 0) {
-			auto& strAddress = kv.second.string_value();
-			if (strAddress == "deleted") {
-				address = 0;
-				return true;
+	kNone,
+	kIdentity,		// "SkyrimSE.exe@0123456789ABCDEF" ハッシュが一致 (ファイル名は別名にすぎない)
+	kLegacy			// "SkyrimSE.exe" 旧形式、ファイル名が一致しただけなので検証が必要
+};
+
+
+// キーがモジュール (ファイル名moduleName、ハッシュmoduleHash) を指しているか
+static AddressKey MatchAddressKey(const std::string& key, const std::string& moduleName, std::uint64_t moduleHash)
+{
+	std::string name;
+	std::uint64_t hash;
+	MSPE::Identity::ParseKey(key, name, hash);
+	if (hash) {
+		return hash == moduleHash ? AddressKey::kIdentity : AddressKey::kNone;
+	}
+	return _stricmp(name.c_str(), moduleName.c_str()) == 0 ? AddressKey::kLegacy : AddressKey::kNone;
+}
+
+
+// モジュール表のキーごとに MatchAddressKey() の結果を求めておく
+static std::vector<AddressKey> MatchAddressKeys(const Signature::Document& document, const std::string& moduleName, std::uint64_t moduleHash)
+{
+	std::vector<AddressKey> result(document.module_count());
+	for (std::uint32_t i = 0; i < result.size(); ++i) {
+		result[i] = MatchAddressKey(document.module(i), moduleName, moduleHash);
+	}
+	return result;
+}
+
+
+static std::vector<AddressKey> MatchAddressKeys(const Signature::Document& document, const MSPE::Identity& identity)
+{
+	return MatchAddressKeys(document, identity.name(), identity.hash());
+}
+
+
+static AddressKey GetAddress(const Signature::Record& record, const std::vector<AddressKey>& keys, duint& address)
+{
+	const Signature::Record::Address* legacy = nullptr;
+	for (auto& elem : record.addresses) {
+		switch (keys[elem.module]) {
+		case AddressKey::kIdentity:
+			address = elem.rva;
+			return AddressKey::kIdentity;
+		case AddressKey::kLegacy:
+			legacy = &elem;
+			break;
+		default:
+			break;
+		}
+	}
+	if (legacy) {
+		address = legacy->rva;
+		return AddressKey::kLegacy;
+	}
+	return AddressKey::kNone;
+}
+
+
+// "module"のレコードが、対象モジュールで"deleted"になっていればtrue
+// (対象モジュールのアドレス欄は、ファイル名だけのキーで持つ)
+static bool IsDeletedInTarget(const Signature::Document& document, const Signature::Record& record)
+{
+	duint rva;
+	return GetAddress(record, MatchAddressKeys(document, record.module, 0), rva) != AddressKey::kNone && rva == 0;
+}
+
+
+// このモジュールを指すアドレス (旧形式のキーも含む) を削除
+static void EraseAddress(Signature::Record& record, const std::vector<AddressKey>& keys)
+{
+	auto& addresses = record.addresses;
+	addresses.erase(std::remove_if(addresses.begin(), addresses.end(), [&keys](const Signature::Record::Address& elem) -> bool {
+		return keys[elem.module] != AddressKey::kNone;
+	}), addresses.end());
+}
+
+
+// レコードの対象がメインモジュール (ファイル名mainName) ならtrue。"module"が空ならメインモジュール
+static bool IsMainTarget(const Signature::Record& record, const std::string& mainName)
+{
+	return record.module.empty() || _stricmp(record.module.c_str(), mainName.c_str()) == 0;
+}
+
+
+// 対象モジュールの名前を比べるためのキー (小文字)
+static std::string TargetKey(const std::string& module)
+{
+	std::string key = module;
+	for (auto& c : key) {
+		c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+	}
+	return key;
+}
+
+
+// 旧形式のキーやファイル名の違うキーは、ハッシュ付きのキー (module) に置き換える
+static void SetAddress(Signature::Record& record, const std::vector<AddressKey>& keys, std::uint32_t module, duint address)
+{
+	EraseAddress(record, keys);
+	record.addresses.push_back({ module, address });
+}
+
+
+// 拡張子が.sigdbならシグネチャデータベース、それ以外はJSONとして読み書きする
+static bool LoadDocument(Signature::Document& document, const char* path, std::string& err)
+{
+	if (Util::HasExtension(path, ".sigdb")) {
+		return document.LoadDatabase(path, err);
+	}
+	return document.Load(path, err);
+}
+
+
+static bool SaveDocument(const Signature::Document& document, const char* path, std::string& err)
+{
+	if (Util::HasExtension(path, ".sigdb")) {
+		return document.SaveDatabase(path, err);
+	}
+	// 差分が読みやすいように、1行に1項目で書き出す
+	return document.Save(path, 2, err);
+}
+
+
+// ラベルのrvaと、unwind情報の指紋 (一意でなければ0) を求める。ラベルがなければfalseを返す
+static bool LookupLabel(const std::string& label, duint& rva, std::uint64_t& fingerprint)
+{
+	duint addr;
+	if (!Script::Label::FromString(label.c_str(), &addr)) {
+		return false;
+	}
+
+	auto& image = MSPE::Image::Get();
+	rva = addr - Script::Module::GetMainModuleBase();
+	fingerprint = 0;
+	if (image.contains_addr(addr)) {
+		fingerprint = MSPE::FingerprintTable::Get().GetUnique(image.rva(addr));
+	}
+	return true;
+}
+
+
+// 解決できているラベルそれぞれについて、ラベルの付いたほかの関数からの呼び出し関係を"relation"に記録する
+// 次のビルドでシグネチャが見つからなくなったときに、Propagateでたどって求める (メインモジュールのみ)
+static void DescribeRelations(Signature::Document& document, const std::vector<AddressKey>& keys, const std::string& mainName)
+{
+	std::unordered_map<std::uint32_t, const std::string*> labelAt;		// rva -> ラベル
+	for (auto& record : document) {
+		duint rva;
+		if (record.label.size() && IsMainTarget(record, mainName) && GetAddress(record, keys, rva) != AddressKey::kNone && rva) {
+			labelAt.emplace(static_cast<std::uint32_t>(rva), &record.label);
+		}
+	}
+	if (labelAt.empty()) {
+		return;
+	}
+
+	auto& functions = MSPE::FunctionTable::Get();
+	auto& xrefs = MSPE::XrefTable::Get();
+	auto lookup = [&labelAt](std::uint32_t rva) -> const std::string* {
+		auto it = labelAt.find(rva);
+		return it != labelAt.end() ? it->second : nullptr;
+	};
+
+	for (auto& record : document) {
+		// シグネチャそのものが呼び出し関係なら、記録しなくてよい
+		duint rva;
+		if (Signature::Relation::IsRelation(record.signature) || !IsMainTarget(record, mainName)
+			|| GetAddress(record, keys, rva) == AddressKey::kNone || rva == 0) {
+			continue;
+		}
+		Signature::Relation::Relation relation;
+		if (Signature::Relation::Describe(static_cast<std::uint32_t>(rva), lookup, functions, xrefs, relation)) {
+			record.relation = Signature::Relation::Format(relation);
+		}
+	}
+}
+
+
+// このビルドでアドレスの分かっているラベルそれぞれについて、関数の命令のハッシュを"code"に記録する
+// 次のビルドで同じハッシュの関数がただ1つあれば、シグネチャを検索せずにそこへ移す (TransferByCodeHash、メインモジュールのみ)
+// 関数の先頭でないラベルや、このビルドで一意でないハッシュは消しておく
+static void DescribeCodeHashes(Signature::Document& document, const std::vector<AddressKey>& keys, const std::string& mainName)
+{
+	const MSPE::CodeHashTable* hashes = nullptr;
+	for (auto& record : document) {
+		duint rva;
+		if (record.label.empty() || !IsMainTarget(record, mainName) || GetAddress(record, keys, rva) != AddressKey::kIdentity || rva == 0) {
+			continue;
+		}
+		if (!hashes) {
+			hashes = &MSPE::CodeHashTable::Get();
+		}
+		record.codeHash = hashes->GetUnique(static_cast<std::uint32_t>(rva));
+	}
+}
+
+
+// ジャーナルのエントリをdocumentに適用する
+// アドレス欄はSaveと同じ規則で更新するので、同じエントリを何度適用しても結果は変わらない
+static void ApplyJournal(Signature::Document& document, const Signature::Journal::Entry& entry)
+{
+	std::string name;
+	std::uint64_t hash;
+	MSPE::Identity::ParseKey(entry.module, name, hash);
+	std::uint32_t module = document.Intern(entry.module);
+	auto keys = MatchAddressKeys(document, name, hash);
+
+	switch (entry.op) {
+	case Signature::Journal::Op::kSet:
+	{
+		auto& record = document.Insert(entry.label);
+		if (record.signature != entry.signature) {
+			record.signature = entry.signature;
+			record.compiled = Signature::Database::npos;
+		}
+		if (entry.rva) {
+			SetAddress(record, keys, module, entry.rva);
+		}
+		else {
+			EraseAddress(record, keys);
+		}
+		// 一意でなくなった指紋は消す (古いビルドの指紋を残さない)
+		record.fingerprint = entry.fingerprint;
+		break;
+	}
+	case Signature::Journal::Op::kRemove:
+	{
+		size_t idx = document.Find(entry.label);
+		if (idx != Signature::Document::npos) {
+			SetAddress(document[idx], keys, module, 0);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+
+// 変更をs_documentとジャーナルに記録する
+// ジャーナルがkCompactSizeを超えたら、シグネチャファイルに書き出してジャーナルを空にする
+// (書き出した直後に落ちても、同じエントリを再生するだけなので結果は変わらない)
+// 次の追記を待たずにジャーナルをディスクに書き出すよう、残った分はGUIスレッドが空いたときに書き出す
+static void AppendJournal(const Signature::Journal::Entry& entry)
+{
+	{
+		std::lock_guard<std::mutex> lock(s_lazyMutex);
+		ApplyJournal(s_document, entry);
+	}
+	if (!s_journal.Append(entry)) {
+		_plugin_logprintf("cannot write the journal: \"%s\"\n", Signature::Journal::PathFor(s_journal.path().c_str()).c_str());
+		return;
+	}
+
+	if (s_journal.size() >= Signature::Journal::kCompactSize) {
+		std::string path = s_journal.path();
+		std::string err;
+		if (!SaveDocument(s_document, path.c_str(), err) || !s_journal.Create(path.c_str(), err)) {
+			_plugin_logprintf("%s\n", err.c_str());
+		}
+	}
+
+	// SetもRemoveもGUIスレッドから呼ばれるので、s_syncPostedもGUIスレッドだけで扱う
+	if (s_journal.dirty() && !s_syncPosted) {
+		s_syncPosted = true;
+		Job::Post([]() {
+			s_syncPosted = false;
+			s_journal.Sync();
+		});
+	}
+}
+
+
+// unwind情報の指紋が一意に一致する関数があれば、そのアドレスを返す (.textのスキャンはしない)
+static bool FindByFingerprint(const Signature::Document& document, const Signature::Record& record, duint& rva)
+{
+	if (record.fingerprint == 0) {
+		return false;
+	}
+
+	auto& functions = MSPE::FunctionTable::Get();
+	size_t idx = MSPE::FingerprintTable::Get().FindUnique(record.fingerprint);
+	if (idx == MSPE::FunctionTable::npos) {
+		return false;
+	}
+
+	// シグネチャが一致しなければ、スキャンに任せる
+	// (ラベルが呼び出し先にあるシグネチャは、この関数を呼ぶ命令のほうで一致を確かめる)
+	duint addr = MSPE::Image::Get().base() + functions[idx].begin;
+	if (!document.Verify(record, addr)) {
+		return false;
+	}
+
+	rva = functions[idx].begin;
+	return true;
+}
+
+
+// Openでのレコード1件の解決
+//   1. 呼び出し元のスレッドで、アドレス欄を引いてシグネチャをコンパイルする
+//   2. ワーカースレッドで、メインモジュールのスナップショット (MSPE::Image) から解決する
+//   3. 呼び出し元のスレッドで、レコードの順にラベルをためてログを出す
+// アンカー形式やコンパイルできないシグネチャは、3でx64dbg経由で解決する
+// データ形式のシグネチャは、2でスナップショットのセクションから解決する
+// 文字列参照と定数の形式のシグネチャは、2で索引から解決する
+// 3で見つからなかったラベルと呼び出し関係の形式のシグネチャは、解決できたラベルから呼び出し関係をたどって求める (Propagate)
+// Openでは1～3をジョブのスレッドで行い、シグネチャの登録とラベルの適用だけGUIスレッドで行う
+// ほかのモジュールを対象にしたレコードは、そのモジュールが読み込まれたときにResolveModulesで解決する
+struct Resolution
+{
+	enum class Method
+	{
+		kSkip,			// ラベルが空か"deleted"
+		kSerial,		// 3でSignature::Find(signature) を使う
+		kParallel,		// 2でスナップショットから解決する
+		kData,			// 2でスナップショットのセクションから解決する (データ形式)
+		kString,		// 2で文字列と参照の索引から解決する (文字列参照の形式)
+		kConstant,		// 2で定数の索引から解決する (定数の形式)
+		kRelation,		// 3のあとで、解決できたラベルから呼び出し関係をたどる (呼び出し関係の形式)
+		kModule			// 対象がほかのモジュール (ResolveModulesで解決する)
+	};
+
+	const Signature::Record*	record = nullptr;
+	Method						method = Method::kSkip;
+	AddressKey					key = AddressKey::kNone;
+	duint						rva = 0;				// アドレス欄の値、解決できたらそのrva
+	Signature::Pattern			pattern;
+	Signature::Data::Pattern	data;					// データ形式のシグネチャ
+	Signature::String::Literal	literal;				// 文字列参照の形式のシグネチャ
+	std::vector<std::uint64_t>	constants;				// 定数の形式のシグネチャ
+
+	bool						stale = false;			// アドレス欄の値がシグネチャと一致しなかった
+	bool						fromUnwind = false;		// unwind情報の指紋から取得した
+	bool						fromCode = false;		// 命令のハッシュから取得した
+	bool						fromRelation = false;	// 解決できたラベルから呼び出し関係をたどって求めた
+	bool						searched = false;		// 検索した
+	bool						found = false;			// 検索がtrueを返した
+	size_t						errors = 0;				// 検索中の逆アセンブル失敗 (ログに出していない分)
+	std::vector<duint>			result;
+};
+
+
+// 2で使う索引 (メインモジュールのみ)。使うシグネチャがあるときだけ作る (なければnullptr)
+struct SnapshotIndexes
+{
+	const MSPE::StringTable*	strings = nullptr;		// 文字列参照の形式
+	const MSPE::XrefTable*		xrefs = nullptr;		// 文字列参照の形式
+	const MSPE::ConstantTable*	constants = nullptr;	// 定数の形式
+};
+
+
+// 索引から引いて解決する (文字列参照と定数の形式)
+static void ResolveIndexed(Resolution& res, const MSPE::Image& image, const MSPE::FunctionTable& functions, const SnapshotIndexes& indexes)
+{
+	auto find = [&](std::vector<duint>& result, size_t maxResult) -> void {
+		if (res.method == Resolution::Method::kString) {
+			Signature::String::Find(image, functions, *indexes.strings, *indexes.xrefs, res.literal, result, maxResult);
+		}
+		else {
+			Signature::Constant::Find(image, functions, *indexes.constants, res.constants, result, maxResult);
+		}
+	};
+
+	// 索引を引くだけなので、アドレス欄は引いた結果に含まれるかで確かめる
+	if (res.key == AddressKey::kLegacy) {
+		std::vector<duint> found;
+		find(found, 0);
+		if (std::find(found.begin(), found.end(), image.base() + res.rva) == found.end()) {
+			res.stale = true;
+			res.rva = 0;
+		}
+	}
+	if (res.rva) {
+		return;
+	}
+	res.searched = true;
+	res.found = true;
+	find(res.result, 2);
+}
+
+
+// 2. スナップショットから解決する (ワーカースレッド)
+// メインモジュール以外のスナップショットには関数テーブルがないので、functionsとfingerprintsはnullptr
+static void ResolveSnapshot(Resolution& res, const MSPE::Image& image, const MSPE::FunctionTable* functions,
+	const MSPE::FingerprintTable* fingerprints, const SnapshotIndexes& indexes = SnapshotIndexes())
+{
+	if (res.method == Resolution::Method::kString || res.method == Resolution::Method::kConstant) {
+		ResolveIndexed(res, image, *functions, indexes);
+		return;
+	}
+
+	if (res.method == Resolution::Method::kData) {
+		// データには関数の指紋がないので、アドレス欄を確かめたらすぐにセクションを検索する
+		if (res.key == AddressKey::kLegacy && !Signature::Data::Verify(image, res.data, image.base() + res.rva)) {
+			res.stale = true;
+			res.rva = 0;
+		}
+		if (res.rva) {
+			return;
+		}
+		res.searched = true;
+		res.found = Signature::Data::Find(image, res.data, res.result, 2);
+		return;
+	}
+
+	auto pattern = res.pattern.view();
+	if (res.key == AddressKey::kLegacy && !Signature::Verify(image, pattern, image.base() + res.rva)) {
+		// ファイル名だけ同じ別のビルドのアドレス
+		res.stale = true;
+		res.rva = 0;
+	}
+	if (res.rva) {
+		return;
+	}
+
+	// ラベルが呼び出し先にあるシグネチャも、Verifyが関数を参照する命令から確かめる
+	if (res.record->fingerprint && fingerprints) {
+		size_t idx = fingerprints->FindUnique(res.record->fingerprint);
+		if (idx != MSPE::FunctionTable::npos && Signature::Verify(image, pattern, image.base() + (*functions)[idx].begin)) {
+			res.rva = (*functions)[idx].begin;
+			res.fromUnwind = true;
+			return;
+		}
+	}
+
+	res.searched = true;
+	res.found = Signature::Find(image, pattern, res.result, 2, res.errors);
+}
+
+
+// 3. x64dbg経由で解決する (呼び出し元のスレッド)
+static void ResolveSerial(const Signature::Document& document, Resolution& res, duint mainModBase)
+{
+	if (res.key == AddressKey::kLegacy && !document.Verify(*res.record, mainModBase + res.rva)) {
+		// ファイル名だけ同じ別のビルドのアドレス
+		res.stale = true;
+		res.rva = 0;
+	}
+	if (res.rva) {
+		return;
+	}
+
+	if (FindByFingerprint(document, *res.record, res.rva)) {
+		res.fromUnwind = true;
+		return;
+	}
+
+	res.searched = true;
+	res.found = Signature::Find(res.record->signature, res.result, 2);
+}
+
+
+struct OpenCounters
+{
+	size_t	fromCache = 0;
+	size_t	stale = 0;
+	size_t	fromUnwind = 0;
+	size_t	fromCode = 0;
+	size_t	fromRelation = 0;
+	size_t	match = 0;
+	size_t	missing = 0;
+	size_t	manyMatch = 0;
+	size_t	duplicate = 0;
+};
+
+
+static void RegisterSignature(const Signature::Record& record, OpenCounters& counters)
+{
+	if (Signature::Get(record.label)) {
+		// 同じラベルに複数のシグネチャが付いている
+		// .jsonファイルがおかしいので直接編集する必要があるかも
+		counters.duplicate++;
+		_plugin_logprintf("<warning> duplicate entry: \"%s\"\n", record.label.c_str());
+	}
+	else {
+		Signature::Set(record.label, record.signature);
+	}
+}
+
+
+// 3. 解決した結果のラベルをlabelsにため、ログを出す (呼び出し元のスレッド)
+// moduleBaseは対象モジュールのベースアドレス (res.rvaの基準)
+static void ApplyResolution(Resolution& res, duint moduleBase, Util::LabelTransaction& labels, OpenCounters& counters)
+{
+	const std::string& label = res.record->label;
+	const std::string& signature = res.record->signature;
+
+	if (res.stale) {
+		counters.stale++;
+	}
+
+	if (res.fromRelation) {
+		// シグネチャは見つからなかったが、呼び出し関係から求めた
+		counters.fromRelation++;
+		labels.Set(label, moduleBase + res.rva);
+		return;
+	}
+
+	// スナップショットから検索したときに出せなかったログ
+	if ((res.method == Resolution::Method::kParallel || res.method == Resolution::Method::kData) && res.searched) {
+		for (size_t i = 0; i < res.errors; ++i) {
+			_plugin_logprint("disasemble error\n");
+		}
+		if (!res.found) {
+			_plugin_logprint("maybe fatal error\n");
+		}
+	}
+
+	if (!res.searched) {
+		if (res.fromCode) {
+			// 命令のハッシュから取得
+			counters.fromCode++;
+		}
+		else if (res.fromUnwind) {
+			// unwind情報の指紋から取得
+			counters.fromUnwind++;
+		}
+		else {
+			// すでにアドレス取得済み
+			counters.fromCache++;
+		}
+	}
+	else if (res.found) {
+		if (res.result.size() == 0) {
+			// 検索に失敗
+			counters.missing++;
+			_plugin_logprintf("do not match signature\n");
+			_plugin_logprintf("    label:     \"%s\"\n", label.c_str());
+			_plugin_logprintf("    signature: \"%s\"\n", signature.c_str());
+		}
+		else {
+			res.rva = res.result.front() - moduleBase;
+			if (res.result.size() == 1) {
+				// シグネチャからアドレス取得成功
+				counters.match++;
+			}
+			else {
+				// 取得には成功したものの、複数マッチしている
+				counters.manyMatch++;
+				_plugin_logprintf("too many match signature\n");
+				_plugin_logprintf("    label:     \"%s\"\n", label.c_str());
+				_plugin_logprintf("    signature: \"%s\"\n", signature.c_str());
 			}
-			std::size_t idx;
-			try {
-				int d = std::stoi(strAddress, &idx, 0);
-				address = idx == strAddress.size() ? d : 0;
+		}
+	}
+
+	if (res.rva) {
+		labels.Set(label, moduleBase + res.rva);
+	}
+}
+
+
+// シグネチャをコンパイルして、解決の方法を決める
+static void CompileResolution(const Signature::Document& document, const Signature::Record& record, Resolution& res)
+{
+	if (Signature::Data::Parse(record.signature, res.data)) {
+		res.method = Resolution::Method::kData;
+	}
+	else if (Signature::String::Parse(record.signature, res.literal)) {
+		res.method = Resolution::Method::kString;
+	}
+	else if (Signature::Constant::Parse(record.signature, res.constants)) {
+		res.method = Resolution::Method::kConstant;
+	}
+	else if (Signature::Relation::IsRelation(record.signature)) {
+		res.method = Resolution::Method::kRelation;
+	}
+	else if (document.Compile(record, res.pattern)) {
+		res.method = Resolution::Method::kParallel;
+	}
+	else {
+		res.method = Resolution::Method::kSerial;
+	}
+}
+
+
+// 1. アドレス欄を引き、シグネチャをコンパイルする (呼び出し元のスレッド)
+// keysはメインモジュール (ファイル名mainName) のキー
+static void PrepareResolution(const Signature::Document& document, Resolution& res, const Signature::Record& record,
+	const std::vector<AddressKey>& keys, const std::string& mainName)
+{
+	res.record = &record;
+	if (record.label.size() == 0) {
+		return;
+	}
+
+	if (!IsMainTarget(record, mainName)) {
+		if (!IsDeletedInTarget(document, record)) {
+			res.method = Resolution::Method::kModule;
+		}
+		return;
+	}
+
+	res.key = GetAddress(record, keys, res.rva);
+	if (res.key != AddressKey::kNone && res.rva == 0) {
+		return;		// deleted
+	}
+
+	CompileResolution(document, record, res);
+}
+
+
+// 解決できたrva (アドレス欄か、ただ1つ見つかった検索結果)。なければ0
+static duint GetResolvedRva(const Resolution& res, duint moduleBase)
+{
+	if (res.rva) {
+		return res.rva;
+	}
+	if (res.searched && res.found && res.result.size() == 1) {
+		return res.result.front() - moduleBase;
+	}
+	return 0;
+}
+
+
+// 見つからなかったラベルと呼び出し関係の形式のシグネチャを、解決できたラベルから呼び出し関係をたどって求める
+// 求めたラベルもアンカーとしてワークリストに積み、求められなくなるまでたどる (メインモジュールのみ)
+// knownLabelsはSecundaが張ったラベルの写し。nullptrならLabelIndexを引く (GUIスレッドのみ)
+static void Propagate(std::vector<Resolution>& resolutions, const std::unordered_map<std::string, duint>* knownLabels)
+{
+	auto& image = MSPE::Image::Get();
+
+	std::vector<Signature::Relation::Relation> relations(resolutions.size());
+	std::unordered_map<std::string, std::vector<size_t>> dependents;		// アンカーのラベル -> たどるレコード
+	for (size_t i = 0; i < resolutions.size(); ++i) {
+		auto& res = resolutions[i];
+		const std::string* relation = nullptr;
+		if (res.method == Resolution::Method::kRelation) {
+			relation = &res.record->signature;
+		}
+		else if ((res.method == Resolution::Method::kParallel || res.method == Resolution::Method::kSerial || res.method == Resolution::Method::kData
+			|| res.method == Resolution::Method::kString || res.method == Resolution::Method::kConstant) && res.searched && res.result.empty() && res.record->relation.size()) {
+			relation = &res.record->relation;
+		}
+		if (!relation) {
+			continue;
+		}
+		if (res.method == Resolution::Method::kRelation && res.key == AddressKey::kLegacy && res.rva) {
+			// ファイル名だけ同じ別のビルドのアドレスは使わず、たどり直す
+			res.stale = true;
+			res.rva = 0;
+		}
+		if (res.rva) {
+			continue;
+		}
+		if (Signature::Relation::Parse(*relation, relations[i])) {
+			dependents[relations[i].anchor].push_back(i);
+		}
+	}
+
+	//
+	// ワークリストの初期値は解決できたラベル。このファイルになければ、Secundaが張ったラベルも使う
+	//
+	std::unordered_map<std::string, std::uint32_t> resolved;
+	std::vector<std::string> worklist;
+	for (auto& res : resolutions) {
+		if (res.method == Resolution::Method::kSkip || res.method == Resolution::Method::kModule) {
+			continue;
+		}
+		duint rva = GetResolvedRva(res, image.base());
+		if (rva && dependents.count(res.record->label) && resolved.emplace(res.record->label, static_cast<std::uint32_t>(rva)).second) {
+			worklist.push_back(res.record->label);
+		}
+	}
+	auto findKnown = [knownLabels](const std::string& label, duint& addr) -> bool {
+		if (!knownLabels) {
+			return Util::LabelIndex::Get().FindAddress(label, addr);
+		}
+		auto it = knownLabels->find(label);
+		if (it == knownLabels->end()) {
+			return false;
+		}
+		addr = it->second;
+		return true;
+	};
+	for (auto& kv : dependents) {
+		duint addr;
+		if (!resolved.count(kv.first) && findKnown(kv.first, addr) && image.contains_addr(addr)) {
+			resolved.emplace(kv.first, image.rva(addr));
+			worklist.push_back(kv.first);
+		}
+	}
+
+	// 参照の表は、たどるアンカーがあるときだけ作る
+	if (!worklist.empty()) {
+		auto& functions = MSPE::FunctionTable::Get();
+		auto& xrefs = MSPE::XrefTable::Get();
+		std::vector<std::uint32_t> derived;
+		while (!worklist.empty()) {
+			std::string anchor = std::move(worklist.back());
+			worklist.pop_back();
+
+			auto it = dependents.find(anchor);
+			if (it == dependents.end()) {
+				continue;
+			}
+			std::vector<size_t> indices = std::move(it->second);
+			dependents.erase(it);
+
+			std::uint32_t anchorRva = resolved[anchor];
+			for (size_t i : indices) {
+				auto& res = resolutions[i];
+				derived.clear();
+				Signature::Relation::Derive(relations[i], anchorRva, functions, xrefs, derived);
+				if (derived.size() != 1) {
+					continue;
+				}
+				res.rva = derived.front();
+				res.fromRelation = true;
+
+				// 求めたラベルをたどるレコードがあれば、次のアンカーにする
+				const std::string& label = res.record->label;
+				if (dependents.count(label) && resolved.emplace(label, derived.front()).second) {
+					worklist.push_back(label);
+				}
+			}
+		}
+	}
+
+	// たどれなかった呼び出し関係の形式のシグネチャは、見つからなかったものとして数える
+	for (auto& res : resolutions) {
+		if (res.method == Resolution::Method::kRelation && !res.rva) {
+			res.searched = true;
+			res.found = true;
+		}
+	}
+}
+
+
+// 前のビルドで記録した命令のハッシュ ("code") と、このビルドのすべての関数のハッシュを突き合わせる
+// ただ1つの関数と一致したレコードは、シグネチャを検証も検索もせずにその関数にする (変わっていない関数)
+// 変わった関数だけが 2. と 3. の検索に残る。データ形式は関数ではないので使わない
+static void TransferByCodeHash(std::vector<Resolution>& resolutions)
+{
+	auto transferable = [](const Resolution& res) -> bool {
+		return res.record && res.record->codeHash && res.key != AddressKey::kIdentity && (res.rva == 0 || res.key == AddressKey::kLegacy)
+			&& res.method != Resolution::Method::kSkip && res.method != Resolution::Method::kModule && res.method != Resolution::Method::kData;
+	};
+	if (std::none_of(resolutions.begin(), resolutions.end(), transferable)) {
+		return;
+	}
+
+	auto& functions = MSPE::FunctionTable::Get();
+	auto& hashes = MSPE::CodeHashTable::Get();
+	for (auto& res : resolutions) {
+		if (!transferable(res)) {
+			continue;
+		}
+		size_t idx = hashes.FindUnique(res.record->codeHash);
+		if (idx == MSPE::FunctionTable::npos) {
+			continue;
+		}
+		if (res.key == AddressKey::kLegacy && res.rva != functions[idx].begin) {
+			// ファイル名だけ同じ別のビルドのアドレス
+			res.stale = true;
+		}
+		// アドレス欄はもう確かめなくてよい
+		res.key = AddressKey::kNone;
+		res.rva = functions[idx].begin;
+		res.fromCode = true;
+	}
+}
+
+
+// 2. と 3. を行い、張るラベルをlabelsにためる
+// contextがあれば進み具合を知らせ、中止を求められたら途中でfalseを返す
+// ジョブのスレッドから呼ぶときは、GUIスレッドで取ったLabelIndexの写しをknownLabelsに渡す
+static bool ResolveRecords(const Signature::Document& document, std::vector<Resolution>& resolutions, duint mainModBase,
+	Util::LabelTransaction& labels, OpenCounters& counters, Job::Context* context = nullptr,
+	const std::unordered_map<std::string, duint>* knownLabels = nullptr)
+{
+	// 変わっていない関数は、命令のハッシュでまとめて移す
+	TransferByCodeHash(resolutions);
+
+	// アドレス欄のハッシュが一致したものは、検証も検索もいらない
+	std::vector<size_t> pending;
+	for (size_t i = 0; i < resolutions.size(); ++i) {
+		auto& res = resolutions[i];
+		if ((res.method == Resolution::Method::kParallel || res.method == Resolution::Method::kData || res.method == Resolution::Method::kString
+			|| res.method == Resolution::Method::kConstant) && res.key != AddressKey::kIdentity) {
+			pending.push_back(i);
+		}
+	}
+
+	//
+	// 2. ワーカースレッドで、スナップショットから解決する
+	// テーブルはここで作っておき、ワーカースレッドからは読むだけにする
+	//
+	auto& image = MSPE::Image::Get();
+	auto& functions = MSPE::FunctionTable::Get();
+	auto& fingerprints = MSPE::FingerprintTable::Get();
+	SnapshotIndexes indexes;
+	for (size_t i : pending) {
+		if (resolutions[i].method == Resolution::Method::kString && !indexes.strings) {
+			indexes.strings = &MSPE::StringTable::Get();
+			indexes.xrefs = &MSPE::XrefTable::Get();
+		}
+		if (resolutions[i].method == Resolution::Method::kConstant && !indexes.constants) {
+			indexes.constants = &MSPE::ConstantTable::Get();
+		}
+	}
+	size_t total = pending.size() + resolutions.size();
+	std::atomic<size_t> done = 0;
+	Util::ParallelFor(pending.size(), [&](size_t i) {
+		if (context && context->cancelled()) {
+			return;
+		}
+		ResolveSnapshot(resolutions[pending[i]], image, &functions, &fingerprints, indexes);
+		if (context) {
+			context->Progress(++done, total);
+		}
+	});
+
+	//
+	// 3. x64dbg経由で解決する
+	//
+	for (auto& res : resolutions) {
+		if (context) {
+			if (context->cancelled()) {
+				return false;
+			}
+			context->Progress(++done, total);
+		}
+		if (res.method == Resolution::Method::kSerial) {
+			ResolveSerial(document, res, mainModBase);
+		}
+	}
+
+	// 見つからなかったラベルを、解決できたラベルから呼び出し関係をたどって求める
+	Propagate(resolutions, knownLabels);
+
+	//
+	// レコードの順に結果をまとめる (ログと集計は1件ずつ順に解決したときと同じになる)
+	// ラベルは呼び出し元でまとめて張り、画面の更新も1回にする
+	//
+	for (auto& res : resolutions) {
+		if (res.method == Resolution::Method::kSkip || res.method == Resolution::Method::kModule) {
+			continue;
+		}
+		ApplyResolution(res, mainModBase, labels, counters);
+	}
+	return true;
+}
+
+
+static void LogCounters(const OpenCounters& counters)
+{
+	if (counters.fromCache) {
+		_plugin_logprintf("   cache:%zu", counters.fromCache);
+	}
+	if (counters.stale) {
+		_plugin_logprintf("   stale cache:%zu", counters.stale);
+	}
+	if (counters.fromCode) {
+		_plugin_logprintf("   code:%zu", counters.fromCode);
+	}
+	if (counters.fromUnwind) {
+		_plugin_logprintf("   unwind:%zu", counters.fromUnwind);
+	}
+	if (counters.fromRelation) {
+		_plugin_logprintf("   relation:%zu", counters.fromRelation);
+	}
+	if (counters.match) {
+		_plugin_logprintf("   match:%zu", counters.match);
+	}
+	if (counters.missing) {
+		_plugin_logprintf("   missing:%zu", counters.missing);
+	}
+	if (counters.manyMatch) {
+		_plugin_logprintf("   too many match:%zu", counters.manyMatch);
+	}
+	if (counters.duplicate) {
+		_plugin_logprintf("   duplicate entry:%zu", counters.duplicate);
+	}
+}
+
+
+
+//
+// メインモジュール以外を対象にしたシグネチャ ("module")
+//   対象モジュールが読み込まれたときに、そのモジュールのレコードだけを解決する
+//   解決したモジュールはベースアドレスを覚えておき、同じモジュールを二度は検索しない
+//   (s_documentと同じく、GUIスレッドで扱う)
+//
+
+static std::unordered_map<std::string, std::vector<size_t>> s_targets;		// 対象モジュール (小文字) -> s_documentのインデックス
+static std::unordered_map<std::string, duint> s_resolvedModules;			// 解決済みの対象モジュール (小文字) -> ベースアドレス
+
+
+// s_documentから対象モジュールごとのレコードを集め直す (s_documentを読み込んだとき)
+static void CollectTargets(const std::string& mainName)
+{
+	s_targets.clear();
+	s_resolvedModules.clear();
+	for (size_t i = 0; i < s_document.size(); ++i) {
+		auto& record = s_document[i];
+		if (record.label.size() == 0 || IsMainTarget(record, mainName) || IsDeletedInTarget(s_document, record)) {
+			continue;
+		}
+		s_targets[TargetKey(record.module)].push_back(i);
+	}
+}
+
+
+// 対象モジュールnameを、baseに読み込まれたものとしては解決していないことにする
+static void ForgetTarget(const std::string& name, duint base)
+{
+	auto resolved = s_resolvedModules.find(name);
+	if (resolved != s_resolvedModules.end() && resolved->second == base) {
+		s_resolvedModules.erase(resolved);
+	}
+}
+
+
+// 読み込まれている対象モジュールのうち、まだ解決していないものを解決してラベルを張る
+// スナップショットと検索はジョブのスレッドで、ラベルは終わったあとにGUIスレッドで張る
+// ほかのジョブが動いていれば、それが終わってから解決する
+static bool s_targetsDeferred = false;
+
+static void ResolveTargets()
+{
+	// LOADDLLから送られたものが、デバッグを終えたあとに届くことがある
+	if (!DbgIsDebugging()) {
+		return;
+	}
+	if (Job::IsRunning()) {
+		if (!s_targetsDeferred) {
+			s_targetsDeferred = true;
+			Job::PostWhenIdle([]() {
+				s_targetsDeferred = false;
+				ResolveTargets();
+			});
+		}
+		return;
+	}
+
+	// ジョブの間にs_documentが変わってもよいように、レコードは写しを使う
+	struct Target
+	{
+		std::string						name;
+		duint							base = 0;
+		std::vector<Signature::Record>	records;
+		std::vector<Resolution>			resolutions;
+	};
+	auto targets = std::make_shared<std::vector<Target>>();
+
+	for (auto& kv : s_targets) {
+		duint base = Script::Module::BaseFromName(kv.first.c_str());
+		if (base == 0) {
+			continue;
+		}
+		auto resolved = s_resolvedModules.find(kv.first);
+		if (resolved != s_resolvedModules.end() && resolved->second == base) {
+			continue;
+		}
+		s_resolvedModules.insert_or_assign(kv.first, base);
+
+		Target target;
+		target.name = kv.first;
+		target.base = base;
+		auto keys = MatchAddressKeys(s_document, kv.first, 0);
+		target.records.reserve(kv.second.size());
+		for (size_t idx : kv.second) {
+			target.records.push_back(s_document[idx]);
+		}
+		target.resolutions.resize(target.records.size());
+		for (size_t i = 0; i < target.records.size(); ++i) {
+			auto& res = target.resolutions[i];
+			auto& record = target.records[i];
+			res.record = &record;
+			res.key = GetAddress(record, keys, res.rva);
+			CompileResolution(s_document, record, res);
+		}
+		targets->push_back(std::move(target));
+	}
+	if (targets->empty()) {
+		return;
+	}
+
+	auto work = [targets](Job::Context& context) -> void {
+		std::atomic<size_t> done = 0;
+		Util::ParallelFor(targets->size(), [targets, &context, &done](size_t i) {
+			auto& target = (*targets)[i];
+			if (context.cancelled()) {
+				return;
 			}
-			catch (const std::invalid_argument & e) {
-				_plugin_logprintf("invalid argument error in std::stoi()\n");
-				if (e.what()) {
-					_plugin_logprintf(e.what());
+			auto image = MSPE::Image::Snapshot(target.base);
+			if (image->size() != 0) {
+				for (auto& res : target.resolutions) {
+					if (res.method == Resolution::Method::kParallel || res.method == Resolution::Method::kData) {
+						ResolveSnapshot(res, *image, nullptr, nullptr);
+					}
 				}
-				_plugin_logprintf(strAddress.c_str());
-				_plugin_logprintf("\n");
-				address = 0;
-			}
-			catch (const std::out_of_range & e) {
-				_plugin_logprintf("out of range error in std::stoi()\n");
-				if (e.what()) {
-					_plugin_logprintf(e.what());
+			}
+			context.Progress(++done, targets->size());
+		});
+	};
+
+	auto finished = [targets](bool cancelled) -> void {
+		if (cancelled || !DbgIsDebugging()) {
+			// 次に読み込まれたときに、もう一度解決する
+			for (auto& target : *targets) {
+				ForgetTarget(target.name, target.base);
+			}
+			return;
+		}
+
+		Util::LabelTransaction labels;
+		for (auto& target : *targets) {
+			OpenCounters counters;
+			for (auto& res : target.resolutions) {
+				if (res.method == Resolution::Method::kSerial || res.method == Resolution::Method::kRelation || res.method == Resolution::Method::kString
+					|| res.method == Resolution::Method::kConstant) {
+					// アンカー形式、呼び出し関係、文字列参照と定数の形式はメインモジュールの表を使うので、ほかのモジュールでは使えない
+					counters.missing++;
+					_plugin_logprintf("<warning> the signature is not supported outside the main module: \"%s\"\n", res.record->label.c_str());
+					continue;
 				}
-				_plugin_logprintf(strAddress.c_str());
-				_plugin_logprintf("\n");
-				address = 0;
+				ApplyResolution(res, target.base, labels, counters);
 			}
-			return true;
+
+			_plugin_logprint("[ SECUNDA MOON -> Module ]");
+			_plugin_logprintf("   module:%s", target.name.c_str());
+			LogCounters(counters);
+			_plugin_logprint("\n");
+		}
+		labels.Commit();
+	};
+
+	if (!Job::Start("Resolve modules", work, finished)) {
+		for (auto& target : *targets) {
+			ForgetTarget(target.name, target.base);
 		}
 	}
-	return false;
 }
 
 
-static bool GetJsonAddress(json11::Json& json, const std::string& moduleName, duint& address)
+
+//
+// 遅延モード
+//   OpenLazyではラベルとシグネチャを登録するだけで、アドレスは必要になったときに1件ずつ解決する
+//   (式関数 sig.<ラベル>、SigResolve、Show signatures)。解決した結果は覚えておく
+//
+
+static std::unordered_map<std::string, size_t> s_pending;		// まだ解決していないラベル -> s_documentのインデックス
+static std::unordered_map<std::string, duint> s_resolved;		// 解決済みのラベル -> rva (見つからなければ0)
+
+// 登録した式関数
+struct ExprFunction
 {
-	auto addressMap = json["address"].object_items();
-	return GetJsonAddress(addressMap, moduleName, address);
-}
+	std::string		name;		// "sig." + ラベル (式に使えない文字は'_'に置き換える)
+	std::string		label;
+};
+static std::vector<ExprFunction> s_exprFunctions;
 
 
-static void SetJsonAddress(std::map<std::string, json11::Json>& addressMap, const std::string& moduleName, duint address)
+static duint LabelExprFunction(int argc, duint* argv, void* userdata)
 {
-	std::ostringstream oss;
-	if (address == 0) {
-		oss << "deleted";
-	}
-	else {
-		oss << "0x" << std::hex << std::uppercase << std::setfill('0') << std::setw(8) << address;
+	size_t idx = reinterpret_cast<size_t>(userdata);
+	std::string label;
+	{
+		std::lock_guard<std::mutex> lock(s_lazyMutex);
+		if (idx >= s_exprFunctions.size()) {
+			return 0;
+		}
+		label = s_exprFunctions[idx].label;
 	}
 
-	for (auto& kv : addressMap) {
-		auto& name = kv.first;
-		if (_stricmp(name.c_str(), moduleName.c_str()) == 0) {
-			addressMap.insert_or_assign(name, oss.str());
-			return;
+	duint addr = 0;
+	Signature::File::Resolve(label, addr);
+	return addr;
+}
+
+
+static std::string ExprFunctionName(const std::string& label)
+{
+	std::string name = "sig." + label;
+	for (auto& c : name) {
+		if (!isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '.') {
+			c = '_';
 		}
 	}
-	addressMap.insert_or_assign(moduleName, oss.str());
+	return name;
+}
+
+
+// 遅延モードをやめる (s_lazyMutexをロックして呼ぶ)
+static void ResetLazy()
+{
+	for (auto& function : s_exprFunctions) {
+		_plugin_unregisterexprfunction(pluginHandle, function.name.c_str());
+	}
+	s_exprFunctions.clear();
+	s_pending.clear();
+	s_resolved.clear();
 }
 
 
-static void SetJsonAddress(json11::Json& json, const std::string& moduleName, duint address)
+// 遅延モードで解決済み・解決待ちのラベルを忘れる (シグネチャを登録・削除したとき)
+static void ForgetLazy(const std::string& label)
 {
-	auto jsonMap = json.object_items();
-	auto addressMap = json["address"].object_items();
-	SetJsonAddress(addressMap, moduleName, address);
-	jsonMap.insert_or_assign("address", json11::Json(addressMap));
-	json = json11::Json(jsonMap);
+	std::lock_guard<std::mutex> lock(s_lazyMutex);
+	s_pending.erase(label);
+	s_resolved.erase(label);
 }
 
 
-static void EraseJsonAddress(std::map<std::string, json11::Json>& addressMap, const std::string& moduleName)
+// 遅延モードで解決待ちのラベルを解決して、s_resolvedに移す。labelがnullptrなら、解決待ちをすべて解決する
+// 式関数やSigResolveのスレッドから呼ばれるので、s_lazyMutexをロックするのはレコードを写す間と結果を移す間だけにして、
+// 検索はロックを外して行う。ラベルはGUIスレッドで張る (s_lazyMutexをロックせずに呼ぶ)
+// recordsは解決したレコードの写しで、resolutionsはそれを指す
+static void ResolveLazy(const std::string* label, duint mainModBase, std::vector<Signature::Record>& records,
+	std::vector<Resolution>& resolutions, OpenCounters& counters)
 {
-	for (auto it = addressMap.begin(); it != addressMap.end(); ++it) {
-		const std::string& name = it->first;
-		if (_stricmp(name.c_str(), moduleName.c_str()) == 0) {
-			addressMap.erase(it);
+	{
+		std::lock_guard<std::mutex> lock(s_lazyMutex);
+
+		// s_documentの順に解決して、Openと同じログにする
+		std::vector<size_t> indices;
+		if (label) {
+			auto pending = s_pending.find(*label);
+			if (pending != s_pending.end()) {
+				indices.push_back(pending->second);
+			}
+		}
+		else {
+			indices.reserve(s_pending.size());
+			for (auto& kv : s_pending) {
+				indices.push_back(kv.second);
+			}
+			std::sort(indices.begin(), indices.end());
+		}
+		if (indices.empty()) {
+			return;
+		}
+
+		// パターンもここでコンパイルして写すので、ロックを外したあとはs_documentを読まない
+		auto& identity = MSPE::Identity::Get();
+		auto keys = MatchAddressKeys(s_document, identity);
+		records.reserve(indices.size());
+		resolutions.resize(indices.size());
+		for (size_t i = 0; i < indices.size(); ++i) {
+			records.push_back(s_document[indices[i]]);
+			PrepareResolution(s_document, resolutions[i], records[i], keys, identity.name());
+		}
+	}
+
+	// 呼び出し関係をたどるものがあるときだけ、LabelIndexの写しを取る
+	std::unordered_map<std::string, duint> knownLabels;
+	for (auto& res : resolutions) {
+		if (res.method == Resolution::Method::kRelation || res.record->relation.size()) {
+			knownLabels = Util::LabelIndex::Get().addresses();
 			break;
 		}
 	}
+
+	// アンカー形式などはシグネチャの文字列で確かめるので、データベースのない空のDocumentを渡す
+	Signature::Document document;
+	auto labels = std::make_shared<Util::LabelTransaction>();
+	ResolveRecords(document, resolutions, mainModBase, *labels, counters, nullptr, &knownLabels);
+	Job::Post([labels]() {
+		labels->Commit();
+	});
+
+	// 検索の間にシグネチャが登録し直されたり、ほかのファイルを開いたりしたラベルは移さない
+	std::lock_guard<std::mutex> lock(s_lazyMutex);
+	for (auto& res : resolutions) {
+		if (s_pending.erase(res.record->label)) {
+			s_resolved.emplace(res.record->label, res.rva);
+		}
+	}
 }
 
-static void EraseJsonAddress(json11::Json& json, const std::string& moduleName)
+
+
+static const char* ConflictKindName(Signature::MergeConflict::Kind kind)
 {
-	auto addressMap = json["address"].object_items();
-	EraseJsonAddress(addressMap, moduleName);
-	auto jsonMap = json.object_items();
-	if (addressMap.size() == 0) {
-		jsonMap.erase("address");
+	switch (kind) {
+	case Signature::MergeConflict::Kind::kSignature:
+		return "signature";
+	case Signature::MergeConflict::Kind::kAddress:
+		return "address";
+	case Signature::MergeConflict::Kind::kFingerprint:
+		return "unwind";
+	default:
+		return "";
 	}
-	else {
-		jsonMap.insert_or_assign("address", json11::Json(addressMap));
-	}
-	json = json11::Json(jsonMap);
 }
 
 
-
-namespace Signature::File
+// 併合で食い違った値を、候補ごとに1行でリファレンスビューに表示する
+static void ShowConflicts(const std::vector<std::string>& files, const std::vector<Signature::MergeConflict>& conflicts)
 {
-	bool Open(char* Path)
-	{
-		using json11::Json;
+	size_t rows = 0;
+	for (auto& conflict : conflicts) {
+		rows += conflict.candidates.size();
+	}
 
-		duint mainModBase = Script::Module::GetMainModuleBase();
-		std::string mainModName = Util::GetModName(mainModBase);
+	GuiReferenceInitialize("Signature conflicts");
+	GuiReferenceAddColumn(50, GuiTranslateText("Label"));
+	GuiReferenceAddColumn(10, "Conflict");
+	GuiReferenceAddColumn(40, "Module");
+	GuiReferenceAddColumn(4, "Use");
+	GuiReferenceAddColumn(50, "Value");
+	GuiReferenceAddColumn(50, "File");
+	GuiReferenceSetRowCount(static_cast<int>(rows));
+	GuiReferenceSetProgress(0);
 
-		std::ifstream ifs(Path);
-		if (!ifs.is_open()) {
-			_plugin_logprintf("cannot open the file: \"%s\"\n", Path);
-			return false;
+	int idx = 0;
+	for (auto& conflict : conflicts) {
+		for (size_t i = 0; i < conflict.candidates.size(); ++i) {
+			auto& candidate = conflict.candidates[i];
+			GuiReferenceSetCellContent(idx, 0, conflict.label.c_str());
+			GuiReferenceSetCellContent(idx, 1, ConflictKindName(conflict.kind));
+			GuiReferenceSetCellContent(idx, 2, conflict.module.c_str());
+			GuiReferenceSetCellContent(idx, 3, i == conflict.chosen ? "*" : "");
+			GuiReferenceSetCellContent(idx, 4, candidate.value.c_str());
+			GuiReferenceSetCellContent(idx, 5, files[candidate.document].c_str());
+			++idx;
 		}
+	}
+
+	GuiReferenceSetProgress(100);
+	GuiUpdateAllViews();
+}
 
-		const std::string jsonText{ std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>() };
-		ifs.close();
 
+
+namespace Signature::File
+{
+	// シグネチャファイルを読み込み、ジャーナルを再生する
+	static bool Load(char* Path, size_t& journaled)
+	{
+		// 読み込めなかったときは、今のs_documentをそのまま残す
 		std::string err;
-		s_json = Json::parse(jsonText, err);
-		if (err.size() > 0) {
-			_plugin_logprintf("Unable to parse JSON: \"%s\"\n", Path);
+		Signature::Document document;
+		if (!LoadDocument(document, Path, err)) {
+			_plugin_logprintf("Unable to load the signature file: \"%s\"\n", Path);
 			_plugin_logprintf("%s\n", err.c_str());
 			return false;
 		}
 
+		// 前のシグネチャファイルのジャーナルは、ここまでの分を書き出して閉じる
+		s_journal.Close();
+		std::lock_guard<std::mutex> lock(s_lazyMutex);
+		ResetLazy();
+		s_document = std::move(document);
+		s_path = Path;
+
+		// 前回保存してからの変更を再生する
+		journaled = 0;
+		auto replay = [](const Signature::Journal::Entry& entry) -> void {
+			ApplyJournal(s_document, entry);
+		};
+		if (!s_journal.Open(Path, replay, journaled, err)) {
+			_plugin_logprintf("<warning> the journal is not available: %s\n", err.c_str());
+		}
+
 		Signature::Clear();
+		Signature::Reserve(s_document.size());
+		return true;
+	}
 
-		size_t fromCache = 0;
-		size_t match = 0;
-		size_t missing = 0;
-		size_t manyMatch = 0;
-		size_t duplicate = 0;
 
-		for (auto& obj : s_json.array_items()) {
-			const std::string& label = obj["label"].string_value();
-			std::string signature = obj["signature"].string_value();
-			if (label.size() == 0) {
-				continue;
+	bool Open(char* Path)
+	{
+		// 読み込みと解決はジョブのスレッドで、ジョブ用のdocumentに対して行う
+		// s_documentを置き換えるのは、終わったあとのGUIスレッド
+		struct State
+		{
+			std::string					path;
+			Signature::Document			document;
+			std::vector<Resolution>		resolutions;
+			Util::LabelTransaction		labels;
+			OpenCounters				counters;
+			size_t						journaled = 0;
+			bool						loaded = false;
+			std::string					err;
+			std::unordered_map<std::string, duint>	knownLabels;	// 呼び出し関係のアンカーに使う
+		};
+		auto state = std::make_shared<State>();
+		state->path = Path;
+
+		duint mainModBase = Script::Module::GetMainModuleBase();
+		auto& identity = MSPE::Identity::Get();
+		std::string moduleKey = identity.key();
+		std::string moduleName = identity.name();
+		std::uint64_t moduleHash = identity.hash();
+
+		// よく使うテーブルはGUIスレッドで作っておく。レコードによって使う索引は、ジョブのスレッドで作る
+		// (Get()は作っている間ロックするので、GUIスレッドから同時に引いてもよい)
+		MSPE::Image::Get();
+		MSPE::FunctionTable::Get();
+		MSPE::FingerprintTable::Get();
+		state->knownLabels = Util::LabelIndex::Get().addresses();
+
+		auto work = [state, mainModBase, moduleName, moduleHash](Job::Context& context) -> void {
+			auto& document = state->document;
+			if (!LoadDocument(document, state->path.c_str(), state->err)) {
+				return;
 			}
+			state->loaded = true;
 
-			duint rva = 0;
-			if (GetJsonAddress((Json)obj, mainModName, rva)) {
-				if (rva == 0) {
-					continue;		// deleted
-				}
+			// 前回保存してからの変更を再生する (ジャーナルを開くのはGUIスレッドで)
+			std::string err;
+			Signature::Journal::Read(state->path.c_str(), [&document](const Signature::Journal::Entry& entry) -> void {
+				ApplyJournal(document, entry);
+			}, state->journaled, err);
+
+			auto keys = MatchAddressKeys(document, moduleName, moduleHash);
+			state->resolutions.resize(document.size());
+			for (size_t i = 0; i < document.size(); ++i) {
+				PrepareResolution(document, state->resolutions[i], document[i], keys, moduleName);
 			}
+			ResolveRecords(document, state->resolutions, mainModBase, state->labels, state->counters, &context, &state->knownLabels);
+		};
 
-			if (rva) {
-				// すでにアドレス取得済み
-				fromCache++;
+		auto finished = [state, moduleKey, moduleName](bool cancelled) -> void {
+			if (!state->loaded) {
+				_plugin_logprintf("Unable to load the signature file: \"%s\"\n", state->path.c_str());
+				_plugin_logprintf("%s\n", state->err.c_str());
+				return;
 			}
-			else {
-				// search
-				std::vector<duint> result;
-				if (Signature::Find(signature, result, 2)) {
-					if (result.size() == 0) {
-						// 検索に失敗
-						missing++;
-						_plugin_logprintf("do not match signature\n");
-						_plugin_logprintf("    label:     \"%s\"\n", label.c_str());
-						_plugin_logprintf("    signature: \"%s\"\n", signature.c_str());
-					}
-					else {
-						rva = result.front() - mainModBase;
-						if (result.size() == 1) {
-							// シグネチャからアドレス取得成功
-							match++;
-						}
-						else {
-							// 取得には成功したものの、複数マッチしている
-							manyMatch++;
-							_plugin_logprintf("too many match signature\n");
-							_plugin_logprintf("    label:     \"%s\"\n", label.c_str());
-							_plugin_logprintf("    signature: \"%s\"\n", signature.c_str());
-						}
-					}
+			if (cancelled || !DbgIsDebugging()) {
+				_plugin_logprintf("[ SECUNDA MOON -> Open ]   cancelled: \"%s\"\n", state->path.c_str());
+				return;
+			}
+
+			// 前のシグネチャファイルのジャーナルは、ここまでの分を書き出して閉じる
+			s_journal.Close();
+			{
+				std::lock_guard<std::mutex> lock(s_lazyMutex);
+				ResetLazy();
+
+				// レコードはvectorごと移るので、resolutionsのポインタはそのまま使える
+				s_document = std::move(state->document);
+			}
+			s_path = state->path;
+			size_t journaled;
+			std::string err;
+			if (!s_journal.Open(state->path.c_str(), nullptr, journaled, err)) {
+				_plugin_logprintf("<warning> the journal is not available: %s\n", err.c_str());
+			}
+
+			Signature::Clear();
+			Signature::Reserve(s_document.size());
+			for (auto& res : state->resolutions) {
+				if (res.method != Resolution::Method::kSkip) {
+					RegisterSignature(*res.record, state->counters);
 				}
 			}
+			state->labels.Commit();
+
+			// 結果を表示
+			_plugin_logprint("[ SECUNDA MOON -> Open ]");
+			_plugin_logprintf("   module:%s", moduleKey.c_str());
+			if (state->journaled) {
+				_plugin_logprintf("   journal:%zu", state->journaled);
+			}
+			LogCounters(state->counters);
+			_plugin_logprint("\n");
+
+			// ほかのモジュールを対象にしたレコードは、読み込まれているモジュールの分だけ解決する
+			CollectTargets(moduleName);
+			ResolveTargets();
+		};
+
+		return Job::Start("Open", work, finished);
+	}
+
+
+	bool OpenLazy(char* Path)
+	{
+		auto& identity = MSPE::Identity::Get();
+
+		size_t journaled;
+		if (!Load(Path, journaled)) {
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(s_lazyMutex);
 
-			if (rva) {
-				Util::SetLabel(label, mainModBase + rva);
+		// シグネチャを登録し、ラベルごとにレコードを引けるようにしておく
+		auto keys = MatchAddressKeys(s_document, identity);
+		OpenCounters counters;
+		s_pending.reserve(s_document.size());
+		for (size_t i = 0; i < s_document.size(); ++i) {
+			auto& record = s_document[i];
+			if (record.label.size() == 0) {
+				continue;
 			}
-			if (Signature::Get(label)) {
-				// 同じラベルに複数のシグネチャが付いている
-				// .jsonファイルがおかしいので直接編集する必要があるかも
-				duplicate++;
-				_plugin_logprintf("<warning> duplicate entry: \"%s\"\n", label.c_str());
+			if (!IsMainTarget(record, identity.name())) {
+				// 対象モジュールが読み込まれたときに解決する
+				if (!IsDeletedInTarget(s_document, record)) {
+					RegisterSignature(record, counters);
+				}
+				continue;
 			}
-			else {
-				Signature::Set(label, signature);
+			duint rva;
+			if (GetAddress(record, keys, rva) != AddressKey::kNone && rva == 0) {
+				continue;		// deleted
+			}
+			if (s_pending.emplace(record.label, i).second) {
+				s_exprFunctions.push_back({ ExprFunctionName(record.label), record.label });
+			}
+			RegisterSignature(record, counters);
+		}
+
+		// 式関数 sig.<ラベル> を登録する
+		// (式関数の引数は数値だけなので、ラベルを引数で渡すことはできない)
+		size_t conflicts = 0;
+		for (size_t i = 0; i < s_exprFunctions.size(); ++i) {
+			if (!_plugin_registerexprfunction(pluginHandle, s_exprFunctions[i].name.c_str(), 0, LabelExprFunction, reinterpret_cast<void*>(i))) {
+				// 置き換えた名前が別のラベルと重なった
+				conflicts++;
 			}
 		}
 
 		// 結果を表示
 		_plugin_logprint("[ SECUNDA MOON -> Open ]");
-		if (fromCache) {
-			_plugin_logprintf("   cache:%d", fromCache);
+		_plugin_logprintf("   module:%s", identity.key().c_str());
+		if (journaled) {
+			_plugin_logprintf("   journal:%zu", journaled);
 		}
-		if (match) {
-			_plugin_logprintf("   match:%d", match);
-		}
-		if (missing) {
-			_plugin_logprintf("   missing:%d", missing);
-		}
-		if (manyMatch) {
-			_plugin_logprintf("   too many match:%d", manyMatch);
-		}
-		if (duplicate) {
-			_plugin_logprintf("   duplicate entry:%d", duplicate);
+		_plugin_logprintf("   lazy:%zu", s_pending.size());
+		if (conflicts) {
+			_plugin_logprintf("   expression conflict:%zu", conflicts);
 		}
+		LogCounters(counters);
 		_plugin_logprint("\n");
 
+		// ほかのモジュールを対象にしたレコードは、読み込まれているモジュールの分だけすぐに解決する
+		CollectTargets(identity.name());
+		ResolveTargets();
+
 		return true;
 	}
 
 
-	bool Save(char* Path)
+	bool Resolve(const std::string& label, duint& addr)
 	{
-		using json11::Json;
+		if (!DbgIsDebugging()) {
+			return false;
+		}
+		duint mainModBase = Script::Module::GetMainModuleBase();
+
+		{
+			std::lock_guard<std::mutex> lock(s_lazyMutex);
+
+			auto resolved = s_resolved.find(label);
+			if (resolved != s_resolved.end()) {
+				addr = resolved->second ? mainModBase + resolved->second : 0;
+				return resolved->second != 0;
+			}
+		}
+
+		std::vector<Signature::Record> records;
+		std::vector<Resolution> resolutions;
+		OpenCounters counters;
+		ResolveLazy(&label, mainModBase, records, resolutions, counters);
+		if (resolutions.empty()) {
+			// 遅延モードで開いたラベルでなければ、張ってあるラベルを引く
+			return Script::Label::FromString(label.c_str(), &addr);
+		}
+
+		duint rva = resolutions[0].rva;
+		addr = rva ? mainModBase + rva : 0;
+		return rva != 0;
+	}
 
+
+	void ResolveAll()
+	{
+		if (!DbgIsDebugging()) {
+			return;
+		}
 		duint mainModBase = Script::Module::GetMainModuleBase();
-		std::string mainModName = Util::GetModName(mainModBase);
-		if (mainModName.size() == 0) {
-			_plugin_logprint("invalid module name");
-			return false;
+
+		std::vector<Signature::Record> records;
+		std::vector<Resolution> resolutions;
+		OpenCounters counters;
+		ResolveLazy(nullptr, mainModBase, records, resolutions, counters);
+		if (resolutions.empty()) {
+			return;
 		}
 
-		std::ofstream ofs(Path);
-		if (!ofs.is_open()) {
-			_plugin_logprint("cannot create json file");
+		_plugin_logprint("[ SECUNDA MOON -> Resolve ]");
+		_plugin_logprintf("   resolved:%zu", resolutions.size());
+		LogCounters(counters);
+		_plugin_logprint("\n");
+	}
+
+
+	bool Save(char* Path)
+	{
+		auto& identity = MSPE::Identity::Get();
+		if (identity.name().size() == 0) {
+			_plugin_logprint("invalid module name");
 			return false;
 		}
 
-		std::vector<Json> entries = s_json.array_items();
+		std::lock_guard<std::mutex> lock(s_lazyMutex);
+
+		// 対象モジュールのキーも先に登録しておく (あとで登録するとkeysの大きさが足りなくなる)
+		std::uint32_t module = s_document.Intern(identity.key());
+		for (auto& record : s_document) {
+			if (!IsMainTarget(record, identity.name())) {
+				s_document.Intern(record.module);
+			}
+		}
+		auto keys = MatchAddressKeys(s_document, identity);
 
 		// 削除されたシグネチャを処理
-		for (Json& json : entries) {
-			const std::string& label = json["label"].string_value();
-			if (!Signature::Get(label)) {
+		for (auto& record : s_document) {
+			if (!Signature::Get(record.label)) {
 				// アドレス欄に"deleted"をセット
-				SetJsonAddress(json, mainModName, 0);
+				if (IsMainTarget(record, identity.name())) {
+					SetAddress(record, keys, module, 0);
+				}
+				else {
+					SetAddress(record, MatchAddressKeys(s_document, record.module, 0), s_document.Intern(record.module), 0);
+				}
 			}
 		}
 
-		Signature::ForEach([mainModBase, &entries, &mainModName] (const std::string& label, const std::string& signature)
+		Signature::ForEach([module, &keys, &identity] (std::string_view labelView, std::string_view signature)
 			-> void {
 
-			auto it = std::find_if(entries.begin(), entries.end(), [&label](const Json& json) -> auto {
-				return label == json["label"].string_value();
-			});
-			if (it == entries.end()) {
-				entries.push_back(Json({
-					{ "label", label },
-					{ "signature", signature }
-					}));
-				it = entries.end() - 1;
+			std::string label(labelView);
+			if (s_pending.count(label)) {
+				// 遅延モードでまだ解決していないので、レコードはそのままにしておく
+				return;
+			}
+
+			auto& record = s_document.Insert(label);
+			if (record.signature != signature) {
+				record.signature = signature;
+				record.compiled = Signature::Database::npos;
+			}
+
+			if (!IsMainTarget(record, identity.name())) {
+				// 対象モジュールが読み込まれていなければ、アドレス欄はそのままにしておく
+				duint base = Script::Module::BaseFromName(record.module.c_str());
+				if (base == 0) {
+					return;
+				}
+				auto targetKeys = MatchAddressKeys(s_document, record.module, 0);
+				duint addr;
+				if (Script::Label::FromString(label.c_str(), &addr)) {
+					SetAddress(record, targetKeys, s_document.Intern(record.module), addr - base);
+				}
+				else {
+					EraseAddress(record, targetKeys);
+				}
+				return;
+			}
+
+			duint rva;
+			std::uint64_t fingerprint;
+			if (!LookupLabel(label, rva, fingerprint)) {
+				EraseAddress(record, keys);
+			}
+			else {
+				SetAddress(record, keys, module, rva);
+				// このビルドで一意でなければ0にして、古いビルドの指紋を消す
+				record.fingerprint = fingerprint;
 			}
+		});
+
+		DescribeCodeHashes(s_document, keys, identity.name());
+		DescribeRelations(s_document, keys, identity.name());
+
+		std::string err;
+		if (!SaveDocument(s_document, Path, err)) {
+			_plugin_logprintf("%s\n", err.c_str());
+			return false;
+		}
+		s_path = Path;
+
+		// 保存したので、ジャーナルは空からやり直す
+		if (!s_journal.Create(Path, err)) {
+			_plugin_logprintf("<warning> the journal is not available: %s\n", err.c_str());
+		}
+
+		return true;
+	}
+
+
+	void Set(const std::string& label, const std::string& signature)
+	{
+		Signature::Set(label, signature);
+		ForgetLazy(label);
+
+		// x64dbg上で張られたラベルかもしれないので、索引に加えておく
+		duint addr;
+		if (Script::Label::FromString(label.c_str(), &addr)) {
+			Util::LabelIndex::Get().Set(label, addr);
+		}
+
+		auto& identity = MSPE::Identity::Get();
+		if (!s_journal.is_open() || identity.name().size() == 0) {
+			return;
+		}
 
+		Signature::Journal::Entry entry;
+		entry.op = Signature::Journal::Op::kSet;
+		entry.label = label;
+		entry.signature = signature;
+		entry.module = identity.key();
+
+		// ほかのモジュールを対象にしたレコードは、Saveと同じく対象モジュールのキーと、そのベースからのrvaにする
+		size_t idx = s_document.Find(label);
+		if (idx == Signature::Document::npos || IsMainTarget(s_document[idx], identity.name())) {
+			LookupLabel(label, entry.rva, entry.fingerprint);
+		}
+		else {
+			auto& record = s_document[idx];
+			entry.module = record.module;
+			entry.fingerprint = record.fingerprint;
+
+			duint base = Script::Module::BaseFromName(record.module.c_str());
 			duint addr;
-			if (!Script::Label::FromString(label.c_str(), &addr)) {
-				EraseJsonAddress(*it, mainModName);
+			if (base == 0) {
+				// 対象モジュールが読み込まれていなければ、アドレス欄はそのままにしておく
+				GetAddress(record, MatchAddressKeys(s_document, record.module, 0), entry.rva);
+			}
+			else if (Script::Label::FromString(label.c_str(), &addr)) {
+				entry.rva = addr - base;
+			}
+		}
+		AppendJournal(entry);
+	}
+
+
+	void Remove(const std::string& label)
+	{
+		Signature::Remove(label);
+		ForgetLazy(label);
+
+		auto& identity = MSPE::Identity::Get();
+		if (!s_journal.is_open() || identity.name().size() == 0) {
+			return;
+		}
+
+		Signature::Journal::Entry entry;
+		entry.op = Signature::Journal::Op::kRemove;
+		entry.label = label;
+		entry.module = identity.key();
+
+		// ほかのモジュールを対象にしたレコードは、対象モジュールのキーで"deleted"にする
+		size_t idx = s_document.Find(label);
+		if (idx != Signature::Document::npos && !IsMainTarget(s_document[idx], identity.name())) {
+			entry.module = s_document[idx].module;
+		}
+		AppendJournal(entry);
+	}
+
+
+	void ResolveModules()
+	{
+		ResolveTargets();
+	}
+
+
+	void ForgetModule(duint base)
+	{
+		for (auto it = s_resolvedModules.begin(); it != s_resolvedModules.end();) {
+			if (base == 0 || it->second == base) {
+				it = s_resolvedModules.erase(it);
 			}
 			else {
-				SetJsonAddress(*it, mainModName, addr - mainModBase);
+				++it;
 			}
+		}
+	}
+
+
+	void Flush()
+	{
+		s_journal.Sync();
+	}
+
+
+	void Close()
+	{
+		s_journal.Close();
+		s_path.clear();
+
+		std::lock_guard<std::mutex> lock(s_lazyMutex);
+		ResetLazy();
+	}
+
 
-			auto jsonMap = it->object_items();
-			jsonMap["signature"] = Json(signature);
-			*it = Json(jsonMap);
+	bool Merge(const std::vector<std::string>& from, const char* to)
+	{
+		// 開いているファイルに書き出すと、次のSaveで併合した結果が上書きされる
+		if (s_path.size() && _stricmp(s_path.c_str(), to) == 0) {
+			_plugin_logprintf("the signature file is open: \"%s\" (merge into another file, then open it)\n", to);
+			return false;
+		}
+
+		//
+		// 入力を並列に読み込む (ジャーナルがあれば再生する)
+		//
+		std::vector<Signature::Document> documents(from.size());
+		std::vector<std::string> errors(from.size());
+		std::vector<char> loaded(from.size(), false);
+		Util::ParallelFor(from.size(), [&](size_t i) {
+			auto& document = documents[i];
+			auto replay = [&document](const Signature::Journal::Entry& entry) -> void {
+				ApplyJournal(document, entry);
+			};
+			size_t journaled;
+			loaded[i] = LoadDocument(document, from[i].c_str(), errors[i])
+				&& Signature::Journal::Read(from[i].c_str(), replay, journaled, errors[i]);
 		});
 
-		s_json = Json(entries);
-		ofs << s_json.dump();
-		ofs.close();
+		for (size_t i = 0; i < from.size(); ++i) {
+			if (!loaded[i]) {
+				_plugin_logprintf("Unable to load the signature file: \"%s\"\n", from[i].c_str());
+				_plugin_logprintf("%s\n", errors[i].c_str());
+				return false;
+			}
+		}
+
+		//
+		// 併合する
+		// シグネチャが食い違ったら、デバッグ中ならメインモジュールで一意に見つかるものを、
+		// そうでなければ前の入力を選ぶ
+		//
+		auto resolve = [](const std::string& label, const std::vector<const Signature::Record*>& candidates) -> size_t {
+			if (!DbgIsDebugging()) {
+				return 0;
+			}
+			for (size_t i = 0; i < candidates.size(); ++i) {
+				std::vector<duint> result;
+				if (Signature::Find(candidates[i]->signature, result, 2) && result.size() == 1) {
+					return i;
+				}
+			}
+			return 0;
+		};
+
+		std::vector<const Signature::Document*> inputs;
+		for (auto& document : documents) {
+			inputs.push_back(&document);
+		}
+		Signature::Document merged;
+		std::vector<Signature::MergeConflict> conflicts;
+		Signature::Merge(inputs, resolve, merged, conflicts);
+
+		std::string err;
+		if (!SaveDocument(merged, to, err)) {
+			_plugin_logprintf("%s\n", err.c_str());
+			return false;
+		}
+
+		// toのジャーナルは、toが入力なら併合済み、そうでなければ上書きしたファイルのものなので捨てる
+		DeleteFileA(Signature::Journal::PathFor(to).c_str());
+
+		//
+		// 結果を表示
+		//
+		size_t count[3] = { 0, 0, 0 };
+		for (auto& conflict : conflicts) {
+			count[static_cast<size_t>(conflict.kind)]++;
+		}
+
+		_plugin_logprint("[ SECUNDA MOON -> Merge ]");
+		_plugin_logprintf("   files:%zu", from.size());
+		_plugin_logprintf("   signatures:%zu", merged.size());
+		for (size_t i = 0; i < 3; ++i) {
+			if (count[i]) {
+				_plugin_logprintf("   %s conflict:%zu", ConflictKindName(static_cast<Signature::MergeConflict::Kind>(i)), count[i]);
+			}
+		}
+		_plugin_logprint("\n");
+
+		if (conflicts.size()) {
+			ShowConflicts(from, conflicts);
+			_plugin_logprintf("%zu conflict(s) listed in Reference View\n", conflicts.size());
+		}
+		return true;
+	}
+
+
+	bool Convert(const char* from, const char* to)
+	{
+		Signature::Document document;
+		std::string err;
+		size_t journaled = 0;
+		auto replay = [&document](const Signature::Journal::Entry& entry) -> void {
+			ApplyJournal(document, entry);
+		};
+		if (!LoadDocument(document, from, err) || !Signature::Journal::Read(from, replay, journaled, err)) {
+			_plugin_logprintf("Unable to load the signature file: \"%s\"\n", from);
+			_plugin_logprintf("%s\n", err.c_str());
+			return false;
+		}
+		if (!SaveDocument(document, to, err)) {
+			_plugin_logprintf("%s\n", err.c_str());
+			return false;
+		}
 
+		_plugin_logprintf("converted %zu signatures: \"%s\" -> \"%s\"\n", document.size(), from, to);
 		return true;
 	}
 }
\ No newline at end of file
@@ -2,6 +2,47 @@
 
 namespace Signature::File
 {
+	// 読み込みと解決はバックグラウンドのジョブで行い、終わったらGUIスレッドでシグネチャを登録してラベルを張る
+	// ジョブを始められたらtrueを返す (読み込めたかどうかはログに出す)
 	bool Open(char* Path);
 	bool Save(char* Path);
+
+	// シグネチャを登録するだけで、アドレスは必要になったときに解決する (遅延モード)
+	// ラベルごとに式関数 sig.<ラベル> を登録する。式に使えない文字は'_'に置き換える
+	bool OpenLazy(char* Path);
+
+	// ラベルのアドレスを返す。遅延モードでまだ解決していなければ、ここで解決してラベルを張る
+	// 解決した結果は覚えておき、次からはそれを返す
+	bool Resolve(const std::string& label, duint& addr);
+
+	// 遅延モードでまだ解決していないラベルを、すべて解決する
+	void ResolveAll();
+
+	// シグネチャを登録・削除し、開いているシグネチャファイルのジャーナルに記録する
+	// (Open/Saveしていなければ、次のSaveまでメモリ上にあるだけ)
+	void Set(const std::string& label, const std::string& signature);
+	void Remove(const std::string& label);
+
+	// "module"でほかのモジュールを対象にしたシグネチャのうち、対象モジュールが読み込まれていて、
+	// まだ解決していないものを解決してラベルを張る (モジュールが読み込まれたときに、GUIスレッドで呼ぶ)
+	// 検索はバックグラウンドのジョブで行い、ラベルは終わってから張る。ほかのジョブが動いていれば、その後で始める
+	void ResolveModules();
+
+	// モジュールbaseを解決していないことにする (モジュールが外されたとき)。0ならすべてのモジュール
+	void ForgetModule(duint base);
+
+	// ジャーナルの溜まっている分をディスクに書き出す
+	void Flush();
+
+	// ジャーナルを閉じる
+	void Close();
+
+	// シグネチャファイルfromを並列に読み込み、ラベルで併合してtoに書き出す
+	// 食い違った値はリファレンスビューに表示する。開いているファイルには書き出さない
+	// s_documentとジャーナルを扱うので、GUIスレッドで呼ぶ
+	bool Merge(const std::vector<std::string>& from, const char* to);
+
+	// シグネチャファイルを変換する (拡張子が.sigdbならシグネチャデータベース、それ以外はJSON)
+	// ジャーナルがあれば再生してから変換する
+	bool Convert(const char* from, const char* to);
 }
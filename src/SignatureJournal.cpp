@@ -0,0 +1,302 @@
+﻿#include "pch.h"
+#include "SignatureJournal.h"
+#include "Hash.h"
+#include <cstring>		// memcpy
+
+
+namespace Signature
+{
+	//
+	// ペイロード
+	//   std::uint8_t	op
+	//   std::uint32_t	ラベルの長さ、ラベル
+	//   std::uint32_t	シグネチャの長さ、シグネチャ
+	//   std::uint32_t	キーの長さ、キー
+	//   std::uint64_t	rva
+	//   std::uint64_t	fingerprint
+	//
+
+	static void PutString(std::string& out, const std::string& str)
+	{
+		std::uint32_t length = static_cast<std::uint32_t>(str.size());
+		out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+		out.append(str);
+	}
+
+
+	template <class T>
+	static void PutValue(std::string& out, T value)
+	{
+		out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+
+	// ペイロードを先頭から読む。範囲外を読もうとしたらfalseを返す
+	class PayloadReader
+	{
+	public:
+		PayloadReader(const char* data, size_t size) : _cur(data), _end(data + size) {}
+
+		template <class T>
+		bool Get(T& value) {
+			if (static_cast<size_t>(_end - _cur) < sizeof(T)) {
+				return false;
+			}
+			std::memcpy(&value, _cur, sizeof(T));
+			_cur += sizeof(T);
+			return true;
+		}
+
+		bool Get(std::string& str) {
+			std::uint32_t length;
+			if (!Get(length) || static_cast<size_t>(_end - _cur) < length) {
+				return false;
+			}
+			str.assign(_cur, length);
+			_cur += length;
+			return true;
+		}
+
+		bool eof() const {
+			return _cur == _end;
+		}
+
+	private:
+		const char*	_cur;
+		const char*	_end;
+	};
+
+
+	static std::uint32_t Checksum(const void* data, size_t size)
+	{
+		return static_cast<std::uint32_t>(Hash::Compute(data, size));
+	}
+
+
+	static bool ReadFileAll(const std::string& path, std::string& data, std::string& err)
+	{
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			data.clear();
+			return true;		// ジャーナルなし
+		}
+
+		LARGE_INTEGER fileSize;
+		bool succeeded = GetFileSizeEx(file, &fileSize) && fileSize.QuadPart < 0x80000000;
+		if (succeeded) {
+			data.resize(static_cast<size_t>(fileSize.QuadPart));
+			DWORD read = 0;
+			succeeded = data.empty() || (ReadFile(file, &data[0], static_cast<DWORD>(data.size()), &read, nullptr) && read == data.size());
+		}
+		CloseHandle(file);
+
+		if (!succeeded) {
+			err = "cannot read the journal: " + path;
+		}
+		return succeeded;
+	}
+
+
+
+	Journal::~Journal()
+	{
+		Close();
+	}
+
+
+	std::string Journal::PathFor(const char* path)
+	{
+		return std::string(path) + ".journal";
+	}
+
+
+	bool Journal::Parse(const std::string& data, const Callback& callback, size_t& count, size_t& validSize, std::string& err)
+	{
+		count = 0;
+		validSize = 0;
+		if (data.empty()) {
+			return true;
+		}
+
+		Header header;
+		if (data.size() < sizeof(header)) {
+			return true;		// ヘッダを書く前に落ちた
+		}
+		std::memcpy(&header, data.data(), sizeof(header));
+		if (header.magic != kMagic) {
+			err = "not a signature journal";
+			return false;
+		}
+		if (header.version != kVersion) {
+			err = "unsupported signature journal version";
+			return false;
+		}
+
+		size_t offset = sizeof(header);
+		validSize = offset;
+		while (data.size() - offset >= sizeof(EntryHeader)) {
+			EntryHeader entryHeader;
+			std::memcpy(&entryHeader, data.data() + offset, sizeof(entryHeader));
+			const char* payload = data.data() + offset + sizeof(entryHeader);
+			if (data.size() - offset - sizeof(entryHeader) < entryHeader.size
+				|| Checksum(payload, entryHeader.size) != entryHeader.checksum) {
+				break;		// 書きかけ
+			}
+
+			Entry entry;
+			std::uint8_t op;
+			std::uint64_t rva;
+			PayloadReader reader(payload, entryHeader.size);
+			if (!reader.Get(op) || !reader.Get(entry.label) || !reader.Get(entry.signature) || !reader.Get(entry.module)
+				|| !reader.Get(rva) || !reader.Get(entry.fingerprint) || !reader.eof()) {
+				break;
+			}
+			entry.op = static_cast<Op>(op);
+			entry.rva = static_cast<duint>(rva);
+			if (entry.op != Op::kSet && entry.op != Op::kRemove) {
+				break;
+			}
+
+			if (callback) {
+				callback(entry);
+			}
+			count++;
+			offset += sizeof(entryHeader) + entryHeader.size;
+			validSize = offset;
+		}
+		return true;
+	}
+
+
+	bool Journal::Read(const char* path, const Callback& callback, size_t& count, std::string& err)
+	{
+		std::string data;
+		size_t validSize;
+		return ReadFileAll(PathFor(path), data, err) && Parse(data, callback, count, validSize, err);
+	}
+
+
+	bool Journal::Open(const char* path, const Callback& callback, size_t& count, std::string& err)
+	{
+		Close();
+
+		std::string journalPath = PathFor(path);
+		std::string data;
+		size_t validSize;
+		if (!ReadFileAll(journalPath, data, err) || !Parse(data, callback, count, validSize, err)) {
+			return false;
+		}
+
+		_file = CreateFileA(journalPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (_file == INVALID_HANDLE_VALUE) {
+			err = "cannot open the journal: " + journalPath;
+			return false;
+		}
+
+		// 書きかけのエントリを切り捨てて、その後ろに追記する
+		LARGE_INTEGER position;
+		position.QuadPart = static_cast<LONGLONG>(validSize);
+		bool succeeded = SetFilePointerEx(_file, position, nullptr, FILE_BEGIN) && SetEndOfFile(_file);
+		_path = path;
+		_size = validSize;
+		if (succeeded && validSize == 0) {
+			Header header = { kMagic, kVersion };
+			DWORD written = 0;
+			succeeded = WriteFile(_file, &header, sizeof(header), &written, nullptr) && written == sizeof(header);
+			_size = sizeof(header);
+			_dirty = true;
+		}
+		if (!succeeded) {
+			Close();
+			err = "cannot write the journal: " + journalPath;
+			return false;
+		}
+		_lastSync = GetTickCount();
+		return true;
+	}
+
+
+	bool Journal::Create(const char* path, std::string& err)
+	{
+		Close();
+
+		std::string journalPath = PathFor(path);
+		_file = CreateFileA(journalPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (_file == INVALID_HANDLE_VALUE) {
+			err = "cannot create the journal: " + journalPath;
+			return false;
+		}
+
+		Header header = { kMagic, kVersion };
+		DWORD written = 0;
+		if (!WriteFile(_file, &header, sizeof(header), &written, nullptr) || written != sizeof(header)) {
+			Close();
+			err = "cannot write the journal: " + journalPath;
+			return false;
+		}
+		_path = path;
+		_size = sizeof(header);
+		_dirty = true;
+		_lastSync = GetTickCount();
+		return true;
+	}
+
+
+	void Journal::Close()
+	{
+		if (!is_open()) {
+			return;
+		}
+		Sync();
+		CloseHandle(_file);
+		_file = INVALID_HANDLE_VALUE;
+		_path.clear();
+		_size = 0;
+		_dirty = false;
+	}
+
+
+	bool Journal::Append(const Entry& entry)
+	{
+		if (!is_open()) {
+			return false;
+		}
+
+		// EntryHeaderの分を空けておき、ペイロードを書いてから埋める
+		std::string buffer(sizeof(EntryHeader), '\0');
+		PutValue(buffer, static_cast<std::uint8_t>(entry.op));
+		PutString(buffer, entry.label);
+		PutString(buffer, entry.signature);
+		PutString(buffer, entry.module);
+		PutValue(buffer, static_cast<std::uint64_t>(entry.rva));
+		PutValue(buffer, entry.fingerprint);
+
+		EntryHeader entryHeader;
+		entryHeader.size = static_cast<std::uint32_t>(buffer.size() - sizeof(EntryHeader));
+		entryHeader.checksum = Checksum(buffer.data() + sizeof(EntryHeader), entryHeader.size);
+		std::memcpy(&buffer[0], &entryHeader, sizeof(entryHeader));
+
+		DWORD written = 0;
+		if (!WriteFile(_file, buffer.data(), static_cast<DWORD>(buffer.size()), &written, nullptr) || written != buffer.size()) {
+			return false;
+		}
+		_size += buffer.size();
+		_dirty = true;
+
+		if (GetTickCount() - _lastSync >= kSyncInterval) {
+			return Sync();
+		}
+		return true;
+	}
+
+
+	bool Journal::Sync()
+	{
+		if (!is_open() || !_dirty) {
+			return true;
+		}
+		_lastSync = GetTickCount();
+		_dirty = false;
+		return FlushFileBuffers(_file) != FALSE;
+	}
+}
@@ -0,0 +1,111 @@
+﻿#pragma once
+
+#include <string>
+#include <functional>
+
+
+namespace Signature
+{
+	// シグネチャファイルのジャーナル (<シグネチャファイル>.journal)
+	//
+	// 前回保存してからのシグネチャの登録・削除を追記していき、シグネチャファイルを開くときに上から再生する。
+	// 追記はWriteFileでOSに渡すだけで、FlushFileBuffersはkSyncIntervalごとにまとめて行う。
+	// 間隔が空いて残った分は、使う側がSyncかCloseで書き出す。
+	//
+	//   Header
+	//   EntryHeader + ペイロード (size バイト) の繰り返し
+	//
+	// 書きかけのエントリ (クラッシュしたときなど) はchecksumで見分けて、そこから後ろは捨てる。
+	class Journal
+	{
+	public:
+		static constexpr std::uint32_t kMagic = 0x4C4A4753;		// "SGJL"
+		static constexpr std::uint32_t kVersion = 1;
+		static constexpr std::uint64_t kCompactSize = 1024 * 1024;	// これを超えたらシグネチャファイルにまとめる
+		static constexpr DWORD kSyncInterval = 1000;				// ms
+
+		enum class Op : std::uint8_t
+		{
+			kSet = 1,		// シグネチャとアドレスを登録
+			kRemove = 2		// アドレスを"deleted"にする
+		};
+
+		struct Entry
+		{
+			Op				op = Op::kSet;
+			std::string		label;
+			std::string		signature;			// kSetのみ
+			std::string		module;				// アドレス欄のキー ("SkyrimSE.exe@0123456789ABCDEF")
+			duint			rva = 0;			// kSetのみ、0ならアドレスなし
+			std::uint64_t	fingerprint = 0;	// kSetのみ、0なら無し
+		};
+
+		struct Header
+		{
+			std::uint32_t	magic;
+			std::uint32_t	version;
+		};
+
+		struct EntryHeader
+		{
+			std::uint32_t	size;				// ペイロードのバイト数
+			std::uint32_t	checksum;			// ペイロードのハッシュ値 (下位32ビット)
+		};
+
+		using Callback = std::function<void(const Entry& entry)>;
+
+		Journal() = default;
+		~Journal();
+		Journal(const Journal&) = delete;
+		Journal& operator=(const Journal&) = delete;
+
+		// シグネチャファイルpathのジャーナルのパスを返す
+		static std::string PathFor(const char* path);
+
+		// シグネチャファイルpathのジャーナルを読み、エントリごとにcallbackを呼ぶ
+		// ジャーナルがなければ何もせずにtrueを返す。読んだエントリ数をcountに返す
+		static bool Read(const char* path, const Callback& callback, size_t& count, std::string& err);
+
+		// シグネチャファイルpathのジャーナルを読んで再生し、続きを追記できるように開く
+		bool Open(const char* path, const Callback& callback, size_t& count, std::string& err);
+
+		// シグネチャファイルpathの空のジャーナルを作って開く (シグネチャファイルを保存した直後に使う)
+		bool Create(const char* path, std::string& err);
+
+		// 溜まっている分をディスクに書き出して閉じる
+		void Close();
+
+		bool Append(const Entry& entry);
+
+		// 前回からkSyncIntervalが過ぎていなくても、ディスクに書き出す
+		bool Sync();
+
+		inline bool is_open() const {
+			return _file != INVALID_HANDLE_VALUE;
+		}
+
+		// OSに渡しただけで、まだディスクに書き出していない分があればtrue
+		inline bool dirty() const {
+			return _dirty;
+		}
+
+		// ヘッダを含むジャーナルのバイト数
+		inline std::uint64_t size() const {
+			return _size;
+		}
+
+		// ジャーナルが付いているシグネチャファイルのパス
+		inline const std::string& path() const {
+			return _path;
+		}
+
+	private:
+		static bool Parse(const std::string& data, const Callback& callback, size_t& count, size_t& validSize, std::string& err);
+
+		HANDLE			_file = INVALID_HANDLE_VALUE;
+		std::string		_path;
+		std::uint64_t	_size = 0;
+		DWORD			_lastSync = 0;
+		bool			_dirty = false;
+	};
+}
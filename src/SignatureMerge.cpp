@@ -0,0 +1,255 @@
+﻿#include "pch.h"
+#include "SignatureMerge.h"
+#include "SignatureRecord.h"
+#include <algorithm>	// find_if, min
+#include <string_view>
+#include <unordered_map>
+
+
+namespace Signature
+{
+	// ラベルを持つ入力のレコード
+	struct MergeSource
+	{
+		size_t			document;
+		const Record*	record;
+	};
+
+
+	static std::string FormatAddress(duint rva)
+	{
+		if (rva == 0) {
+			return "deleted";
+		}
+		char buffer[32];
+		sprintf_s(buffer, "0x%08llX", static_cast<unsigned long long>(rva));
+		return buffer;
+	}
+
+
+	static std::string FormatFingerprint(std::uint64_t fingerprint)
+	{
+		char buffer[32];
+		sprintf_s(buffer, "%016llX", static_cast<unsigned long long>(fingerprint));
+		return buffer;
+	}
+
+
+	// 食い違った値を候補に加える (同じ値の候補がすでにあれば何もしない)
+	static void AddCandidate(MergeConflict& conflict, size_t document, std::string&& value)
+	{
+		for (auto& candidate : conflict.candidates) {
+			if (candidate.value == value) {
+				return;
+			}
+		}
+		conflict.candidates.push_back({ document, std::move(value) });
+	}
+
+
+	// 1つのラベルについて、入力sourcesを優先順 (sources[0]が最優先) にdstへ併せる
+	static void MergeRecord(const std::vector<MergeSource>& sources, const std::vector<std::vector<std::uint32_t>>& modules,
+		const Document& result, Record& dst, std::vector<MergeConflict>& conflicts)
+	{
+		const Record& primary = *sources.front().record;
+		dst.signature = primary.signature;
+		dst.module = primary.module;
+		dst.relation.clear();
+		dst.fingerprint = 0;
+		dst.codeHash = 0;
+		dst.extra.clear();
+
+		std::vector<size_t> addressOwners;				// dst.addressesの各アドレスをどの入力から取ったか
+		size_t fingerprintOwner = 0;
+		size_t firstConflict = conflicts.size();		// このラベルのアドレスと指紋の食い違い
+
+		auto findConflict = [&conflicts, firstConflict](MergeConflict::Kind kind, const std::string& module) -> MergeConflict* {
+			for (size_t i = firstConflict; i < conflicts.size(); ++i) {
+				if (conflicts[i].kind == kind && conflicts[i].module == module) {
+					return &conflicts[i];
+				}
+			}
+			return nullptr;
+		};
+
+		for (auto& source : sources) {
+			const Record& src = *source.record;
+
+			//
+			// アドレス欄
+			//
+			for (auto& address : src.addresses) {
+				std::uint32_t module = modules[source.document][address.module];
+				auto it = std::find_if(dst.addresses.begin(), dst.addresses.end(), [module](const Record::Address& elem) -> bool {
+					return elem.module == module;
+				});
+				if (it == dst.addresses.end()) {
+					dst.addresses.push_back({ module, address.rva });
+					addressOwners.push_back(source.document);
+				}
+				else if (it->rva != address.rva) {
+					const std::string& key = result.module(module);
+					MergeConflict* conflict = findConflict(MergeConflict::Kind::kAddress, key);
+					if (!conflict) {
+						conflicts.push_back({ MergeConflict::Kind::kAddress, dst.label, key, {}, 0 });
+						conflict = &conflicts.back();
+						AddCandidate(*conflict, addressOwners[it - dst.addresses.begin()], FormatAddress(it->rva));
+					}
+					AddCandidate(*conflict, source.document, FormatAddress(address.rva));
+				}
+			}
+
+			//
+			// 指紋
+			//
+			if (src.fingerprint) {
+				if (dst.fingerprint == 0) {
+					dst.fingerprint = src.fingerprint;
+					fingerprintOwner = source.document;
+				}
+				else if (dst.fingerprint != src.fingerprint) {
+					MergeConflict* conflict = findConflict(MergeConflict::Kind::kFingerprint, std::string());
+					if (!conflict) {
+						conflicts.push_back({ MergeConflict::Kind::kFingerprint, dst.label, std::string(), {}, 0 });
+						conflict = &conflicts.back();
+						AddCandidate(*conflict, fingerprintOwner, FormatFingerprint(dst.fingerprint));
+					}
+					AddCandidate(*conflict, source.document, FormatFingerprint(src.fingerprint));
+				}
+			}
+
+			// 呼び出し関係は、優先順で最初にあるもの (シグネチャの代わりに使うだけなので、食い違いは数えない)
+			if (dst.relation.empty()) {
+				dst.relation = src.relation;
+			}
+
+			// 命令のハッシュも同じく、優先順で最初にあるもの
+			if (dst.codeHash == 0) {
+				dst.codeHash = src.codeHash;
+			}
+
+			//
+			// 知らないフィールド
+			//
+			for (auto& member : src.extra) {
+				auto it = std::find_if(dst.extra.begin(), dst.extra.end(), [&member](const std::pair<std::string, json11::Json>& elem) -> bool {
+					return elem.first == member.first;
+				});
+				if (it == dst.extra.end()) {
+					dst.extra.push_back(member);
+				}
+			}
+		}
+	}
+
+
+	void Merge(const std::vector<const Document*>& documents, const MergeResolver& resolve,
+		Document& result, std::vector<MergeConflict>& conflicts)
+	{
+		result.Clear();
+		conflicts.clear();
+
+		// 入力ごとに、アドレス欄のキーをresultのインデックスに読み替える表
+		std::vector<std::vector<std::uint32_t>> modules(documents.size());
+		for (size_t i = 0; i < documents.size(); ++i) {
+			auto& document = *documents[i];
+			modules[i].resize(document.module_count());
+			for (std::uint32_t j = 0; j < modules[i].size(); ++j) {
+				modules[i][j] = result.Intern(document.module(j));
+			}
+		}
+
+		// ラベルごとに入力を集める。resultには最初に出てきた順にレコードを作る
+		size_t total = 0;
+		for (auto* document : documents) {
+			total += document->size();
+		}
+
+		std::unordered_map<std::string_view, std::uint32_t> labelIndex;	// label -> resultのインデックス
+		labelIndex.reserve(total);
+		result.Reserve(total);
+
+		std::vector<MergeSource> inputs;
+		std::vector<std::uint32_t> inputLabels;
+		inputs.reserve(total);
+		inputLabels.reserve(total);
+		for (size_t i = 0; i < documents.size(); ++i) {
+			for (auto& record : *documents[i]) {
+				if (record.label.size() == 0) {
+					continue;
+				}
+				auto it = labelIndex.try_emplace(record.label, static_cast<std::uint32_t>(result.size()));
+				if (it.second) {
+					result.Insert(record.label);
+				}
+				inputs.push_back({ i, &record });
+				inputLabels.push_back(it.first->second);
+			}
+		}
+
+		// ラベルごとに連続するように、入力の順を保ったまま並べ替える (計数ソート)
+		std::vector<std::uint32_t> offsets(result.size() + 1, 0);
+		for (auto idx : inputLabels) {
+			offsets[idx + 1]++;
+		}
+		for (size_t idx = 0; idx < result.size(); ++idx) {
+			offsets[idx + 1] += offsets[idx];
+		}
+		std::vector<MergeSource> sources(inputs.size());
+		{
+			std::vector<std::uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < inputs.size(); ++i) {
+				sources[cursor[inputLabels[i]]++] = inputs[i];
+			}
+		}
+
+		std::vector<const Record*> candidates;
+		std::vector<size_t> owners;
+		std::vector<MergeSource> ordered;
+		for (size_t idx = 0; idx < result.size(); ++idx) {
+			const MergeSource* first = sources.data() + offsets[idx];
+			const MergeSource* last = sources.data() + offsets[idx + 1];
+			Record& dst = result[idx];
+
+			//
+			// シグネチャが食い違っていれば1つ選び、その入力を先頭にする
+			//
+			candidates.clear();
+			owners.clear();
+			for (auto* source = first; source != last; ++source) {
+				auto it = std::find_if(candidates.begin(), candidates.end(), [source](const Record* elem) -> bool {
+					return elem->signature == source->record->signature;
+				});
+				if (it == candidates.end()) {
+					candidates.push_back(source->record);
+					owners.push_back(source->document);
+				}
+			}
+
+			size_t chosen = 0;
+			if (candidates.size() > 1) {
+				chosen = resolve ? std::min<size_t>(resolve(dst.label, candidates), candidates.size() - 1) : 0;
+
+				MergeConflict conflict = { MergeConflict::Kind::kSignature, dst.label, std::string(), {}, chosen };
+				for (size_t i = 0; i < candidates.size(); ++i) {
+					conflict.candidates.push_back({ owners[i], candidates[i]->signature });
+				}
+				conflicts.push_back(std::move(conflict));
+			}
+
+			ordered.clear();
+			for (auto* source = first; source != last; ++source) {
+				if (source->record == candidates[chosen]) {
+					ordered.push_back(*source);
+				}
+			}
+			for (auto* source = first; source != last; ++source) {
+				if (source->record != candidates[chosen]) {
+					ordered.push_back(*source);
+				}
+			}
+
+			MergeRecord(ordered, modules, result, dst, conflicts);
+		}
+	}
+}
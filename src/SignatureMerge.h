@@ -0,0 +1,53 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+
+
+namespace Signature
+{
+	class Document;
+	struct Record;
+
+
+	// 併合で食い違った値
+	struct MergeConflict
+	{
+		enum class Kind
+		{
+			kSignature,			// 同じラベルに別のシグネチャ
+			kAddress,			// 同じラベル・同じモジュールに別のアドレス
+			kFingerprint		// 同じラベルに別の"unwind"
+		};
+
+		struct Candidate
+		{
+			size_t			document;	// 何番目の入力か
+			std::string		value;		// シグネチャ、アドレス ("0x%08llX"か"deleted")、指紋 ("%016llX")
+		};
+
+		Kind					kind;
+		std::string				label;
+		std::string				module;		// kAddressのみ、アドレス欄のキー
+		std::vector<Candidate>	candidates;	// 値ごとに、最初に出てきた入力
+		size_t					chosen;		// 採用したcandidatesのインデックス
+	};
+
+
+	// 同じラベルのシグネチャが食い違ったとき、採用するレコードのインデックスを返す
+	// candidatesは入力の順に並んでいて、シグネチャはすべて異なる
+	using MergeResolver = std::function<size_t(const std::string& label, const std::vector<const Record*>& candidates)>;
+
+
+	// documentsを前から順にラベルで併合し、resultに入れる (resultのそれまでの内容は破棄される)
+	//
+	// - シグネチャが食い違ったらresolveで選ぶ。選んだレコードのシグネチャ・指紋・知らないフィールドを優先する
+	// - アドレス欄はモジュールごとに併せる。同じモジュールのアドレスが食い違ったら、選んだレコード、
+	//   次に前の入力を優先する
+	// - 食い違いはすべてconflictsに返す
+	//
+	// ラベルとアドレス欄のキーはハッシュで引くので、全入力のレコード数に比例した時間で終わる。
+	void Merge(const std::vector<const Document*>& documents, const MergeResolver& resolve,
+		Document& result, std::vector<MergeConflict>& conflicts);
+}
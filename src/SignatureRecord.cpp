@@ -0,0 +1,341 @@
+﻿#include "pch.h"
+#include "SignatureRecord.h"
+#include "SignatureDatabase.h"
+#include "Signature.h"
+#include "Util.h"
+#include "json11/json11_arena.hpp"
+#include "json11/json11_writer.hpp"
+#include <algorithm>
+#include <iterator>	// size
+
+
+static duint ParseAddress(std::string_view address)
+{
+	if (address == "deleted") {
+		return 0;
+	}
+	std::string strAddress(address);
+	std::size_t idx;
+	try {
+		int d = std::stoi(strAddress, &idx, 0);
+		return idx == strAddress.size() ? d : 0;
+	}
+	catch (const std::invalid_argument & e) {
+		_plugin_logprintf("invalid argument error in std::stoi()\n");
+		if (e.what()) {
+			_plugin_logprintf(e.what());
+		}
+		_plugin_logprintf(strAddress.c_str());
+		_plugin_logprintf("\n");
+	}
+	catch (const std::out_of_range & e) {
+		_plugin_logprintf("out of range error in std::stoi()\n");
+		if (e.what()) {
+			_plugin_logprintf(e.what());
+		}
+		_plugin_logprintf(strAddress.c_str());
+		_plugin_logprintf("\n");
+	}
+	return 0;
+}
+
+
+static std::string_view FormatAddress(duint rva, char (&buffer)[32])
+{
+	if (rva == 0) {
+		return "deleted";
+	}
+	int length = sprintf_s(buffer, "0x%08llX", static_cast<unsigned long long>(rva));
+	return std::string_view(buffer, length);
+}
+
+
+static std::uint64_t ParseFingerprint(std::string_view fingerprint)
+{
+	if (fingerprint.size() == 0) {
+		return 0;
+	}
+	std::string strFingerprint(fingerprint);
+	char* end = nullptr;
+	std::uint64_t result = std::strtoull(strFingerprint.c_str(), &end, 16);
+	return *end == '\0' ? result : 0;
+}
+
+
+static std::string_view FormatFingerprint(std::uint64_t fingerprint, char (&buffer)[32])
+{
+	int length = sprintf_s(buffer, "%016llX", static_cast<unsigned long long>(fingerprint));
+	return std::string_view(buffer, length);
+}
+
+
+// レコードを書き出す。キーはアルファベット順 (知らないフィールドも合わせて並べる)
+static void WriteRecord(json11::Writer& writer, const Signature::Record& record, const std::vector<std::string>& modules)
+{
+	enum Field : size_t
+	{
+		kAddress,
+		kCode,
+		kLabel,
+		kModule,
+		kRelation,
+		kSignature,
+		kUnwind,
+		kExtra
+	};
+
+	std::pair<std::string_view, size_t> fields[kExtra];
+	size_t count = 0;
+	if (record.addresses.size()) {
+		fields[count++] = { "address", kAddress };
+	}
+	if (record.codeHash) {
+		fields[count++] = { "code", kCode };
+	}
+	fields[count++] = { "label", kLabel };
+	if (record.module.size()) {
+		fields[count++] = { "module", kModule };
+	}
+	if (record.relation.size()) {
+		fields[count++] = { "relation", kRelation };
+	}
+	fields[count++] = { "signature", kSignature };
+	if (record.fingerprint) {
+		fields[count++] = { "unwind", kUnwind };
+	}
+
+	char buffer[32];
+	auto extra = record.extra.begin();
+
+	writer.begin_object();
+	for (size_t i = 0; i < count || extra != record.extra.end();) {
+		// extraは読み込んだ順 (キー順) に並んでいる
+		if (extra != record.extra.end() && (i == count || extra->first < fields[i].first)) {
+			writer.key(extra->first);
+			writer.value(extra->second);
+			++extra;
+			continue;
+		}
+
+		writer.key(fields[i].first);
+		switch (fields[i++].second) {
+		case kAddress:
+		{
+			// モジュール名の順に並べる
+			const Signature::Record::Address* sorted[16];
+			std::vector<const Signature::Record::Address*> heap;
+			const Signature::Record::Address** first = sorted;
+			size_t n = record.addresses.size();
+			if (n > std::size(sorted)) {
+				heap.resize(n);
+				first = heap.data();
+			}
+			for (size_t j = 0; j < n; ++j) {
+				first[j] = &record.addresses[j];
+			}
+			std::stable_sort(first, first + n, [&modules](const Signature::Record::Address* lhs, const Signature::Record::Address* rhs) {
+				return modules[lhs->module] < modules[rhs->module];
+			});
+
+			writer.begin_object();
+			for (size_t j = 0; j < n; ++j) {
+				if (j > 0 && first[j]->module == first[j - 1]->module) {
+					continue;
+				}
+				writer.key(modules[first[j]->module]);
+				writer.value(FormatAddress(first[j]->rva, buffer));
+			}
+			writer.end_object();
+			break;
+		}
+		case kCode:
+			writer.value(FormatFingerprint(record.codeHash, buffer));
+			break;
+		case kLabel:
+			writer.value(record.label);
+			break;
+		case kModule:
+			writer.value(record.module);
+			break;
+		case kRelation:
+			writer.value(record.relation);
+			break;
+		case kSignature:
+			writer.value(record.signature);
+			break;
+		case kUnwind:
+			writer.value(FormatFingerprint(record.fingerprint, buffer));
+			break;
+		}
+	}
+	writer.end_object();
+}
+
+
+
+namespace Signature
+{
+	bool Document::Load(const char* path, std::string& err)
+	{
+		Clear();
+
+		json11::arena::Document json;
+		if (!json.load(path, err)) {
+			return false;
+		}
+
+		auto items = json.root().array_items();
+		_records.reserve(items.size());
+
+		// アドレス欄のキーはほとんど同じなので、文字列を作らずに引く
+		std::unordered_map<std::string_view, std::uint32_t> moduleCache;
+
+		for (auto& obj : items) {
+			Record record;
+			for (auto& member : obj.object_items()) {
+				auto& key = member.key;
+				auto& value = member.value;
+				if (key == "label") {
+					record.label = value.string_value();
+				}
+				else if (key == "signature") {
+					record.signature = value.string_value();
+				}
+				else if (key == "module") {
+					record.module = value.string_value();
+				}
+				else if (key == "relation") {
+					record.relation = value.string_value();
+				}
+				else if (key == "unwind") {
+					record.fingerprint = ParseFingerprint(value.string_value());
+				}
+				else if (key == "code") {
+					record.codeHash = ParseFingerprint(value.string_value());
+				}
+				else if (key == "address") {
+					auto addressMap = value.object_items();
+					record.addresses.reserve(addressMap.size());
+					for (auto& address : addressMap) {
+						auto it = moduleCache.find(address.key);
+						if (it == moduleCache.end()) {
+							it = moduleCache.emplace(address.key, Intern(std::string(address.key))).first;
+						}
+						record.addresses.push_back({ it->second, ParseAddress(address.value.string_value()) });
+					}
+				}
+				else {
+					record.extra.emplace_back(std::string(key), value.to_json());
+				}
+			}
+
+			_labelIndex.emplace(record.label, static_cast<std::uint32_t>(_records.size()));
+			_records.push_back(std::move(record));
+		}
+
+		return true;
+	}
+
+
+	bool Document::Save(const char* path, int indent, std::string& err) const
+	{
+		// 一時ファイルに書き出してから置き換える (途中で失敗しても元のファイルは壊れない)
+		std::string temp = std::string(path) + ".tmp";
+		FILE* fp = nullptr;
+		if (fopen_s(&fp, temp.c_str(), "wb") != 0 || !fp) {
+			err = "cannot create the file: " + temp;
+			return false;
+		}
+
+		bool succeeded;
+		{
+			json11::Writer writer(fp, indent);
+			writer.begin_array();
+			for (auto& record : _records) {
+				WriteRecord(writer, record, _modules);
+			}
+			writer.end_array();
+			succeeded = writer.flush();
+		}
+		succeeded = std::fflush(fp) == 0 && succeeded;
+		succeeded = std::fclose(fp) == 0 && succeeded;
+
+		if (!succeeded) {
+			DeleteFileA(temp.c_str());
+			err = "cannot write the file: " + temp;
+			return false;
+		}
+		if (!Util::CommitFile(temp, path)) {
+			err = "cannot replace the file: " + std::string(path);
+			return false;
+		}
+		return true;
+	}
+
+
+	bool Document::Verify(const Record& record, duint labelAddr) const
+	{
+		if (_database && record.compiled != Database::npos) {
+			return Signature::Verify(_database->pattern(record.compiled), labelAddr);
+		}
+		return Signature::Verify(record.signature, labelAddr);
+	}
+
+
+	bool Document::Compile(const Record& record, Pattern& pattern) const
+	{
+		if (_database && record.compiled != Database::npos) {
+			auto view = _database->pattern(record.compiled);
+			pattern.bytes.assign(view.bytes, view.bytes + view.size);
+			pattern.mask.assign(view.mask, view.mask + view.size);
+			pattern.index = view.index;
+			return true;
+		}
+		return Signature::Compile(record.signature, pattern);
+	}
+
+
+	void Document::Clear()
+	{
+		_database.reset();
+		_records.clear();
+		_labelIndex.clear();
+		_modules.clear();
+		_moduleIndex.clear();
+	}
+
+
+	void Document::Reserve(size_t count)
+	{
+		_records.reserve(count);
+		_labelIndex.reserve(count);
+	}
+
+
+	size_t Document::Find(const std::string& label) const
+	{
+		auto it = _labelIndex.find(label);
+		return it != _labelIndex.end() ? it->second : npos;
+	}
+
+
+	Record& Document::Insert(const std::string& label)
+	{
+		auto result = _labelIndex.emplace(label, static_cast<std::uint32_t>(_records.size()));
+		if (result.second) {
+			_records.emplace_back();
+			_records.back().label = label;
+		}
+		return _records[result.first->second];
+	}
+
+
+	std::uint32_t Document::Intern(const std::string& module)
+	{
+		auto result = _moduleIndex.emplace(module, static_cast<std::uint32_t>(_modules.size()));
+		if (result.second) {
+			_modules.push_back(module);
+		}
+		return result.first->second;
+	}
+}
@@ -0,0 +1,118 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include "json11/json11.hpp"
+
+
+namespace Signature
+{
+	class Database;
+	struct Pattern;
+
+
+	// シグネチャファイルの1エントリ
+	struct Record
+	{
+		struct Address
+		{
+			std::uint32_t	module;		// Document::module() のインデックス
+			duint			rva;		// 0なら"deleted"
+		};
+
+		std::string				label;
+		std::string				signature;
+		std::string				module;				// "module" 対象モジュールのファイル名 (空ならメインモジュール)
+		std::uint64_t			fingerprint = 0;	// "unwind" (0なら無し)
+		std::uint64_t			codeHash = 0;		// "code" 値を除いた命令のハッシュ (MSPE::CodeHashTable、0なら無し)
+		std::string				relation;			// "relation" 解決できたラベルからの呼び出し関係 (SignatureRelation.h、空なら無し)
+		std::vector<Address>	addresses;
+
+		// シグネチャデータベースから読んだときの、コンパイル済みのパターン (Databaseのレコード)
+		// signatureを書き換えたらnposに戻す
+		std::uint32_t			compiled = static_cast<std::uint32_t>(-1);
+
+		// 知らないフィールド (そのまま書き戻す)
+		std::vector<std::pair<std::string, json11::Json>>	extra;
+	};
+
+
+	// シグネチャファイルの内容
+	// ラベルのハッシュ索引と、アドレス欄のキー (モジュール名) の表を持つ
+	class Document
+	{
+	public:
+		static constexpr size_t npos = static_cast<size_t>(-1);
+
+		// JSONファイルを読み込む (それまでの内容は破棄される)
+		bool Load(const char* path, std::string& err);
+
+		// JSONファイルに書き出す。indentが0なら改行なし
+		bool Save(const char* path, int indent, std::string& err) const;
+
+		// シグネチャデータベース (.sigdb) を読み込む (それまでの内容は破棄される)
+		bool LoadDatabase(const char* path, std::string& err);
+
+		// シグネチャデータベース (.sigdb) に書き出す
+		bool SaveDatabase(const char* path, std::string& err) const;
+
+		// labelAddrにラベルがあるとして、レコードのシグネチャが一致すればtrueを返す
+		// データベースから読んだレコードは、コンパイル済みのパターンで比較する
+		bool Verify(const Record& record, duint labelAddr) const;
+
+		// レコードのシグネチャをコンパイルする。データベースから読んだレコードは、コンパイル済みのパターンをコピーする
+		bool Compile(const Record& record, Pattern& pattern) const;
+
+		void Clear();
+
+		// レコードcount個分の領域を確保しておく
+		void Reserve(size_t count);
+
+		inline size_t size() const {
+			return _records.size();
+		}
+		inline Record& operator[](size_t idx) {
+			return _records[idx];
+		}
+		inline const Record& operator[](size_t idx) const {
+			return _records[idx];
+		}
+		inline std::vector<Record>::iterator begin() {
+			return _records.begin();
+		}
+		inline std::vector<Record>::iterator end() {
+			return _records.end();
+		}
+		inline std::vector<Record>::const_iterator begin() const {
+			return _records.begin();
+		}
+		inline std::vector<Record>::const_iterator end() const {
+			return _records.end();
+		}
+
+		// labelを持つ最初のレコードのインデックスを返す。なければnpos
+		size_t Find(const std::string& label) const;
+
+		// labelを持つレコードを返す。なければ末尾に追加する
+		Record& Insert(const std::string& label);
+
+		// アドレス欄のキーを登録し、そのインデックスを返す
+		std::uint32_t Intern(const std::string& module);
+
+		inline size_t module_count() const {
+			return _modules.size();
+		}
+		inline const std::string& module(std::uint32_t idx) const {
+			return _modules[idx];
+		}
+
+	private:
+		std::shared_ptr<const Database>					_database;
+		std::vector<Record>								_records;
+		std::unordered_map<std::string, std::uint32_t>	_labelIndex;	// label -> 最初のレコード
+		std::vector<std::string>						_modules;
+		std::unordered_map<std::string, std::uint32_t>	_moduleIndex;	// module -> _modulesのインデックス
+	};
+}
@@ -0,0 +1,225 @@
+﻿#include "pch.h"
+#include "SignatureRelation.h"
+#include "MSPE.h"
+#include <algorithm>	// find
+
+
+namespace
+{
+	constexpr char kCalleePrefix[] = "call:";
+	constexpr size_t kCalleePrefixLength = sizeof(kCalleePrefix) - 1;
+	constexpr char kCallerPrefix[] = "caller:";
+	constexpr size_t kCallerPrefixLength = sizeof(kCallerPrefix) - 1;
+
+	using Relation = Signature::Relation::Relation;
+
+
+	bool StartsWith(const std::string& str, const char* prefix, size_t length)
+	{
+		return str.size() >= length && str.compare(0, length, prefix) == 0;
+	}
+
+
+	// rvaを含む関数の範囲 (関数テーブルになければfalse)
+	bool GetFunction(const MSPE::FunctionTable& functions, std::uint32_t rva, std::uint32_t& begin, std::uint32_t& end)
+	{
+		size_t idx = functions.FindOwner(rva);
+		if (idx == MSPE::FunctionTable::npos) {
+			return false;
+		}
+		begin = functions[idx].begin;
+		end = functions[idx].end;
+		return true;
+	}
+
+
+	// アンカーのラベルをx64dbgから引いてたどる (Find / Verify)
+	bool DeriveFromLabel(const std::string& signature, std::vector<std::uint32_t>& result)
+	{
+		Relation relation;
+		if (!Signature::Relation::Parse(signature, relation)) {
+			_plugin_logprintf("invalid relation signature: \"%s\"\n", signature.c_str());
+			return false;
+		}
+
+		auto& image = MSPE::Image::Get();
+		duint anchor = 0;
+		if (!Script::Label::FromString(relation.anchor.c_str(), &anchor) || !image.contains_addr(anchor)) {
+			return true;		// not found
+		}
+
+		Signature::Relation::Derive(relation, image.rva(anchor), MSPE::FunctionTable::Get(), MSPE::XrefTable::Get(), result);
+		return true;
+	}
+}
+
+
+namespace Signature::Relation
+{
+	bool IsRelation(const std::string& signature)
+	{
+		return StartsWith(signature, kCalleePrefix, kCalleePrefixLength) || StartsWith(signature, kCallerPrefix, kCallerPrefixLength);
+	}
+
+
+	bool Parse(const std::string& signature, Relation& relation)
+	{
+		if (StartsWith(signature, kCallerPrefix, kCallerPrefixLength)) {
+			relation.kind = Relation::Kind::kCaller;
+			relation.anchor = signature.substr(kCallerPrefixLength);
+			relation.ordinal = 0;
+			return relation.anchor.size() > 0;
+		}
+		if (!StartsWith(signature, kCalleePrefix, kCalleePrefixLength)) {
+			return false;
+		}
+
+		// "<label>#<n>"
+		auto pos = signature.rfind('#');
+		if (pos == std::string::npos || pos <= kCalleePrefixLength || pos + 1 >= signature.size()) {
+			return false;
+		}
+		char* end = nullptr;
+		relation.kind = Relation::Kind::kCallee;
+		relation.ordinal = std::strtoul(signature.c_str() + pos + 1, &end, 10);
+		relation.anchor = signature.substr(kCalleePrefixLength, pos - kCalleePrefixLength);
+		return *end == '\0';
+	}
+
+
+	std::string Format(const Relation& relation)
+	{
+		if (relation.kind == Relation::Kind::kCaller) {
+			return kCallerPrefix + relation.anchor;
+		}
+		return kCalleePrefix + relation.anchor + "#" + std::to_string(relation.ordinal);
+	}
+
+
+	void Derive(const Relation& relation, std::uint32_t anchorRva, const MSPE::FunctionTable& functions, const MSPE::XrefTable& xrefs,
+		std::vector<std::uint32_t>& result)
+	{
+		if (relation.kind == Relation::Kind::kCallee) {
+			// アンカーの関数の中の call を、アドレス順に数える
+			std::uint32_t begin, end;
+			if (!GetFunction(functions, anchorRva, begin, end)) {
+				return;
+			}
+			size_t n = 0;
+			for (auto& xref : xrefs.From(begin, end)) {
+				if (xref.kind != MSPE::XrefTable::Kind::kCall) {
+					continue;
+				}
+				if (n++ == relation.ordinal) {
+					result.push_back(xref.to);
+					return;
+				}
+			}
+			return;
+		}
+
+		// アンカーを呼び出している関数 (同じ関数からの呼び出しはまとめる)
+		for (auto idx : xrefs.To(anchorRva)) {
+			auto& xref = xrefs[idx];
+			std::uint32_t begin, end;
+			if (xref.kind != MSPE::XrefTable::Kind::kCall || !GetFunction(functions, xref.from, begin, end)) {
+				continue;
+			}
+			if (std::find(result.begin(), result.end(), begin) == result.end()) {
+				result.push_back(begin);
+			}
+		}
+	}
+
+
+	bool Describe(std::uint32_t rva, const std::function<const std::string*(std::uint32_t)>& labelAt,
+		const MSPE::FunctionTable& functions, const MSPE::XrefTable& xrefs, Relation& relation)
+	{
+		std::vector<std::uint32_t> derived;
+		auto derivesOnly = [&](const Relation& candidate, std::uint32_t anchorRva) -> bool {
+			derived.clear();
+			Derive(candidate, anchorRva, functions, xrefs, derived);
+			return derived.size() == 1 && derived.front() == rva;
+		};
+
+		//
+		// 1. ラベルの付いた関数の n 番目の call (呼び出し元ごとに、関数の中の call の順番を数える)
+		//
+		for (auto idx : xrefs.To(rva)) {
+			auto& site = xrefs[idx];
+			std::uint32_t begin, end;
+			if (site.kind != MSPE::XrefTable::Kind::kCall || !GetFunction(functions, site.from, begin, end) || begin == rva) {
+				continue;
+			}
+			const std::string* anchor = labelAt(begin);
+			if (!anchor) {
+				continue;
+			}
+
+			Relation candidate;
+			candidate.kind = Relation::Kind::kCallee;
+			candidate.anchor = *anchor;
+			for (auto& xref : xrefs.From(begin, site.from)) {
+				if (xref.kind == MSPE::XrefTable::Kind::kCall) {
+					candidate.ordinal++;
+				}
+			}
+			if (derivesOnly(candidate, begin)) {
+				relation = std::move(candidate);
+				return true;
+			}
+		}
+
+		//
+		// 2. ラベルの付いた関数を呼び出している、ただ1つの関数
+		//
+		std::uint32_t begin, end;
+		if (!GetFunction(functions, rva, begin, end) || begin != rva) {
+			return false;
+		}
+		for (auto& xref : xrefs.From(begin, end)) {
+			if (xref.kind != MSPE::XrefTable::Kind::kCall || xref.to == rva) {
+				continue;
+			}
+			const std::string* anchor = labelAt(xref.to);
+			if (!anchor) {
+				continue;
+			}
+
+			Relation candidate;
+			candidate.kind = Relation::Kind::kCaller;
+			candidate.anchor = *anchor;
+			if (derivesOnly(candidate, xref.to)) {
+				relation = std::move(candidate);
+				return true;
+			}
+		}
+		return false;
+	}
+
+
+	bool Find(const std::string& signature, std::vector<duint>& result, size_t maxResult)
+	{
+		std::vector<std::uint32_t> derived;
+		if (!DeriveFromLabel(signature, derived)) {
+			return false;
+		}
+		auto& image = MSPE::Image::Get();
+		for (auto rva : derived) {
+			if (maxResult != 0 && result.size() >= maxResult) {
+				break;
+			}
+			result.push_back(image.base() + rva);
+		}
+		return true;
+	}
+
+
+	bool Verify(const std::string& signature, duint labelAddr)
+	{
+		std::vector<std::uint32_t> derived;
+		auto& image = MSPE::Image::Get();
+		return DeriveFromLabel(signature, derived) && image.contains_addr(labelAddr)
+			&& derived.size() == 1 && derived.front() == image.rva(labelAddr);
+	}
+}
@@ -0,0 +1,55 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+
+
+namespace MSPE
+{
+	class FunctionTable;
+	class XrefTable;
+}
+
+
+// 呼び出し関係の形式のシグネチャ
+//   call:<label>#<n>	ラベル<label>の関数の中で、n 番目 (0から、アドレス順) の call の呼び出し先
+//   caller:<label>		ラベル<label>の関数を呼び出している、ただ1つの関数
+// バイト列のかわりにシグネチャとして書けるほか、レコードの"relation"として保存しておき、
+// シグネチャが見つからなくなったときに、解決できたラベルからたどって求める (SignatureFile.cpp)
+namespace Signature::Relation
+{
+	struct Relation
+	{
+		enum class Kind
+		{
+			kCallee,		// call:
+			kCaller			// caller:
+		};
+
+		Kind			kind = Kind::kCallee;
+		std::string		anchor;				// たどり始めるラベル
+		size_t			ordinal = 0;		// kCalleeのみ
+	};
+
+	// シグネチャが呼び出し関係の形式ならtrueを返す
+	bool IsRelation(const std::string& signature);
+
+	bool Parse(const std::string& signature, Relation& relation);
+	std::string Format(const Relation& relation);
+
+	// アンカーのラベルがanchorRvaにあるとして、関係をたどった先の関数を全て返す。x64dbgを呼ばないので、ワーカースレッドから呼べる
+	void Derive(const Relation& relation, std::uint32_t anchorRva, const MSPE::FunctionTable& functions, const MSPE::XrefTable& xrefs,
+		std::vector<std::uint32_t>& result);
+
+	// rvaの関数を、ラベルの付いた関数 (labelAtがラベルを返すもの) からの関係で表す
+	// 呼び出し元の関数からの call:、なければ呼び出し先の関数からの caller: を探し、たどってrvaだけに戻るものを返す
+	bool Describe(std::uint32_t rva, const std::function<const std::string*(std::uint32_t)>& labelAt,
+		const MSPE::FunctionTable& functions, const MSPE::XrefTable& xrefs, Relation& relation);
+
+	// x64dbgに張られたアンカーのラベルからたどり、見つかったアドレスを全て返す
+	bool Find(const std::string& signature, std::vector<duint>& result, size_t maxResult = 0);
+
+	// labelAddrが、x64dbgに張られたアンカーのラベルからたどった先ならtrueを返す
+	bool Verify(const std::string& signature, duint labelAddr);
+}
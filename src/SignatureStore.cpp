@@ -0,0 +1,314 @@
+﻿#include "pch.h"
+#include "SignatureStore.h"
+#include <algorithm>	// max
+#include <functional>	// hash
+
+
+namespace Signature
+{
+	static constexpr size_t kMinSlots = 64;
+	static constexpr size_t kMinGarbage = 64 * 1024;	// これより少なければ詰め直さない (バイト数)
+
+
+	static std::uint32_t HashLabel(std::string_view label)
+	{
+		return static_cast<std::uint32_t>(std::hash<std::string_view>()(label));
+	}
+
+
+	// パターンから、作成ダイアログと同じ形式のシグネチャ文字列 ("48 8B ?? *E8 ?? ?? ?? ??") を作る
+	static void FormatPattern(const PatternView& pattern, std::string& out)
+	{
+		static const char kHex[] = "0123456789ABCDEF";
+
+		out.clear();
+		if (pattern.size == 0) {
+			return;
+		}
+
+		// 1バイト3文字 (最後のバイトは区切りなし) と'*'
+		bool marked = pattern.index != 0;
+		out.resize(pattern.size * 3 - 1 + (marked ? (pattern.index == pattern.size ? 2 : 1) : 0));
+		char* p = &out[0];
+		for (size_t i = 0; i < pattern.size; ++i) {
+			if (i) {
+				*p++ = ' ';
+				if (i == pattern.index) {
+					*p++ = '*';
+				}
+			}
+			std::uint8_t byte = pattern.bytes[i];
+			std::uint8_t mask = pattern.mask[i];
+			*p++ = (mask & 0xF0) ? kHex[byte >> 4] : '?';
+			*p++ = (mask & 0x0F) ? kHex[byte & 0x0F] : '?';
+		}
+		if (marked && pattern.index == pattern.size) {
+			*p++ = ' ';
+			*p++ = '*';
+		}
+	}
+
+
+	Store& Store::Get()
+	{
+		static Store s_store;
+		return s_store;
+	}
+
+
+	std::uint32_t Store::Find(std::string_view label) const
+	{
+		if (_count == 0) {
+			return npos;
+		}
+		std::uint32_t slot = FindSlot(label, HashLabel(label), nullptr);
+		return slot == npos ? npos : _slots[slot];
+	}
+
+
+	std::uint32_t Store::Set(std::string_view label, std::string_view signature)
+	{
+		CompactIfNeeded();
+
+		// 墓標も含めて半分を超えたら広げる (墓標が多いだけなら同じ大きさで作り直す)
+		if ((_count + _tombstones + 1) * 2 > _slots.size()) {
+			Rehash(std::max<size_t>(kMinSlots, (_count + 1) * 4));
+		}
+
+		std::uint32_t hash = HashLabel(label);
+		std::uint32_t freeSlot = npos;
+		std::uint32_t slot = FindSlot(label, hash, &freeSlot);
+		if (slot != npos) {
+			std::uint32_t id = _slots[slot];
+			auto& entry = _entries[id];
+			std::string buffer;
+			if (this->signature(id, buffer) != signature) {
+				_garbage += SignatureFootprint(entry);
+				SetSignature(entry, signature);
+			}
+			return id;
+		}
+
+		std::uint32_t id = static_cast<std::uint32_t>(_entries.size());
+		Entry entry;
+		entry.label = AddString(label);
+		entry.hash = hash;
+		SetSignature(entry, signature);
+		_entries.push_back(entry);
+
+		if (_slots[freeSlot] == kTombstone) {
+			_tombstones--;
+		}
+		_slots[freeSlot] = id;
+		_count++;
+		return id;
+	}
+
+
+	bool Store::Remove(std::string_view label)
+	{
+		if (_count == 0) {
+			return false;
+		}
+		std::uint32_t slot = FindSlot(label, HashLabel(label), nullptr);
+		if (slot == npos) {
+			return false;
+		}
+
+		auto& entry = _entries[_slots[slot]];
+		_garbage += entry.label.length + 1 + SignatureFootprint(entry);
+		entry.label.offset = npos;
+		_slots[slot] = kTombstone;
+		_tombstones++;
+		_count--;
+
+		CompactIfNeeded();
+		return true;
+	}
+
+
+	void Store::Clear()
+	{
+		_entries.clear();
+		_strings.clear();
+		_patterns.clear();
+		_slots.clear();
+		_count = 0;
+		_tombstones = 0;
+		_garbage = 0;
+	}
+
+
+	void Store::Reserve(size_t count)
+	{
+		_entries.reserve(count);
+		if (count * 2 > _slots.size()) {
+			Rehash(count * 4);
+		}
+	}
+
+
+	std::string_view Store::signature(std::uint32_t id, std::string& buffer) const
+	{
+		auto& entry = _entries[id];
+		if (entry.signature.offset != npos) {
+			return string(entry.signature);
+		}
+		FormatPattern(pattern(id), buffer);
+		return buffer;
+	}
+
+
+	PatternView Store::pattern(std::uint32_t id) const
+	{
+		auto& entry = _entries[id];
+		if (entry.patternSize == 0) {
+			return PatternView();
+		}
+		const std::uint8_t* bytes = _patterns.data() + entry.pattern;
+		return PatternView{ bytes, bytes + entry.patternSize, entry.patternSize, entry.patternIndex };
+	}
+
+
+	Store::StringRef Store::AddString(std::string_view str)
+	{
+		StringRef ref = { static_cast<std::uint32_t>(_strings.size()), static_cast<std::uint32_t>(str.size()) };
+		_strings.insert(_strings.end(), str.begin(), str.end());
+		_strings.push_back('\0');
+		return ref;
+	}
+
+
+	void Store::SetSignature(Entry& entry, std::string_view signature)
+	{
+		Pattern compiled;
+		if (!Compile(std::string(signature), compiled)) {
+			entry.signature = AddString(signature);
+			entry.pattern = 0;
+			entry.patternSize = 0;
+			entry.patternIndex = 0;
+			return;
+		}
+		entry.pattern = static_cast<std::uint32_t>(_patterns.size());
+		entry.patternSize = static_cast<std::uint32_t>(compiled.size());
+		entry.patternIndex = static_cast<std::uint32_t>(compiled.index);
+		_patterns.insert(_patterns.end(), compiled.bytes.begin(), compiled.bytes.end());
+		_patterns.insert(_patterns.end(), compiled.mask.begin(), compiled.mask.end());
+
+		// パターンから同じ文字列を作れるなら、文字列は持たない
+		std::string formatted;
+		FormatPattern(compiled.view(), formatted);
+		if (formatted == signature) {
+			entry.signature = { npos, 0 };
+		}
+		else {
+			entry.signature = AddString(signature);
+		}
+	}
+
+
+	size_t Store::SignatureFootprint(const Entry& entry)
+	{
+		size_t size = entry.patternSize * 2;
+		if (entry.signature.offset != npos) {
+			size += entry.signature.length + 1;
+		}
+		return size;
+	}
+
+
+	std::uint32_t Store::FindSlot(std::string_view label, std::uint32_t hash, std::uint32_t* free_slot) const
+	{
+		size_t mask = _slots.size() - 1;
+		for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+			std::uint32_t id = _slots[i];
+			if (id == kEmpty) {
+				if (free_slot && *free_slot == npos) {
+					*free_slot = static_cast<std::uint32_t>(i);
+				}
+				return npos;
+			}
+			if (id == kTombstone) {
+				if (free_slot && *free_slot == npos) {
+					*free_slot = static_cast<std::uint32_t>(i);
+				}
+				continue;
+			}
+			auto& entry = _entries[id];
+			if (entry.hash == hash && string(entry.label) == label) {
+				return static_cast<std::uint32_t>(i);
+			}
+		}
+	}
+
+
+	void Store::Rehash(size_t capacity)
+	{
+		size_t size = kMinSlots;
+		while (size < capacity) {
+			size <<= 1;
+		}
+
+		_slots.assign(size, kEmpty);
+		_tombstones = 0;
+		size_t mask = size - 1;
+		for (std::uint32_t id = 0; id < _entries.size(); ++id) {
+			if (_entries[id].removed()) {
+				continue;
+			}
+			size_t i = _entries[id].hash & mask;
+			while (_slots[i] != kEmpty) {
+				i = (i + 1) & mask;
+			}
+			_slots[i] = id;
+		}
+	}
+
+
+	void Store::CompactIfNeeded()
+	{
+		// 使われていないバイトが、生きているものより多くなったら詰め直す
+		if (_garbage >= kMinGarbage && _garbage * 2 > _strings.size() + _patterns.size()) {
+			Compact();
+		}
+	}
+
+
+	void Store::Compact()
+	{
+		std::vector<Entry> entries;
+		std::vector<char> strings;
+		std::vector<std::uint8_t> patterns;
+		entries.reserve(_count);
+		strings.reserve(_strings.size());
+		patterns.reserve(_patterns.size());
+
+		auto copyString = [this, &strings](const StringRef& ref) -> StringRef {
+			StringRef result = { static_cast<std::uint32_t>(strings.size()), ref.length };
+			strings.insert(strings.end(), _strings.begin() + ref.offset, _strings.begin() + ref.offset + ref.length + 1);
+			return result;
+		};
+
+		for (auto& entry : _entries) {
+			if (entry.removed()) {
+				continue;
+			}
+			Entry copy = entry;
+			copy.label = copyString(entry.label);
+			if (entry.signature.offset != npos) {
+				copy.signature = copyString(entry.signature);
+			}
+			if (entry.patternSize) {
+				copy.pattern = static_cast<std::uint32_t>(patterns.size());
+				patterns.insert(patterns.end(), _patterns.begin() + entry.pattern, _patterns.begin() + entry.pattern + entry.patternSize * 2);
+			}
+			entries.push_back(copy);
+		}
+
+		_entries.swap(entries);
+		_strings.swap(strings);
+		_patterns.swap(patterns);
+		_garbage = 0;
+		Rehash(std::max<size_t>(kMinSlots, _count * 4));
+	}
+}
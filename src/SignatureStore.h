@@ -0,0 +1,131 @@
+﻿#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Signature.h"
+
+
+namespace Signature
+{
+	// 登録されたシグネチャ (Signature::Set/Get/Remove の中身)
+	//
+	// ラベルは1つの領域 (_strings) に、コンパイル済みのパターンはバイト列とマスクを続けて別の領域 (_patterns) に
+	// 詰める。シグネチャ文字列は、パターンから同じ文字列を作れない (書式が違う、アンカー形式など) ときだけ
+	// _stringsに持つ。ラベルIDは_entriesのインデックスで、名前はオープンアドレス法のハッシュ表 (_slots) で引く。
+	// 走査は_entriesを前から順に読むだけ (登録順) になる。
+	//
+	// 削除したエントリと置き換えたシグネチャは領域に残り、生きているものより多くなったら詰め直す。
+	// 詰め直すとラベルIDが変わるので、IDや文字列はSet/Remove/Clearをまたいで持たないこと。
+	class Store
+	{
+	public:
+		static constexpr std::uint32_t npos = static_cast<std::uint32_t>(-1);
+
+		static Store& Get();
+
+		// labelのラベルID、なければnpos
+		std::uint32_t Find(std::string_view label) const;
+
+		// labelにsignatureを登録 (置き換え) して、ラベルIDを返す
+		std::uint32_t Set(std::string_view label, std::string_view signature);
+
+		// labelを削除する。なければfalseを返す
+		bool Remove(std::string_view label);
+
+		void Clear();
+
+		// シグネチャcount個分のエントリとハッシュ表を確保しておく
+		void Reserve(size_t count);
+
+		// 登録されているシグネチャの数
+		inline size_t size() const {
+			return _count;
+		}
+
+		// ラベル (data()は'\0'で終わっている)
+		inline std::string_view label(std::uint32_t id) const {
+			return string(_entries[id].label);
+		}
+
+		// シグネチャ文字列 (data()は'\0'で終わっている)
+		// パターンから作るときはbufferに入れるので、次にbufferを使うまで有効
+		std::string_view signature(std::uint32_t id, std::string& buffer) const;
+
+		// コンパイル済みのパターン、アンカー形式などコンパイルできないシグネチャはsize 0
+		PatternView pattern(std::uint32_t id) const;
+
+		// 登録されているシグネチャを登録順に走査する
+		// callback(std::string_view label, std::string_view signature)。callbackの中でSet/Remove/Clearしないこと
+		template <class Callback>
+		void ForEach(Callback&& callback) const {
+			std::string buffer;
+			for (std::uint32_t id = 0; id < _entries.size(); ++id) {
+				if (!_entries[id].removed()) {
+					callback(label(id), signature(id, buffer));
+				}
+			}
+		}
+
+	private:
+		struct StringRef
+		{
+			std::uint32_t	offset;
+			std::uint32_t	length;
+		};
+
+		struct Entry
+		{
+			StringRef		label;				// 削除したらoffsetがnpos
+			StringRef		signature;			// パターンから作れるならoffsetがnpos
+			std::uint32_t	pattern;			// _patterns内のバイト列 (patternSize) とマスク (patternSize)
+			std::uint32_t	patternSize;		// 0ならコンパイルしていない
+			std::uint32_t	patternIndex;
+			std::uint32_t	hash;				// ラベルのハッシュ値 (下位32ビット)
+
+			inline bool removed() const {
+				return label.offset == npos;
+			}
+		};
+
+		static constexpr std::uint32_t kEmpty = npos;
+		static constexpr std::uint32_t kTombstone = npos - 1;
+
+		inline std::string_view string(const StringRef& ref) const {
+			return std::string_view(_strings.data() + ref.offset, ref.length);
+		}
+
+		StringRef AddString(std::string_view str);
+		void SetSignature(Entry& entry, std::string_view signature);
+
+		// シグネチャ文字列とパターンが使っているバイト数
+		static size_t SignatureFootprint(const Entry& entry);
+
+		// labelのスロット。なければ、入れるべきスロット (最初に見つけた墓標か空き) をfree_slotに返してnposを返す
+		std::uint32_t FindSlot(std::string_view label, std::uint32_t hash, std::uint32_t* free_slot) const;
+
+		// スロット数をcapacityにしてハッシュ表を作り直す
+		void Rehash(size_t capacity);
+
+		// 削除したエントリと使われなくなった文字列・パターンを取り除く (ラベルIDが変わる)
+		void CompactIfNeeded();
+		void Compact();
+
+		// members
+		std::vector<Entry>			_entries;
+		std::vector<char>			_strings;
+		std::vector<std::uint8_t>	_patterns;
+		std::vector<std::uint32_t>	_slots;		// ラベルID、kEmpty、kTombstone (要素数は2のべき乗)
+		size_t						_count = 0;
+		size_t						_tombstones = 0;
+		size_t						_garbage = 0;	// _stringsと_patternsの使われていないバイト数
+	};
+
+
+	// 登録されたシグネチャを登録順に走査する
+	template <class Callback>
+	inline void ForEach(Callback&& callback)
+	{
+		Store::Get().ForEach(std::forward<Callback>(callback));
+	}
+}
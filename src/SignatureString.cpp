@@ -0,0 +1,252 @@
+﻿#include "pch.h"
+#include "SignatureString.h"
+#include "MSPE.h"
+#include <algorithm>	// sort, unique, find
+
+
+namespace
+{
+	constexpr char kStringPrefix[] = "str:";
+	constexpr size_t kStringPrefixLength = sizeof(kStringPrefix) - 1;
+	constexpr char kCallSuffix[] = "+call#";
+	constexpr size_t kCallSuffixLength = sizeof(kCallSuffix) - 1;
+
+	using Literal = Signature::String::Literal;
+	using Kind = MSPE::XrefTable::Kind;
+
+
+	// 参照元fromから、同じ関数テーブルのエントリの終わりまでで n 番目の call の呼び出し先 (なければfalse)
+	bool FindCallAfter(const MSPE::XrefTable& xrefs, std::uint32_t from, std::uint32_t end, size_t ordinal, std::uint32_t& target)
+	{
+		size_t count = 0;
+		for (auto& xref : xrefs.From(from + 1, end)) {
+			if (xref.kind != Kind::kCall) {
+				continue;
+			}
+			if (count++ == ordinal) {
+				target = xref.to;
+				return true;
+			}
+		}
+		return false;
+	}
+
+
+	// 参照元fromから、その関数の中のtoまでにある call の数
+	size_t CountCalls(const MSPE::XrefTable& xrefs, std::uint32_t from, std::uint32_t to)
+	{
+		size_t count = 0;
+		for (auto& xref : xrefs.From(from + 1, to)) {
+			if (xref.kind == Kind::kCall) {
+				++count;
+			}
+		}
+		return count;
+	}
+}
+
+
+namespace Signature::String
+{
+	bool IsString(const std::string& signature)
+	{
+		return signature.size() >= kStringPrefixLength && signature.compare(0, kStringPrefixLength, kStringPrefix) == 0;
+	}
+
+
+	bool Parse(const std::string& signature, Literal& literal)
+	{
+		if (!IsString(signature)) {
+			return false;
+		}
+
+		// "<text>"
+		size_t pos = kStringPrefixLength;
+		if (pos >= signature.size() || signature[pos] != '"') {
+			return false;
+		}
+		literal.text.clear();
+		for (++pos; pos < signature.size() && signature[pos] != '"'; ++pos) {
+			char c = signature[pos];
+			if (c == '\\') {
+				if (++pos >= signature.size()) {
+					return false;
+				}
+				switch (signature[pos]) {
+				case 'n':	c = '\n';	break;
+				case 'r':	c = '\r';	break;
+				case 't':	c = '\t';	break;
+				case '"':	c = '"';	break;
+				case '\\':	c = '\\';	break;
+				default:
+					return false;
+				}
+			}
+			literal.text += c;
+		}
+		if (pos >= signature.size() || literal.text.empty()) {
+			return false;		// 閉じる '"' がない
+		}
+
+		// +call#<n>
+		literal.call = false;
+		literal.ordinal = 0;
+		std::string rest = signature.substr(pos + 1);
+		if (rest.empty()) {
+			return true;
+		}
+		if (rest.size() <= kCallSuffixLength || rest.compare(0, kCallSuffixLength, kCallSuffix) != 0) {
+			return false;
+		}
+		char* end = nullptr;
+		literal.ordinal = std::strtoul(rest.c_str() + kCallSuffixLength, &end, 10);
+		literal.call = true;
+		return *end == '\0' && std::isdigit(static_cast<unsigned char>(rest[kCallSuffixLength]));
+	}
+
+
+	std::string Format(const Literal& literal)
+	{
+		std::string signature = kStringPrefix;
+		signature += '"';
+		for (char c : literal.text) {
+			switch (c) {
+			case '\n':	signature += "\\n";		break;
+			case '\r':	signature += "\\r";		break;
+			case '\t':	signature += "\\t";		break;
+			case '"':	signature += "\\\"";	break;
+			case '\\':	signature += "\\\\";	break;
+			default:	signature += c;			break;
+			}
+		}
+		signature += '"';
+		if (literal.call) {
+			signature += kCallSuffix;
+			signature += std::to_string(literal.ordinal);
+		}
+		return signature;
+	}
+
+
+	void Find(const MSPE::Image& image, const MSPE::FunctionTable& functions, const MSPE::StringTable& strings, const MSPE::XrefTable& xrefs,
+		const Literal& literal, std::vector<duint>& result, size_t maxResult)
+	{
+		std::vector<std::uint32_t> found;
+		for (std::uint32_t rva : strings.Find(image, literal.text)) {
+			for (std::uint32_t idx : xrefs.To(rva)) {
+				auto& xref = xrefs[idx];
+				size_t entry = functions.Find(xref.from);
+				if (xref.kind != Kind::kData || entry == MSPE::FunctionTable::npos) {
+					continue;
+				}
+				if (!literal.call) {
+					found.push_back(functions[functions[entry].owner].begin);
+					continue;
+				}
+				std::uint32_t target;
+				if (FindCallAfter(xrefs, xref.from, functions[entry].end, literal.ordinal, target)) {
+					found.push_back(target);
+				}
+			}
+		}
+
+		// 同じ関数から何度も参照していれば、1つにまとめる
+		std::sort(found.begin(), found.end());
+		found.erase(std::unique(found.begin(), found.end()), found.end());
+		for (std::uint32_t rva : found) {
+			if (maxResult != 0 && result.size() >= maxResult) {
+				break;
+			}
+			result.push_back(image.base() + rva);
+		}
+	}
+
+
+	bool Describe(duint addr, std::string& signature)
+	{
+		auto& image = MSPE::Image::Get();
+		if (!image.contains_addr(addr)) {
+			return false;
+		}
+		auto& functions = MSPE::FunctionTable::Get();
+		std::uint32_t rva = image.rva(addr);
+		size_t idx = functions.FindOwner(rva);
+		if (idx == MSPE::FunctionTable::npos || functions[idx].begin != rva) {
+			return false;
+		}
+
+		auto& strings = MSPE::StringTable::Get();
+		auto& xrefs = MSPE::XrefTable::Get();
+
+		// 引き直してaddrだけに戻るものを使う
+		std::vector<duint> found;
+		auto unique = [&](const Literal& literal) -> bool {
+			found.clear();
+			Find(image, functions, strings, xrefs, literal, found, 2);
+			return found.size() == 1 && found.front() == addr;
+		};
+
+		// 関数の中で参照している文字列
+		Literal literal;
+		for (auto& xref : xrefs.From(functions[idx].begin, functions[idx].end)) {
+			size_t str = strings.Find(xref.to);
+			if (xref.kind != Kind::kData || str == MSPE::StringTable::npos) {
+				continue;
+			}
+			literal.text = strings.Text(image, str);
+			literal.call = false;
+			if (unique(literal)) {
+				signature = Format(literal);
+				return true;
+			}
+		}
+
+		// 呼び出し元で、呼び出しの前に参照している文字列 (近いものから)
+		for (std::uint32_t site : xrefs.To(rva)) {
+			auto& call = xrefs[site];
+			size_t entry = functions.Find(call.from);
+			if (call.kind != Kind::kCall || entry == MSPE::FunctionTable::npos) {
+				continue;
+			}
+			auto refs = xrefs.From(functions[entry].begin, call.from);
+			for (size_t i = refs.size(); i-- > 0;) {
+				size_t str = strings.Find(refs[i].to);
+				if (refs[i].kind != Kind::kData || str == MSPE::StringTable::npos) {
+					continue;
+				}
+				literal.text = strings.Text(image, str);
+				literal.call = true;
+				literal.ordinal = CountCalls(xrefs, refs[i].from, call.from);
+				if (unique(literal)) {
+					signature = Format(literal);
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+
+	bool Find(const std::string& signature, std::vector<duint>& result, size_t maxResult)
+	{
+		Literal literal;
+		if (!Parse(signature, literal)) {
+			_plugin_logprintf("invalid string signature: \"%s\"\n", signature.c_str());
+			return false;
+		}
+		Find(MSPE::Image::Get(), MSPE::FunctionTable::Get(), MSPE::StringTable::Get(), MSPE::XrefTable::Get(), literal, result, maxResult);
+		return true;
+	}
+
+
+	bool Verify(const std::string& signature, duint labelAddr)
+	{
+		Literal literal;
+		if (!Parse(signature, literal)) {
+			return false;
+		}
+		std::vector<duint> result;
+		Find(MSPE::Image::Get(), MSPE::FunctionTable::Get(), MSPE::StringTable::Get(), MSPE::XrefTable::Get(), literal, result);
+		return std::find(result.begin(), result.end(), labelAddr) != result.end();
+	}
+}
@@ -0,0 +1,46 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+
+
+namespace MSPE
+{
+	class Image;
+	class FunctionTable;
+	class StringTable;
+	class XrefTable;
+}
+
+
+// 文字列参照の形式のシグネチャ
+//   str:"<text>"				.rdataの文字列リテラル<text>を参照している関数
+//   str:"<text>"+call#<n>		その参照のあとで、同じ関数の中で n 番目 (0から、アドレス順) の call の呼び出し先
+// <text>の中の '"' と '\' は '\' を前に付けて書く (\n、\r、\t も使える)。ASCIIとUTF-16のリテラルのどちらにも一致する。
+// 文字列の索引 (MSPE::StringTable) と参照の索引 (MSPE::XrefTable) を引くだけなので、セクションは検索しない
+namespace Signature::String
+{
+	struct Literal
+	{
+		std::string		text;
+		bool			call = false;		// +call#<n> があればtrue
+		size_t			ordinal = 0;
+	};
+
+	// シグネチャが文字列参照の形式ならtrueを返す
+	bool IsString(const std::string& signature);
+
+	bool Parse(const std::string& signature, Literal& literal);
+	std::string Format(const Literal& literal);
+
+	// 文字列を参照している命令からたどった先の関数を全て返す (アドレス順)。x64dbgを呼ばないので、ワーカースレッドから呼べる
+	void Find(const MSPE::Image& image, const MSPE::FunctionTable& functions, const MSPE::StringTable& strings, const MSPE::XrefTable& xrefs,
+		const Literal& literal, std::vector<duint>& result, size_t maxResult = 0);
+
+	// addrの関数を、それだけを参照している文字列か、呼び出し元が参照している文字列からの call で表す
+	bool Describe(duint addr, std::string& signature);
+
+	// メインモジュールの索引を使う版
+	bool Find(const std::string& signature, std::vector<duint>& result, size_t maxResult = 0);
+	bool Verify(const std::string& signature, duint labelAddr);
+}
@@ -0,0 +1,188 @@
+﻿#include "pch.h"
+#include "Signature.h"
+#include "SignatureStore.h"
+#include "LabelIndex.h"
+#include "Job.h"
+#include <algorithm>	// sort, min
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+
+namespace
+{
+	// シグネチャ一覧の1行
+	struct Row
+	{
+		duint		addr = 0;		// ラベルがなければ0
+		std::string	label;
+		std::string	signature;
+	};
+
+	constexpr size_t kVisibleRows = 64;		// 開くときに埋める行数 (最初に見える分)
+	constexpr size_t kBatchSize = 256;		// 残りの行を埋める単位
+
+	std::mutex								s_cacheMutex;
+	std::unordered_map<duint, std::string>	s_disassembly;		// アドレス -> 逆アセンブル
+
+
+	bool FindDisassembly(duint addr, std::string& text)
+	{
+		std::lock_guard<std::mutex> lock(s_cacheMutex);
+
+		auto it = s_disassembly.find(addr);
+		if (it == s_disassembly.end()) {
+			return false;
+		}
+		text = it->second;
+		return true;
+	}
+
+
+	// addrの逆アセンブル。覚えていなければx64dbgに問い合わせて覚える
+	std::string Disassemble(duint addr)
+	{
+		std::string text;
+		if (FindDisassembly(addr, text)) {
+			return text;
+		}
+
+		DISASM_INSTR inst;
+		DbgDisasmAt(addr, &inst);
+		text = inst.instruction;
+
+		std::lock_guard<std::mutex> lock(s_cacheMutex);
+		s_disassembly.emplace(addr, text);
+		return text;
+	}
+
+
+	// リファレンスビューの行idxにrowを書き込む
+	void FillRow(int idx, const Row& row)
+	{
+		if (row.addr) {
+			char temp[32];
+			sprintf_s(temp, "%p", (PVOID)row.addr);
+			GuiReferenceSetCellContent(idx, 0, temp);
+			GuiReferenceSetCellContent(idx, 1, Disassemble(row.addr).c_str());
+		}
+		else {
+			GuiReferenceSetCellContent(idx, 0, "<missing>");
+			GuiReferenceSetCellContent(idx, 1, "");
+		}
+		GuiReferenceSetCellContent(idx, 2, row.label.c_str());
+		GuiReferenceSetCellContent(idx, 3, row.signature.c_str());
+	}
+
+
+	// リファレンスビューがまだこのシグネチャ一覧を表示していればtrue
+	// (ほかの一覧に切り替わっていたら、残りの行を書き込まない。先頭の行は開くときに埋めてある)
+	bool IsShowing(const std::vector<Row>& rows)
+	{
+		if (GuiReferenceGetRowCount() != static_cast<int>(rows.size())) {
+			return false;
+		}
+		char* label = GuiReferenceGetCellContent(0, 2);
+		bool showing = label && rows.front().label == label;
+		if (label) {
+			BridgeFree(label);
+		}
+		return showing;
+	}
+
+
+	// kVisibleRowsから後ろの行を、バックグラウンドでkBatchSize行ずつ埋める
+	// 中止されるか (Cancel、デバッグの終了)、ビューがほかの一覧に切り替わったら、その区切りでやめる
+	void FillRemaining(std::vector<Row> rows)
+	{
+		auto shared = std::make_shared<std::vector<Row>>(std::move(rows));
+
+		auto work = [shared](Job::Context& context) -> void {
+			// x64dbgのコマンドと同じく、リファレンスビューにはワーカースレッドから書き込む
+			auto& rows = *shared;
+			for (size_t begin = kVisibleRows; begin < rows.size(); begin += kBatchSize) {
+				if (context.cancelled() || !IsShowing(rows)) {
+					return;
+				}
+				size_t end = std::min<size_t>(begin + kBatchSize, rows.size());
+				for (size_t i = begin; i < end; ++i) {
+					FillRow(static_cast<int>(i), rows[i]);
+				}
+				GuiReferenceReloadData();
+				context.Progress(end, rows.size());
+			}
+		};
+
+		auto finished = [](bool cancelled) -> void {
+			GuiReferenceReloadData();
+		};
+
+		Job::Start("Show signatures", work, finished);
+	}
+}
+
+
+namespace Signature
+{
+	void Show()
+	{
+		//
+		// ラベルのアドレスを引いて、アドレス順の表を作る
+		// (Secundaが張ったラベルは索引から引き、x64dbgには問い合わせない)
+		//
+		auto& index = Util::LabelIndex::Get();
+		std::vector<Row> rows;
+		rows.reserve(Size());
+		ForEach([&index, &rows](std::string_view label, std::string_view signature) -> void {
+			Row row;
+			row.label = label;
+			row.signature = signature;
+			if (!index.FindAddress(row.label, row.addr)) {
+				Script::Label::FromString(row.label.c_str(), &row.addr);
+			}
+			rows.push_back(std::move(row));
+		});
+
+		// ラベルが見つからないものは最後にまとめる
+		std::sort(rows.begin(), rows.end(), [](const Row& lhs, const Row& rhs) -> bool {
+			if ((lhs.addr == 0) != (rhs.addr == 0)) {
+				return lhs.addr != 0;
+			}
+			if (lhs.addr != rhs.addr) {
+				return lhs.addr < rhs.addr;
+			}
+			return lhs.label < rhs.label;
+		});
+
+		//
+		// 最初に見える行だけすぐに埋め、残りはバックグラウンドで埋める
+		//
+		GuiReferenceInitialize("Signatures");
+		GuiReferenceAddColumn(16, GuiTranslateText("Address"));
+		GuiReferenceAddColumn(40, GuiTranslateText("Disassembly"));
+		GuiReferenceAddColumn(50, GuiTranslateText("Label"));
+		GuiReferenceAddColumn(50, "Signature");
+		GuiReferenceSetRowCount(static_cast<int>(rows.size()));
+		GuiReferenceSetProgress(0);
+
+		size_t visible = std::min<size_t>(kVisibleRows, rows.size());
+		for (size_t i = 0; i < visible; ++i) {
+			FillRow(static_cast<int>(i), rows[i]);
+		}
+
+		_plugin_logprintf("%zu signature(s) listed in Reference View\n", rows.size());
+		GuiReferenceSetProgress(100);
+		GuiUpdateAllViews();
+
+		if (rows.size() > visible) {
+			FillRemaining(std::move(rows));
+		}
+	}
+
+
+	void ReleaseView()
+	{
+		std::lock_guard<std::mutex> lock(s_cacheMutex);
+		s_disassembly.clear();
+	}
+}
@@ -1,6 +1,9 @@
 ﻿#include "pch.h"
 #include "Util.h"
+#include "LabelIndex.h"
 #include <memory>
+#include <atomic>
+#include <thread>
 
 namespace
 {
@@ -24,19 +27,36 @@ namespace Util {
 		if (!Script::Label::FromString(name, &addr)) {
 			return false;
 		}
+		LabelIndex::Get().Remove(addr);
 		return Script::Label::Delete(addr);
 	}
 
+	bool HasLabel(duint addr)
+	{
+		std::string label;
+		return GetLabel(addr, label);
+	}
+
 	bool GetLabel(duint addr, std::string& label)
 	{
-		if (!Script::Label::Get(addr, nullptr)) {
-			return false;
+		if (LabelIndex::Get().Find(addr, label)) {
+			return true;
 		}
 
+		// 遅延モードで開いたときなど、x64dbgにだけあるラベル
+		return RefreshLabel(addr, label);
+	}
+
+	bool RefreshLabel(duint addr, std::string& label)
+	{
 		char buffer[MAX_LABEL_SIZE];
-		memset(buffer, 0, sizeof(MAX_LABEL_SIZE));
-		Script::Label::Get(addr, buffer);
+		memset(buffer, 0, sizeof(buffer));
+		if (!Script::Label::Get(addr, buffer)) {
+			LabelIndex::Get().Remove(addr);
+			return false;
+		}
 		label = buffer;
+		LabelIndex::Get().Set(label, addr);
 		return true;
 	}
 
@@ -51,9 +71,14 @@ namespace Util {
 	{
 		duint old_addr = 0;
 		if (Script::Label::FromString(name, &old_addr) && old_addr != addr) {
+			LabelIndex::Get().Remove(old_addr);
 			Script::Label::Delete(old_addr);
 		}
-		return Script::Label::Set(addr, name, manual);
+		if (!Script::Label::Set(addr, name, manual)) {
+			return false;
+		}
+		LabelIndex::Get().Set(name, addr);
+		return true;
 	}
 
 	std::string GetModName(duint moduleAddr)
@@ -209,4 +234,43 @@ namespace Util {
 		return true;
 	}
 
+
+	bool CommitFile(const std::string& temp, const char* path)
+	{
+		if (!MoveFileExA(temp.c_str(), path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+			DeleteFileA(temp.c_str());
+			return false;
+		}
+		return true;
+	}
+
+
+	bool HasExtension(const char* path, const char* extension)
+	{
+		size_t length = std::strlen(path);
+		size_t extLength = std::strlen(extension);
+		return length >= extLength && _stricmp(path + length - extLength, extension) == 0;
+	}
+
+
+	void ParallelFor(size_t count, const std::function<void(size_t index)>& fn)
+	{
+		std::atomic<size_t> next = 0;
+		auto worker = [&]() {
+			for (size_t i = next++; i < count; i = next++) {
+				fn(i);
+			}
+		};
+
+		size_t numThreads = std::min<size_t>(std::max<size_t>(1, std::thread::hardware_concurrency()), count);
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < numThreads; ++i) {
+			threads.emplace_back(worker);
+		}
+		worker();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+
 } // Util
\ No newline at end of file
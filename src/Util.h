@@ -2,6 +2,7 @@
 
 #include "pluginmain.h"
 #include <string>
+#include <functional>
 
 namespace Util
 {
@@ -9,11 +10,15 @@ namespace Util
 	inline bool DeleteLabel(const std::string& name) {
 		return DeleteLabel(name.c_str());
 	}
-	inline bool HasLabel(duint addr) {
-		return Script::Label::Get(addr, nullptr);
-	}
+	// LabelIndexから引き、なければx64dbgに問い合わせる (見つかったラベルは索引に加える)
+	bool HasLabel(duint addr);
 	std::string GetLabel(duint addr);
 	bool GetLabel(duint addr, std::string& label);
+	// 索引を使わずにx64dbgに問い合わせ、addrの索引をx64dbgに合わせる
+	// x64dbg上で付け替えたり消したりしたラベルは索引に残っているので、ユーザーが選んだアドレスはこちらで引く
+	bool RefreshLabel(duint addr, std::string& label);
+
+	// ラベルを張り、LabelIndexにも記録する
 	bool SetLabel(const char* name, duint addr, bool manual = false);
 	inline bool SetLabel(const std::string& name, duint addr, bool manual = false) {
 		return SetLabel(name.c_str(), addr, manual);
@@ -26,4 +31,14 @@ namespace Util
 	std::vector<duint> FindMemAll(duint start, duint size, const char* pattern, size_t max = 0);
 
 	bool OpenSelectionDialog(const char* Title, const char* Filter, bool Save, bool(*Callback)(char*));
+
+	// 書き終えた一時ファイルtempでpathを置き換える。失敗したらtempを削除する
+	bool CommitFile(const std::string& temp, const char* path);
+
+	// pathの拡張子がextension (".json"など) ならtrueを返す (大文字小文字は区別しない)
+	bool HasExtension(const char* path, const char* extension);
+
+	// 0からcount-1までの各インデックスについて、ワーカースレッドでfnを呼ぶ (呼び出し元のスレッドも加わる)
+	// インデックスは空いたスレッドから順に取っていくので、処理時間にばらつきがあっても偏らない
+	void ParallelFor(size_t count, const std::function<void(size_t index)>& fn);
 }
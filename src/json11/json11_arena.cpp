@@ -0,0 +1,580 @@
+/* json11 arena parser
+ *
+ * See json11_arena.hpp. The grammar and the error messages follow JsonParser in json11.cpp
+ * (JsonParse::STANDARD).
+ */
+
+#include "json11_arena.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace json11 {
+namespace arena {
+
+static const int max_depth = 200;
+
+static const size_t block_size = 64 * 1024;
+
+static const Value null_value;
+
+using std::string;
+using std::string_view;
+
+/* * * * * * * * * * * * * * * * * * * *
+ * Value
+ */
+
+string_view Value::string_value() const {
+    return is_string() ? string_view(m_string, m_size) : string_view();
+}
+
+Range<Value> Value::array_items() const {
+    return is_array() ? Range<Value>(m_items, m_size) : Range<Value>();
+}
+
+Range<Member> Value::object_items() const {
+    return is_object() ? Range<Member>(m_members, m_size) : Range<Member>();
+}
+
+const Value & Value::operator[] (size_t i) const {
+    return is_array() && i < m_size ? m_items[i] : null_value;
+}
+
+const Value & Value::operator[] (string_view key) const {
+    auto members = object_items();
+    auto it = std::lower_bound(members.begin(), members.end(), key, [](const Member & member, string_view k) {
+        return member.key < k;
+    });
+    return it != members.end() && it->key == key ? it->value : null_value;
+}
+
+Json Value::to_json() const {
+    switch (m_type) {
+    case Json::NUMBER:
+        return m_size ? Json(static_cast<int>(m_number)) : Json(m_number);
+    case Json::BOOL:
+        return Json(m_boolean);
+    case Json::STRING:
+        return Json(string(m_string, m_size));
+    case Json::ARRAY: {
+        Json::array items;
+        items.reserve(m_size);
+        for (auto & item : array_items())
+            items.push_back(item.to_json());
+        return Json(std::move(items));
+    }
+    case Json::OBJECT: {
+        Json::object members;
+        for (auto & member : object_items())
+            members.emplace_hint(members.end(), string(member.key), member.value.to_json());
+        return Json(std::move(members));
+    }
+    default:
+        return Json();
+    }
+}
+
+/* * * * * * * * * * * * * * * * * * * *
+ * Document
+ */
+
+Document::Document() : m_cursor(nullptr), m_remaining(0), m_allocated(0) {}
+
+Document::~Document() {}
+
+void Document::clear() {
+    m_buffer.clear();
+    m_buffer.shrink_to_fit();
+    m_blocks.clear();
+    m_cursor = nullptr;
+    m_remaining = 0;
+    m_allocated = 0;
+    m_root = Value();
+}
+
+size_t Document::memory_usage() const {
+    return m_buffer.capacity() + m_allocated;
+}
+
+/* allocate(size)
+ *
+ * Bump allocation from the current block. Everything stored in the arena (Value, Member) is
+ * trivially destructible, so blocks are simply freed with the document.
+ */
+void * Document::allocate(size_t size) {
+    const size_t align = alignof(Member) > alignof(Value) ? alignof(Member) : alignof(Value);
+    size = (size + align - 1) & ~(align - 1);
+
+    if (size > m_remaining) {
+        size_t capacity = size > block_size ? size : block_size;
+        m_blocks.emplace_back(new char[capacity]);
+        m_cursor = m_blocks.back().get();
+        m_remaining = capacity;
+        m_allocated += capacity;
+    }
+
+    void * result = m_cursor;
+    m_cursor += size;
+    m_remaining -= size;
+    return result;
+}
+
+/* * * * * * * * * * * * * * * * * * * *
+ * Parsing
+ */
+
+static inline string esc(char c) {
+    char buf[12];
+    if (static_cast<uint8_t>(c) >= 0x20 && static_cast<uint8_t>(c) <= 0x7f) {
+        snprintf(buf, sizeof buf, "'%c' (%d)", c, c);
+    } else {
+        snprintf(buf, sizeof buf, "(%d)", c);
+    }
+    return string(buf);
+}
+
+static inline bool in_range(long x, long lower, long upper) {
+    return (x >= lower && x <= upper);
+}
+
+/* Parser
+ *
+ * State of an in-progress parse. Items of the arrays and objects being parsed are collected on
+ * the stacks and copied into the arena in one piece when the closing bracket is reached.
+ */
+struct Parser final {
+
+    /* State
+     */
+    Document &doc;
+    char *str;      // NUL terminated
+    size_t size;
+    size_t i;
+    string &err;
+    bool failed;
+    std::vector<Value> values;
+    std::vector<Member> members;
+
+    bool fail(string &&msg) {
+        if (!failed)
+            err = std::move(msg);
+        failed = true;
+        return false;
+    }
+
+    void consume_whitespace() {
+        while (str[i] == ' ' || str[i] == '\r' || str[i] == '\n' || str[i] == '\t')
+            i++;
+    }
+
+    char get_next_token() {
+        consume_whitespace();
+        if (i == size) {
+            fail("unexpected end of input");
+            return static_cast<char>(0);
+        }
+        return str[i++];
+    }
+
+    /* encode_utf8(pt, out)
+     *
+     * Encode pt as UTF-8 at out and advance it.
+     */
+    static void encode_utf8(long pt, char *&out) {
+        if (pt < 0)
+            return;
+
+        if (pt < 0x80) {
+            *out++ = static_cast<char>(pt);
+        } else if (pt < 0x800) {
+            *out++ = static_cast<char>((pt >> 6) | 0xC0);
+            *out++ = static_cast<char>((pt & 0x3F) | 0x80);
+        } else if (pt < 0x10000) {
+            *out++ = static_cast<char>((pt >> 12) | 0xE0);
+            *out++ = static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
+            *out++ = static_cast<char>((pt & 0x3F) | 0x80);
+        } else {
+            *out++ = static_cast<char>((pt >> 18) | 0xF0);
+            *out++ = static_cast<char>(((pt >> 12) & 0x3F) | 0x80);
+            *out++ = static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
+            *out++ = static_cast<char>((pt & 0x3F) | 0x80);
+        }
+    }
+
+    /* parse_string(result)
+     *
+     * Parse a string, starting at the current position. The result points into the buffer; if
+     * the string has escapes, it is unescaped in place.
+     */
+    bool parse_string(string_view &result) {
+        char *first = str + i;
+
+        // The usual case: no escapes
+        while (i < size && str[i] != '"' && str[i] != '\\' && !in_range(str[i], 0, 0x1f))
+            i++;
+        if (i == size)
+            return fail("unexpected end of input in string");
+        if (str[i] == '"') {
+            result = string_view(first, str + i - first);
+            i++;
+            return true;
+        }
+
+        char *out = str + i;
+        long last_escaped_codepoint = -1;
+        while (true) {
+            if (i == size)
+                return fail("unexpected end of input in string");
+
+            char ch = str[i++];
+
+            if (ch == '"') {
+                encode_utf8(last_escaped_codepoint, out);
+                result = string_view(first, out - first);
+                return true;
+            }
+
+            if (in_range(ch, 0, 0x1f))
+                return fail("unescaped " + esc(ch) + " in string");
+
+            if (ch != '\\') {
+                encode_utf8(last_escaped_codepoint, out);
+                last_escaped_codepoint = -1;
+                *out++ = ch;
+                continue;
+            }
+
+            if (i == size)
+                return fail("unexpected end of input in string");
+
+            ch = str[i++];
+
+            if (ch == 'u') {
+                string esc(str + i, std::min<size_t>(4, size - i));
+                if (esc.length() < 4) {
+                    return fail("bad \\u escape: " + esc);
+                }
+                for (size_t j = 0; j < 4; j++) {
+                    if (!in_range(esc[j], 'a', 'f') && !in_range(esc[j], 'A', 'F')
+                            && !in_range(esc[j], '0', '9'))
+                        return fail("bad \\u escape: " + esc);
+                }
+
+                long codepoint = strtol(esc.data(), nullptr, 16);
+
+                if (in_range(last_escaped_codepoint, 0xD800, 0xDBFF)
+                        && in_range(codepoint, 0xDC00, 0xDFFF)) {
+                    encode_utf8((((last_escaped_codepoint - 0xD800) << 10)
+                                 | (codepoint - 0xDC00)) + 0x10000, out);
+                    last_escaped_codepoint = -1;
+                } else {
+                    encode_utf8(last_escaped_codepoint, out);
+                    last_escaped_codepoint = codepoint;
+                }
+
+                i += 4;
+                continue;
+            }
+
+            encode_utf8(last_escaped_codepoint, out);
+            last_escaped_codepoint = -1;
+
+            if (ch == 'b') {
+                *out++ = '\b';
+            } else if (ch == 'f') {
+                *out++ = '\f';
+            } else if (ch == 'n') {
+                *out++ = '\n';
+            } else if (ch == 'r') {
+                *out++ = '\r';
+            } else if (ch == 't') {
+                *out++ = '\t';
+            } else if (ch == '"' || ch == '\\' || ch == '/') {
+                *out++ = ch;
+            } else {
+                return fail("invalid escape character " + esc(ch));
+            }
+        }
+    }
+
+    bool parse_number(Value &result) {
+        size_t start_pos = i;
+
+        if (str[i] == '-')
+            i++;
+
+        // Integer part
+        if (str[i] == '0') {
+            i++;
+            if (in_range(str[i], '0', '9'))
+                return fail("leading 0s not permitted in numbers");
+        } else if (in_range(str[i], '1', '9')) {
+            i++;
+            while (in_range(str[i], '0', '9'))
+                i++;
+        } else {
+            return fail("invalid " + esc(str[i]) + " in number");
+        }
+
+        result.m_type = Json::NUMBER;
+
+        if (str[i] != '.' && str[i] != 'e' && str[i] != 'E'
+                && (i - start_pos) <= static_cast<size_t>(std::numeric_limits<int>::digits10)) {
+            result.m_size = 1;
+            result.m_number = std::atoi(str + start_pos);
+            return true;
+        }
+
+        // Decimal part
+        if (str[i] == '.') {
+            i++;
+            if (!in_range(str[i], '0', '9'))
+                return fail("at least one digit required in fractional part");
+
+            while (in_range(str[i], '0', '9'))
+                i++;
+        }
+
+        // Exponent part
+        if (str[i] == 'e' || str[i] == 'E') {
+            i++;
+
+            if (str[i] == '+' || str[i] == '-')
+                i++;
+
+            if (!in_range(str[i], '0', '9'))
+                return fail("at least one digit required in exponent");
+
+            while (in_range(str[i], '0', '9'))
+                i++;
+        }
+
+        result.m_size = 0;
+        result.m_number = std::strtod(str + start_pos, nullptr);
+        return true;
+    }
+
+    bool expect(const char *expected) {
+        size_t length = std::strlen(expected);
+        i--;
+        if (size - i >= length && std::memcmp(str + i, expected, length) == 0) {
+            i += length;
+            return true;
+        }
+        return fail("parse error: expected " + string(expected) + ", got "
+                    + string(str + i, std::min<size_t>(length, size - i)));
+    }
+
+    /* make_object(result, first)
+     *
+     * Sort the members collected since first by key, drop all but the last of duplicate keys and
+     * move them into the arena.
+     */
+    void make_object(Value &result, size_t first) {
+        auto begin = members.begin() + first;
+        auto less = [](const Member &lhs, const Member &rhs) {
+            return lhs.key < rhs.key;
+        };
+        if (members.end() - begin <= 16) {
+            // insertion sort: small objects are the usual case and stable_sort allocates a buffer
+            for (auto it = begin; it != members.end(); ++it) {
+                Member member = *it;
+                auto hole = it;
+                for (; hole != begin && less(member, *(hole - 1)); --hole)
+                    *hole = *(hole - 1);
+                *hole = member;
+            }
+        } else {
+            std::stable_sort(begin, members.end(), less);
+        }
+
+        auto last = begin;
+        for (auto it = begin; it != members.end(); ++it) {
+            if (it + 1 != members.end() && (it + 1)->key == it->key)
+                continue;
+            *last++ = *it;
+        }
+
+        size_t count = last - begin;
+        auto *data = static_cast<Member *>(doc.allocate(count * sizeof(Member)));
+        std::copy(begin, last, data);
+        members.resize(first);
+
+        result.m_type = Json::OBJECT;
+        result.m_size = static_cast<uint32_t>(count);
+        result.m_members = data;
+    }
+
+    void make_array(Value &result, size_t first) {
+        size_t count = values.size() - first;
+        auto *data = static_cast<Value *>(doc.allocate(count * sizeof(Value)));
+        std::copy(values.begin() + first, values.end(), data);
+        values.resize(first);
+
+        result.m_type = Json::ARRAY;
+        result.m_size = static_cast<uint32_t>(count);
+        result.m_items = data;
+    }
+
+    bool parse_json(int depth, Value &result) {
+        if (depth > max_depth) {
+            return fail("exceeded maximum nesting depth");
+        }
+
+        char ch = get_next_token();
+        if (failed)
+            return false;
+
+        if (ch == '-' || (ch >= '0' && ch <= '9')) {
+            i--;
+            return parse_number(result);
+        }
+
+        if (ch == 't') {
+            result.m_type = Json::BOOL;
+            result.m_boolean = true;
+            return expect("true");
+        }
+
+        if (ch == 'f') {
+            result.m_type = Json::BOOL;
+            result.m_boolean = false;
+            return expect("false");
+        }
+
+        if (ch == 'n') {
+            result = Value();
+            return expect("null");
+        }
+
+        if (ch == '"') {
+            string_view s;
+            if (!parse_string(s))
+                return false;
+            result.m_type = Json::STRING;
+            result.m_size = static_cast<uint32_t>(s.size());
+            result.m_string = s.data();
+            return true;
+        }
+
+        if (ch == '{') {
+            size_t first = members.size();
+            ch = get_next_token();
+            if (ch == '}') {
+                make_object(result, first);
+                return true;
+            }
+
+            while (1) {
+                if (ch != '"')
+                    return fail("expected '\"' in object, got " + esc(ch));
+
+                Member member;
+                if (!parse_string(member.key))
+                    return false;
+
+                ch = get_next_token();
+                if (ch != ':')
+                    return fail("expected ':' in object, got " + esc(ch));
+
+                if (!parse_json(depth + 1, member.value))
+                    return false;
+                members.push_back(member);
+
+                ch = get_next_token();
+                if (ch == '}')
+                    break;
+                if (ch != ',')
+                    return fail("expected ',' in object, got " + esc(ch));
+
+                ch = get_next_token();
+            }
+            make_object(result, first);
+            return true;
+        }
+
+        if (ch == '[') {
+            size_t first = values.size();
+            ch = get_next_token();
+            if (ch == ']') {
+                make_array(result, first);
+                return true;
+            }
+
+            while (1) {
+                i--;
+                Value item;
+                if (!parse_json(depth + 1, item))
+                    return false;
+                values.push_back(item);
+
+                ch = get_next_token();
+                if (ch == ']')
+                    break;
+                if (ch != ',')
+                    return fail("expected ',' in list, got " + esc(ch));
+
+                ch = get_next_token();
+                (void)ch;
+            }
+            make_array(result, first);
+            return true;
+        }
+
+        return fail("expected value, got " + esc(ch));
+    }
+};
+
+bool Document::parse(string && in, string & err) {
+    clear();
+    m_buffer = std::move(in);
+
+    Parser parser { *this, &m_buffer[0], m_buffer.size(), 0, err, false, {}, {} };
+    Value result;
+    if (parser.parse_json(0, result)) {
+        // Check for any trailing garbage
+        parser.consume_whitespace();
+        if (parser.i != parser.size)
+            parser.fail("unexpected trailing " + esc(parser.str[parser.i]));
+    }
+    if (parser.failed) {
+        clear();
+        return false;
+    }
+
+    m_root = result;
+    return true;
+}
+
+bool Document::load(const char * path, string & err) {
+    clear();
+
+    FILE *fp = nullptr;
+#ifdef _MSC_VER
+    fopen_s(&fp, path, "rb");
+#else
+    fp = std::fopen(path, "rb");
+#endif
+    if (!fp) {
+        err = "cannot open the file";
+        return false;
+    }
+
+    string in;
+    std::fseek(fp, 0, SEEK_END);
+    long length = std::ftell(fp);
+    std::fseek(fp, 0, SEEK_SET);
+    if (length > 0) {
+        in.resize(static_cast<size_t>(length));
+        in.resize(std::fread(&in[0], 1, in.size(), fp));
+    }
+    std::fclose(fp);
+
+    return parse(std::move(in), err);
+}
+
+} // namespace arena
+} // namespace json11
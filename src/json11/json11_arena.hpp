@@ -0,0 +1,142 @@
+/* json11 arena parser
+ *
+ * An alternative parse mode for large documents. The whole input is kept in one buffer owned by
+ * json11::arena::Document and values are built in a bump arena instead of one shared_ptr per
+ * value:
+ *
+ *  - strings are views into the buffer. Escaped strings are unescaped in place (the result is
+ *    never longer than the source), so no string is copied.
+ *  - arrays are contiguous arrays of values, objects are flat vectors of members sorted by key.
+ *    Duplicate keys keep the last value, as Json::parse does.
+ *
+ * Values are read-only and valid as long as their Document. The accessors mirror the Json API
+ * (string_value() returns a string_view), and to_json() converts a value to a json11::Json for
+ * code written against the Json API.
+ */
+
+#pragma once
+
+#include "json11.hpp"
+#include <string_view>
+#include <vector>
+#include <memory>
+
+namespace json11 {
+namespace arena {
+
+class Value;
+struct Member;
+
+/* Range
+ *
+ * Read-only view of the items of an array or the members of an object.
+ */
+template <class T>
+class Range final {
+public:
+    Range() noexcept : m_first(nullptr), m_size(0) {}
+    Range(const T * first, size_t size) noexcept : m_first(first), m_size(size) {}
+
+    const T * begin() const { return m_first; }
+    const T * end() const { return m_first + m_size; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const T & operator[](size_t i) const { return m_first[i]; }
+
+private:
+    const T * m_first;
+    size_t m_size;
+};
+
+class Value final {
+public:
+    Value() noexcept : m_type(Json::NUL), m_size(0), m_number(0) {}
+
+    Json::Type type() const { return m_type; }
+
+    bool is_null()   const { return m_type == Json::NUL; }
+    bool is_number() const { return m_type == Json::NUMBER; }
+    bool is_bool()   const { return m_type == Json::BOOL; }
+    bool is_string() const { return m_type == Json::STRING; }
+    bool is_array()  const { return m_type == Json::ARRAY; }
+    bool is_object() const { return m_type == Json::OBJECT; }
+
+    double number_value() const { return is_number() ? m_number : 0; }
+    int int_value() const { return is_number() ? static_cast<int>(m_number) : 0; }
+    bool bool_value() const { return is_bool() && m_boolean; }
+
+    // Return the enclosed string if this is a string, "" otherwise.
+    std::string_view string_value() const;
+    // Return the enclosed items if this is an array, or an empty range otherwise.
+    Range<Value> array_items() const;
+    // Return the enclosed members sorted by key if this is an object, or an empty range otherwise.
+    Range<Member> object_items() const;
+
+    // Return a reference to arr[i] if this is an array, a null value otherwise.
+    const Value & operator[](size_t i) const;
+    // Return a reference to obj[key] if this is an object, a null value otherwise.
+    const Value & operator[](std::string_view key) const;
+
+    // Copy into a Json (for code written against the Json API).
+    Json to_json() const;
+
+private:
+    friend class Document;
+    friend struct Parser;
+
+    Json::Type m_type;
+    uint32_t m_size;        // length of a string, item count of an array or an object, 1 for an integral number
+    union {
+        double m_number;
+        bool m_boolean;
+        const char * m_string;
+        const Value * m_items;
+        const Member * m_members;
+    };
+};
+
+struct Member final {
+    std::string_view key;
+    Value value;
+};
+
+/* Document
+ *
+ * Owns the input buffer and the arena. Not copyable or movable, because values point into both.
+ */
+class Document final {
+public:
+    Document();
+    ~Document();
+    Document(const Document &) = delete;
+    Document & operator=(const Document &) = delete;
+
+    // Parse in, taking over its buffer. If parse fails, root() is null and err is set to a
+    // message in the same form as Json::parse.
+    bool parse(std::string && in, std::string & err);
+
+    // Read the whole file at path into the buffer and parse it.
+    bool load(const char * path, std::string & err);
+
+    const Value & root() const { return m_root; }
+
+    // Bytes held by the buffer and the arena.
+    size_t memory_usage() const;
+
+    void clear();
+
+private:
+    friend struct Parser;
+
+    void * allocate(size_t size);
+
+    std::string m_buffer;
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    char * m_cursor;
+    size_t m_remaining;
+    size_t m_allocated;
+    Value m_root;
+};
+
+} // namespace arena
+} // namespace json11
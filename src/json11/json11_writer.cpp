@@ -0,0 +1,195 @@
+/* json11 streaming writer
+ *
+ * See json11_writer.hpp. Scalars are formatted as in json11.cpp.
+ */
+
+#include "json11_writer.hpp"
+#include <cmath>
+#include <cstdint>
+
+namespace json11 {
+
+static const size_t buffer_size = 64 * 1024;
+
+Writer::Writer(std::FILE * fp, int indent)
+    : m_fp(fp), m_indent(indent), m_after_key(false), m_failed(false) {
+    m_buffer.reserve(buffer_size + 256);
+}
+
+Writer::~Writer() {
+    flush();
+}
+
+bool Writer::flush() {
+    if (!m_buffer.empty()) {
+        if (std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_fp) != m_buffer.size())
+            m_failed = true;
+        m_buffer.clear();
+    }
+    return !m_failed;
+}
+
+void Writer::reserve() {
+    if (m_buffer.size() >= buffer_size)
+        flush();
+}
+
+void Writer::newline(size_t depth) {
+    m_buffer += '\n';
+    m_buffer.append(depth * m_indent, ' ');
+}
+
+/* prefix()
+ *
+ * Separator and indentation before an array item or an object key.
+ */
+void Writer::prefix() {
+    reserve();
+    if (m_after_key) {
+        m_after_key = false;
+        return;
+    }
+    if (m_stack.empty())
+        return;
+
+    if (m_stack.back().count++ > 0)
+        m_buffer += m_indent ? "," : ", ";
+    if (m_indent)
+        newline(m_stack.size());
+}
+
+void Writer::begin_array() {
+    prefix();
+    m_buffer += '[';
+    m_stack.push_back({ false, 0 });
+}
+
+void Writer::end_array() {
+    if (m_indent && m_stack.back().count > 0)
+        newline(m_stack.size() - 1);
+    m_stack.pop_back();
+    m_buffer += ']';
+}
+
+void Writer::begin_object() {
+    prefix();
+    m_buffer += '{';
+    m_stack.push_back({ true, 0 });
+}
+
+void Writer::end_object() {
+    if (m_indent && m_stack.back().count > 0)
+        newline(m_stack.size() - 1);
+    m_stack.pop_back();
+    m_buffer += '}';
+}
+
+void Writer::key(std::string_view key) {
+    prefix();
+    write_string(key);
+    m_buffer += ": ";
+    m_after_key = true;
+}
+
+void Writer::value(std::nullptr_t) {
+    prefix();
+    m_buffer += "null";
+}
+
+void Writer::value(double value) {
+    prefix();
+    if (std::isfinite(value)) {
+        char buf[32];
+        snprintf(buf, sizeof buf, "%.17g", value);
+        m_buffer += buf;
+    } else {
+        m_buffer += "null";
+    }
+}
+
+void Writer::value(int value) {
+    prefix();
+    char buf[32];
+    snprintf(buf, sizeof buf, "%d", value);
+    m_buffer += buf;
+}
+
+void Writer::value(bool value) {
+    prefix();
+    m_buffer += value ? "true" : "false";
+}
+
+void Writer::value(std::string_view value) {
+    prefix();
+    write_string(value);
+}
+
+void Writer::value(const Json & value) {
+    switch (value.type()) {
+    case Json::NUMBER:
+        // Json keeps whether a number was an int only in its dump format
+        prefix();
+        value.dump(m_buffer);
+        break;
+    case Json::BOOL:
+        this->value(value.bool_value());
+        break;
+    case Json::STRING:
+        this->value(std::string_view(value.string_value()));
+        break;
+    case Json::ARRAY:
+        begin_array();
+        for (auto & item : value.array_items())
+            this->value(item);
+        end_array();
+        break;
+    case Json::OBJECT:
+        begin_object();
+        for (auto & kv : value.object_items()) {
+            key(kv.first);
+            this->value(kv.second);
+        }
+        end_object();
+        break;
+    default:
+        this->value(nullptr);
+        break;
+    }
+}
+
+void Writer::write_string(std::string_view value) {
+    m_buffer += '"';
+    for (size_t i = 0; i < value.length(); i++) {
+        const char ch = value[i];
+        if (ch == '\\') {
+            m_buffer += "\\\\";
+        } else if (ch == '"') {
+            m_buffer += "\\\"";
+        } else if (ch == '\b') {
+            m_buffer += "\\b";
+        } else if (ch == '\f') {
+            m_buffer += "\\f";
+        } else if (ch == '\n') {
+            m_buffer += "\\n";
+        } else if (ch == '\r') {
+            m_buffer += "\\r";
+        } else if (ch == '\t') {
+            m_buffer += "\\t";
+        } else if (static_cast<uint8_t>(ch) <= 0x1f) {
+            char buf[8];
+            snprintf(buf, sizeof buf, "\\u%04x", ch);
+            m_buffer += buf;
+        } else if (static_cast<uint8_t>(ch) == 0xe2 && i + 2 < value.length()
+                   && static_cast<uint8_t>(value[i+1]) == 0x80
+                   && (static_cast<uint8_t>(value[i+2]) == 0xa8 || static_cast<uint8_t>(value[i+2]) == 0xa9)) {
+            m_buffer += static_cast<uint8_t>(value[i+2]) == 0xa8 ? "\\u2028" : "\\u2029";
+            i += 2;
+        } else {
+            m_buffer += ch;
+        }
+    }
+    m_buffer += '"';
+    reserve();
+}
+
+} // namespace json11
@@ -0,0 +1,69 @@
+/* json11 streaming writer
+ *
+ * Serializes JSON straight to a FILE through a fixed-size buffer, without building a Json tree
+ * or the whole output string first. The caller emits keys in the order it wants them, so the
+ * output is as deterministic as the calls.
+ *
+ * With indent == 0 the output is formatted exactly like Json::dump. With indent > 0 every array
+ * item and object member is on its own line, indented by that many spaces per level; empty
+ * arrays and objects stay on one line ("[]", "{}").
+ */
+
+#pragma once
+
+#include "json11.hpp"
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace json11 {
+
+class Writer final {
+public:
+    explicit Writer(std::FILE * fp, int indent = 0);
+    ~Writer();
+    Writer(const Writer &) = delete;
+    Writer & operator=(const Writer &) = delete;
+
+    void begin_array();
+    void end_array();
+    void begin_object();
+    void end_object();
+
+    // Write an object key. The next call writes its value.
+    void key(std::string_view key);
+
+    void value(std::nullptr_t);
+    void value(double value);
+    void value(int value);
+    void value(bool value);
+    void value(std::string_view value);
+    void value(const char * value) { this->value(std::string_view(value)); }
+    void value(const std::string & value) { this->value(std::string_view(value)); }
+    // Write a Json tree with the same formatting.
+    void value(const Json & value);
+
+    // Write out the buffer. Return false if any write to the file has failed.
+    bool flush();
+
+private:
+    void prefix();
+    void newline(size_t depth);
+    void write_string(std::string_view value);
+    void reserve();
+
+    struct Frame {
+        bool object;
+        size_t count;
+    };
+
+    std::FILE * m_fp;
+    int m_indent;
+    bool m_after_key;
+    bool m_failed;
+    std::string m_buffer;
+    std::vector<Frame> m_stack;
+};
+
+} // namespace json11
@@ -1,18 +1,23 @@
 ﻿#include "pch.h"
 #include "plugin.h"
 #include "Util.h"
+#include "LabelIndex.h"
+#include "Job.h"
 #include "Signature.h"
 #include "SignatureDialog.h"
 #include "SignatureFile.h"
 #include "MSRTTI.h"
+#include "MSPE.h"
 
 enum {
 	PLUGIN_MENU_OPEN,
+	PLUGIN_MENU_OPEN_LAZY,
 	PLUGIN_MENU_SAVE,
 	PLUGIN_MEMU_SHOW_SIGNATURES,
 	PLUGIN_MEMU_CREATE_SIGNATURE,
 	PLUGIN_MEMU_REMOVE_SIGNATURE,
-	PLUGIN_MEMU_ANALYSE_RTTI
+	PLUGIN_MEMU_ANALYSE_RTTI,
+	PLUGIN_MENU_CANCEL
 };
 
 
@@ -31,9 +36,9 @@ static void RemoveSignature()
 {
 	SELECTIONDATA sel = { 0, 0 };
 	if (GuiSelectionGet(GUI_DISASSEMBLY, &sel)) {
-		std::string label = Util::GetLabel(sel.start);
-		if (label.size() > 0) {
-			Signature::Remove(label);
+		std::string label;
+		if (Util::RefreshLabel(sel.start, label)) {
+			Signature::File::Remove(label);
 		}
 	}
 }
@@ -45,17 +50,31 @@ static void MenuEntryCallback(CBTYPE Type, PLUG_CB_MENUENTRY* Info)
 		return;
 	}
 
+	// ジョブが終わるまでは、シグネチャを扱うものは受け付けない
+	if (Info->hEntry == PLUGIN_MENU_CANCEL) {
+		Job::Cancel();
+		return;
+	}
+	if (Job::IsRunning()) {
+		_plugin_logprint("[ SECUNDA MOON ] a background job is running (Cancel to stop it)\n");
+		return;
+	}
+
 	switch (Info->hEntry)
 	{
 	case PLUGIN_MENU_OPEN:
-		Util::OpenSelectionDialog("Open a signature file", "Signatures (*.json)\0*.json\0\0", false, Signature::File::Open);
+		Util::OpenSelectionDialog("Open a signature file", "Signatures (*.json)\0*.json\0Signature database (*.sigdb)\0*.sigdb\0\0", false, Signature::File::Open);
+		break;
+	case PLUGIN_MENU_OPEN_LAZY:
+		Util::OpenSelectionDialog("Open a signature file", "Signatures (*.json)\0*.json\0Signature database (*.sigdb)\0*.sigdb\0\0", false, Signature::File::OpenLazy);
 		break;
 	case PLUGIN_MENU_SAVE:
 		if (Signature::Size()) {
-			Util::OpenSelectionDialog("Open a signature file", "Signatures (*.json)\0*.json\0\0", true, Signature::File::Save);
+			Util::OpenSelectionDialog("Open a signature file", "Signatures (*.json)\0*.json\0Signature database (*.sigdb)\0*.sigdb\0\0", true, Signature::File::Save);
 		}
 		break;
 	case PLUGIN_MEMU_SHOW_SIGNATURES:
+		Signature::File::ResolveAll();
 		Signature::Show();
 		break;
 	case PLUGIN_MEMU_CREATE_SIGNATURE:
@@ -70,8 +89,173 @@ static void MenuEntryCallback(CBTYPE Type, PLUG_CB_MENUENTRY* Info)
 	default:
 		break;
 	}
+}
+
+
+// SigConvert <from>, <to>
+static bool ConvertCommand(int argc, char** argv)
+{
+	if (argc < 3) {
+		_plugin_logprint("usage: SigConvert <from>, <to>\n");
+		return false;
+	}
+	return Signature::File::Convert(argv[1], argv[2]);
+}
+
+
+// SigMerge <to>, <from1>, <from2>, ...
+static bool MergeCommand(int argc, char** argv)
+{
+	if (argc < 3) {
+		_plugin_logprint("usage: SigMerge <to>, <from1>, <from2>, ...\n");
+		return false;
+	}
+	if (Job::IsRunning()) {
+		_plugin_logprint("[ SECUNDA MOON ] a background job is running (SigCancel to stop it)\n");
+		return false;
+	}
+	// 開いているシグネチャファイルとジャーナルはGUIスレッドで扱うので、併合もGUIスレッドで行う
+	std::vector<std::string> from(argv + 2, argv + argc);
+	std::string to = argv[1];
+	Job::Post([from, to]() {
+		Signature::File::Merge(from, to.c_str());
+	});
+	return true;
+}
+
+
+// SigResolve [label1, label2, ...]
+// ラベルを省略すると、遅延モードでまだ解決していないラベルをすべて解決する
+static bool ResolveCommand(int argc, char** argv)
+{
+	if (Job::IsRunning()) {
+		_plugin_logprint("[ SECUNDA MOON ] a background job is running (SigCancel to stop it)\n");
+		return false;
+	}
+	if (argc < 2) {
+		Signature::File::ResolveAll();
+		return true;
+	}
+
+	bool succeeded = true;
+	for (int i = 1; i < argc; ++i) {
+		duint addr = 0;
+		if (Signature::File::Resolve(argv[i], addr)) {
+			_plugin_logprintf("%s: %p\n", argv[i], (PVOID)addr);
+		}
+		else {
+			_plugin_logprintf("%s: <missing>\n", argv[i]);
+			succeeded = false;
+		}
+		// 最後のラベルのアドレスをスクリプトから使えるようにする
+		DbgValToString("$result", addr);
+	}
+	return succeeded;
+}
+
+
+// SigCancel
+// バックグラウンドのジョブ (Open、Analyse RTTI、Scan) を中止する
+static bool CancelCommand(int argc, char** argv)
+{
+	if (!Job::Cancel()) {
+		_plugin_logprint("[ SECUNDA MOON ] no background job\n");
+		return false;
+	}
+	return true;
+}
+
+
+// "module"で指定したモジュールが読み込まれたら、そのレコードを解決する
+static void LoadDllCallback(CBTYPE Type, PLUG_CB_LOADDLL* Info)
+{
+	// デバッグイベントの中ではなく、x64dbgがモジュールを登録し終えてからGUIスレッドで解決する
+	Job::Post([]() {
+		Signature::File::ResolveModules();
+	});
+}
+
+
+static void UnloadDllCallback(CBTYPE Type, PLUG_CB_UNLOADDLL* Info)
+{
+	duint base = reinterpret_cast<duint>(Info->UnloadDll->lpBaseOfDll);
+	Job::Post([base]() {
+		Signature::File::ForgetModule(base);
+	});
+}
+
+
+// SigXrefs <address>
+// アドレスを参照している命令 (call/jmp、RIP相対のロード・ストア・lea) をリファレンスビューに表示する
+// 参照の表は最初に一度だけ作り、モジュールのハッシュごとにファイルに保存しておく
+static bool XrefsCommand(int argc, char** argv)
+{
+	if (argc < 2) {
+		_plugin_logprint("usage: SigXrefs <address>\n");
+		return false;
+	}
+	if (Job::IsRunning()) {
+		_plugin_logprint("[ SECUNDA MOON ] a background job is running (SigCancel to stop it)\n");
+		return false;
+	}
+
+	duint addr = DbgValFromString(argv[1]);
+	if (!MSPE::Image::Get().contains_addr(addr)) {
+		_plugin_logprintf("%p is not in the main module\n", (PVOID)addr);
+		return false;
+	}
+
+	auto work = [](Job::Context& context) -> void {
+		MSPE::XrefTable::Get();
+	};
+
+	auto finished = [addr](bool cancelled) -> void {
+		if (cancelled || !DbgIsDebugging()) {
+			return;
+		}
+		static const char* const kKinds[] = { "call", "jump", "data" };
+
+		auto& image = MSPE::Image::Get();
+		auto& xrefs = MSPE::XrefTable::Get();
+		auto refs = xrefs.To(image.rva(addr));
+
+		GuiReferenceInitialize("Xrefs");
+		GuiReferenceAddColumn(16, GuiTranslateText("Address"));
+		GuiReferenceAddColumn(8, "Kind");
+		GuiReferenceAddColumn(50, GuiTranslateText("Label"));
+		GuiReferenceSetRowCount(static_cast<int>(refs.size()));
+		for (size_t i = 0; i < refs.size(); ++i) {
+			auto& xref = xrefs[refs[i]];
+			char temp[32];
+			sprintf_s(temp, "%p", (PVOID)(image.base() + xref.from));
+			GuiReferenceSetCellContent(static_cast<int>(i), 0, temp);
+			GuiReferenceSetCellContent(static_cast<int>(i), 1, kKinds[static_cast<int>(xref.kind)]);
+			GuiReferenceSetCellContent(static_cast<int>(i), 2, Util::GetLabel(image.base() + xref.from).c_str());
+		}
+		GuiReferenceReloadData();
+
+		_plugin_logprintf("%zu xref(s) to %p (%zu in the module)\n", refs.size(), (PVOID)addr, xrefs.size());
+	};
 
-	GuiUpdateAllViews();
+	return Job::Start("Xrefs", work, finished);
+}
+
+
+static void StopDebugCallback(CBTYPE Type, PLUG_CB_STOPDEBUG* Info)
+{
+	// 終わったデバッグの結果は適用しない
+	// workはMSPE::Imageや索引を使っているので、戻るまで待ってから解放する
+	Job::Cancel();
+	Job::Wait();
+	Signature::File::Flush();
+	// finishedとs_resolvedModulesはGUIスレッドで扱うので、解放もGUIスレッドで行う
+	// (すでに積まれたfinishedが先に呼ばれ、中止されたものとして戻る)
+	Job::Post([]() {
+		Signature::File::ForgetModule(0);
+		Util::LabelIndex::Get().Clear();
+		Signature::ReleaseView();
+		MSPE::Image::Release();
+	});
 }
 
 
@@ -88,10 +272,17 @@ static void MenuPrepareCallback(CBTYPE Type, PLUG_CB_MENUPREPARE* Info)
 
 	SELECTIONDATA sel = { 0, 0 };
 	if (GuiSelectionGet(GUI_DISASSEMBLY, &sel)) {
-		bSelectionInFunction = DbgFunctionGet(sel.start, nullptr, nullptr);
+		// メニューを開くたびにモジュールを読み込むと重いので、読み込み済みのときだけ関数テーブルを使う
+		if (MSPE::Image::IsLoaded() && MSPE::Image::Get().contains_addr(sel.start)) {
+			bSelectionInFunction = MSPE::FunctionTable::Get().Lookup(sel.start, nullptr, nullptr);
+		}
+		else {
+			bSelectionInFunction = DbgFunctionGet(sel.start, nullptr, nullptr);
+		}
 
+		// x64dbg上で付け替えたり消したりしたかもしれないので、索引ではなくx64dbgに問い合わせる
 		std::string label;
-		if (Util::GetLabel(sel.start, label)) {
+		if (Util::RefreshLabel(sel.start, label)) {
 			bSelectionOnLabel = true;
 			bLabelHasSignature = Signature::Get(label);
 		}
@@ -110,6 +301,15 @@ namespace Plugin
 	{
 		_plugin_registercallback(pluginHandle, CB_MENUENTRY, (CBPLUGIN)MenuEntryCallback);
 		_plugin_registercallback(pluginHandle, CB_MENUPREPARE, (CBPLUGIN)MenuPrepareCallback);
+		_plugin_registercallback(pluginHandle, CB_STOPDEBUG, (CBPLUGIN)StopDebugCallback);
+		_plugin_registercallback(pluginHandle, CB_LOADDLL, (CBPLUGIN)LoadDllCallback);
+		_plugin_registercallback(pluginHandle, CB_UNLOADDLL, (CBPLUGIN)UnloadDllCallback);
+
+		_plugin_registercommand(pluginHandle, "SigConvert", ConvertCommand, false);
+		_plugin_registercommand(pluginHandle, "SigMerge", MergeCommand, false);
+		_plugin_registercommand(pluginHandle, "SigResolve", ResolveCommand, true);
+		_plugin_registercommand(pluginHandle, "SigCancel", CancelCommand, false);
+		_plugin_registercommand(pluginHandle, "SigXrefs", XrefsCommand, true);
 
 		return true; //Return false to cancel loading the plugin.
 	}
@@ -126,17 +326,35 @@ namespace Plugin
 
 		_plugin_unregistercallback(pluginHandle, CB_MENUENTRY);
 		_plugin_unregistercallback(pluginHandle, CB_MENUPREPARE);
+		_plugin_unregistercallback(pluginHandle, CB_STOPDEBUG);
+		_plugin_unregistercallback(pluginHandle, CB_LOADDLL);
+		_plugin_unregistercallback(pluginHandle, CB_UNLOADDLL);
+
+		_plugin_unregistercommand(pluginHandle, "SigConvert");
+		_plugin_unregistercommand(pluginHandle, "SigMerge");
+		_plugin_unregistercommand(pluginHandle, "SigResolve");
+		_plugin_unregistercommand(pluginHandle, "SigCancel");
+		_plugin_unregistercommand(pluginHandle, "SigXrefs");
+
+		Job::Shutdown();
+
+		Signature::File::Close();
+
+		MSPE::Image::Release();
 	}
 
 	//Do GUI/Menu related things here.
 	void Setup()
 	{
 		_plugin_menuaddentry(hMenu, PLUGIN_MENU_OPEN, "&Open signature file");
+		_plugin_menuaddentry(hMenu, PLUGIN_MENU_OPEN_LAZY, "Open signature file (&lazy)");
 		_plugin_menuaddentry(hMenu, PLUGIN_MENU_SAVE, "&Save signature file");
 		_plugin_menuaddentry(hMenu, PLUGIN_MEMU_SHOW_SIGNATURES, "&Show Signatures");
 		//_plugin_menuentrysetvisible(pluginHandle, PLUGIN_MENU_SAVE, false);
 		_plugin_menuaddseparator(hMenu);
 		_plugin_menuaddentry(hMenu, PLUGIN_MEMU_ANALYSE_RTTI, "&Analyse RTTI");
+		_plugin_menuaddseparator(hMenu);
+		_plugin_menuaddentry(hMenu, PLUGIN_MENU_CANCEL, "&Cancel background job");
 
 		_plugin_menuaddentry(hMenuDisasm, PLUGIN_MEMU_CREATE_SIGNATURE, "&Create signature");
 		_plugin_menuaddentry(hMenuDisasm, PLUGIN_MEMU_REMOVE_SIGNATURE, "&Remove signature");
@@ -0,0 +1,30 @@
+# 合成のシグネチャファイルを作る (ベンチマーク用)
+#   python gen_sigfile.py [件数] [出力ファイル]
+# 乱数の種は固定なので、同じ件数なら毎回同じファイルになる
+import json
+import random
+import sys
+
+count = int(sys.argv[1]) if len(sys.argv) > 1 else 50000
+path = sys.argv[2] if len(sys.argv) > 2 else 'sigfile_%d.json' % count
+
+random.seed(1)
+entries = []
+for i in range(count):
+    signature = ' '.join('%02X' % random.randrange(256) if random.random() > .2 else '??' for _ in range(24))
+    entry = {
+        'label': 'Func_%06d' % i,
+        'signature': signature,
+        'unwind': '%016X' % random.getrandbits(64),
+        'address': {
+            'SkyrimSE.exe@%016X' % 0x1122334455667788: '0x%08X' % random.randrange(1 << 28),
+            'SkyrimSE_1_5_97.exe': '0x%08X' % random.randrange(1 << 28),
+        },
+    }
+    # エスケープを含むラベルも混ぜる
+    if i % 100 == 0:
+        entry['label'] += 'é\n"x"'
+    entries.append(entry)
+
+with open(path, 'w') as f:
+    json.dump(entries, f)
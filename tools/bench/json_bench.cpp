@@ -0,0 +1,90 @@
+// json11::Json::parse と json11::arena::Document の読み込み時間とヒープの最大使用量を比べる
+//   json_bench <signature file>
+// operator newを置き換えて、確保したバイト数と回数を数える (ファイルのバッファは両方に含まない)
+#include "json11/json11.hpp"
+#include "json11/json11_arena.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <new>
+
+
+static size_t s_current = 0;
+static size_t s_peak = 0;
+static size_t s_count = 0;
+
+void* operator new(size_t size)
+{
+	s_current += size;
+	s_count++;
+	if (s_current > s_peak) {
+		s_peak = s_current;
+	}
+	auto* p = static_cast<size_t*>(std::malloc(size + 16));
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	p[0] = size;
+	return p + 2;
+}
+void operator delete(void* ptr) noexcept
+{
+	if (!ptr) {
+		return;
+	}
+	auto* p = static_cast<size_t*>(ptr) - 2;
+	s_current -= p[0];
+	std::free(p);
+}
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* ptr) noexcept { operator delete(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { operator delete(ptr); }
+
+
+static void Reset()
+{
+	s_current = 0;
+	s_peak = 0;
+	s_count = 0;
+}
+
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		std::cerr << "usage: json_bench <signature file>\n";
+		return 1;
+	}
+	using clock = std::chrono::steady_clock;
+
+	std::ifstream ifs(argv[1], std::ios::binary);
+	std::string text{ std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>() };
+	std::string copy = text;
+	std::string err;
+
+	Reset();
+	auto t0 = clock::now();
+	auto json = json11::Json::parse(text, err);
+	auto t1 = clock::now();
+	std::cout << "json11::Json::parse  " << std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms, peak heap "
+		<< s_peak / 1024 << " KiB, " << s_count << " allocations\n";
+
+	json11::arena::Document document;
+	Reset();
+	auto t2 = clock::now();
+	bool ok = document.parse(std::move(copy), err);
+	auto t3 = clock::now();
+	std::cout << "arena::Document      " << std::chrono::duration<double, std::milli>(t3 - t2).count() << " ms, peak heap "
+		<< s_peak / 1024 << " KiB, " << s_count << " allocations\n";
+
+	if (!ok) {
+		std::cerr << err << "\n";
+		return 1;
+	}
+	bool equal = document.root().to_json() == json;
+	std::cout << "to_json() == Json::parse: " << (equal ? "yes" : "no") << "\n";
+	return equal ? 0 : 1;
+}
@@ -0,0 +1,369 @@
+#include "SyntheticModule.h"
+#include "MSPE.h"
+#include "Util.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+
+
+// Install() されたイメージ
+static const std::vector<std::uint8_t>* s_installed = nullptr;
+
+static std::string s_cacheDir;
+static std::uint64_t s_cacheHash = 0;
+
+
+//
+// Code
+//
+Code& Code::Bytes(std::initializer_list<std::uint8_t> a_bytes)
+{
+	_bytes.insert(_bytes.end(), a_bytes);
+	return *this;
+}
+
+
+Code& Code::Imm32(std::uint32_t a_value)
+{
+	for (int i = 0; i < 4; ++i) {
+		_bytes.push_back(static_cast<std::uint8_t>(a_value >> (i * 8)));
+	}
+	return *this;
+}
+
+
+Code& Code::Imm64(std::uint64_t a_value)
+{
+	Imm32(static_cast<std::uint32_t>(a_value));
+	return Imm32(static_cast<std::uint32_t>(a_value >> 32));
+}
+
+
+Code& Code::Rel32(std::initializer_list<std::uint8_t> a_opcode, std::uint32_t a_target)
+{
+	Bytes(a_opcode);
+	std::uint32_t next = here() + 4;
+	return Imm32(a_target - next);
+}
+
+
+//
+// SyntheticModule
+//
+SyntheticModule::SyntheticModule() :
+	_data(kImageSize, 0),
+	_nextCode(kText),
+	_nextRData(kRData)
+{
+	auto* dos = reinterpret_cast<IMAGE_DOS_HEADER*>(_data.data());
+	dos->e_magic = IMAGE_DOS_SIGNATURE;
+	dos->e_lfanew = 0x80;
+
+	auto* nt = reinterpret_cast<IMAGE_NT_HEADERS*>(_data.data() + dos->e_lfanew);
+	nt->Signature = IMAGE_NT_SIGNATURE;
+	nt->FileHeader.Machine = 0x8664;
+	nt->FileHeader.NumberOfSections = 4;
+	nt->FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER64);
+	nt->OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR_MAGIC;
+	nt->OptionalHeader.ImageBase = kBase;
+	nt->OptionalHeader.SectionAlignment = 0x1000;
+	nt->OptionalHeader.FileAlignment = 0x200;
+	nt->OptionalHeader.SizeOfImage = kImageSize;
+	nt->OptionalHeader.SizeOfHeaders = kHeaderSize;
+	nt->OptionalHeader.NumberOfRvaAndSizes = 16;
+	nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION].VirtualAddress = kPData;
+
+	struct Layout
+	{
+		const char*		name;
+		std::uint32_t	rva;
+		std::uint32_t	size;
+		std::uint32_t	characteristics;
+	};
+	static const Layout kSections[] = {
+		{ ".text", kText, kTextSize, 0x60000020 },		// code, execute, read
+		{ ".rdata", kRData, kRDataSize, 0x40000040 },	// initialized data, read
+		{ ".data", kData, kDataSize, 0xC0000040 },		// initialized data, read, write
+		{ ".pdata", kPData, kPDataSize, 0x40000040 }
+	};
+	auto* section = IMAGE_FIRST_SECTION(nt);
+	for (auto& layout : kSections) {
+		std::memcpy(section->Name, layout.name, std::strlen(layout.name));
+		section->Misc.VirtualSize = layout.size;
+		section->VirtualAddress = layout.rva;
+		section->SizeOfRawData = layout.size;
+		section->PointerToRawData = layout.rva;
+		section->Characteristics = layout.characteristics;
+		++section;
+	}
+
+	// version 1, no flags, no unwind codes
+	_unwind = AddRData(4);
+	_data[_unwind] = 0x01;
+
+	// the padding between functions
+	std::memset(_data.data() + kText, 0xCC, kTextSize);
+}
+
+
+std::uint32_t SyntheticModule::Align(std::uint32_t a_rva, std::uint32_t a_alignment) const
+{
+	return (a_rva + a_alignment - 1) & ~(a_alignment - 1);
+}
+
+
+std::uint32_t SyntheticModule::AddFunction(const Code& a_code)
+{
+	std::uint32_t rva = _nextCode;
+	std::uint32_t size = static_cast<std::uint32_t>(a_code.bytes().size());
+	if (a_code.rva() != rva || size == 0 || rva + size > kText + kTextSize
+		|| (_functionCount + 1) * sizeof(IMAGE_RUNTIME_FUNCTION_ENTRY) > kPDataSize) {
+		std::fprintf(stderr, "cannot place a function at %X\n", rva);
+		std::abort();
+	}
+	Write(rva, a_code.bytes().data(), size);
+
+	IMAGE_RUNTIME_FUNCTION_ENTRY entry = {};
+	entry.BeginAddress = rva;
+	entry.EndAddress = rva + size;
+	entry.UnwindData = _unwind;
+	Write(kPData + _functionCount * sizeof(entry), &entry, sizeof(entry));
+	++_functionCount;
+
+	auto* dos = reinterpret_cast<IMAGE_DOS_HEADER*>(_data.data());
+	auto* nt = reinterpret_cast<IMAGE_NT_HEADERS*>(_data.data() + dos->e_lfanew);
+	nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION].Size = _functionCount * sizeof(entry);
+
+	_nextCode = Align(rva + size, 0x10);
+	return rva;
+}
+
+
+std::uint32_t SyntheticModule::AddString(const std::string& a_text)
+{
+	std::uint32_t rva = AddRData(a_text.size() + 1);
+	Write(rva, a_text.c_str(), a_text.size());
+	return rva;
+}
+
+
+std::uint32_t SyntheticModule::AddWideString(const std::string& a_text)
+{
+	std::uint32_t rva = AddRData((a_text.size() + 1) * 2);
+	for (size_t i = 0; i < a_text.size(); ++i) {
+		_data[rva + i * 2] = static_cast<std::uint8_t>(a_text[i]);
+	}
+	return rva;
+}
+
+
+std::uint32_t SyntheticModule::AddRData(size_t a_size)
+{
+	// a zero gap keeps neighbouring literals apart
+	std::uint32_t rva = _nextRData;
+	if (rva + a_size > kRData + kRDataSize) {
+		std::fprintf(stderr, "the .rdata section is full\n");
+		std::abort();
+	}
+	_nextRData = Align(rva + static_cast<std::uint32_t>(a_size) + 1, 0x10);
+	return rva;
+}
+
+
+void SyntheticModule::Write(std::uint32_t a_rva, const void* a_data, size_t a_size)
+{
+	if (a_rva + a_size > _data.size()) {
+		std::fprintf(stderr, "write out of the image: %X\n", a_rva);
+		std::abort();
+	}
+	std::memcpy(_data.data() + a_rva, a_data, a_size);
+}
+
+
+void SyntheticModule::Install() const
+{
+	s_installed = &_data;
+	MSPE::Image::Release();
+}
+
+
+void SyntheticModule::SetCache(const std::string& a_dir, std::uint64_t a_hash)
+{
+	s_cacheDir = a_dir;
+	s_cacheHash = a_hash;
+}
+
+
+//
+// Check
+//
+static int s_passed = 0;
+static int s_failed = 0;
+
+bool Check::Report(bool a_ok, const char* a_expr, const char* a_file, int a_line)
+{
+	if (a_ok) {
+		++s_passed;
+	}
+	else {
+		++s_failed;
+		std::fprintf(stderr, "%s:%d: failed: %s\n", a_file, a_line, a_expr);
+	}
+	return a_ok;
+}
+
+
+int Check::Finish(const char* a_name)
+{
+	std::printf("%s: %d passed, %d failed\n", a_name, s_passed, s_failed);
+	return s_failed == 0 ? 0 : 1;
+}
+
+
+//
+// x64dbg stubs: the installed image is the main module and the only readable memory
+//
+HMODULE g_dllHandle = nullptr;
+
+void _plugin_logprintf(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	std::vprintf(format, args);
+	va_end(args);
+}
+
+void BridgeFree(void* ptr)
+{
+	std::free(ptr);
+}
+
+namespace Script
+{
+	namespace Module
+	{
+		duint GetMainModuleBase()
+		{
+			return s_installed ? SyntheticModule::kBase : 0;
+		}
+
+		duint GetMainModuleSize()
+		{
+			return s_installed ? s_installed->size() : 0;
+		}
+
+		bool GetMainModuleSectionList(ListInfo* list)
+		{
+			if (!s_installed) {
+				return false;
+			}
+			auto* dos = reinterpret_cast<const IMAGE_DOS_HEADER*>(s_installed->data());
+			auto* nt = reinterpret_cast<const IMAGE_NT_HEADERS*>(s_installed->data() + dos->e_lfanew);
+			auto* first = IMAGE_FIRST_SECTION(nt);
+			int count = nt->FileHeader.NumberOfSections;
+
+			auto* info = static_cast<ModuleSectionInfo*>(std::calloc(count, sizeof(ModuleSectionInfo)));
+			for (int i = 0; i < count; ++i) {
+				info[i].addr = SyntheticModule::kBase + first[i].VirtualAddress;
+				info[i].size = first[i].Misc.VirtualSize;
+				std::memcpy(info[i].name, first[i].Name, IMAGE_SIZEOF_SHORT_NAME);
+			}
+			list->count = count;
+			list->size = count * sizeof(ModuleSectionInfo);
+			list->data = info;
+			return true;
+		}
+	}
+
+	namespace Memory
+	{
+		bool Read(duint addr, void* data, duint size, duint* sizeRead)
+		{
+			if (!s_installed || addr < SyntheticModule::kBase || addr - SyntheticModule::kBase + size > s_installed->size()) {
+				return false;
+			}
+			std::memcpy(data, s_installed->data() + (addr - SyntheticModule::kBase), size);
+			if (sizeRead) {
+				*sizeRead = size;
+			}
+			return true;
+		}
+	}
+}
+
+
+//
+// Util: the parts of Util.cpp used by the indexes, without the x64dbg calls
+//
+namespace Util
+{
+	bool CommitFile(const std::string& temp, const char* path)
+	{
+		if (std::rename(temp.c_str(), path) != 0) {
+			std::remove(temp.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	void ParallelFor(size_t count, const std::function<void(size_t index)>& fn)
+	{
+		std::atomic<size_t> next = 0;
+		auto worker = [&]() {
+			for (size_t i = next++; i < count; i = next++) {
+				fn(i);
+			}
+		};
+
+		size_t numThreads = std::min<size_t>(std::max<size_t>(1, std::thread::hardware_concurrency()), count);
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < numThreads; ++i) {
+			threads.emplace_back(worker);
+		}
+		worker();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+}
+
+
+//
+// MSPE::Identity: the hash is given by SetCache instead of hashing the module file
+//
+namespace MSPE
+{
+	static std::unique_ptr<Identity> s_identity;
+
+	const Identity& Identity::Get()
+	{
+		auto& image = Image::Get();
+		if (!s_identity || s_identity->_serial != image.serial()) {
+			s_identity.reset(new Identity());
+			s_identity->_serial = image.serial();
+			s_identity->_name = "synthetic.exe";
+			s_identity->_hash = s_cacheHash;
+		}
+		return *s_identity;
+	}
+
+	std::string Identity::key() const
+	{
+		if (_hash == 0) {
+			return _name;
+		}
+		char buffer[20];
+		sprintf_s(buffer, "@%016llX", static_cast<unsigned long long>(_hash));
+		return _name + buffer;
+	}
+
+	std::string Identity::cache_path(const char* a_extension) const
+	{
+		if (_hash == 0 || s_cacheDir.empty()) {
+			return std::string();
+		}
+		return s_cacheDir + "/" + key() + a_extension;
+	}
+}
@@ -0,0 +1,129 @@
+#pragma once
+// 合成のPEイメージと、それをメインモジュールとして見せる x64dbg のスタブ
+// ヘッダ、.text、.rdata、.data、.pdata を持つイメージをメモリ上に組み、Script::Module と Script::Memory の
+// スタブがそれを返す。MSPE の索引はデバッガなしで、実際のモジュールと同じ経路で作られる
+#include "pch.h"
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+
+// 関数1つ分の機械語。rel32 の飛び先は rva で渡し、命令の終わりからの距離に直して書く
+class Code
+{
+public:
+	explicit Code(std::uint32_t a_rva) : _rva(a_rva) {}
+
+	inline std::uint32_t rva() const {
+		return _rva;
+	}
+	// 次の命令の rva
+	inline std::uint32_t here() const {
+		return _rva + static_cast<std::uint32_t>(_bytes.size());
+	}
+	inline const std::vector<std::uint8_t>& bytes() const {
+		return _bytes;
+	}
+
+	Code& Bytes(std::initializer_list<std::uint8_t> a_bytes);
+	Code& Imm32(std::uint32_t a_value);
+	Code& Imm64(std::uint64_t a_value);
+	// a_opcode のあとに a_target への rel32 を置く (rel32 で終わる命令だけに使う)
+	Code& Rel32(std::initializer_list<std::uint8_t> a_opcode, std::uint32_t a_target);
+
+	inline Code& Call(std::uint32_t a_target) {
+		return Rel32({ 0xE8 }, a_target);
+	}
+	inline Code& Jmp(std::uint32_t a_target) {
+		return Rel32({ 0xE9 }, a_target);
+	}
+	inline Code& Jz(std::uint32_t a_target) {
+		return Rel32({ 0x0F, 0x84 }, a_target);
+	}
+	// lea rcx, [rip+disp32]
+	inline Code& LeaRcx(std::uint32_t a_target) {
+		return Rel32({ 0x48, 0x8D, 0x0D }, a_target);
+	}
+	// mov rax, [rip+disp32]
+	inline Code& LoadRax(std::uint32_t a_target) {
+		return Rel32({ 0x48, 0x8B, 0x05 }, a_target);
+	}
+	inline Code& Ret() {
+		return Bytes({ 0xC3 });
+	}
+
+private:
+	std::uint32_t				_rva;
+	std::vector<std::uint8_t>	_bytes;
+};
+
+
+class SyntheticModule
+{
+public:
+	static constexpr duint kBase = 0x140000000;
+
+	// セクションの配置 (ファイル上の配置も同じ)
+	static constexpr std::uint32_t kHeaderSize = 0x400;
+	static constexpr std::uint32_t kText = 0x1000;
+	static constexpr std::uint32_t kTextSize = 0x20000;
+	static constexpr std::uint32_t kRData = kText + kTextSize;
+	static constexpr std::uint32_t kRDataSize = 0x8000;
+	static constexpr std::uint32_t kData = kRData + kRDataSize;
+	static constexpr std::uint32_t kDataSize = 0x1000;
+	static constexpr std::uint32_t kPData = kData + kDataSize;
+	static constexpr std::uint32_t kPDataSize = 0x4000;
+	static constexpr std::uint32_t kImageSize = kPData + kPDataSize;
+
+	SyntheticModule();
+
+	inline const std::vector<std::uint8_t>& data() const {
+		return _data;
+	}
+	inline duint addr(std::uint32_t a_rva) const {
+		return kBase + a_rva;
+	}
+
+	// 次に置かれる関数の rva。Code はこの rva で作る
+	inline std::uint32_t next_function() const {
+		return _nextCode;
+	}
+	// a_code を置き、.pdata に登録する。関数は16バイト境界に並べ、間は int3 で埋める
+	std::uint32_t AddFunction(const Code& a_code);
+
+	// .rdata に NUL で終わる文字列を置き、その rva を返す
+	std::uint32_t AddString(const std::string& a_text);
+	std::uint32_t AddWideString(const std::string& a_text);
+	// .rdata に a_size バイトの領域を取る (中身は0)
+	std::uint32_t AddRData(size_t a_size);
+
+	void Write(std::uint32_t a_rva, const void* a_data, size_t a_size);
+
+	// このイメージをメインモジュールにする。MSPE::Image を解放するので、索引は次の Get() で作り直される
+	void Install() const;
+
+	// 索引のキャッシュを a_dir に、モジュールのハッシュを a_hash として置く。a_hash が0ならキャッシュを使わない
+	static void SetCache(const std::string& a_dir, std::uint64_t a_hash);
+
+private:
+	std::uint32_t Align(std::uint32_t a_rva, std::uint32_t a_alignment) const;
+
+	// members
+	std::vector<std::uint8_t>	_data;
+	std::uint32_t				_nextCode;
+	std::uint32_t				_nextRData;
+	std::uint32_t				_functionCount = 0;
+	std::uint32_t				_unwind;		// 全ての関数が共有する UNWIND_INFO
+};
+
+
+// チェックの結果を数える。失敗は標準エラーに書く
+#define CHECK(expr) Check::Report((expr), #expr, __FILE__, __LINE__)
+
+namespace Check
+{
+	bool Report(bool a_ok, const char* a_expr, const char* a_file, int a_line);
+	// 失敗がなければ0を返す。main の最後に呼ぶ
+	int Finish(const char* a_name);
+}
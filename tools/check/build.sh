@@ -0,0 +1,46 @@
+#!/bin/sh
+# 合成のイメージを使うチェックを g++ で組んで実行する (x64dbgもWindowsもいらない)
+#   tools/check/build.sh [出力先ディレクトリ]	既定はリポジトリ直下の _check_build
+# src/*.cpp は "pch.h" を同じディレクトリから読むので、使うソースを出力先にコピーし、
+# pch.h だけ compat/pch.h に差し替えてから組む
+set -e
+
+ROOT=$(cd "$(dirname "$0")/../.." && pwd)
+OUT=${1:-$ROOT/_check_build}
+CC=${CC:-gcc}
+CXX=${CXX:-g++}
+CFLAGS=${CFLAGS:--O2 -g}
+CXXFLAGS=${CXXFLAGS:--O2 -g}
+LZ4=${LZ4:--llz4}
+
+SOURCES="MSPE.cpp MSPE_Image.cpp MSPE_Function.cpp MSPE_Relocation.cpp MSPE_Xref.cpp MSPE_String.cpp SignatureString.cpp MSPE_Constant.cpp SignatureConstant.cpp"
+CHECKS="xref_check string_check constant_check"
+
+mkdir -p "$OUT/src" "$OUT/obj"
+cp "$ROOT"/src/*.h "$OUT/src/"
+for f in $SOURCES; do
+	cp "$ROOT/src/$f" "$OUT/src/"
+done
+cp "$ROOT/tools/check/compat/pch.h" "$OUT/src/pch.h"
+
+INCLUDES="-I $ROOT/tools/check/compat -I $OUT/src -I $ROOT -I $ROOT/src"
+OBJECTS=""
+for f in "$ROOT"/src/distorm/src/*.c; do
+	obj="$OUT/obj/distorm_$(basename "$f" .c).o"
+	$CC $CFLAGS -c "$f" -o "$obj"
+	OBJECTS="$OBJECTS $obj"
+done
+for f in $SOURCES; do
+	obj="$OUT/obj/$(basename "$f" .cpp).o"
+	$CXX -std=c++17 -fms-extensions $CXXFLAGS $INCLUDES -c "$OUT/src/$f" -o "$obj"
+	OBJECTS="$OBJECTS $obj"
+done
+$CXX -std=c++17 -fms-extensions $CXXFLAGS $INCLUDES -c "$ROOT/tools/check/SyntheticModule.cpp" -o "$OUT/obj/SyntheticModule.o"
+OBJECTS="$OBJECTS $OUT/obj/SyntheticModule.o"
+
+status=0
+for check in $CHECKS; do
+	$CXX -std=c++17 -fms-extensions $CXXFLAGS $INCLUDES "$ROOT/tools/check/$check.cpp" $OBJECTS $LZ4 -pthread -o "$OUT/$check"
+	"$OUT/$check" "$OUT" || status=1
+done
+exit $status
@@ -0,0 +1,3 @@
+#pragma once
+DWORD UnDecorateSymbolName(const char*, char*, DWORD, DWORD);
+#define UNDNAME_COMPLETE 0
@@ -0,0 +1,12 @@
+#pragma once
+// src/pch.h の代わり (tools/check を g++ で組むとき専用)
+// チェックで使うソースが必要とするプラグインSDKのヘッダだけを読み込む
+
+#include <windows.h>
+
+#include "pluginsdk/bridgemain.h"
+#include "pluginsdk/_plugins.h"
+
+#include "pluginsdk/_scriptapi_label.h"
+#include "pluginsdk/_scriptapi_memory.h"
+#include "pluginsdk/_scriptapi_module.h"
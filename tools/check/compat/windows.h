@@ -0,0 +1,162 @@
+#pragma once
+// windows.h の代わり (tools/check を g++ で組むとき専用)
+// MSPE と x64dbg のプラグインSDKのヘッダが使う型、定数、関数の宣言だけを Linux 上で用意する。
+// 宣言だけの関数は、チェックで使うものを SyntheticModule.cpp で定義している
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#define _WIN64 1
+#define __declspec(x)
+#define __stdcall
+#define __cdecl
+#define WINAPI
+#define APIENTRY
+#define CALLBACK
+typedef void* HANDLE; typedef void* HWND; typedef void* HMODULE; typedef void* HINSTANCE; typedef void* HMENU; typedef void* HICON;
+typedef uint32_t DWORD; typedef int BOOL; typedef unsigned char BYTE; typedef unsigned short WORD; typedef int32_t LONG;
+typedef uint32_t ULONG; typedef long long LONGLONG; typedef unsigned long long ULONGLONG; typedef uint64_t DWORD64; typedef uint64_t ULONG_PTR;
+typedef int64_t LONG_PTR; typedef uint64_t UINT_PTR; typedef int64_t INT_PTR; typedef unsigned int UINT; typedef void* LPVOID; typedef const void* LPCVOID;
+typedef char CHAR; typedef wchar_t WCHAR; typedef char* LPSTR; typedef const char* LPCSTR; typedef void* PVOID; typedef uint64_t WPARAM; typedef int64_t LPARAM; typedef int64_t LRESULT;
+typedef DWORD* LPDWORD; typedef void VOID; typedef uint64_t SIZE_T; typedef long HRESULT; typedef BYTE BOOLEAN; typedef unsigned short USHORT;typedef short SHORT; typedef WCHAR* LPWSTR; typedef const WCHAR* LPCWSTR;
+typedef struct { LONG x, y; } POINT; typedef struct { LONG left, top, right, bottom; } RECT; typedef struct { HWND hwnd; UINT message; WPARAM wParam; LPARAM lParam; DWORD time; POINT pt; } MSG;
+typedef struct { DWORD LowPart; LONG HighPart; } LARGE_INTEGER_S; typedef union { struct { DWORD LowPart; LONG HighPart; }; LONGLONG QuadPart; } LARGE_INTEGER;
+typedef struct _M128A { ULONGLONG Low; LONGLONG High; } M128A;
+typedef struct { int dummy; } CONTEXT; typedef struct { int dummy; } EXCEPTION_RECORD;
+typedef struct { EXCEPTION_RECORD ExceptionRecord; DWORD dwFirstChance; } EXCEPTION_DEBUG_INFO;
+typedef struct { DWORD dwDebugEventCode; DWORD dwProcessId; DWORD dwThreadId; union { EXCEPTION_DEBUG_INFO Exception; } u; } DEBUG_EVENT;
+typedef struct { HANDLE hFile; HANDLE hProcess; HANDLE hThread; LPVOID lpBaseOfImage; } CREATE_PROCESS_DEBUG_INFO;
+typedef struct { HANDLE hThread; } CREATE_THREAD_DEBUG_INFO; typedef struct { DWORD dwExitCode; } EXIT_THREAD_DEBUG_INFO; typedef struct { DWORD dwExitCode; } EXIT_PROCESS_DEBUG_INFO;
+typedef struct { HANDLE hFile; LPVOID lpBaseOfDll; } LOAD_DLL_DEBUG_INFO; typedef struct { LPVOID lpBaseOfDll; } UNLOAD_DLL_DEBUG_INFO; typedef struct { int d; } OUTPUT_DEBUG_STRING_INFO;
+typedef struct { DWORD dwProcessId; DWORD dwThreadId; DWORD dwError; } RIP_INFO_S;
+typedef struct { PVOID BaseAddress; PVOID AllocationBase; DWORD AllocationProtect; SIZE_T RegionSize; DWORD State; DWORD Protect; DWORD Type; } MEMORY_BASIC_INFORMATION;
+typedef struct { DWORD SizeOfStruct; DWORD64 BaseOfImage; DWORD ImageSize; DWORD TimeDateStamp; DWORD CheckSum; DWORD NumSyms; int SymType; CHAR ModuleName[32]; CHAR ImageName[256]; CHAR LoadedImageName[256]; } IMAGEHLP_MODULE64;
+typedef struct { int d; } PROCESS_INFORMATION; typedef struct { int d; } STARTUPINFOW; typedef struct { int d;} FLOATING_SAVE_AREA; typedef struct { int d; } XMM_SAVE_AREA32;
+
+#define MAX_PATH 260
+inline void __debugbreak() { __builtin_trap(); }
+#define TRUE 1
+#define FALSE 0
+#define DLL_PROCESS_ATTACH 1
+#define ARRAYSIZE(a) (sizeof(a)/sizeof((a)[0]))
+#include <cstdarg>
+inline int sprintf_s(char* b, const char* f, ...) { va_list a; va_start(a, f); int r = vsprintf(b, f, a); va_end(a); return r; }
+template<size_t N> inline int sprintf_s(char (&b)[N], const char* f, ...) { va_list a; va_start(a, f); int r = vsnprintf(b, N, f, a); va_end(a); return r; }
+#include <strings.h>
+inline int _stricmp(const char* a, const char* b) { return strcasecmp(a, b); }
+inline int _strnicmp(const char* a, const char* b, size_t n) { return strncasecmp(a, b, n); }
+#define _TRUNCATE ((size_t)-1)
+template<size_t N> inline int strncpy_s(char (&d)[N], const char* s, size_t n) { size_t m = strnlen(s, n < N - 1 ? n : N - 1); memcpy(d, s, m); d[m] = 0; return 0; }
+#define _DBGHELP_ 1
+#define DECLSPEC_ALIGN(x)
+typedef uint64_t ULONG64; typedef struct { DWORD dwLowDateTime, dwHighDateTime; } FILETIME;
+typedef unsigned char UCHAR; typedef UCHAR* PUCHAR; typedef char* PSTR;
+typedef struct { DWORD VirtualAddress; DWORD Size; } IMAGE_DATA_DIRECTORY;
+typedef struct { WORD e_magic; WORD pad[29]; LONG e_lfanew; } IMAGE_DOS_HEADER;
+typedef struct { WORD Machine; WORD NumberOfSections; DWORD TimeDateStamp; DWORD PointerToSymbolTable; DWORD NumberOfSymbols; WORD SizeOfOptionalHeader; WORD Characteristics; } IMAGE_FILE_HEADER;
+typedef struct { WORD Magic; BYTE MajorLinkerVersion, MinorLinkerVersion; DWORD SizeOfCode, SizeOfInitializedData, SizeOfUninitializedData, AddressOfEntryPoint, BaseOfCode; ULONGLONG ImageBase; DWORD SectionAlignment, FileAlignment; WORD a,b,c,d,e,f; DWORD Win32VersionValue, SizeOfImage, SizeOfHeaders, CheckSum; WORD Subsystem, DllCharacteristics; ULONGLONG g,h,i,j; DWORD LoaderFlags, NumberOfRvaAndSizes; IMAGE_DATA_DIRECTORY DataDirectory[16]; } IMAGE_OPTIONAL_HEADER64;
+typedef struct { DWORD Signature; IMAGE_FILE_HEADER FileHeader; IMAGE_OPTIONAL_HEADER64 OptionalHeader; } IMAGE_NT_HEADERS64, IMAGE_NT_HEADERS;
+typedef struct { BYTE Name[8]; union { DWORD PhysicalAddress; DWORD VirtualSize; } Misc; DWORD VirtualAddress, SizeOfRawData, PointerToRawData, PointerToRelocations, PointerToLinenumbers; WORD NumberOfRelocations, NumberOfLinenumbers; DWORD Characteristics; } IMAGE_SECTION_HEADER;
+typedef struct { DWORD BeginAddress; DWORD EndAddress; union { DWORD UnwindInfoAddress; DWORD UnwindData; }; } IMAGE_RUNTIME_FUNCTION_ENTRY, RUNTIME_FUNCTION;
+typedef struct { DWORD VirtualAddress; DWORD SizeOfBlock; } IMAGE_BASE_RELOCATION;
+typedef struct { union { DWORD Characteristics; DWORD OriginalFirstThunk; }; DWORD TimeDateStamp; DWORD ForwarderChain; DWORD Name; DWORD FirstThunk; } IMAGE_IMPORT_DESCRIPTOR;
+typedef struct { WORD Hint; CHAR Name[1]; } IMAGE_IMPORT_BY_NAME;
+#define IMAGE_DOS_SIGNATURE 0x5A4D
+#define IMAGE_NT_SIGNATURE 0x00004550
+#define IMAGE_NT_OPTIONAL_HDR64_MAGIC 0x20b
+#define IMAGE_DIRECTORY_ENTRY_IMPORT 1
+#define IMAGE_DIRECTORY_ENTRY_EXCEPTION 3
+#define IMAGE_DIRECTORY_ENTRY_BASERELOC 5
+#define IMAGE_DIRECTORY_ENTRY_IAT 12
+#define IMAGE_REL_BASED_ABSOLUTE 0
+#define IMAGE_REL_BASED_HIGHLOW 3
+#define IMAGE_REL_BASED_DIR64 10
+#define IMAGE_ORDINAL_FLAG64 0x8000000000000000ull
+#define IMAGE_SCN_CNT_CODE 0x20
+#define IMAGE_SCN_MEM_EXECUTE 0x20000000
+#define IMAGE_FIRST_SECTION(nt) ((IMAGE_SECTION_HEADER*)((uintptr_t)(nt) + 24 + (nt)->FileHeader.SizeOfOptionalHeader))
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+#define GENERIC_READ 0x80000000
+#define GENERIC_WRITE 0x40000000
+#define FILE_SHARE_READ 1
+#define FILE_SHARE_WRITE 2
+#define OPEN_EXISTING 3
+#define CREATE_ALWAYS 2
+#define OPEN_ALWAYS 4
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define PAGE_READONLY 2
+#define FILE_MAP_READ 4
+#define MOVEFILE_REPLACE_EXISTING 1
+#define MOVEFILE_WRITE_THROUGH 8
+#define FILE_END 2
+#define INFINITE 0xFFFFFFFF
+HANDLE CreateFileA(LPCSTR, DWORD, DWORD, void*, DWORD, DWORD, HANDLE);
+HANDLE CreateFileMappingA(HANDLE, void*, DWORD, DWORD, DWORD, LPCSTR);
+LPVOID MapViewOfFile(HANDLE, DWORD, DWORD, DWORD, SIZE_T);
+BOOL UnmapViewOfFile(LPCVOID);
+BOOL CloseHandle(HANDLE);
+BOOL GetFileSizeEx(HANDLE, LARGE_INTEGER*);
+BOOL MoveFileExA(LPCSTR, LPCSTR, DWORD);
+inline BOOL DeleteFileA(LPCSTR p) { return remove(p) == 0; }
+BOOL WriteFile(HANDLE, LPCVOID, DWORD, LPDWORD, void*);
+BOOL ReadFile(HANDLE, LPVOID, DWORD, LPDWORD, void*);
+BOOL FlushFileBuffers(HANDLE);
+BOOL SetFilePointerEx(HANDLE, LARGE_INTEGER, LARGE_INTEGER*, DWORD);
+#define FILE_BEGIN 0
+BOOL SetEndOfFile(HANDLE);
+DWORD GetTickCount(); ULONGLONG GetTickCount64();
+BOOL QueryPerformanceCounter(LARGE_INTEGER*); BOOL QueryPerformanceFrequency(LARGE_INTEGER*);
+DWORD GetLastError();
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include <memory>
+#define IMAGE_NT_OPTIONAL_HDR_MAGIC 0x20b
+#define IMAGE_SIZEOF_SHORT_NAME 8
+#define IMAGE_ORDINAL_FLAG IMAGE_ORDINAL_FLAG64
+#define IMAGE_ORDINAL(o) ((o) & 0xffff)
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <limits>
+#include <functional>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <random>
+#include <numeric>
+#include <string_view>
+#include <optional>
+#include <queue>
+#include <cctype>
+#include <set>
+#include <array>
+#include <list>
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <bitset>
+#include <shared_mutex>
+#include <cstdarg>
+#include <iterator>
+#include <emmintrin.h>
+#ifndef max
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+#endif
+#ifndef min
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+#endif
+inline int fopen_s(FILE** f, const char* p, const char* m) { *f = fopen(p, m); return *f ? 0 : 1; }
+inline DWORD GetModuleFileNameA(HMODULE, char*, DWORD) { return 0; }
+inline BOOL CreateDirectoryA(const char*, void*) { return 0; }
@@ -0,0 +1,147 @@
+// MSPE::ConstantTable と const: シグネチャのチェック
+//   constant_check <キャッシュを書くディレクトリ>
+// imm32 と imm64、符号拡張した別名、正と負のディスプレースメント、関数の突き合わせ、キャッシュの往復、Describe を確かめる
+#include "SyntheticModule.h"
+#include "MSPE.h"
+#include "SignatureConstant.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using MSPE::ConstantTable;
+namespace Constant = Signature::Constant;
+
+
+static std::vector<duint> Find(const std::string& signature)
+{
+	std::vector<duint> result;
+	Constant::Find(signature, result);
+	return result;
+}
+
+
+int main(int argc, char* argv[])
+{
+	std::string cacheDir = argc > 1 ? argv[1] : ".";
+
+	SyntheticModule module;
+
+	// mov ecx, 0x12345678 / mov rax, 0x1122334455667788 / mov eax, [rcx+0x1A0]
+	Code a(module.next_function());
+	std::uint32_t aImm32 = a.here();
+	a.Bytes({ 0xB9 }).Imm32(0x12345678);
+	std::uint32_t aImm64 = a.here();
+	a.Bytes({ 0x48, 0xB8 }).Imm64(0x1122334455667788);
+	std::uint32_t aDisp = a.here();
+	a.Bytes({ 0x8B, 0x81 }).Imm32(0x1A0).Ret();
+	std::uint32_t aRva = module.AddFunction(a);
+
+	// mov ecx, 0x12345678 / mov eax, 0x10 / mov eax, [rbp-0x200]
+	Code b(module.next_function());
+	std::uint32_t bImm32 = b.here();
+	b.Bytes({ 0xB9 }).Imm32(0x12345678);
+	b.Bytes({ 0xB8 }).Imm32(0x10);
+	std::uint32_t bDisp = b.here();
+	b.Bytes({ 0x8B, 0x85 }).Imm32(static_cast<std::uint32_t>(-0x200)).Ret();
+	std::uint32_t bRva = module.AddFunction(b);
+
+	// mov ecx, 0x12345678 / cmp rax, 0xDEADBEEF (sign-extended to 64 bits)
+	Code c(module.next_function());
+	std::uint32_t cImm32 = c.here();
+	c.Bytes({ 0xB9 }).Imm32(0x12345678);
+	c.Bytes({ 0x48, 0x3D }).Imm32(0xDEADBEEF).Ret();
+	std::uint32_t cRva = module.AddFunction(c);
+
+	// cmp eax, 0xDEADBEEF / mov ecx, 0x1A0
+	Code d(module.next_function());
+	d.Bytes({ 0x3D }).Imm32(0xDEADBEEF);
+	d.Bytes({ 0xB9 }).Imm32(0x1A0).Ret();
+	std::uint32_t dRva = module.AddFunction(d);
+
+	module.Install();
+
+	//
+	// the index
+	//
+	{
+		auto& constants = ConstantTable::Get();
+		CHECK((constants.Find(0x12345678) == std::vector<std::uint32_t>{ aImm32, bImm32, cImm32 }));
+		CHECK((constants.Find(0x1122334455667788) == std::vector<std::uint32_t>{ aImm64 }));
+		CHECK((constants.Find(static_cast<std::uint64_t>(-0x200)) == std::vector<std::uint32_t>{ bDisp }));
+		CHECK(constants.Find(0x1A0).size() == 2 && constants.Find(0x1A0)[0] == aDisp);
+		CHECK(constants.Find(0x10).empty());
+		CHECK(constants.Find(0x1000).empty());
+	}
+
+	//
+	// signatures
+	//
+	std::vector<std::uint64_t> values;
+	CHECK(Constant::Parse("const: 0x200 , 512,-0x200", values)
+		&& values == (std::vector<std::uint64_t>{ 0x200, 512, static_cast<std::uint64_t>(-0x200) }));
+	CHECK(Constant::Format(values) == "const:0x200,0x200,-0x200");
+	CHECK(!Constant::Parse("const:", values));
+	CHECK(!Constant::Parse("const:0x10", values));
+	CHECK(!Constant::Parse("const:0x200,", values));
+	CHECK(!Constant::Parse("const:0x200,x", values));
+	CHECK(!Constant::Parse("const:0x200z", values));
+
+	CHECK((Find("const:0x12345678") == std::vector<duint>{ module.addr(aRva), module.addr(bRva), module.addr(cRva) }));
+	CHECK((Find("const:0x12345678,0x1A0") == std::vector<duint>{ module.addr(aRva) }));
+	CHECK((Find("const:0x1A0") == std::vector<duint>{ module.addr(aRva), module.addr(dRva) }));
+	CHECK((Find("const:0x1122334455667788") == std::vector<duint>{ module.addr(aRva) }));
+	CHECK((Find("const:-0x200") == std::vector<duint>{ module.addr(bRva) }));
+	CHECK((Find("const:0xDEADBEEF") == std::vector<duint>{ module.addr(cRva), module.addr(dRva) }));
+	CHECK((Find("const:0x12345678,0xDEADBEEF") == std::vector<duint>{ module.addr(cRva) }));
+	CHECK(Find("const:0x1000").empty());
+	CHECK(Find("const:0x1122334455667788,-0x200").empty());
+	CHECK(Constant::Verify("const:0x1A0", module.addr(dRva)));
+
+	//
+	// Describe gives a signature that finds only the function again
+	//
+	std::string signature;
+	CHECK(Constant::Describe(module.addr(aRva), signature) && signature == "const:0x1122334455667788");
+	CHECK(Constant::Describe(module.addr(bRva), signature) && signature == "const:-0x200");
+	CHECK(Constant::Describe(module.addr(cRva), signature) && signature == "const:0xDEADBEEF,0x12345678");
+	for (std::uint32_t rva : { aRva, bRva, cRva, dRva }) {
+		CHECK(Constant::Describe(module.addr(rva), signature) && Find(signature) == std::vector<duint>{ module.addr(rva) });
+	}
+	CHECK(!Constant::Describe(module.addr(aRva + 1), signature));
+
+	//
+	// the cache: a table loaded for the same hash keeps the old values, even though the code changed
+	//
+	SyntheticModule::SetCache(cacheDir, 0x0123456789ABCDEF);
+	std::string path = cacheDir + "/synthetic.exe@0123456789ABCDEF.const";
+	std::remove(path.c_str());
+	module.Install();
+	std::size_t built = ConstantTable::Get().size();
+	std::FILE* fp = std::fopen(path.c_str(), "rb");
+	CHECK(fp != nullptr);
+	if (fp) {
+		std::fclose(fp);
+	}
+
+	std::uint32_t changed = 0x22222222;
+	module.Write(bImm32 + 1, &changed, sizeof(changed));
+	module.Install();
+	{
+		auto& constants = ConstantTable::Get();
+		CHECK(constants.size() == built);
+		CHECK(constants.Find(0x12345678).size() == 3);
+		CHECK(constants.Find(0x22222222).empty());
+		CHECK(constants.Find(0x1A0).size() == 2);
+	}
+
+	SyntheticModule::SetCache(std::string(), 0);
+	module.Install();
+	{
+		auto& constants = ConstantTable::Get();
+		CHECK(constants.Find(0x12345678).size() == 2);
+		CHECK((constants.Find(0x22222222) == std::vector<std::uint32_t>{ bImm32 }));
+	}
+	std::remove(path.c_str());
+
+	return Check::Finish("constant_check");
+}
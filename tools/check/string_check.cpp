@@ -0,0 +1,109 @@
+// MSPE::StringTable と str: シグネチャのチェック
+//   string_check
+// ASCIIとUTF-16のリテラル、短いものと終わりのないもの、+call#<n>、Describe の往復を確かめる
+#include "SyntheticModule.h"
+#include "MSPE.h"
+#include "SignatureString.h"
+#include <string>
+#include <vector>
+
+using MSPE::StringTable;
+namespace String = Signature::String;
+
+
+static std::vector<duint> Find(const std::string& signature)
+{
+	std::vector<duint> result;
+	String::Find(signature, result);
+	return result;
+}
+
+
+int main()
+{
+	SyntheticModule module;
+	const std::string kHello = "Hello, world";
+	const std::string kLong = "The quick brown fox jumps over the lazy dog";
+	std::uint32_t narrow = module.AddString(kHello);
+	std::uint32_t wide = module.AddWideString(kHello);
+	std::uint32_t shortText = module.AddString("abc");
+	std::uint32_t longText = module.AddString(kLong);
+	std::uint32_t tabs = module.AddString("a\tquoted \"text\"\\");
+
+	// a printable run closed by a control character instead of NUL
+	std::uint32_t unterminated = module.AddRData(16);
+	module.Write(unterminated, "no terminator\x01", 14);
+
+	Code helper(module.next_function());
+	helper.Ret();
+	std::uint32_t helperRva = module.AddFunction(helper);
+
+	Code target(module.next_function());
+	target.Bytes({ 0x33, 0xC0 }).Ret();
+	std::uint32_t targetRva = module.AddFunction(target);
+
+	Code user(module.next_function());
+	user.LeaRcx(narrow).Call(helperRva).Call(targetRva).Ret();
+	std::uint32_t userRva = module.AddFunction(user);
+
+	Code wideUser(module.next_function());
+	wideUser.LeaRcx(wide).Call(helperRva).Ret();
+	std::uint32_t wideUserRva = module.AddFunction(wideUser);
+
+	Code unique(module.next_function());
+	unique.LeaRcx(longText).Call(helperRva).Call(targetRva).LeaRcx(tabs).Ret();
+	std::uint32_t uniqueRva = module.AddFunction(unique);
+
+	module.Install();
+	auto& image = MSPE::Image::Get();
+	auto& strings = StringTable::Get();
+
+	//
+	// the index
+	//
+	CHECK(strings.size() == 4);
+	CHECK(strings.Find(narrow) != StringTable::npos);
+	CHECK(strings.Find(wide) != StringTable::npos && strings[strings.Find(wide)].wide);
+	CHECK(strings.Find(shortText) == StringTable::npos);
+	CHECK(strings.Find(unterminated) == StringTable::npos);
+	CHECK(strings.Find(wide) != StringTable::npos && strings.Text(image, strings.Find(wide)) == kHello);
+	CHECK(strings.Find(longText) != StringTable::npos && strings[strings.Find(longText)].length == kLong.size());
+	CHECK((strings.Find(image, kHello) == std::vector<std::uint32_t>{ narrow, wide }));
+	CHECK(strings.Find(image, "abc").empty());
+	CHECK(strings.Find(image, "Hello, worl").empty());
+
+	//
+	// signatures
+	//
+	String::Literal literal;
+	CHECK(String::Parse("str:\"a\\tquoted \\\"text\\\"\\\\\"", literal) && literal.text == "a\tquoted \"text\"\\" && !literal.call);
+	CHECK(String::Format(literal) == "str:\"a\\tquoted \\\"text\\\"\\\\\"");
+	CHECK(String::Parse("str:\"x\"+call#12", literal) && literal.call && literal.ordinal == 12);
+	CHECK(!String::Parse("str:\"x", literal));
+	CHECK(!String::Parse("str:\"\"", literal));
+	CHECK(!String::Parse("str:\"x\"+call#", literal));
+	CHECK(!String::Parse("str:\"x\"+call#1z", literal));
+	CHECK(!String::Parse("str:\"x\\q\"", literal));
+
+	CHECK((Find("str:\"Hello, world\"") == std::vector<duint>{ module.addr(userRva), module.addr(wideUserRva) }));
+	CHECK((Find("str:\"" + kLong + "\"") == std::vector<duint>{ module.addr(uniqueRva) }));
+	CHECK((Find("str:\"" + kLong + "\"+call#0") == std::vector<duint>{ module.addr(helperRva) }));
+	CHECK((Find("str:\"" + kLong + "\"+call#1") == std::vector<duint>{ module.addr(targetRva) }));
+	CHECK(Find("str:\"" + kLong + "\"+call#2").empty());
+	CHECK(Find("str:\"abc\"").empty());
+	CHECK(String::Verify("str:\"a\\tquoted \\\"text\\\"\\\\\"", module.addr(uniqueRva)));
+
+	//
+	// Describe gives a signature that finds only the function again
+	//
+	std::string signature;
+	CHECK(String::Describe(module.addr(uniqueRva), signature) && signature == "str:\"" + kLong + "\"");
+	CHECK(String::Describe(module.addr(targetRva), signature) && signature == "str:\"Hello, world\"+call#1");
+	CHECK(!String::Describe(module.addr(userRva), signature));
+	CHECK(!String::Describe(module.addr(userRva + 1), signature));
+	for (std::uint32_t rva : { uniqueRva, targetRva }) {
+		CHECK(String::Describe(module.addr(rva), signature) && Find(signature) == std::vector<duint>{ module.addr(rva) });
+	}
+
+	return Check::Finish("string_check");
+}
@@ -0,0 +1,121 @@
+// MSPE::XrefTable のチェック
+//   xref_check <キャッシュを書くディレクトリ>
+// call、jmp、jcc、rip相対の lea と load を合成のイメージに置き、索引の内容と From()、To() を確かめる。
+// 256命令ずつのデコードの境目をまたぐ関数と、キャッシュの書き出しと読み込みも確かめる
+#include "SyntheticModule.h"
+#include "MSPE.h"
+#include <cstdio>
+#include <string>
+
+using MSPE::XrefTable;
+
+
+static bool Has(const XrefTable& xrefs, std::uint32_t from, std::uint32_t to, XrefTable::Kind kind)
+{
+	auto found = xrefs.From(from);
+	return found.size() == 1 && found[0].to == to && found[0].kind == kind;
+}
+
+
+int main(int argc, char* argv[])
+{
+	std::string cacheDir = argc > 1 ? argv[1] : ".";
+
+	SyntheticModule module;
+	std::uint32_t data = module.AddRData(8);
+	std::uint32_t text = module.AddString("xref check");
+
+	Code callee(module.next_function());
+	callee.Bytes({ 0x33, 0xC0 }).Ret();		// xor eax, eax
+	std::uint32_t calleeRva = module.AddFunction(callee);
+
+	Code caller(module.next_function());
+	std::uint32_t callSite = caller.here();
+	caller.Call(calleeRva);
+	std::uint32_t leaSite = caller.here();
+	caller.LeaRcx(text);
+	std::uint32_t loadSite = caller.here();
+	caller.LoadRax(data);
+	std::uint32_t jzSite = caller.here();
+	std::uint32_t retSite = jzSite + 6 + 5;		// jz rel32, jmp rel32
+	caller.Jz(retSite);
+	std::uint32_t jmpSite = caller.here();
+	caller.Jmp(calleeRva);
+	caller.Ret();
+	module.AddFunction(caller);
+
+	// more instructions than one decode call (256) takes
+	const int kCalls = 300;
+	Code big(module.next_function());
+	for (int i = 0; i < kCalls; ++i) {
+		big.Call(calleeRva);
+	}
+	big.Ret();
+	std::uint32_t bigRva = module.AddFunction(big);
+
+	module.Install();
+
+	//
+	// the index
+	//
+	{
+		auto& xrefs = XrefTable::Get();
+		CHECK(xrefs.size() == 5 + kCalls);
+		CHECK(Has(xrefs, callSite, calleeRva, XrefTable::Kind::kCall));
+		CHECK(Has(xrefs, leaSite, text, XrefTable::Kind::kData));
+		CHECK(Has(xrefs, loadSite, data, XrefTable::Kind::kData));
+		CHECK(Has(xrefs, jzSite, retSite, XrefTable::Kind::kJump));
+		CHECK(Has(xrefs, jmpSite, calleeRva, XrefTable::Kind::kJump));
+		CHECK(xrefs.From(retSite).empty());
+
+		auto inBig = xrefs.From(bigRva, big.here());
+		CHECK(inBig.size() == kCalls);
+		bool allCalls = true;
+		for (size_t i = 0; i < inBig.size(); ++i) {
+			allCalls = allCalls && inBig[i].from == bigRva + i * 5 && inBig[i].to == calleeRva && inBig[i].kind == XrefTable::Kind::kCall;
+		}
+		CHECK(allCalls);
+
+		// the call, the jmp and every call of the big function, in source order
+		auto toCallee = xrefs.To(calleeRva);
+		CHECK(toCallee.size() == 2 + kCalls);
+		CHECK(toCallee.size() > 2 && xrefs[toCallee[0]].from == callSite && xrefs[toCallee[1]].from == jmpSite);
+		CHECK(xrefs.To(text).size() == 1);
+		CHECK(xrefs.To(bigRva).empty());
+	}
+
+	//
+	// the cache: a table loaded for the same hash keeps the old targets, even though the code changed
+	//
+	SyntheticModule::SetCache(cacheDir, 0x0123456789ABCDEF);
+	std::string path = cacheDir + "/synthetic.exe@0123456789ABCDEF.xref";
+	std::remove(path.c_str());
+	module.Install();
+	std::size_t built = XrefTable::Get().size();
+	std::FILE* fp = std::fopen(path.c_str(), "rb");
+	CHECK(fp != nullptr);
+	if (fp) {
+		std::fclose(fp);
+	}
+
+	std::uint32_t rel = bigRva - (callSite + 5);
+	module.Write(callSite + 1, &rel, sizeof(rel));
+	module.Install();
+	{
+		auto& xrefs = XrefTable::Get();
+		CHECK(xrefs.size() == built);
+		CHECK(Has(xrefs, callSite, calleeRva, XrefTable::Kind::kCall));
+		CHECK(xrefs.To(calleeRva).size() == 2 + kCalls);
+	}
+
+	SyntheticModule::SetCache(std::string(), 0);
+	module.Install();
+	{
+		auto& xrefs = XrefTable::Get();
+		CHECK(Has(xrefs, callSite, bigRva, XrefTable::Kind::kCall));
+		CHECK(xrefs.To(bigRva).size() == 1);
+	}
+	std::remove(path.c_str());
+
+	return Check::Finish("xref_check");
+}